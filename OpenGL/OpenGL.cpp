@@ -1,11 +1,37 @@
 #include <iostream>
 #include <fstream>
+#include <chrono>
+#include <random>
+#include <cstring>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "model.h"
+#include "gputimer.h"
+#include "terrain.h"
+#include "terrainstream.h"
+#include "clipmap.h"
+#include "jobs.h"
+#include "culling.h"
+#include "framepipeline.h"
+#include "commandbuffer.h"
+#include "uniformring.h"
+#include "scenegraph.h"
+#include "transforms.h"
+#include "animation.h"
+#include "skinning.h"
+#include "overdraw.h"
+#include "deferred.h"
+#include "clusters.h"
+#include "shadows.h"
+#include "hiz.h"
+#include "occlusionraster.h"
+#include "postprocess.h"
+#include "dynamicresolution.h"
+
+#include <emmintrin.h>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/quaternion.hpp>
@@ -17,13 +43,208 @@ void ProcessInput(GLFWwindow* window);
 int Init(GLFWwindow*& window);
 void CreateGeometry(GLuint &VAO, GLuint &EBO, int &size, int &numIndices);
 void CreateShaders();
-void CreateProgram(GLuint& programID, const char* vertex, const char* fragment);
+void CreateProgram(GLuint& programID, const char* vertex, const char* fragment, const vector<const char*>& fragmentPreludes = {});
+GLuint CreateDepthProgram(GLuint program, const char* vertex);
+GLuint CreateGBufferProgram(GLuint program, const char* vertex, const char* fragment);
+void CopyProgramUniforms(GLuint from, GLuint to);
+
+//16 bit triangle strips over the plane vertices, one draw per band of rows
+struct TerrainStrips {
+    GLuint VAO, EBO;
+    vector<GLsizei> counts;
+    vector<void*> offsets;
+    vector<GLint> baseVertices;
+
+    //compared with the triangle list, vertex shader runs are simulated with a FIFO post transform cache
+    unsigned int listIndexBytes, stripIndexBytes;
+    unsigned int listInvocations, stripInvocations;
+};
+
+unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum format, int comp, float hScale, float xzScale, unsigned int& indexCount, unsigned int& heightmapID, int& width, int& height, TerrainStrips& strips);
+void GenerateStripIndices(int width, int height, vector<unsigned short>& indices, TerrainStrips& strips);
+void WritePlaneRow(float* out, const unsigned char* data, int z, int width, int height, int comp, float hScale, float xzScale);
+void WritePlaneIndexRow(unsigned int* out, int z, int width);
+void FillBuffer(GLenum target, GLsizeiptr size, const function<void(void*)>& fill);
+
+//how often the vertex shader runs for a stream of indices, modelled as a FIFO post transform cache
+struct VertexCacheCounter {
+    vector<int> addedAt;
+    int added, cacheSize;
+    unsigned int invocations;
+
+    VertexCacheCounter(int vertexCount, int cacheSize = 32) : addedAt(vertexCount, -cacheSize - 1), added(0), cacheSize(cacheSize), invocations(0) {}
+
+    template<typename T> void Add(const T* indices, int count, int baseVertex, T restartIndex)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (indices[i] == restartIndex)
+                continue;
+
+            // a vertex is still cached while fewer than cacheSize others got added after it
+            int vertex = baseVertex + indices[i];
+            if (added - addedAt[vertex] > cacheSize)
+            {
+                addedAt[vertex] = added++;
+                invocations++;
+            }
+        }
+    }
 
-unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum format, int comp, float hScale, float xzScale, unsigned int& indexCount, unsigned int& heightmapID);
+    //the next draw starts with an empty cache
+    void Flush() { added += cacheSize; }
+};
+GLuint GenerateGridPatch(int patchSize, unsigned int& indexCount);
+void EditTerrain(glm::vec3 center, float radius, float amount);
+GLuint GenerateSplatMap(unsigned char* data, int width, int height, int comp, float hScale, float xzScale);
 void RenderBox(glm::mat4& view, glm::mat4& projection, int triangleIndexCount, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale);
 void RenderSkyBox();
 void RenderTerrain();
-void RenderModel(Model* model, GLuint& programID, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale, glm::vec4 color = glm::vec4(0, 0, 0, 0), bool untextured = false);
+void RenderStreamedTerrain();
+void RenderClipmapTerrain();
+//a model placed in the world. It has a scene graph node with the model's own node hierarchy below it,
+//visibleMeshes is filled in by UpdateModelInstances
+struct ModelInstance {
+    Model* model;
+    const ProgramUniforms* program;
+    glm::vec3 pos, rot, scale;
+    glm::vec4 color;
+    bool untextured;
+    //whether its meshes hide what is behind them in the CPU occlusion raster
+    bool occluder;
+
+    int node;
+    //node i of the model is scene node firstModelNode + i
+    int firstModelNode;
+    //what the node was last set to, it is only marked dirty when pos, rot or scale change
+    glm::vec3 placedPos, placedRot, placedScale;
+    //one flag per mesh of the model
+    vector<char> visibleMeshes;
+    //per mesh, bit i set when it casts into shadow cascade i
+    vector<char> shadowMeshes;
+
+    //skinned meshes of the model are drawn with this one
+    const ProgramUniforms* skinnedProgram;
+    //only for models with bones or clips, filled in by AnimateModelInstances
+    bool animated;
+    AnimationState animation;
+    //node transforms of the pose relative to the instance node, and the bone matrices of the skinned meshes
+    vector<glm::mat4> animatedNodes, bones;
+    glm::vec3 skinnedBoundsMin, skinnedBoundsMax;
+    //where sampling the clip and the blend clip left off
+    ClipCursor clipCursors[2];
+    //per mesh, first vertex in the frame's CPU skinned vertices or -1 when the GPU skins it
+    vector<int> streamedVertices;
+
+    //object of the instance in the OverdrawMonitor, and whether it gets a depth pre-pass this frame
+    int overdrawObject;
+    bool depthPrepass;
+    //one per mesh when it is an occluder
+    vector<OccluderMesh> occluders;
+};
+void AddModelInstance(Model* model, const ProgramUniforms* program, glm::vec3 scale, glm::vec4 color, bool untextured, bool occluder);
+void AnimateModelInstances(vector<ModelInstance>& instances);
+void SkinModelInstances(vector<ModelInstance>& instances, vector<SkinnedVertex>& vertices);
+void PlaceModelInstances(vector<ModelInstance>& instances);
+void UpdateModelInstances(vector<ModelInstance>& instances, const Frustum& frustum, const ShadowCascades& shadows, const function<bool(glm::vec3, glm::vec3)>& isOccluded);
+glm::mat4 MeshWorld(const ModelInstance& instance, size_t mesh);
+glm::mat4 ComposeWorld(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale);
+void RecordModelInstances(const vector<ModelInstance>& instances, vector<CommandBuffer>& batches, vector<CommandBuffer>& depthBatches);
+void RecordModel(const ModelInstance& instance, CommandBuffer& commands, CommandBuffer& depthCommands);
+void RecordShadowCasters(const vector<ModelInstance>& instances, const ShadowCascades& shadows, vector<CommandBuffer> (&batches)[SHADOW_CASCADES], int (&draws)[SHADOW_CASCADES]);
+void RecordShadowCaster(const ModelInstance& instance, int cascade, CommandBuffer& commands);
+void RunTerrainBenchmark(GLFWwindow* window);
+void RunHeightFieldBenchmark();
+void RunJobBenchmark();
+void RunTransformBenchmark();
+void RunSkinningBenchmark();
+void RunVertexBenchmark();
+int RunOcclusionTest(const char* heightmap, const char* cottage);
+int RunFrameGraphTest();
+
+//uniform blocks of the model shaders, std140 so vec3s take 16 bytes
+struct FrameUniformData {
+    glm::mat4 view, projection;
+    glm::vec4 cameraPosition, lightDirection;
+};
+struct ObjectUniformData {
+    glm::mat4 world;
+    //mat3 normalMatrix, a std140 mat3 is three vec4 columns
+    glm::vec4 normalMatrix[3];
+    glm::vec4 color;
+};
+ObjectUniformData MakeObjectData(const glm::mat4& world, glm::vec4 color);
+const int FRAME_UNIFORM_BINDING = 0;
+const int OBJECT_UNIFORM_BINDING = 1;
+const int BONE_UNIFORM_BINDING = 2;
+const int CLUSTER_UNIFORM_BINDING = 3;
+const int SHADOW_UNIFORM_BINDING = 4;
+
+//height change made on the main thread, the texels of the edited rectangle are uploaded on the render thread
+struct TerrainEdit {
+    int x, z, width, height;
+    vector<unsigned char> texels;
+};
+
+//terrain drawing options, the render thread gets a copy with every packet
+struct TerrainOptions {
+    bool splat, strips, grid, streamed, clipmap;
+};
+
+//everything the render thread needs for one frame. Filled in by the main thread and only read by the render thread
+struct RenderPacket {
+    glm::mat4 view, projection;
+    glm::vec3 cameraPosition;
+    float time;
+    TerrainOptions terrain;
+    //model draws recorded on the job system, one buffer per batch of instances, replayed in order
+    vector<CommandBuffer> modelCommands;
+    //depth only draws of the instances with a pre-pass, same batches, replayed with color writes off before everything
+    vector<CommandBuffer> depthCommands;
+    //skinned on the CPU for the streamed draws in modelCommands
+    vector<SkinnedVertex> skinnedVertices;
+    vector<TerrainEdit> terrainEdits;
+    //only set when the heights changed
+    shared_ptr<const HeightField> heightField;
+    bool runTerrainBenchmark;
+    bool runVertexBenchmark;
+    //the terrain and the box get a depth pre-pass too, the models decide per instance
+    bool prepassTerrain, prepassBox;
+    //every object is pre-passed with sample queries around both passes, for the OverdrawMonitor
+    bool measureOverdraw;
+    bool overdrawView;
+    //G-buffer and lighting passes instead of the forward shaders, lit by the visible point lights too
+    bool deferred;
+    vector<PointLight> pointLights;
+    //the forward shaders' lists of pointLights per cluster, only built when not deferred
+    ClusterLists clusters;
+    bool clusterView;
+    //fitted every frame, the depth only draws of the model instances only for the cascades updated this frame
+    ShadowCascades shadows;
+    vector<CommandBuffer> shadowCommands[SHADOW_CASCADES];
+    //model draws in shadowCommands and how long recording them took
+    int shadowDraws[SHADOW_CASCADES];
+    double shadowRecordMs;
+    bool shadowReport;
+    //read the frame's depth back for the occlusion culling of the frames after it
+    bool captureDepth;
+    //parts of the post chain
+    bool bloom, autoExposure;
+    //whether the resolution follows the GPU time, and the time it has
+    bool dynamicResolution;
+    double frameBudgetMs;
+};
+void RenderLoop(GLFWwindow* window);
+void RenderFrame(const RenderPacket& frame, GLFWwindow* window);
+void ApplyTerrainEdits(const RenderPacket& frame);
+bool UploadModels(const RenderPacket& frame);
+void RenderModels(const vector<CommandBuffer>& batches, GLintptr offset, GLintptr frameOffset = 0);
+void BeginColorPass(bool prepassed, int object, bool measure);
+void EndColorPass(bool prepassed, bool measure);
+void RenderScene(const RenderPacket& frame, bool deferred, bool modelsUploaded, GLintptr framesSize, GLintptr depthSize, glm::vec3 boxPos, glm::vec3 boxRot, glm::vec3 boxScale);
+void RenderDeferredLights(const RenderPacket& frame);
+void RenderDeferredFog();
+void RenderShadows(const RenderPacket& frame, bool modelsUploaded, GLintptr offset, glm::vec3 boxPos, glm::vec3 boxRot, glm::vec3 boxScale);
 
 //Callbacks
 void Mouse_Callback(GLFWwindow* window, double xpos, double ypos);
@@ -34,9 +255,26 @@ bool keys[2048];
 //Utils
 void LoadFile(const char* filename, char*& output);
 GLuint loadTexture(const char* path, int comp = 0);
+GLuint loadTextureArray(const char** paths, int count, int size);
+unsigned char* ResizeImage(const unsigned char* src, int width, int height, int comp, int newWidth, int newHeight);
 
 //Program ID's
-GLuint simpleProgram, skyBoxProgram, terrainProgram, modelProgram, untexturedModelProgram;
+GLuint simpleProgram, skyBoxProgram, terrainProgram, terrainSplatProgram, terrainStreamProgram, terrainGridProgram, terrainClipmapProgram, modelProgram, untexturedModelProgram, skinnedModelProgram, skinnedUntexturedModelProgram;
+//uniform locations for recording command buffers away from the GL thread
+ProgramUniforms modelUniforms, untexturedModelUniforms, skinnedModelUniforms, skinnedUntexturedModelUniforms;
+//the same vertex shaders with depthFragment, for the depth pre-pass and the overdraw view
+map<GLuint, GLuint> depthPrograms;
+ProgramUniforms depthModelUniforms, depthSkinnedModelUniforms;
+//G-buffer versions of the same programs, the model ones by the id of the forward program
+map<GLuint, GLuint> gbufferPrograms;
+map<GLuint, ProgramUniforms> gbufferModelUniforms;
+GLuint deferredLightProgram, pointLightProgram, deferredFogProgram;
+//reduces a depth buffer for the Hi-Z occlusion culling
+GLuint hizReduceProgram;
+PostPrograms postPrograms;
+//frame and object uniform blocks of the models, owned by the render thread
+UniformRing uniformRing;
+UniformRing skinnedVertexRing(GL_ARRAY_BUFFER);
 
 const int WIDTH = 1280, HEIGHT = 720;
 
@@ -46,9 +284,18 @@ float camYaw, camPitch;
 
 //world data
 glm::vec3 lightDirection = glm::normalize(glm::vec3(-0.5f, -0.5f, -0.5f));
-glm::vec3 cameraPosition = glm::vec3(100, 125.0f, 100.0f);
+glm::vec3 camPosition = glm::vec3(100, 125.0f, 100.0f);
 glm::quat camQuat = glm::quat(glm::vec3(glm::radians(camPitch), glm::radians(camYaw), 0));
+glm::mat4 camView, camProjection;
 
+//Render thread, the main thread runs input and simulation one frame ahead of it
+FramePipeline<RenderPacket> renderPipeline;
+TerrainOptions terrainOptions = { true, false, false, false, false };
+vector<TerrainEdit> pendingTerrainEdits;
+bool terrainHeightsChanged = false;
+
+//the render thread's copy of the camera and options, set from the packet it draws
+glm::vec3 cameraPosition;
 glm::mat4 view;
 glm::mat4 projection;
 
@@ -58,16 +305,170 @@ int boxSize, boxIndexCount;
 //Terrain Data
 
 GLuint terrainVAO, terrainIndexCount, heightMapID, heightMapNormalID;
+TerrainStrips terrainStrips;
+bool useStripTerrain = false;
 unsigned char* heightmapData;
+int heightmapWidth, heightmapHeight;
+//CPU side heights for ground queries
+HeightField terrainHeightField;
+//snapshot of the heights the render thread works with
+shared_ptr<const HeightField> renderHeightField;
 
 GLuint dirt, sand, grass, rock, snow;
+//all five layers in one texture array, blended by the splat map
+GLuint terrainLayers, terrainSplatMap;
+bool useSplatTerrain = true;
+
+//GPU displaced terrain, one small patch instanced over the heightmap texture
+const int TERRAIN_PATCH_SIZE = 56;
+GLuint terrainPatchVAO, terrainPatchIndexCount;
+bool useGridTerrain = false;
+
+//Streamed terrain, tiles are made with --split-terrain
+TerrainStreamer* terrainStreamer = nullptr;
+bool useStreamedTerrain = false;
+
+//Geometry clipmap, constant triangle count out to the far plane
+TerrainClipmap* terrainClipmap = nullptr;
+bool useClipmapTerrain = false;
+
+//Profiling
+GpuTimer terrainTimer;
+bool runTerrainBenchmark = false;
+bool runHeightFieldBenchmark = false;
+bool runJobBenchmark = false;
+bool runTransformBenchmark = false;
+bool runSkinningBenchmark = false;
+bool runVertexBenchmark = false;
+//skin animated meshes with the job system instead of in the vertex shader
+bool useCpuSkinning = false;
 
 Model* backpack;
 Model* house;
 Model* ironMan;
-
-int main()
+vector<ModelInstance> modelInstances;
+//transforms of everything in modelInstances, owned by the main thread
+SceneGraph scene;
+//instances that moved this frame, composed in one batch
+TransformArray movedTransforms;
+vector<int> movedInstances;
+vector<glm::mat4> movedWorlds;
+
+//Depth pre-pass: off, per object from the measured overdraw, or for every opaque object
+enum DepthPrepassMode { PREPASS_OFF, PREPASS_AUTO, PREPASS_ALL };
+DepthPrepassMode depthPrepassMode = PREPASS_AUTO;
+//shows how many times every pixel is shaded instead of the scene
+bool overdrawView = false;
+//set for the frame being recorded
+bool measureOverdraw = false;
+OverdrawMonitor overdrawMonitor;
+//objects of the monitor, instance i of modelInstances is OVERDRAW_MODELS + i
+const int OVERDRAW_TERRAIN = 0, OVERDRAW_BOX = 1, OVERDRAW_MODELS = 2;
+
+//Deferred shading, forward stays the default for comparison
+bool deferredShading = false;
+GBuffer gbuffer;
+LightVolumes lightVolumes;
+//where the lights are placed, UpdatePointLights moves them and keeps the visible ones
+const int POINT_LIGHT_COUNT = 256;
+vector<PointLight> pointLights;
+void CreatePointLights(int count);
+void UpdatePointLights(float t, const Frustum& frustum, vector<PointLight>& visible);
+
+//Clustered forward: the visible point lights binned per cluster on the main thread, uploaded by the render thread
+LightClusters lightClusters;
+ClusterBuffers clusterBuffers;
+//lights per cluster instead of the scene, and the cluster stats printed every CLUSTER_REPORT_INTERVAL frames
+bool clusterView = false;
+const int CLUSTER_REPORT_INTERVAL = 60;
+int clusterReportFrame = 0;
+void BuildLightClusters(RenderPacket& packet);
+
+//Cascaded shadow maps of the sun. The cascades are fitted and their casters recorded on the main thread, the render
+//thread draws the updated ones before anything else
+CascadedShadows cascadedShadows;
+ShadowMaps shadowMaps;
+//draw counts and times of the shadow passes, printed every SHADOW_REPORT_INTERVAL frames by the render thread
+bool shadowReport = false;
+const int SHADOW_REPORT_INTERVAL = 60;
+int shadowReportFrame = 0;
+//of the last update of every cascade, owned by the render thread
+int shadowDraws[SHADOW_CASCADES];
+double shadowRecordMs;
+void ReportShadows(bool report);
+
+//Occlusion culling, the meshes in the frustum are tested against one of two depth sources.
+//Hi-Z: the render thread reduces every frame's depth and reads it back, the main thread culls the meshes whose bounds
+//are behind it in the newest pyramid that came back.
+//CPU raster: the main thread draws the coarse occluders of this frame into a small depth buffer first, no GPU involved
+enum OcclusionMode { OCCLUSION_OFF, OCCLUSION_HIZ, OCCLUSION_RASTER };
+OcclusionMode occlusionMode = OCCLUSION_HIZ;
+HiZBuffer hizBuffer;
+HiZPyramid occlusionPyramid;
+OcclusionRasterizer occlusionRasterizer;
+//a lower LOD of the terrain, rebuilt when it is edited. The model instances flagged as occluders are drawn with it
+const int TERRAIN_OCCLUDER_STEP = 8;
+OccluderMesh terrainOccluder;
+//set by every edit and only cleared by the rebuild, edits made while raster occlusion is off still reach it
+bool terrainOccluderDirty = true;
+double occlusionRasterMs;
+void RasterizeOccluders(const glm::mat4& viewProjection);
+OccluderMesh MeshOccluder(const Mesh& mesh);
+//meshes culled and tested, printed every OCCLUSION_REPORT_INTERVAL frames
+bool occlusionReport = false;
+const int OCCLUSION_REPORT_INTERVAL = 60;
+int occlusionReportFrame = 0;
+int occludedMeshes, testedMeshes;
+
+//HDR: the scene goes into a float target, bloom, auto exposure and tone mapping take it to the screen
+PostProcess postProcess;
+//everything the render thread draws after the shadow maps is a pass of the frame graph, built again every frame: the
+//scene or the G-buffer and its lighting, the Hi-Z reduction and the post chain. Their targets only live for part of a
+//frame and come from the pool, the shadow maps are drawn before it and outlive frames
+FrameGraph frameGraph;
+RenderTargetPool renderTargets;
+void BuildFrameGraph(FrameGraph& graph, const RenderPacket& frame, bool deferred, function<void()> drawScene);
+//what the frame graph came to when it was last printed, it is printed again when its passes change
+FrameGraphStats reportedFrameGraph = {};
+void ReportFrameGraph();
+bool bloom = true;
+bool autoExposure = true;
+
+//the scene resolution goes down to half when the GPU takes longer than the budget. The timer spans the whole frame,
+//around the pass timers inside it
+GpuSpanTimer gpuFrameTimer;
+DynamicResolution dynamicResolution;
+bool dynamicResolutionEnabled = true;
+const double FRAME_BUDGETS_MS[] = { 1000.0 / 60.0, 1000.0 / 90.0, 1000.0 / 120.0, 1000.0 / 240.0 };
+int frameBudget = 0;
+
+//which pass the render functions draw, owned by the render thread
+enum RenderPass { PASS_COLOR, PASS_DEPTH, PASS_OVERDRAW, PASS_GBUFFER };
+RenderPass renderPass = PASS_COLOR;
+GLuint PassProgram(GLuint program);
+//where UploadModels() put the frame's model data in the rings
+GLintptr modelUniformBase;
+GLint modelVertexBase;
+
+int main(int argc, char** argv)
 {
+    //offline: OpenGL --split-terrain <heightmap> <output directory> [tile size]
+    if (argc >= 4 && strcmp(argv[1], "--split-terrain") == 0)
+    {
+        stbi_set_flip_vertically_on_load(true);
+        int tileSize = argc >= 5 ? atoi(argv[4]) : 64;
+        return SplitTerrain(argv[2], argv[3], tileSize, 250.0f, 5.0f) ? 0 : -1;
+    }
+    //headless: OpenGL --occlusion-test [heightmap] [cottage]
+    if (argc >= 2 && strcmp(argv[1], "--occlusion-test") == 0)
+    {
+        stbi_set_flip_vertically_on_load(true);
+        return RunOcclusionTest(argc >= 3 ? argv[2] : "textures/heightmap3.png", argc >= 4 ? argv[3] : "models/cottage/cottage_obj.obj");
+    }
+    //headless: OpenGL --frame-graph-test
+    if (argc >= 2 && strcmp(argv[1], "--frame-graph-test") == 0)
+        return RunFrameGraphTest();
+
     GLFWwindow* window;
     int result = Init(window);
     if (result != 0) return result;
@@ -78,8 +479,9 @@ int main()
     CreateGeometry(boxVAO, boxEBO, boxSize, boxIndexCount);
     
     //Terrain
-    terrainVAO = GeneratePlane("textures/heightmap3.png", heightmapData, GL_RGBA, 4, 250.0f, 5.0f, terrainIndexCount, heightMapID);
+    terrainVAO = GeneratePlane("textures/heightmap3.png", heightmapData, GL_RGBA, 4, 250.0f, 5.0f, terrainIndexCount, heightMapID, heightmapWidth, heightmapHeight, terrainStrips);
     heightMapNormalID = loadTexture("textures/heightmapNormal3.png");
+    terrainHeightField = HeightField(heightmapData, heightmapWidth, heightmapHeight, 4, 250.0f, 5.0f);
 
     dirt = loadTexture("textures/dirt.jpg", 4);
     sand = loadTexture("textures/sand.jpg", 4);
@@ -87,10 +489,53 @@ int main()
     rock = loadTexture("textures/rock.jpg", 4);
     snow = loadTexture("textures/snow.jpg", 4);
 
+    const char* terrainLayerPaths[] = { "textures/dirt.jpg", "textures/sand.jpg", "textures/grass.png", "textures/rock.jpg", "textures/snow.jpg" };
+    terrainLayers = loadTextureArray(terrainLayerPaths, 5, 1024);
+    terrainSplatMap = GenerateSplatMap(heightmapData, heightmapWidth, heightmapHeight, 4, 250.0f, 5.0f);
+    terrainPatchVAO = GenerateGridPatch(TERRAIN_PATCH_SIZE, terrainPatchIndexCount);
+
+    terrainStreamer = new TerrainStreamer("terrain");
+    if (!terrainStreamer->IsValid())
+    {
+        delete terrainStreamer;
+        terrainStreamer = nullptr;
+    }
+
+    renderHeightField = make_shared<const HeightField>(terrainHeightField);
+    terrainClipmap = new TerrainClipmap(renderHeightField.get());
+
+    terrainTimer.Init();
+    gpuFrameTimer.Init();
+    //the skinned meshes point their stream vertex arrays at it
+    skinnedVertexRing.Create();
+    gbuffer.Create();
+    lightVolumes.Create();
+    CreatePointLights(POINT_LIGHT_COUNT);
+    clusterBuffers.Create();
+    shadowMaps.Create();
+    hizBuffer.Create(WIDTH, HEIGHT, hizReduceProgram);
+    postProcess.Create(WIDTH, HEIGHT, postPrograms);
+
     backpack = new Model("models/backpack/backpack.obj");
     house = new Model("models/cottage/cottage_obj.obj");
     ironMan = new Model("models/IronMan/IronMan.obj");
 
+    //               model     program                   scale, pos and rot are set every frame  color                textureless occluder
+    AddModelInstance(backpack, &modelUniforms,           glm::vec3(200),                         glm::vec4(0, 0, 0, 0), false,      false);
+    AddModelInstance(house,    &untexturedModelUniforms, glm::vec3(5),                           glm::vec4(1, 1, 0, 1), true,       true);
+    AddModelInstance(ironMan,  &untexturedModelUniforms, glm::vec3(7),                           glm::vec4(1, 0, 0, 1), true,       false);
+
+    overdrawMonitor.Init(OVERDRAW_MODELS + (int)modelInstances.size());
+    overdrawMonitor.SetObject(OVERDRAW_TERRAIN, "terrain", (size_t)heightmapWidth * heightmapHeight);
+    overdrawMonitor.SetObject(OVERDRAW_BOX, "box", 24);
+    for (const ModelInstance& instance : modelInstances)
+    {
+        size_t vertexCount = 0;
+        for (const Mesh& mesh : instance.model->meshes)
+            vertexCount += mesh.vertices.size();
+        overdrawMonitor.SetObject(instance.overdrawObject, instance.model->directory, vertexCount);
+    }
+
     //Box textures
     boxTex = loadTexture("textures/container2.png");
     boxNormal = loadTexture("textures/container2normal.png");
@@ -109,36 +554,613 @@ int main()
     world = glm::scale(world, glm::vec3(1, 1, 1));
     world = glm::translate(world, glm::vec3(0, 0, 0));*/
 
-    view = glm::lookAt(cameraPosition, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
-    projection = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.05f, 10000.0f);
+    camView = glm::lookAt(camPosition, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    camProjection = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.05f, 10000.0f);
+
+    //the render thread owns the GL context from here on
+    glfwMakeContextCurrent(NULL);
+    std::thread renderThread(RenderLoop, window);
 
     while (!glfwWindowShouldClose(window))
     {
         //Input
         ProcessInput(window);
 
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (runHeightFieldBenchmark)
+        {
+            RunHeightFieldBenchmark();
+            runHeightFieldBenchmark = false;
+        }
+        if (runJobBenchmark)
+        {
+            RunJobBenchmark();
+            runJobBenchmark = false;
+        }
+        if (runTransformBenchmark)
+        {
+            RunTransformBenchmark();
+            runTransformBenchmark = false;
+        }
+        if (runSkinningBenchmark)
+        {
+            RunSkinningBenchmark();
+            runSkinningBenchmark = false;
+        }
 
-        
         float t = glfwGetTime();
 
-        RenderSkyBox();
-        RenderTerrain();
-        RenderBox(view, projection, boxIndexCount, glm::vec3(100, 350, 300), glm::vec3(t * 0.2, t * .4, t * -0.2), glm::vec3(200, 200, 200));
-        RenderModel(backpack, modelProgram, glm::vec3(800, 350, 1100), glm::vec3(0, t * .2, 0), glm::vec3(200, 200, 200));
-        RenderModel(house, untexturedModelProgram, glm::vec3(1500, 20, 1300), glm::vec3(0, t * 5, 0), glm::vec3(5, 5, 5), glm::vec4(1, 1, 0, 1), true);
-        RenderModel(ironMan, untexturedModelProgram, glm::vec3(800, -900, 1100), glm::vec3(0, t * .2, 0), glm::vec3(7, 7, 7), glm::vec4(1, 0, 0, 1), true);
-
-        //Swap & Poll
-        glfwSwapBuffers(window);
+        modelInstances[0].pos = glm::vec3(800, 350, 1100);
+        modelInstances[0].rot = glm::vec3(0, t * .2, 0);
+        modelInstances[1].pos = glm::vec3(1500, terrainHeightField.GetHeight(1500, 1300), 1300);
+        modelInstances[1].rot = glm::vec3(0, t * 5, 0);
+        modelInstances[2].pos = glm::vec3(800, -900, 1100);
+        modelInstances[2].rot = glm::vec3(0, t * .2, 0);
+        for (ModelInstance& instance : modelInstances)
+            instance.animation.time = t;
+
+        //a measured frame pre-passes everything, otherwise the monitor decides per object
+        measureOverdraw = depthPrepassMode == PREPASS_AUTO && overdrawMonitor.BeginFrame();
+        auto usePrepass = [](int object) {
+            return depthPrepassMode == PREPASS_ALL || measureOverdraw || (depthPrepassMode == PREPASS_AUTO && overdrawMonitor.UsePrepass(object));
+        };
+        for (ModelInstance& instance : modelInstances)
+            instance.depthPrepass = usePrepass(instance.overdrawObject);
+
+        //waits while the render thread is still a full frame behind
+        RenderPacket& packet = renderPipeline.BeginWrite();
+        packet.view = camView;
+        packet.projection = camProjection;
+        packet.cameraPosition = camPosition;
+        packet.time = t;
+        packet.terrain = terrainOptions;
+        cascadedShadows.Update(camView, camProjection, lightDirection, packet.shadows);
+        AnimateModelInstances(modelInstances);
+        PlaceModelInstances(modelInstances);
+        function<bool(glm::vec3, glm::vec3)> isOccluded;
+        if (occlusionMode == OCCLUSION_HIZ)
+        {
+            hizBuffer.Latest(occlusionPyramid);
+            isOccluded = [](glm::vec3 boundsMin, glm::vec3 boundsMax) { return occlusionPyramid.IsBoxOccluded(boundsMin, boundsMax); };
+        }
+        else if (occlusionMode == OCCLUSION_RASTER)
+        {
+            RasterizeOccluders(camProjection * camView);
+            isOccluded = [](glm::vec3 boundsMin, glm::vec3 boundsMax) { return occlusionRasterizer.IsBoxOccluded(boundsMin, boundsMax); };
+        }
+        UpdateModelInstances(modelInstances, ExtractFrustum(camProjection * camView), packet.shadows, isOccluded);
+        packet.captureDepth = occlusionMode == OCCLUSION_HIZ;
+        if (occlusionReport && ++occlusionReportFrame >= OCCLUSION_REPORT_INTERVAL)
+        {
+            occlusionReportFrame = 0;
+            std::cout << "Occlusion: " << occludedMeshes << " of " << testedMeshes << " meshes in the frustum culled";
+            if (occlusionMode == OCCLUSION_HIZ)
+                std::cout << ", pyramid " << occlusionPyramid.frame;
+            else if (occlusionMode == OCCLUSION_RASTER)
+                std::cout << ", " << occlusionRasterizer.rasterizedTriangles << " of " << occlusionRasterizer.submittedTriangles
+                          << " occluder triangles drawn in " << occlusionRasterMs << " ms";
+            std::cout << std::endl;
+        }
+        SkinModelInstances(modelInstances, packet.skinnedVertices);
+        RecordModelInstances(modelInstances, packet.modelCommands, packet.depthCommands);
+        auto shadowStart = chrono::high_resolution_clock::now();
+        RecordShadowCasters(modelInstances, packet.shadows, packet.shadowCommands, packet.shadowDraws);
+        packet.shadowRecordMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - shadowStart).count();
+        packet.shadowReport = shadowReport;
+        //the packet's old edits were uploaded two frames ago, its list is reused for the next ones
+        packet.terrainEdits.swap(pendingTerrainEdits);
+        pendingTerrainEdits.clear();
+        packet.heightField = terrainHeightsChanged ? make_shared<const HeightField>(terrainHeightField) : nullptr;
+        terrainHeightsChanged = false;
+        packet.runTerrainBenchmark = runTerrainBenchmark;
+        runTerrainBenchmark = false;
+        packet.runVertexBenchmark = runVertexBenchmark;
+        runVertexBenchmark = false;
+        packet.prepassTerrain = usePrepass(OVERDRAW_TERRAIN);
+        packet.prepassBox = usePrepass(OVERDRAW_BOX);
+        packet.measureOverdraw = measureOverdraw;
+        packet.overdrawView = overdrawView;
+        packet.deferred = deferredShading;
+        UpdatePointLights(t, ExtractFrustum(camProjection * camView), packet.pointLights);
+        packet.clusterView = clusterView;
+        packet.bloom = bloom;
+        packet.autoExposure = autoExposure;
+        packet.dynamicResolution = dynamicResolutionEnabled;
+        packet.frameBudgetMs = FRAME_BUDGETS_MS[frameBudget];
+        if (!deferredShading)
+            BuildLightClusters(packet);
+        renderPipeline.EndWrite();
+
+        //Poll
         glfwPollEvents();
     }
 
+    renderPipeline.Close();
+    renderThread.join();
+
+    //the GL objects go away on this thread again
+    glfwMakeContextCurrent(window);
+    delete terrainStreamer;
+    delete terrainClipmap;
+
     glfwTerminate();
     return 0;
 }
 
+// owns the GL context, draws the packets from the main thread until the pipeline is closed
+void RenderLoop(GLFWwindow* window)
+{
+    glfwMakeContextCurrent(window);
+
+    while (const RenderPacket* frame = renderPipeline.BeginRead())
+    {
+        RenderFrame(*frame, window);
+        bool report = frame->shadowReport;
+        //everything is submitted, the main thread can refill the packet while we wait for the swap
+        renderPipeline.EndRead();
+
+        //Swap
+        glfwSwapBuffers(window);
+
+        terrainTimer.Collect();
+        overdrawMonitor.Collect();
+        shadowMaps.Collect();
+        hizBuffer.Collect();
+        unsigned int frameSamples = gpuFrameTimer.samples;
+        gpuFrameTimer.Collect();
+        if (gpuFrameTimer.samples != frameSamples && dynamicResolution.Update(gpuFrameTimer.lastMs))
+        {
+            float scale = dynamicResolution.Scale();
+            std::cout << "Resolution: " << (int)lroundf(scale * 100.0f) << "% (" << lroundf(WIDTH * scale) << "x" << lroundf(HEIGHT * scale)
+                      << "), GPU frame " << dynamicResolution.SmoothedMs() << " ms of " << dynamicResolution.budgetMs << " ms" << std::endl;
+        }
+        ReportShadows(report);
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+void RenderFrame(const RenderPacket& frame, GLFWwindow* window)
+{
+    view = frame.view;
+    projection = frame.projection;
+    cameraPosition = frame.cameraPosition;
+    useSplatTerrain = frame.terrain.splat;
+    useStripTerrain = frame.terrain.strips;
+    useGridTerrain = frame.terrain.grid;
+    useStreamedTerrain = frame.terrain.streamed;
+    useClipmapTerrain = frame.terrain.clipmap;
+
+    ApplyTerrainEdits(frame);
+
+    if (frame.runTerrainBenchmark)
+        RunTerrainBenchmark(window);
+    if (frame.runVertexBenchmark)
+        RunVertexBenchmark();
+
+    //the scale picked from the frames before
+    gpuFrameTimer.Begin();
+    dynamicResolution.enabled = frame.dynamicResolution;
+    dynamicResolution.budgetMs = frame.frameBudgetMs;
+    postProcess.SetRenderScale(dynamicResolution.Scale());
+
+    float t = frame.time;
+    glm::vec3 boxPos(100, 350, 300), boxRot(t * 0.2, t * .4, t * -0.2), boxScale(200, 200, 200);
+
+    if (useStreamedTerrain)
+        terrainStreamer->Update(cameraPosition);
+    if (useClipmapTerrain)
+        terrainClipmap->Update(cameraPosition);
+
+    bool modelsUploaded = UploadModels(frame);
+    bool measure = frame.measureOverdraw;
+    GLintptr frameSize = (sizeof(FrameUniformData) + UNIFORM_BLOCK_ALIGNMENT - 1) / UNIFORM_BLOCK_ALIGNMENT * UNIFORM_BLOCK_ALIGNMENT;
+    GLintptr framesSize = frameSize * (1 + SHADOW_CASCADES);
+    GLintptr depthSize = 0, colorSize = 0;
+    for (const CommandBuffer& commands : frame.depthCommands)
+        depthSize += commands.UniformDataSize();
+    for (const CommandBuffer& commands : frame.modelCommands)
+        colorSize += commands.UniformDataSize();
+
+    //the shadow maps first, the passes after sample them
+    RenderShadows(frame, modelsUploaded, framesSize + depthSize + colorSize, boxPos, boxRot, boxScale);
+    shadowMaps.Bind(frame.shadows.uniforms, SHADOW_UNIFORM_BINDING);
+
+    //the overdraw view is a forward thing, it counts the forward shading
+    bool deferred = frame.deferred && !frame.overdrawView;
+    BuildFrameGraph(frameGraph, frame, deferred, [=, &frame]() {
+        RenderScene(frame, deferred, modelsUploaded, framesSize, depthSize, boxPos, boxRot, boxScale);
+    });
+    frameGraph.Execute(renderTargets);
+    //the fullscreen passes leave these off, the shadows of the next frame draw with them
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    ReportFrameGraph();
+    gpuFrameTimer.End();
+    renderTargets.EndFrame();
+    if (measure)
+        overdrawMonitor.Issued();
+    if (modelsUploaded)
+    {
+        uniformRing.Fence();
+        if (!frame.skinnedVertices.empty())
+            skinnedVertexRing.Fence();
+    }
+}
+
+// the passes of a frame after the shadow maps into graph, and compiles it: the scene (forward into the HDR target, or
+// the G-buffer and the lighting passes), the Hi-Z reduction when the depth is read back, then the post chain or the
+// overdraw view's copy. drawScene draws the depth pre-pass and the color or G-buffer pass. Makes no GL calls, the
+// frame graph test builds frames without a context
+void BuildFrameGraph(FrameGraph& graph, const RenderPacket& frame, bool deferred, function<void()> drawScene)
+{
+    graph.Reset();
+    int scene = postProcess.CreateScene(graph);
+    int screen = graph.Import(0, 0, WIDTH, HEIGHT, GL_RGBA8);
+    int renderWidth = postProcess.renderWidth, renderHeight = postProcess.renderHeight;
+
+    int depth;
+    if (deferred)
+    {
+        gbuffer.Declare(graph, WIDTH, HEIGHT);
+        depth = gbuffer.depth;
+        int pass = graph.AddPass(gbuffer.Surface(), gbuffer.depth, FrameGraph::LOAD_CLEAR, std::move(drawScene));
+        graph.Viewport(pass, renderWidth, renderHeight);
+
+        pass = graph.AddPass(gbuffer.light, FrameGraph::LOAD_NONE, [&frame]() { RenderDeferredLights(frame); });
+        gbuffer.ReadSurface(graph, pass);
+        graph.Viewport(pass, renderWidth, renderHeight);
+
+        pass = graph.AddPass(scene, FrameGraph::LOAD_NONE, []() { RenderDeferredFog(); });
+        graph.Read(pass, gbuffer.light, GBuffer::LIGHT_UNIT);
+        graph.Read(pass, gbuffer.depth, GBuffer::DEPTH_UNIT);
+        graph.Viewport(pass, renderWidth, renderHeight);
+    }
+    else
+    {
+        depth = postProcess.CreateSceneDepth(graph);
+        int pass = graph.AddPass({ scene }, depth, FrameGraph::LOAD_CLEAR, std::move(drawScene));
+        graph.Viewport(pass, renderWidth, renderHeight);
+    }
+    if (frame.captureDepth)
+        hizBuffer.AddPasses(graph, depth, WIDTH, HEIGHT, frame.projection * frame.view, postProcess.RenderScale());
+
+    //the overdraw counts go to the screen as they are
+    if (frame.overdrawView)
+        postProcess.BuildCopy(graph, scene, screen);
+    else
+    {
+        postProcess.bloom = frame.bloom;
+        postProcess.autoExposure = frame.autoExposure;
+        postProcess.Build(graph, scene, screen, frame.time);
+    }
+    graph.Compile();
+}
+
+// the frame's render target memory when the frame graph's passes change: the transients alive at once at the peak, the
+// imported targets the passes use and the shadow maps drawn before the graph. What the pool holds is more while targets
+// of sizes that went out of use wait to be deleted
+void ReportFrameGraph()
+{
+    const FrameGraphStats& graph = frameGraph.Stats();
+    if (graph == reportedFrameGraph)
+        return;
+    reportedFrameGraph = graph;
+    size_t shadowBytes = ShadowMaps::Bytes();
+    std::cout << "Frame graph: " << graph.passes - graph.culledPasses << " of " << graph.passes << " passes, " << graph.transients << " transient targets in "
+              << graph.textures << " textures. Render targets at the peak " << (graph.peakBytes + graph.importedBytes + shadowBytes) / 1024 << " KB: transients "
+              << graph.peakBytes / 1024 << " KB (" << graph.allocatedBytes / 1024 << " KB allocated, " << graph.unaliasedBytes / 1024
+              << " KB without aliasing), imported " << graph.importedBytes / 1024 << " KB, shadow maps " << shadowBytes / 1024 << " KB. Pool "
+              << renderTargets.Bytes() / 1024 << " KB" << std::endl;
+}
+
+// the depth pre-pass and the color pass of the scene into the bound targets: the HDR scene, or the G-buffer when deferred
+void RenderScene(const RenderPacket& frame, bool deferred, bool modelsUploaded, GLintptr framesSize, GLintptr depthSize, glm::vec3 boxPos, glm::vec3 boxRot, glm::vec3 boxScale)
+{
+    bool measure = frame.measureOverdraw;
+
+    //depth pre-pass, same order as the color pass: box and models first, the terrain they cover last
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    renderPass = PASS_DEPTH;
+    if (frame.prepassBox)
+    {
+        if (measure)
+            glBeginQuery(GL_SAMPLES_PASSED, overdrawMonitor.Query(OVERDRAW_BOX, OVERDRAW_DEPTH));
+        RenderBox(view, projection, boxIndexCount, boxPos, boxRot, boxScale);
+        if (measure)
+            glEndQuery(GL_SAMPLES_PASSED);
+    }
+    if (modelsUploaded)
+        RenderModels(frame.depthCommands, framesSize);
+    if (frame.prepassTerrain)
+    {
+        if (measure)
+            glBeginQuery(GL_SAMPLES_PASSED, overdrawMonitor.Query(OVERDRAW_TERRAIN, OVERDRAW_DEPTH));
+        RenderTerrain();
+        if (measure)
+            glEndQuery(GL_SAMPLES_PASSED);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    //color pass, or the G-buffer pass when deferred. The overdraw view draws everything with the depth programs added
+    //up instead, on black
+    renderPass = frame.overdrawView ? PASS_OVERDRAW : (deferred ? PASS_GBUFFER : PASS_COLOR);
+    if (renderPass == PASS_COLOR)
+    {
+        clusterBuffers.Upload(frame.clusters, frame.pointLights, frame.clusterView, CLUSTER_UNIFORM_BINDING, postProcess.RenderScale());
+        RenderSkyBox();
+    }
+
+    BeginColorPass(frame.prepassBox, OVERDRAW_BOX, measure);
+    RenderBox(view, projection, boxIndexCount, boxPos, boxRot, boxScale);
+    EndColorPass(frame.prepassBox, measure);
+
+    if (modelsUploaded)
+        RenderModels(frame.modelCommands, framesSize + depthSize);
+
+    BeginColorPass(frame.prepassTerrain, OVERDRAW_TERRAIN, measure);
+    terrainTimer.Begin();
+    RenderTerrain();
+    terrainTimer.End();
+    EndColorPass(frame.prepassTerrain, measure);
+
+    renderPass = PASS_COLOR;
+}
+
+// draws the cascades updated this frame into their shadow maps with the depth programs: the box and the model
+// instances that were culled against the cascade, and the terrain, which is one draw. offset is where UploadModels()
+// put the model data of the first cascade
+void RenderShadows(const RenderPacket& frame, bool modelsUploaded, GLintptr offset, glm::vec3 boxPos, glm::vec3 boxRot, glm::vec3 boxScale)
+{
+    GLintptr frameSize = (sizeof(FrameUniformData) + UNIFORM_BLOCK_ALIGNMENT - 1) / UNIFORM_BLOCK_ALIGNMENT * UNIFORM_BLOCK_ALIGNMENT;
+    renderPass = PASS_DEPTH;
+    for (int c = 0; c < SHADOW_CASCADES; c++)
+    {
+        const ShadowCascade& cascade = frame.shadows.cascades[c];
+        if (!cascade.updated)
+            continue;
+
+        view = cascade.view;
+        projection = cascade.projection;
+        shadowMaps.BeginCascade(c);
+
+        int draws = 1;
+        //the corners of the unit cube are sqrt(3) / 2 out
+        if (IsSphereVisible(cascade.frustum, boxPos, boxScale.x * 0.867f))
+        {
+            RenderBox(view, projection, boxIndexCount, boxPos, boxRot, boxScale);
+            draws++;
+        }
+        if (modelsUploaded)
+        {
+            RenderModels(frame.shadowCommands[c], offset, frameSize * (1 + c));
+            draws += frame.shadowDraws[c];
+        }
+        RenderTerrain();
+
+        shadowMaps.EndCascade(c);
+        for (const CommandBuffer& commands : frame.shadowCommands[c])
+            offset += commands.UniformDataSize();
+        shadowDraws[c] = draws;
+    }
+    shadowRecordMs = frame.shadowRecordMs;
+
+    view = frame.view;
+    projection = frame.projection;
+    glViewport(0, 0, WIDTH, HEIGHT);
+    renderPass = PASS_COLOR;
+}
+
+// every SHADOW_REPORT_INTERVAL frames while report is on: the draws and GPU time of every cascade the last time it
+// was updated, and how long recording the casters took on the main thread
+void ReportShadows(bool report)
+{
+    if (!report || ++shadowReportFrame < SHADOW_REPORT_INTERVAL)
+        return;
+    shadowReportFrame = 0;
+    std::cout << "Shadows (draws, GPU ms per cascade):";
+    for (int c = 0; c < SHADOW_CASCADES; c++)
+        std::cout << " " << shadowDraws[c] << " " << shadowMaps.timers[c].lastMs << ",";
+    std::cout << " casters recorded in " << shadowRecordMs << " ms" << std::endl;
+}
+
+// depth state of an object's color pass. After a pre-pass it only shades the fragments that match the depth it laid
+// down: GL_LEQUAL with writes off rather than GL_EQUAL, the depth and color programs aren't guaranteed to be invariant
+void BeginColorPass(bool prepassed, int object, bool measure)
+{
+    if (renderPass == PASS_OVERDRAW)
+    {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+    }
+    if (prepassed)
+    {
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    if (measure)
+        glBeginQuery(GL_SAMPLES_PASSED, overdrawMonitor.Query(object, OVERDRAW_COLOR));
+}
+
+void EndColorPass(bool prepassed, bool measure)
+{
+    if (measure)
+        glEndQuery(GL_SAMPLES_PASSED);
+    if (prepassed)
+    {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+    glDisable(GL_BLEND);
+}
+
+// the program a render function draws with in the current pass
+GLuint PassProgram(GLuint program)
+{
+    if (renderPass == PASS_COLOR)
+        return program;
+    if (renderPass == PASS_GBUFFER)
+        return gbufferPrograms.at(program);
+    return depthPrograms.at(program);
+}
+
+// lights the G-buffer into the light target, which is bound with the G-buffer on its units: the sky, the sun on every
+// pixel, the point lights on the pixels their volumes cover
+void RenderDeferredLights(const RenderPacket& frame)
+{
+    glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+
+    RenderSkyBox();
+
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(deferredLightProgram);
+    glUniformMatrix4fv(glGetUniformLocation(deferredLightProgram, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+    glUniform3fv(glGetUniformLocation(deferredLightProgram, "lightDirection"), 1, glm::value_ptr(lightDirection));
+    glUniform3fv(glGetUniformLocation(deferredLightProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    gbuffer.DrawFullscreen();
+
+    //every light adds to what is there, back faces only so each pixel is lit once per light
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+
+    glUseProgram(pointLightProgram);
+    glUniformMatrix4fv(glGetUniformLocation(pointLightProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(pointLightProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(glGetUniformLocation(pointLightProgram, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+    glUniform3fv(glGetUniformLocation(pointLightProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    glUniform2f(glGetUniformLocation(pointLightProgram, "screenSize"), (float)postProcess.renderWidth, (float)postProcess.renderHeight);
+    lightVolumes.Draw(frame.pointLights);
+
+    glCullFace(GL_BACK);
+    glDisable(GL_BLEND);
+}
+
+// the fog over the light target into the scene, the light and the depth are on their GBuffer units
+void RenderDeferredFog()
+{
+    glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(deferredFogProgram);
+    glUniformMatrix4fv(glGetUniformLocation(deferredFogProgram, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+    glUniform3fv(glGetUniformLocation(deferredFogProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    gbuffer.DrawFullscreen();
+}
+
+// scatters the lights over the terrain around where the camera starts, a few meters above the ground
+void CreatePointLights(int count)
+{
+    mt19937 random(7);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < count; i++)
+    {
+        float x = 50.0f + unit(random) * 1500.0f, z = 50.0f + unit(random) * 1500.0f;
+        float y = terrainHeightField.GetHeight(x, z) + 10.0f + unit(random) * 20.0f;
+        glm::vec3 color(unit(random), unit(random), unit(random));
+        color /= glm::max(color.r, glm::max(color.g, color.b));
+        pointLights.push_back({ glm::vec4(x, y, z, 30.0f + unit(random) * 60.0f), glm::vec4(color * 2.0f, 0.0f) });
+    }
+}
+
+// bobs the lights up and down and keeps the ones whose sphere is in the frustum
+void UpdatePointLights(float t, const Frustum& frustum, vector<PointLight>& visible)
+{
+    visible.clear();
+    for (size_t i = 0; i < pointLights.size(); i++)
+    {
+        PointLight light = pointLights[i];
+        light.sphere.y += sinf(t + i * 0.37f) * 5.0f;
+        if (IsSphereVisible(frustum, glm::vec3(light.sphere), light.sphere.w))
+            visible.push_back(light);
+    }
+}
+
+// bins the packet's visible point lights into the clusters of its camera, and every CLUSTER_REPORT_INTERVAL frames of
+// the cluster view prints how the lights spread over the clusters
+void BuildLightClusters(RenderPacket& packet)
+{
+    auto start = chrono::high_resolution_clock::now();
+    lightClusters.Build(packet.view, packet.projection, WIDTH, HEIGHT, packet.pointLights, packet.clusters);
+    double buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    if (!clusterView || ++clusterReportFrame < CLUSTER_REPORT_INTERVAL)
+        return;
+    clusterReportFrame = 0;
+    const ClusterLists& clusters = packet.clusters;
+    std::cout << "Clusters: " << packet.pointLights.size() << " visible lights, " << clusters.occupied << " of " << LightClusters::CLUSTER_COUNT
+              << " clusters lit, " << (clusters.occupied > 0 ? (double)clusters.references / clusters.occupied : 0.0) << " lights per lit cluster, "
+              << clusters.maxCount << " at most, " << clusters.overflow << " dropped, built in " << buildMs << " ms" << std::endl;
+}
+
+// uploads the frame's uniform blocks and CPU skinned vertices with one mapping of each ring. The frame block comes
+// first, then one for each shadow cascade, then the uniform data of the depth batches, the color batches and the
+// shadow batches of every cascade
+bool UploadModels(const RenderPacket& frame)
+{
+    FrameUniformData frameData = { frame.view, frame.projection, glm::vec4(frame.cameraPosition, 0.0f), glm::vec4(lightDirection, 0.0f) };
+    GLsizeiptr frameSize = (sizeof(frameData) + UNIFORM_BLOCK_ALIGNMENT - 1) / UNIFORM_BLOCK_ALIGNMENT * UNIFORM_BLOCK_ALIGNMENT;
+    vector<const vector<CommandBuffer>*> batchLists = { &frame.depthCommands, &frame.modelCommands };
+    for (const vector<CommandBuffer>& batches : frame.shadowCommands)
+        batchLists.push_back(&batches);
+    GLsizeiptr size = frameSize * (1 + SHADOW_CASCADES);
+    for (const vector<CommandBuffer>* batches : batchLists)
+        for (const CommandBuffer& commands : *batches)
+            size += commands.UniformDataSize();
+
+    //vertices skinned on the CPU, the streamed draws count from where they land in the ring
+    modelVertexBase = 0;
+    if (!frame.skinnedVertices.empty())
+    {
+        GLintptr vertexOffset;
+        GLsizeiptr vertexSize = frame.skinnedVertices.size() * sizeof(SkinnedVertex);
+        unsigned char* vertices = skinnedVertexRing.Map(vertexSize, vertexOffset);
+        if (!vertices)
+            return false;
+        memcpy(vertices, frame.skinnedVertices.data(), vertexSize);
+        skinnedVertexRing.Unmap();
+        modelVertexBase = (GLint)(vertexOffset / sizeof(SkinnedVertex));
+    }
+
+    unsigned char* uniforms = uniformRing.Map(size, modelUniformBase);
+    if (!uniforms)
+        return false;
+    memcpy(uniforms, &frameData, sizeof(frameData));
+    for (int c = 0; c < SHADOW_CASCADES; c++)
+    {
+        const ShadowCascade& cascade = frame.shadows.cascades[c];
+        FrameUniformData cascadeData = { cascade.view, cascade.projection, glm::vec4(frame.cameraPosition, 0.0f), glm::vec4(lightDirection, 0.0f) };
+        memcpy(uniforms + frameSize * (1 + c), &cascadeData, sizeof(cascadeData));
+    }
+    GLsizeiptr offset = frameSize * (1 + SHADOW_CASCADES);
+    for (const vector<CommandBuffer>* batches : batchLists)
+    {
+        for (const CommandBuffer& commands : *batches)
+        {
+            memcpy(uniforms + offset, commands.UniformData(), commands.UniformDataSize());
+            offset += commands.UniformDataSize();
+        }
+    }
+    uniformRing.Unmap();
+    return true;
+}
+
+// replays recorded model draws whose uniform data UploadModels() put at offset from the frame block, with the frame
+// block at frameOffset (a shadow cascade's)
+void RenderModels(const vector<CommandBuffer>& batches, GLintptr offset, GLintptr frameOffset)
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, uniformRing.Buffer(), modelUniformBase + frameOffset, sizeof(FrameUniformData));
+    for (const CommandBuffer& commands : batches)
+    {
+        ExecuteCommands(commands, uniformRing.Buffer(), modelUniformBase + offset, modelVertexBase, overdrawMonitor.Queries());
+        offset += commands.UniformDataSize();
+    }
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
 void RenderSkyBox()
 {
     // OpenGL Setup
@@ -174,52 +1196,478 @@ void RenderSkyBox()
 
 void RenderTerrain()
 {
+    if (useStreamedTerrain)
+    {
+        RenderStreamedTerrain();
+        return;
+    }
+    if (useClipmapTerrain)
+    {
+        RenderClipmapTerrain();
+        return;
+    }
+
     glEnable(GL_DEPTH);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
 
-    glUseProgram(terrainProgram);
+    //the grid mode only comes with the splat material
+    bool splat = useSplatTerrain || useGridTerrain;
+    GLuint program = PassProgram(useGridTerrain ? terrainGridProgram : (splat ? terrainSplatProgram : terrainProgram));
+    glUseProgram(program);
 
     glm::mat4 world = glm::mat4(1.0f);
 
     //glUniform1i(glGetUniformLocation(terrainProgram, "mainTex"), 0);
 
-    glUniformMatrix4fv(glGetUniformLocation(terrainProgram, "world"), 1, GL_FALSE, glm::value_ptr(world));
-    glUniformMatrix4fv(glGetUniformLocation(terrainProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(terrainProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
     //make the sun move
     //float t = glfwGetTime();
     //lightDirection = glm::normalize(glm::vec3(glm::sin(t), -0.5f, glm::cos(t)));
 
-    glUniform3fv(glGetUniformLocation(terrainProgram, "lightDirection"), 1, glm::value_ptr(lightDirection));
-    glUniform3fv(glGetUniformLocation(terrainProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(lightDirection));
+    glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, heightMapID);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, heightMapNormalID);
 
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, dirt);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, sand);
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, grass);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, rock);
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_2D, snow);
+    if (splat)
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, terrainLayers);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, terrainSplatMap);
+    }
+    else
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, dirt);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, sand);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, grass);
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D, rock);
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_2D, snow);
+    }
 
     //std::cout << heightmapID << std::endl;
 
+    if (useGridTerrain)
+    {
+        int patchesPerRow = (heightmapWidth - 1 + TERRAIN_PATCH_SIZE - 1) / TERRAIN_PATCH_SIZE;
+        int patchesPerColumn = (heightmapHeight - 1 + TERRAIN_PATCH_SIZE - 1) / TERRAIN_PATCH_SIZE;
+
+        glUniform1i(glGetUniformLocation(program, "patchSize"), TERRAIN_PATCH_SIZE);
+        glUniform1i(glGetUniformLocation(program, "patchesPerRow"), patchesPerRow);
+
+        glBindVertexArray(terrainPatchVAO);
+        glDrawElementsInstanced(GL_TRIANGLES, terrainPatchIndexCount, GL_UNSIGNED_SHORT, 0, patchesPerRow * patchesPerColumn);
+        return;
+    }
+
+    if (useStripTerrain)
+    {
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(0xFFFF);
+
+        glBindVertexArray(terrainStrips.VAO);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLE_STRIP, terrainStrips.counts.data(), GL_UNSIGNED_SHORT, terrainStrips.offsets.data(),
+            (GLsizei)terrainStrips.counts.size(), terrainStrips.baseVertices.data());
+
+        glDisable(GL_PRIMITIVE_RESTART);
+        return;
+    }
+
     glBindVertexArray(terrainVAO);
     glDrawElements(GL_TRIANGLES, terrainIndexCount, GL_UNSIGNED_INT, 0);
 }
 
-void RenderModel(Model* model, GLuint& programID, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale, glm::vec4 color, bool untextured)
+void RenderStreamedTerrain()
+{
+    glEnable(GL_DEPTH);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+
+    GLuint program = PassProgram(terrainStreamProgram);
+    glUseProgram(program);
+
+    //tiles are built in world space
+    glm::mat4 world = glm::mat4(1.0f);
+
+    glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+    glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(lightDirection));
+    glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, terrainLayers);
+
+    terrainStreamer->Draw();
+}
+
+void RenderClipmapTerrain()
+{
+    glEnable(GL_DEPTH);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+
+    GLuint program = PassProgram(terrainClipmapProgram);
+    glUseProgram(program);
+
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+
+    glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(lightDirection));
+    glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, terrainLayers);
+
+    terrainClipmap->Draw(program);
+}
+
+// world matrices and per mesh frustum culling for every instance, spread over the job system
+void AddModelInstance(Model* model, const ProgramUniforms* program, glm::vec3 scale, glm::vec4 color, bool untextured, bool occluder)
+{
+    ModelInstance instance = {};
+    instance.model = model;
+    instance.program = program;
+    instance.pos = glm::vec3(0);
+    instance.rot = glm::vec3(0);
+    instance.scale = scale;
+    instance.color = color;
+    instance.untextured = untextured;
+    instance.occluder = occluder;
+    instance.placedPos = instance.pos;
+    instance.placedRot = instance.rot;
+    instance.placedScale = instance.scale;
+    instance.node = scene.AddNode(-1, ComposeWorld(instance.pos, instance.rot, instance.scale));
+    instance.firstModelNode = scene.AddSubtree(instance.node, instance.model->nodeParents, instance.model->nodeTransforms);
+
+    const Skeleton& skeleton = instance.model->skeleton;
+    instance.skinnedProgram = instance.program == &modelUniforms ? &skinnedModelUniforms : &skinnedUntexturedModelUniforms;
+    instance.animated = !skeleton.bones.empty() || !skeleton.clips.empty();
+    instance.animation.clip = skeleton.clips.empty() ? -1 : 0;
+    for (Mesh& mesh : instance.model->meshes)
+        if (mesh.skinned && !mesh.streamVAO)
+            mesh.SetupStream(skinnedVertexRing.Buffer());
+    instance.overdrawObject = OVERDRAW_MODELS + (int)modelInstances.size();
+    instance.depthPrepass = false;
+    if (instance.occluder)
+        for (const Mesh& mesh : instance.model->meshes)
+            instance.occluders.push_back(MeshOccluder(mesh));
+    modelInstances.push_back(instance);
+}
+
+// poses every animated instance for its AnimationState. The instances are spread over the job system in batches,
+// each thread evaluates its batch in its own scratch memory so hundreds of skeletons don't allocate per frame
+void AnimateModelInstances(vector<ModelInstance>& instances)
+{
+    static vector<int> animatedInstances;
+    animatedInstances.clear();
+    for (int i = 0; i < (int)instances.size(); i++)
+        if (instances[i].animated)
+            animatedInstances.push_back(i);
+
+    JobSystem::Get().ParallelFor((int)animatedInstances.size(), 8, [&](int begin, int end) {
+        static thread_local AnimationScratch scratch;
+        for (int i = begin; i < end; i++)
+        {
+            ModelInstance& instance = instances[animatedInstances[i]];
+            instance.model->skeleton.Evaluate(instance.animation, instance.clipCursors, scratch, instance.animatedNodes, instance.bones, instance.skinnedBoundsMin, instance.skinnedBoundsMax);
+        }
+    });
+}
+
+// moves the instances that changed in the scene graph
+void PlaceModelInstances(vector<ModelInstance>& instances)
+{
+    movedTransforms.Clear();
+    movedInstances.clear();
+    for (int i = 0; i < (int)instances.size(); i++)
+    {
+        ModelInstance& instance = instances[i];
+        if (instance.pos == instance.placedPos && instance.rot == instance.placedRot && instance.scale == instance.placedScale)
+            continue;
+
+        movedTransforms.Add(instance.pos, glm::quat(instance.rot), instance.scale);
+        movedInstances.push_back(i);
+        instance.placedPos = instance.pos;
+        instance.placedRot = instance.rot;
+        instance.placedScale = instance.scale;
+    }
+
+    movedWorlds.resize(movedInstances.size());
+    movedTransforms.ComposeWorld(movedWorlds.data(), 0, movedTransforms.Count());
+    for (size_t i = 0; i < movedInstances.size(); i++)
+        scene.SetLocal(instances[movedInstances[i]].node, movedWorlds[i]);
+    scene.Update();
+}
+
+// the per mesh frustum culling spread over the job system. With isOccluded the meshes in the frustum are also tested
+// for occlusion, the shadow cascades get their own bits
+void UpdateModelInstances(vector<ModelInstance>& instances, const Frustum& frustum, const ShadowCascades& shadows, const function<bool(glm::vec3, glm::vec3)>& isOccluded)
+{
+    atomic<int> occluded(0), tested(0);
+    JobSystem::Get().ParallelFor((int)instances.size(), 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            ModelInstance& instance = instances[i];
+            const Model& model = *instance.model;
+            instance.visibleMeshes.resize(model.meshes.size());
+            instance.shadowMeshes.resize(model.meshes.size());
+            for (size_t m = 0; m < model.meshes.size(); m++)
+            {
+                //a skinned mesh is wherever its bones put it
+                const Mesh& mesh = model.meshes[m];
+                bool skinned = instance.animated && mesh.skinned;
+                glm::vec3 boundsMin, boundsMax;
+                TransformBounds(MeshWorld(instance, m), skinned ? instance.skinnedBoundsMin : mesh.boundsMin, skinned ? instance.skinnedBoundsMax : mesh.boundsMax, boundsMin, boundsMax);
+                instance.visibleMeshes[m] = IsBoxVisible(frustum, boundsMin, boundsMax);
+                //what is hidden still casts shadows
+                if (isOccluded && instance.visibleMeshes[m])
+                {
+                    tested++;
+                    if (isOccluded(boundsMin, boundsMax))
+                    {
+                        instance.visibleMeshes[m] = false;
+                        occluded++;
+                    }
+                }
+                //a cascade that isn't drawn this frame doesn't need its casters
+                char cascades = 0;
+                for (int c = 0; c < SHADOW_CASCADES; c++)
+                    if (shadows.cascades[c].updated && IsBoxVisible(shadows.cascades[c].frustum, boundsMin, boundsMax))
+                        cascades |= 1 << c;
+                instance.shadowMeshes[m] = cascades;
+            }
+        }
+    });
+    occludedMeshes = occluded;
+    testedMeshes = tested;
+}
+
+// draws the terrain LOD and the occluder instances into occlusionRasterizer for this frame's camera
+void RasterizeOccluders(const glm::mat4& viewProjection)
 {
+    auto start = chrono::high_resolution_clock::now();
+    if (terrainOccluderDirty)
+    {
+        terrainOccluder = TerrainOccluder(terrainHeightField, TERRAIN_OCCLUDER_STEP);
+        terrainOccluderDirty = false;
+    }
+
+    occlusionRasterizer.Begin(viewProjection);
+    occlusionRasterizer.AddOccluder(terrainOccluder, glm::mat4(1.0f));
+    for (const ModelInstance& instance : modelInstances)
+        for (size_t m = 0; m < instance.occluders.size(); m++)
+            occlusionRasterizer.AddOccluder(instance.occluders[m], MeshWorld(instance, m));
+    occlusionRasterizer.Render();
+    occlusionRasterMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+}
+
+OccluderMesh MeshOccluder(const Mesh& mesh)
+{
+    OccluderMesh occluder;
+    occluder.vertices.reserve(mesh.vertices.size());
+    for (const Vertex& vertex : mesh.vertices)
+        occluder.vertices.push_back(vertex.Position);
+    occluder.indices = mesh.indices;
+    return occluder;
+}
+
+// with useCpuSkinning the visible skinned meshes of animated instances are skinned into vertices on the job system.
+// Every mesh gets its range of vertices up front, then the ranges are cut into chunks so big meshes spread over threads
+void SkinModelInstances(vector<ModelInstance>& instances, vector<SkinnedVertex>& vertices)
+{
+    struct SkinningChunk {
+        const ModelInstance* instance;
+        const SkinningSource* source;
+        int begin, end, output;
+    };
+    const int chunkSize = 4096;
+    static vector<SkinningChunk> chunks;
+    chunks.clear();
+
+    int vertexCount = 0;
+    for (ModelInstance& instance : instances)
+    {
+        const Model& model = *instance.model;
+        instance.streamedVertices.assign(model.meshes.size(), -1);
+        if (!useCpuSkinning || !instance.animated)
+            continue;
+
+        for (size_t m = 0; m < model.meshes.size(); m++)
+        {
+            const SkinningSource& source = model.skinningSources[m];
+            if (!model.meshes[m].skinned || !instance.visibleMeshes[m] || source.Empty())
+                continue;
+
+            instance.streamedVertices[m] = vertexCount;
+            for (int begin = 0; begin < source.Count(); begin += chunkSize)
+                chunks.push_back({ &instance, &source, begin, glm::min(begin + chunkSize, source.Count()), vertexCount + begin });
+            vertexCount += source.Count();
+        }
+    }
+
+    vertices.resize(vertexCount);
+    JobSystem::Get().ParallelFor((int)chunks.size(), 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            const SkinningChunk& chunk = chunks[i];
+            SkinVertices(*chunk.source, chunk.instance->bones.data(), &vertices[chunk.output], chunk.begin, chunk.end);
+        }
+    });
+}
+
+// the normal matrix is worked out here once per draw instead of for every vertex in the shader
+ObjectUniformData MakeObjectData(const glm::mat4& world, glm::vec4 color)
+{
+    glm::mat3 normalMatrix = NormalMatrix(world);
+    ObjectUniformData object;
+    object.world = world;
+    for (int i = 0; i < 3; i++)
+        object.normalMatrix[i] = glm::vec4(normalMatrix[i], 0.0f);
+    object.color = color;
+    return object;
+}
+
+// world matrix a mesh of the instance is drawn with. Animated instances pose their nodes themselves, their skinned
+// meshes are already in model space after the bone matrices
+glm::mat4 MeshWorld(const ModelInstance& instance, size_t mesh)
+{
+    const Model& model = *instance.model;
+    if (!instance.animated)
+        return scene.World(instance.firstModelNode + model.meshNodes[mesh]);
+    if (model.meshes[mesh].skinned)
+        return scene.World(instance.node);
+    return scene.World(instance.node) * instance.animatedNodes[model.meshNodes[mesh]];
+}
+
+glm::mat4 ComposeWorld(glm::vec3 pos, glm::vec3 rot, glm::vec3 scale)
+{
+    glm::mat4 world = glm::mat4(1.0f);
+    world = glm::translate(world, pos);
+    world = world * glm::toMat4(glm::quat(rot));
+    world = glm::scale(world, scale);
+    return world;
+}
+
+// records every instance on the job system, batches of instances go to their own buffer so the order stays the same.
+// Instances are recorded nearest first, so early-Z rejects what is behind the instances drawn before it
+void RecordModelInstances(const vector<ModelInstance>& instances, vector<CommandBuffer>& batches, vector<CommandBuffer>& depthBatches)
+{
+    static vector<int> order;
+    static vector<float> distances;
+    order.resize(instances.size());
+    distances.resize(instances.size());
+    for (int i = 0; i < (int)instances.size(); i++)
+    {
+        order[i] = i;
+        glm::vec3 offset = glm::vec3(scene.World(instances[i].node)[3]) - camPosition;
+        distances[i] = glm::dot(offset, offset);
+    }
+    sort(order.begin(), order.end(), [](int a, int b) { return distances[a] < distances[b]; });
+
+    const int batchSize = 16;
+    batches.resize((instances.size() + batchSize - 1) / batchSize);
+    depthBatches.resize(batches.size());
+
+    JobSystem::Get().ParallelFor((int)instances.size(), batchSize, [&](int begin, int end) {
+        CommandBuffer& commands = batches[begin / batchSize];
+        CommandBuffer& depthCommands = depthBatches[begin / batchSize];
+        commands.Reset();
+        depthCommands.Reset();
+        for (int i = begin; i < end; i++)
+            RecordModel(instances[order[i]], commands, depthCommands);
+    });
+}
+
+// records the depth only draws of the instances into every shadow cascade updated this frame, culled against the
+// cascade's box. Every cascade gets the same batches of instances as RecordModelInstances(), all of them recorded at once
+void RecordShadowCasters(const vector<ModelInstance>& instances, const ShadowCascades& shadows, vector<CommandBuffer> (&batches)[SHADOW_CASCADES], int (&draws)[SHADOW_CASCADES])
+{
+    const int batchSize = 16;
+    int batchCount = ((int)instances.size() + batchSize - 1) / batchSize;
+    for (int c = 0; c < SHADOW_CASCADES; c++)
+    {
+        batches[c].resize(shadows.cascades[c].updated ? batchCount : 0);
+        draws[c] = 0;
+    }
+
+    JobSystem::Get().ParallelFor(SHADOW_CASCADES * batchCount, 1, [&](int begin, int end) {
+        for (int job = begin; job < end; job++)
+        {
+            int cascade = job / batchCount, batch = job % batchCount;
+            if (!shadows.cascades[cascade].updated)
+                continue;
+            CommandBuffer& commands = batches[cascade][batch];
+            commands.Reset();
+            for (int i = batch * batchSize; i < glm::min((batch + 1) * batchSize, (int)instances.size()); i++)
+                RecordShadowCaster(instances[i], cascade, commands);
+        }
+    });
+
+    for (const ModelInstance& instance : instances)
+        for (char cascades : instance.shadowMeshes)
+            for (int c = 0; c < SHADOW_CASCADES; c++)
+                draws[c] += (cascades >> c) & 1;
+}
+
+// the meshes of the instance in the cascade, with the depth programs. Meshes skinned on the CPU this frame draw their
+// streamed vertices, the other skinned meshes are skinned by the depth program
+void RecordShadowCaster(const ModelInstance& instance, int cascade, CommandBuffer& commands)
+{
+    commands.Enable(GL_DEPTH_TEST);
+    commands.Enable(GL_CULL_FACE);
+
+    const Model& model = *instance.model;
+    const ProgramUniforms* bound = nullptr;
+    bool bonesRecorded = false;
+    unsigned int boneCount = (unsigned int)glm::min((int)instance.bones.size(), MAX_BONES);
+    for (size_t m = 0; m < model.meshes.size(); m++)
+    {
+        if (!((instance.shadowMeshes[m] >> cascade) & 1))
+            continue;
+
+        const Mesh& mesh = model.meshes[m];
+        bool streamed = instance.streamedVertices[m] >= 0;
+        bool skinned = instance.animated && mesh.skinned && !streamed;
+        const ProgramUniforms* program = skinned ? &depthSkinnedModelUniforms : &depthModelUniforms;
+        if (program != bound)
+        {
+            commands.BindProgram(program->id);
+            bound = program;
+        }
+        if (skinned && !bonesRecorded)
+        {
+            commands.UniformBlock(BONE_UNIFORM_BINDING, instance.bones.data(), boneCount * sizeof(glm::mat4), MAX_BONES * sizeof(glm::mat4));
+            bonesRecorded = true;
+        }
+        commands.UniformBlock(OBJECT_UNIFORM_BINDING, MakeObjectData(MeshWorld(instance, m), glm::vec4(0.0f)));
+        mesh.RecordGeometry(commands, streamed ? instance.streamedVertices[m] : -1);
+    }
+}
+
+// with a depth pre-pass the instance's meshes also go into depthCommands, and its color draws only shade the
+// fragments that ended up in front. In the overdraw view the color draws use the depth programs, blended additively,
+// when deferred they write the G-buffer
+void RecordModel(const ModelInstance& instance, CommandBuffer& commands, CommandBuffer& depthCommands)
+{
+    const ProgramUniforms& program = *instance.program;
+
     //glEnable(GL_BLEND);
     
     //blends
@@ -234,36 +1682,103 @@ void RenderModel(Model* model, GLuint& programID, glm::vec3 pos, glm::vec3 rot,
     //glBlendFunc(GL_DST_COLOR, GL_ZERO);
     //double multiply
 
-    glEnable(GL_DEPTH);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    //back faces are culled by default
+    commands.Enable(GL_DEPTH_TEST);
+    commands.Enable(GL_CULL_FACE);
+    //the heat map adds up, whatever blend function the passes before left
+    if (overdrawView)
+    {
+        commands.Enable(GL_BLEND);
+        commands.BlendFunc(GL_ONE, GL_ONE);
+    }
 
-    glUseProgram(programID);
+    bool prepass = instance.depthPrepass;
+    if (prepass)
+    {
+        depthCommands.Enable(GL_DEPTH_TEST);
+        depthCommands.Enable(GL_CULL_FACE);
+        commands.DepthFunc(GL_LEQUAL);
+        commands.DepthMask(false);
+    }
+    if (measureOverdraw)
+    {
+        depthCommands.BeginQuery(GL_SAMPLES_PASSED, OverdrawMonitor::Slot(instance.overdrawObject, OVERDRAW_DEPTH));
+        commands.BeginQuery(GL_SAMPLES_PASSED, OverdrawMonitor::Slot(instance.overdrawObject, OVERDRAW_COLOR));
+    }
 
-    glm::mat4 world = glm::mat4(1.0f);
-    world = glm::translate(world, pos);
-    world = world * glm::toMat4(glm::quat(rot));
-    world = glm::scale(world, scale);
+    //camera and light are in the frame block, every mesh has its own world matrix from the scene graph.
+    //skinned meshes switch to the skinned program, the bones of the instance are recorded once before the first of them
+    const Model& model = *instance.model;
+    const ProgramUniforms* bound = nullptr;
+    const ProgramUniforms* depthBound = nullptr;
+    bool bonesRecorded = false, depthBonesRecorded = false;
+    unsigned int boneCount = (unsigned int)glm::min((int)instance.bones.size(), MAX_BONES);
+    for (size_t m = 0; m < model.meshes.size(); m++)
+    {
+        if (!instance.visibleMeshes[m])
+            continue;
+
+        const Mesh& mesh = model.meshes[m];
+        bool streamed = instance.streamedVertices[m] >= 0;
+        bool skinned = instance.animated && mesh.skinned && !streamed;
+        const ProgramUniforms* depthProgram = skinned ? &depthSkinnedModelUniforms : &depthModelUniforms;
+        const ProgramUniforms* meshProgram = skinned ? instance.skinnedProgram : &program;
+        if (overdrawView)
+            meshProgram = depthProgram;
+        else if (deferredShading)
+            meshProgram = &gbufferModelUniforms.at(meshProgram->id);
+        if (meshProgram != bound)
+        {
+            commands.BindProgram(meshProgram->id);
+            bound = meshProgram;
+        }
+        if (skinned && !bonesRecorded)
+        {
+            commands.UniformBlock(BONE_UNIFORM_BINDING, instance.bones.data(), boneCount * sizeof(glm::mat4), MAX_BONES * sizeof(glm::mat4));
+            bonesRecorded = true;
+        }
 
-    glUniformMatrix4fv(glGetUniformLocation(programID, "world"), 1, GL_FALSE, glm::value_ptr(world));
-    glUniformMatrix4fv(glGetUniformLocation(programID, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(programID, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        ObjectUniformData object = MakeObjectData(MeshWorld(instance, m), instance.untextured ? instance.color : glm::vec4(0, 0, 0, 1));
+        commands.UniformBlock(OBJECT_UNIFORM_BINDING, object);
+        if (streamed)
+            mesh.RecordStreamed(commands, *meshProgram, instance.streamedVertices[m]);
+        else
+            mesh.Record(commands, *meshProgram);
 
-    if(untextured)
-    {
-        glUniform4fv(glGetUniformLocation(programID, "defaultColor"), 1, glm::value_ptr(color));
+        if (!prepass)
+            continue;
+        if (depthProgram != depthBound)
+        {
+            depthCommands.BindProgram(depthProgram->id);
+            depthBound = depthProgram;
+        }
+        if (skinned && !depthBonesRecorded)
+        {
+            depthCommands.UniformBlock(BONE_UNIFORM_BINDING, instance.bones.data(), boneCount * sizeof(glm::mat4), MAX_BONES * sizeof(glm::mat4));
+            depthBonesRecorded = true;
+        }
+        depthCommands.UniformBlock(OBJECT_UNIFORM_BINDING, object);
+        mesh.RecordGeometry(depthCommands, streamed ? instance.streamedVertices[m] : -1);
     }
-    glUniform3fv(glGetUniformLocation(programID, "lightDirection"), 1, glm::value_ptr(lightDirection));
-    glUniform3fv(glGetUniformLocation(programID, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
 
-    model->Draw(programID);
-
-    glDisable(GL_BLEND);
+    if (measureOverdraw)
+    {
+        depthCommands.EndQuery(GL_SAMPLES_PASSED);
+        commands.EndQuery(GL_SAMPLES_PASSED);
+    }
+    if (prepass)
+    {
+        commands.DepthFunc(GL_LESS);
+        commands.DepthMask(true);
+    }
+    commands.Disable(GL_BLEND);
+    //back to GL's default for the passes after
+    if (overdrawView)
+        commands.BlendFunc(GL_ONE, GL_ZERO);
 }
 
-unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum format, int comp, float hScale, float xzScale, unsigned int& indexCount, unsigned int& heightmapID) {
-    int width, height, channels;
+unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum format, int comp, float hScale, float xzScale, unsigned int& indexCount, unsigned int& heightmapID, int& width, int& height, TerrainStrips& strips) {
+    int channels;
     //unsigned char* data = nullptr;
     if (heightmap != nullptr) {
         data = stbi_load(heightmap, &width, &height, &channels, comp);
@@ -282,57 +1797,289 @@ unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum f
         std::cout << "Heightmap Loaded! " << heightmapID << std::endl;
     }
 
+    auto buildStart = chrono::high_resolution_clock::now();
+
     int stride = 8;
-    float* vertices = new float[(width * height) * stride];
-    unsigned int* indices = new unsigned int[(width - 1) * (height - 1) * 6];
+    GLsizeiptr vertSize = (GLsizeiptr)(width * height) * stride * sizeof(float);
+    indexCount = ((width - 1) * (height - 1) * 6);
 
-    int vertexIndex = 0;
-    for (int i = 0; i < (width * height); i++) {
-        // TODO: calculate x/z values
-        int x = i % width;
-        int z = i / width;
+    unsigned int VAO, VBO, EBO;
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
 
-        float texHeight = (float)data[i * comp];
+    glBindVertexArray(VAO);
 
-        // TODO: set position
-        vertices[vertexIndex++] = x * xzScale;
-        vertices[vertexIndex++] = (texHeight / 255.0f) * hScale;
-        vertices[vertexIndex++] = z * xzScale;
+    // every core writes its rows straight into the mapped buffers
+    JobSystem& jobs = JobSystem::Get();
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    FillBuffer(GL_ARRAY_BUFFER, vertSize, [&](void* memory) {
+        float* vertices = (float*)memory;
+        jobs.ParallelFor(height, 16, [&](int begin, int end) {
+            for (int z = begin; z < end; z++)
+                WritePlaneRow(vertices + (size_t)z * width * stride, data, z, width, height, comp, hScale, xzScale);
+        });
+    });
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    FillBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexCount * sizeof(unsigned int), [&](void* memory) {
+        unsigned int* indices = (unsigned int*)memory;
+        jobs.ParallelFor(height - 1, 16, [&](int begin, int end) {
+            for (int z = begin; z < end; z++)
+                WritePlaneIndexRow(indices + (size_t)z * (width - 1) * 6, z, width);
+        });
+    });
 
-        // TODO: set normal
-        vertices[vertexIndex++] = 0;
-        vertices[vertexIndex++] = 1;
-        vertices[vertexIndex++] = 0;
+    double buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - buildStart).count();
 
-        // TODO: set uv
-        vertices[vertexIndex++] = x / (float)width;
-        vertices[vertexIndex++] = z / (float)height;
+    // vertex information!
+    // position
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, 0);
+    glEnableVertexAttribArray(0);
+    // normal
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 3));
+    glEnableVertexAttribArray(1);
+    // uv
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 6));
+    glEnableVertexAttribArray(2);
 
+    glBindVertexArray(0);
+
+    // same vertices, drawn as strips
+    vector<unsigned short> stripIndices;
+    GenerateStripIndices(width, height, stripIndices, strips);
+
+    glGenVertexArrays(1, &strips.VAO);
+    glGenBuffers(1, &strips.EBO);
+
+    glBindVertexArray(strips.VAO);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, strips.EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, stripIndices.size() * sizeof(unsigned short), stripIndices.data(), GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 3));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 6));
+    glEnableVertexAttribArray(2);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindVertexArray(0);
+
+    strips.listIndexBytes = indexCount * sizeof(unsigned int);
+    strips.stripIndexBytes = (unsigned int)(stripIndices.size() * sizeof(unsigned short));
+
+    // the list only lives in GL memory now, the rows are generated again for the count
+    VertexCacheCounter listCache(width * height);
+    vector<unsigned int> indexRow((width - 1) * 6);
+    for (int z = 0; z < height - 1; z++)
+    {
+        WritePlaneIndexRow(indexRow.data(), z, width);
+        listCache.Add<unsigned int>(indexRow.data(), (int)indexRow.size(), 0, 0xFFFFFFFF);
+    }
+    strips.listInvocations = listCache.invocations;
+
+    VertexCacheCounter stripCache(width * height);
+    for (size_t i = 0; i < strips.counts.size(); i++)
+    {
+        const unsigned short* first = &stripIndices[(size_t)strips.offsets[i] / sizeof(unsigned short)];
+        stripCache.Add<unsigned short>(first, strips.counts[i], strips.baseVertices[i], 0xFFFF);
+        stripCache.Flush();
+    }
+    strips.stripInvocations = stripCache.invocations;
+
+    //stbi_image_free(data);
+
+    std::cout << "Plane generated! " << VAO << " (" << buildMs << " ms on " << jobs.ThreadCount() << " threads)" << std::endl;
+    std::cout << "Terrain indices: list " << strips.listIndexBytes / 1024 << " KB, " << strips.listInvocations << " vertex shader runs; "
+        << "strips " << strips.stripIndexBytes / 1024 << " KB in " << strips.counts.size() << " draws, " << strips.stripInvocations << " vertex shader runs ("
+        << width * height << " vertices)" << std::endl;
+
+    return VAO;
+}
+
+// one row of GeneratePlane vertices: position, normal (0, 1, 0), uv.
+// 4 vertices at a time with SSE, the x/height and u columns are interleaved with the constant parts of the row.
+void WritePlaneRow(float* out, const unsigned char* data, int z, int width, int height, int comp, float hScale, float xzScale)
+{
+    const unsigned char* row = data + (size_t)z * width * comp;
+    float v = z / (float)height;
+
+    __m128 zPair = _mm_setr_ps(z * xzScale, 0.0f, z * xzScale, 0.0f);
+    __m128 normalPair = _mm_setr_ps(1.0f, 0.0f, 1.0f, 0.0f);
+    __m128 vs = _mm_set1_ps(v);
+    __m128 scale = _mm_set1_ps(xzScale);
+    __m128 widths = _mm_set1_ps((float)width);
+    __m128 hScales = _mm_set1_ps(hScale);
+    __m128 maxByte = _mm_set1_ps(255.0f);
+    __m128i firstChannel = _mm_set1_epi32(0xFF);
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128 xi = _mm_add_ps(_mm_set1_ps((float)x), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+
+        __m128 texHeights;
+        if (comp == 4)
+            texHeights = _mm_cvtepi32_ps(_mm_and_si128(_mm_loadu_si128((const __m128i*)(row + x * 4)), firstChannel));
+        else
+            texHeights = _mm_setr_ps(row[x * comp], row[(x + 1) * comp], row[(x + 2) * comp], row[(x + 3) * comp]);
+
+        // same operations as the scalar path so both halves of a row match the height field exactly
+        __m128 xs = _mm_mul_ps(xi, scale);
+        __m128 hs = _mm_mul_ps(_mm_div_ps(texHeights, maxByte), hScales);
+        __m128 us = _mm_div_ps(xi, widths);
+
+        __m128 xh01 = _mm_unpacklo_ps(xs, hs);
+        __m128 xh23 = _mm_unpackhi_ps(xs, hs);
+        __m128 uv01 = _mm_unpacklo_ps(us, vs);
+        __m128 uv23 = _mm_unpackhi_ps(us, vs);
+
+        float* vertex = out + x * 8;
+        _mm_storeu_ps(vertex + 0, _mm_movelh_ps(xh01, zPair));
+        _mm_storeu_ps(vertex + 4, _mm_movelh_ps(normalPair, uv01));
+        _mm_storeu_ps(vertex + 8, _mm_movehl_ps(zPair, xh01));
+        _mm_storeu_ps(vertex + 12, _mm_movehl_ps(uv01, normalPair));
+        _mm_storeu_ps(vertex + 16, _mm_movelh_ps(xh23, zPair));
+        _mm_storeu_ps(vertex + 20, _mm_movelh_ps(normalPair, uv23));
+        _mm_storeu_ps(vertex + 24, _mm_movehl_ps(zPair, xh23));
+        _mm_storeu_ps(vertex + 28, _mm_movehl_ps(uv23, normalPair));
+    }
+
+    for (; x < width; x++)
+    {
+        float* vertex = out + x * 8;
+        vertex[0] = x * xzScale;
+        vertex[1] = ((float)row[x * comp] / 255.0f) * hScale;
+        vertex[2] = z * xzScale;
+        vertex[3] = 0;
+        vertex[4] = 1;
+        vertex[5] = 0;
+        vertex[6] = x / (float)width;
+        vertex[7] = v;
+    }
+}
+
+// the two triangles of every quad in row z
+void WritePlaneIndexRow(unsigned int* out, int z, int width)
+{
+    for (int x = 0; x < width - 1; x++)
+    {
+        unsigned int vertex = z * width + x;
+
+        *out++ = vertex;
+        *out++ = vertex + width;
+        *out++ = vertex + width + 1;
+
+        *out++ = vertex;
+        *out++ = vertex + width + 1;
+        *out++ = vertex + 1;
+    }
+}
+
+// (re)allocates the buffer bound to target and lets fill write its contents. The buffer is mapped so the data goes
+// straight into driver memory, a staging copy is only used when it can't be mapped or the mapping got lost.
+void FillBuffer(GLenum target, GLsizeiptr size, const function<void(void*)>& fill)
+{
+    glBufferData(target, size, nullptr, GL_STATIC_DRAW);
+    void* memory = glMapBufferRange(target, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (memory)
+    {
+        fill(memory);
+        if (glUnmapBuffer(target) == GL_TRUE)
+            return;
+        std::cout << "ERROR::BUFFER::MAPPING_LOST" << std::endl;
+    }
+
+    vector<char> staging(size);
+    fill(staging.data());
+    glBufferData(target, size, staging.data(), GL_STATIC_DRAW);
+}
+
+// triangle strips over the GeneratePlane vertices. The plane is cut into bands of rows small enough for 16 bit indices,
+// every band is drawn with its own base vertex. Inside a band the strips are 14 quads wide and walk down row by row,
+// so the row a strip shares with the one before it is still in the post transform cache. The first row of a column
+// touches both of its vertex rows (30 vertices), wider columns would push those out of a 32 entry cache again.
+// every strip starts on a repeated vertex, which keeps the triangles in the same order and winding as the list.
+void GenerateStripIndices(int width, int height, vector<unsigned short>& indices, TerrainStrips& strips)
+{
+    const unsigned short restart = 0xFFFF;
+    const int stripWidth = 14;
+
+    strips.counts.clear();
+    strips.offsets.clear();
+    strips.baseVertices.clear();
+
+    // highest local index is (rows + 1) * width - 1, which has to stay below the restart index
+    int bandRows = glm::min(65535 / width - 1, height - 1);
+    if (bandRows < 1)
+    {
+        std::cout << "ERROR::TERRAIN::ROWS_TOO_WIDE_FOR_16_BIT_STRIPS" << std::endl;
+        return;
+    }
+
+    for (int z0 = 0; z0 < height - 1; z0 += bandRows)
+    {
+        int z1 = glm::min(z0 + bandRows, height - 1);
+        size_t first = indices.size();
+
+        for (int x0 = 0; x0 < width - 1; x0 += stripWidth)
+        {
+            int x1 = glm::min(x0 + stripWidth, width - 1);
+            for (int z = z0; z < z1; z++)
+            {
+                if (indices.size() > first)
+                    indices.push_back(restart);
+
+                int row = (z - z0) * width;
+                indices.push_back(row + width + x0);
+                for (int x = x0; x <= x1; x++)
+                {
+                    indices.push_back(row + width + x);
+                    indices.push_back(row + x);
+                }
+            }
+        }
+
+        strips.counts.push_back((GLsizei)(indices.size() - first));
+        strips.offsets.push_back((void*)(first * sizeof(unsigned short)));
+        strips.baseVertices.push_back(z0 * width);
     }
+}
+
+// a (patchSize + 1)^2 grid of corners, instanced over the terrain and displaced in terrainGridVertex.shader.
+// corners are stored as 2 shorts and indices as shorts, so the whole terrain needs a few kilobytes of vertex data.
+GLuint GenerateGridPatch(int patchSize, unsigned int& indexCount)
+{
+    int side = patchSize + 1;
+    unsigned short* vertices = new unsigned short[side * side * 2];
+    unsigned short* indices = new unsigned short[patchSize * patchSize * 6];
 
-    // OPTIONAL TODO: Calculate normal
-    // TODO: Set normal
+    int vertexIndex = 0;
+    for (int i = 0; i < side * side; i++) {
+        vertices[vertexIndex++] = i % side;
+        vertices[vertexIndex++] = i / side;
+    }
 
+    // same split as the indices in GeneratePlane
     vertexIndex = 0;
-    for (int i = 0; i < (width - 1) * (height - 1); i++) {
-        // TODO: calculate x/z values
-        int x = i % (width - 1);
-        int z = i / (width - 1);
+    for (int i = 0; i < patchSize * patchSize; i++) {
+        int x = i % patchSize;
+        int z = i / patchSize;
 
-        int vertex = z * width + x;
+        int vertex = z * side + x;
 
         indices[vertexIndex++] = vertex;
-        indices[vertexIndex++] = vertex + width;
-        indices[vertexIndex++] = vertex + width + 1;
-        
+        indices[vertexIndex++] = vertex + side;
+        indices[vertexIndex++] = vertex + side + 1;
+
         indices[vertexIndex++] = vertex;
-        indices[vertexIndex++] = vertex + width + 1;
+        indices[vertexIndex++] = vertex + side + 1;
         indices[vertexIndex++] = vertex + 1;
-
     }
 
-    unsigned int vertSize = (width * height) * stride * sizeof(float);
-    indexCount = ((width - 1) * (height - 1) * 6);
+    indexCount = patchSize * patchSize * 6;
 
     unsigned int VAO, VBO, EBO;
     glGenVertexArrays(1, &VAO);
@@ -342,35 +2089,164 @@ unsigned int GeneratePlane(const char* heightmap, unsigned char* &data, GLenum f
     glBindVertexArray(VAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertSize, vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, side * side * 2 * sizeof(unsigned short), vertices, GL_STATIC_DRAW);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned short), indices, GL_STATIC_DRAW);
 
-    // vertex information!
-    // position
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, 0);
+    // grid corner, converted to float by the vertex fetch
+    glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(unsigned short) * 2, 0);
     glEnableVertexAttribArray(0);
-    // normal
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 3));
-    glEnableVertexAttribArray(1);
-    // uv
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * stride, (void*)(sizeof(float) * 6));
-    glEnableVertexAttribArray(2);
 
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-
     glBindVertexArray(0);
 
     delete[] vertices;
     delete[] indices;
 
-    //stbi_image_free(data);
-
-    std::cout << "Plane generated! " << VAO << std::endl;
+    std::cout << "Grid patch generated! " << VAO << " (" << (side * side * 2 + indexCount) * sizeof(unsigned short) << " bytes)" << std::endl;
 
     return VAO;
 }
 
+// raises (or lowers with a negative amount) the terrain around center. Only the grid mode picks this up right away,
+// it is just a heightmap texture update, the full resolution mesh of GeneratePlane stays as it was.
+void EditTerrain(glm::vec3 center, float radius, float amount)
+{
+    int x0 = glm::max((int)((center.x - radius) / 5.0f), 0);
+    int z0 = glm::max((int)((center.z - radius) / 5.0f), 0);
+    int x1 = glm::min((int)((center.x + radius) / 5.0f) + 1, heightmapWidth - 1);
+    int z1 = glm::min((int)((center.z + radius) / 5.0f) + 1, heightmapHeight - 1);
+    if (x0 > x1 || z0 > z1)
+        return;
+
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            float distance = glm::length(glm::vec2(x * 5.0f - center.x, z * 5.0f - center.z));
+            float falloff = 1.0f - glm::smoothstep(0.0f, radius, distance);
+            unsigned char* texel = &heightmapData[(z * heightmapWidth + x) * 4];
+            int value = (int)(texel[0] + amount * falloff + 0.5f);
+            texel[0] = (unsigned char)glm::clamp(value, 0, 255);
+        }
+    }
+
+    // the render thread uploads just the edited rectangle
+    TerrainEdit edit = { x0, z0, x1 - x0 + 1, z1 - z0 + 1, {} };
+    for (int z = z0; z <= z1; z++)
+    {
+        const unsigned char* row = &heightmapData[(z * heightmapWidth + x0) * 4];
+        edit.texels.insert(edit.texels.end(), row, row + edit.width * 4);
+    }
+    pendingTerrainEdits.push_back(std::move(edit));
+
+    // keep the CPU queries in sync, the render thread gets a copy with the next packet
+    terrainHeightField = HeightField(heightmapData, heightmapWidth, heightmapHeight, 4, 250.0f, 5.0f);
+    terrainHeightsChanged = true;
+    terrainOccluderDirty = true;
+}
+
+void ApplyTerrainEdits(const RenderPacket& frame)
+{
+    if (!frame.terrainEdits.empty())
+    {
+        glBindTexture(GL_TEXTURE_2D, heightMapID);
+        for (const TerrainEdit& edit : frame.terrainEdits)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, edit.x, edit.z, edit.width, edit.height, GL_RGBA, GL_UNSIGNED_BYTE, edit.texels.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    if (frame.heightField)
+    {
+        // holding on to the snapshot keeps it alive after the packet is reused
+        renderHeightField = frame.heightField;
+        terrainClipmap->SetHeightField(renderHeightField.get());
+    }
+}
+
+// bakes the per texel weights of the 5 terrain layers (dirt, sand, grass, rock, snow) from height and slope.
+// RGBA holds the weights of the first 4 layers, snow gets what is left. Only the MAX_SPLAT_LAYERS strongest
+// layers are kept per texel so the fragment shader never has to fetch more than that.
+#define MAX_SPLAT_LAYERS 3
+GLuint GenerateSplatMap(unsigned char* data, int width, int height, int comp, float hScale, float xzScale)
+{
+    unsigned char* splat = new unsigned char[width * height * 4];
+
+    for (int i = 0; i < (width * height); i++) {
+        int x = i % width;
+        int z = i / width;
+
+        float y = (data[i * comp] / 255.0f) * hScale;
+
+        //same thresholds the height based shader uses
+        float dirtToSand = glm::clamp((y - 20) / 10, -1.0f, 1.0f) * .5f + .5f;
+        float sandToGrass = glm::clamp((y - 60) / 10, -1.0f, 1.0f) * .5f + .5f;
+        float grassToRock = glm::clamp((y - 120) / 10, -1.0f, 1.0f) * .5f + .5f;
+        float rockToSnow = glm::clamp((y - 160) / 10, -1.0f, 1.0f) * .5f + .5f;
+
+        //unroll the lerp chain into one weight per layer
+        float weights[5];
+        weights[4] = rockToSnow;
+        weights[3] = grassToRock * (1 - rockToSnow);
+        weights[2] = sandToGrass * (1 - grassToRock) * (1 - rockToSnow);
+        weights[1] = dirtToSand * (1 - sandToGrass) * (1 - grassToRock) * (1 - rockToSnow);
+        weights[0] = (1 - dirtToSand) * (1 - sandToGrass) * (1 - grassToRock) * (1 - rockToSnow);
+
+        //steep slopes turn into rock
+        int x0 = glm::max(x - 1, 0), x1 = glm::min(x + 1, width - 1);
+        int z0 = glm::max(z - 1, 0), z1 = glm::min(z + 1, height - 1);
+        float dx = (data[(z * width + x1) * comp] - data[(z * width + x0) * comp]) / 255.0f * hScale / ((x1 - x0) * xzScale);
+        float dz = (data[(z1 * width + x) * comp] - data[(z0 * width + x) * comp]) / 255.0f * hScale / ((z1 - z0) * xzScale);
+        float steepness = 1.0f - glm::normalize(glm::vec3(-dx, 1.0f, -dz)).y;
+        float slopeToRock = glm::smoothstep(0.3f, 0.5f, steepness);
+
+        for (int l = 0; l < 5; l++)
+            weights[l] *= 1.0f - slopeToRock;
+        weights[3] += slopeToRock;
+
+        //drop everything but the strongest layers
+        for (int l = 0; l < 5; l++) {
+            int stronger = 0;
+            for (int o = 0; o < 5; o++) {
+                if (weights[o] > weights[l] || (weights[o] == weights[l] && o < l)) stronger++;
+            }
+            if (stronger >= MAX_SPLAT_LAYERS) weights[l] = 0;
+        }
+
+        float total = 0;
+        for (int l = 0; l < 5; l++) total += weights[l];
+
+        //quantize the first 4, the shader derives snow as 1 - sum so it has to stay <= 255
+        int sum = 0;
+        for (int l = 0; l < 4; l++) {
+            int w = (int)(weights[l] / total * 255.0f + 0.5f);
+            w = glm::min(w, 255 - sum);
+            splat[i * 4 + l] = (unsigned char)w;
+            sum += w;
+        }
+    }
+
+    GLuint splatID;
+    glGenTextures(1, &splatID);
+    glBindTexture(GL_TEXTURE_2D, splatID);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, splat);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    delete[] splat;
+
+    std::cout << "Splat map generated! " << splatID << std::endl;
+
+    return splatID;
+}
+
 void ProcessInput(GLFWwindow* window)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -380,30 +2256,34 @@ void ProcessInput(GLFWwindow* window)
 
     if(keys[GLFW_KEY_W])
     {
-        cameraPosition += camQuat * glm::vec3(0, 0, 1) * 0.2f;
+        camPosition += camQuat * glm::vec3(0, 0, 1) * 0.2f;
         camChanged = true;
     }
     if (keys[GLFW_KEY_A])
     {
-        cameraPosition += camQuat * glm::vec3(1, 0, 0) * 0.2f;
+        camPosition += camQuat * glm::vec3(1, 0, 0) * 0.2f;
         camChanged = true;
     }
     if (keys[GLFW_KEY_S])
     {
-        cameraPosition += camQuat * glm::vec3(0, 0, -1 * 0.2f);
+        camPosition += camQuat * glm::vec3(0, 0, -1 * 0.2f);
         camChanged = true;
     }
     if (keys[GLFW_KEY_D])
     {
-        cameraPosition += camQuat * glm::vec3(-1, 0, 0) * 0.2f;
+        camPosition += camQuat * glm::vec3(-1, 0, 0) * 0.2f;
         camChanged = true;
     }
 
     if(camChanged)
     {
+        //keep the camera above the ground
+        float groundHeight = terrainHeightField.GetHeight(camPosition.x, camPosition.z) + 2.0f;
+        camPosition.y = glm::max(camPosition.y, groundHeight);
+
         glm::vec3 camForward = camQuat * glm::vec3(0, 0, 1);
         glm::vec3 camUp = camQuat * glm::vec3(0, 1, 0);
-        view = glm::lookAt(cameraPosition, cameraPosition + camForward, camUp);
+        camView = glm::lookAt(camPosition, camPosition + camForward, camUp);
     }
 }
 
@@ -536,7 +2416,10 @@ void CreateGeometry(GLuint &VAO, GLuint &EBO, int &size, int &numIndices)
 
 void CreateShaders()
 {
-    CreateProgram(simpleProgram, "shaders/Vertex.shader", "shaders/Fragment.shader");
+    //the point lights of the fragment's cluster and the sun's shadow, for every forward program
+    const vector<const char*> forwardPreludes = { "shaders/clusteredLights.shader", "shaders/shadows.shader" };
+
+    CreateProgram(simpleProgram, "shaders/Vertex.shader", "shaders/Fragment.shader", forwardPreludes);
 
     //Set texture channels
     glUseProgram(simpleProgram);
@@ -545,7 +2428,7 @@ void CreateShaders()
     glUniform1i(glGetUniformLocation(simpleProgram, "gradientTex"), 2);
 
     CreateProgram(skyBoxProgram, "shaders/skyboxVertex.shader", "shaders/skyboxFragment.shader");
-    CreateProgram(terrainProgram, "shaders/terrainVertex.shader", "shaders/terrainFragment.shader");
+    CreateProgram(terrainProgram, "shaders/terrainVertex.shader", "shaders/terrainFragment.shader", forwardPreludes);
 
     glUseProgram(terrainProgram);
     glUniform1i(glGetUniformLocation(terrainProgram, "mainTex"), 0);
@@ -557,7 +2440,36 @@ void CreateShaders()
     glUniform1i(glGetUniformLocation(terrainProgram, "rock"), 5);
     glUniform1i(glGetUniformLocation(terrainProgram, "snow"), 6);
 
-    CreateProgram(modelProgram, "shaders/modelVertex.shader", "shaders/modelFragment.shader");
+    CreateProgram(terrainSplatProgram, "shaders/terrainVertex.shader", "shaders/terrainSplatFragment.shader", forwardPreludes);
+
+    glUseProgram(terrainSplatProgram);
+    glUniform1i(glGetUniformLocation(terrainSplatProgram, "mainTex"), 0);
+    glUniform1i(glGetUniformLocation(terrainSplatProgram, "normalTex"), 1);
+    glUniform1i(glGetUniformLocation(terrainSplatProgram, "layers"), 2);
+    glUniform1i(glGetUniformLocation(terrainSplatProgram, "splatTex"), 3);
+
+    CreateProgram(terrainGridProgram, "shaders/terrainGridVertex.shader", "shaders/terrainSplatFragment.shader", forwardPreludes);
+
+    glUseProgram(terrainGridProgram);
+    glUniform1i(glGetUniformLocation(terrainGridProgram, "mainTex"), 0);
+    glUniform1i(glGetUniformLocation(terrainGridProgram, "normalTex"), 1);
+    glUniform1i(glGetUniformLocation(terrainGridProgram, "layers"), 2);
+    glUniform1i(glGetUniformLocation(terrainGridProgram, "splatTex"), 3);
+    glUniform1f(glGetUniformLocation(terrainGridProgram, "hScale"), 250.0f);
+    glUniform1f(glGetUniformLocation(terrainGridProgram, "xzScale"), 5.0f);
+
+    CreateProgram(terrainStreamProgram, "shaders/terrainVertex.shader", "shaders/terrainStreamFragment.shader", forwardPreludes);
+
+    glUseProgram(terrainStreamProgram);
+    glUniform1i(glGetUniformLocation(terrainStreamProgram, "layers"), 2);
+
+    CreateProgram(terrainClipmapProgram, "shaders/clipmapVertex.shader", "shaders/terrainStreamFragment.shader", forwardPreludes);
+
+    glUseProgram(terrainClipmapProgram);
+    glUniform1i(glGetUniformLocation(terrainClipmapProgram, "clipmap"), 0);
+    glUniform1i(glGetUniformLocation(terrainClipmapProgram, "layers"), 2);
+
+    CreateProgram(modelProgram, "shaders/modelVertex.shader", "shaders/modelFragment.shader", forwardPreludes);
 
     glUseProgram(modelProgram);
 
@@ -567,18 +2479,208 @@ void CreateShaders()
     glUniform1i(glGetUniformLocation(modelProgram, "texture_roughness1"), 3);
     glUniform1i(glGetUniformLocation(modelProgram, "texture_ao1"), 4);
 
-    CreateProgram(untexturedModelProgram, "shaders/modelVertex.shader", "shaders/modelUntexturedFragment.shader");
+    CreateProgram(untexturedModelProgram, "shaders/modelVertex.shader", "shaders/modelUntexturedFragment.shader", forwardPreludes);
 
     glUseProgram(untexturedModelProgram);   
+
+    //same fragment shaders, the vertices are moved by the bones of the instance
+    CreateProgram(skinnedModelProgram, "shaders/skinnedModelVertex.shader", "shaders/modelFragment.shader", forwardPreludes);
+
+    glUseProgram(skinnedModelProgram);
+
+    glUniform1i(glGetUniformLocation(skinnedModelProgram, "texture_diffuse1"), 0);
+    glUniform1i(glGetUniformLocation(skinnedModelProgram, "texture_specular1"), 1);
+    glUniform1i(glGetUniformLocation(skinnedModelProgram, "texture_normal1"), 2);
+    glUniform1i(glGetUniformLocation(skinnedModelProgram, "texture_roughness1"), 3);
+    glUniform1i(glGetUniformLocation(skinnedModelProgram, "texture_ao1"), 4);
+
+    CreateProgram(skinnedUntexturedModelProgram, "shaders/skinnedModelVertex.shader", "shaders/modelUntexturedFragment.shader", forwardPreludes);
+
+    modelUniforms = ProgramUniforms(modelProgram);
+    untexturedModelUniforms = ProgramUniforms(untexturedModelProgram);
+    skinnedModelUniforms = ProgramUniforms(skinnedModelProgram);
+    skinnedUntexturedModelUniforms = ProgramUniforms(skinnedUntexturedModelProgram);
+
+    GLuint modelPrograms[] = { modelProgram, untexturedModelProgram, skinnedModelProgram, skinnedUntexturedModelProgram };
+    for (GLuint program : modelPrograms)
+    {
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FrameData"), FRAME_UNIFORM_BINDING);
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "ObjectData"), OBJECT_UNIFORM_BINDING);
+    }
+    glUniformBlockBinding(skinnedModelProgram, glGetUniformBlockIndex(skinnedModelProgram, "Bones"), BONE_UNIFORM_BINDING);
+    glUniformBlockBinding(skinnedUntexturedModelProgram, glGetUniformBlockIndex(skinnedUntexturedModelProgram, "Bones"), BONE_UNIFORM_BINDING);
+
+    //the forward programs read the point lights of their cluster from the units of ClusterBuffers
+    for (GLuint program : { simpleProgram, terrainProgram, terrainSplatProgram, terrainGridProgram, terrainStreamProgram, terrainClipmapProgram,
+                            modelProgram, untexturedModelProgram, skinnedModelProgram, skinnedUntexturedModelProgram })
+    {
+        glUseProgram(program);
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "ClusterData"), CLUSTER_UNIFORM_BINDING);
+        glUniform1i(glGetUniformLocation(program, "clusterRanges"), ClusterBuffers::RANGE_UNIT);
+        glUniform1i(glGetUniformLocation(program, "clusterIndices"), ClusterBuffers::INDEX_UNIT);
+        glUniform1i(glGetUniformLocation(program, "pointLights"), ClusterBuffers::LIGHT_UNIT);
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "ShadowData"), SHADOW_UNIFORM_BINDING);
+        glUniform1i(glGetUniformLocation(program, "shadowMap"), ShadowMaps::UNIT);
+    }
+
+    //depth only versions, the height and clipmap textures stay on unit 0 which is the sampler default
+    CreateDepthProgram(simpleProgram, "shaders/Vertex.shader");
+    CreateDepthProgram(terrainProgram, "shaders/terrainVertex.shader");
+    CreateDepthProgram(terrainSplatProgram, "shaders/terrainVertex.shader");
+    CreateDepthProgram(terrainStreamProgram, "shaders/terrainVertex.shader");
+    CreateDepthProgram(terrainClipmapProgram, "shaders/clipmapVertex.shader");
+    GLuint depthGridProgram = CreateDepthProgram(terrainGridProgram, "shaders/terrainGridVertex.shader");
+
+    glUseProgram(depthGridProgram);
+    glUniform1f(glGetUniformLocation(depthGridProgram, "hScale"), 250.0f);
+    glUniform1f(glGetUniformLocation(depthGridProgram, "xzScale"), 5.0f);
+
+    depthModelUniforms = ProgramUniforms(CreateDepthProgram(modelProgram, "shaders/modelVertex.shader"));
+    depthSkinnedModelUniforms = ProgramUniforms(CreateDepthProgram(skinnedModelProgram, "shaders/skinnedModelVertex.shader"));
+    depthPrograms[untexturedModelProgram] = depthModelUniforms.id;
+    depthPrograms[skinnedUntexturedModelProgram] = depthSkinnedModelUniforms.id;
+
+    for (GLuint program : { depthModelUniforms.id, depthSkinnedModelUniforms.id })
+    {
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FrameData"), FRAME_UNIFORM_BINDING);
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "ObjectData"), OBJECT_UNIFORM_BINDING);
+    }
+    glUniformBlockBinding(depthSkinnedModelUniforms.id, glGetUniformBlockIndex(depthSkinnedModelUniforms.id, "Bones"), BONE_UNIFORM_BINDING);
+
+    //G-buffer versions: the forward fragment shaders with gbuffer.shader in front, same samplers as the forward program
+    CreateGBufferProgram(simpleProgram, "shaders/Vertex.shader", "shaders/Fragment.shader");
+    CreateGBufferProgram(terrainProgram, "shaders/terrainVertex.shader", "shaders/terrainFragment.shader");
+    CreateGBufferProgram(terrainSplatProgram, "shaders/terrainVertex.shader", "shaders/terrainSplatFragment.shader");
+    CreateGBufferProgram(terrainGridProgram, "shaders/terrainGridVertex.shader", "shaders/terrainSplatFragment.shader");
+    CreateGBufferProgram(terrainStreamProgram, "shaders/terrainVertex.shader", "shaders/terrainStreamFragment.shader");
+    CreateGBufferProgram(terrainClipmapProgram, "shaders/clipmapVertex.shader", "shaders/terrainStreamFragment.shader");
+
+    gbufferModelUniforms[modelProgram] = ProgramUniforms(CreateGBufferProgram(modelProgram, "shaders/modelVertex.shader", "shaders/modelFragment.shader"));
+    gbufferModelUniforms[untexturedModelProgram] = ProgramUniforms(CreateGBufferProgram(untexturedModelProgram, "shaders/modelVertex.shader", "shaders/modelUntexturedFragment.shader"));
+    gbufferModelUniforms[skinnedModelProgram] = ProgramUniforms(CreateGBufferProgram(skinnedModelProgram, "shaders/skinnedModelVertex.shader", "shaders/modelFragment.shader"));
+    gbufferModelUniforms[skinnedUntexturedModelProgram] = ProgramUniforms(CreateGBufferProgram(skinnedUntexturedModelProgram, "shaders/skinnedModelVertex.shader", "shaders/modelUntexturedFragment.shader"));
+    for (const auto& model : gbufferModelUniforms)
+    {
+        GLuint program = model.second.id;
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FrameData"), FRAME_UNIFORM_BINDING);
+        glUniformBlockBinding(program, glGetUniformBlockIndex(program, "ObjectData"), OBJECT_UNIFORM_BINDING);
+        GLuint bones = glGetUniformBlockIndex(program, "Bones");
+        if (bones != GL_INVALID_INDEX)
+            glUniformBlockBinding(program, bones, BONE_UNIFORM_BINDING);
+    }
+
+    //deferred lighting, the G-buffer targets are on the units of GBuffer::Unit
+    CreateProgram(deferredLightProgram, "shaders/fullscreenVertex.shader", "shaders/deferredLightFragment.shader", { "shaders/shadows.shader" });
+    CreateProgram(pointLightProgram, "shaders/pointLightVertex.shader", "shaders/pointLightFragment.shader");
+    CreateProgram(deferredFogProgram, "shaders/fullscreenVertex.shader", "shaders/deferredFogFragment.shader");
+    for (GLuint program : { deferredLightProgram, pointLightProgram, deferredFogProgram })
+    {
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "gAlbedo"), GBuffer::ALBEDO_UNIT);
+        glUniform1i(glGetUniformLocation(program, "gNormal"), GBuffer::NORMAL_UNIT);
+        glUniform1i(glGetUniformLocation(program, "gMaterial"), GBuffer::MATERIAL_UNIT);
+        glUniform1i(glGetUniformLocation(program, "gDepth"), GBuffer::DEPTH_UNIT);
+        glUniform1i(glGetUniformLocation(program, "lightTex"), GBuffer::LIGHT_UNIT);
+    }
+    glUseProgram(deferredLightProgram);
+    glUniformBlockBinding(deferredLightProgram, glGetUniformBlockIndex(deferredLightProgram, "ShadowData"), SHADOW_UNIFORM_BINDING);
+    glUniform1i(glGetUniformLocation(deferredLightProgram, "shadowMap"), ShadowMaps::UNIT);
+
+    //the depth reduction of the occlusion culling reads the level before it from unit 0
+    CreateProgram(hizReduceProgram, "shaders/fullscreenVertex.shader", "shaders/hizReduceFragment.shader");
+    glUseProgram(hizReduceProgram);
+    glUniform1i(glGetUniformLocation(hizReduceProgram, "source"), 0);
+
+    //post chain, PostProcess::Create() sets the rest of their uniforms
+    CreateProgram(postPrograms.downsample, "shaders/fullscreenVertex.shader", "shaders/bloomDownsampleFragment.shader");
+    CreateProgram(postPrograms.upsample, "shaders/fullscreenVertex.shader", "shaders/bloomUpsampleFragment.shader");
+    CreateProgram(postPrograms.histogram, "shaders/luminanceHistogramVertex.shader", "shaders/luminanceHistogramFragment.shader");
+    CreateProgram(postPrograms.exposure, "shaders/fullscreenVertex.shader", "shaders/exposureFragment.shader");
+    CreateProgram(postPrograms.tonemap, "shaders/fullscreenVertex.shader", "shaders/tonemapFragment.shader");
+    CreateProgram(postPrograms.upscale, "shaders/fullscreenVertex.shader", "shaders/upscaleFragment.shader");
+    for (GLuint program : { postPrograms.downsample, postPrograms.upsample, postPrograms.histogram, postPrograms.upscale })
+    {
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "source"), 0);
+    }
+}
+
+// G-buffer variant of program, PassProgram() swaps it in
+GLuint CreateGBufferProgram(GLuint program, const char* vertex, const char* fragment)
+{
+    GLuint gbufferProgram;
+    CreateProgram(gbufferProgram, vertex, fragment, { "shaders/gbuffer.shader" });
+    CopyProgramUniforms(program, gbufferProgram);
+    gbufferPrograms[program] = gbufferProgram;
+    return gbufferProgram;
+}
+
+// sets the sampler units, ints and floats of a variant of a program to what they are in the original. Vectors and
+// matrices, which the render functions set every draw, and block members (location -1) are left alone
+void CopyProgramUniforms(GLuint from, GLuint to)
+{
+    GLint count = 0;
+    glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &count);
+    glUseProgram(to);
+    for (GLint i = 0; i < count; i++)
+    {
+        char name[256];
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(from, i, sizeof(name), nullptr, &size, &type, name);
+        GLint source = glGetUniformLocation(from, name), target = glGetUniformLocation(to, name);
+        if (source < 0 || target < 0)
+            continue;
+
+        if (type == GL_FLOAT)
+        {
+            GLfloat value;
+            glGetUniformfv(from, source, &value);
+            glUniform1f(target, value);
+        }
+        else if (type == GL_INT || type == GL_SAMPLER_2D || type == GL_SAMPLER_2D_ARRAY)
+        {
+            GLint value;
+            glGetUniformiv(from, source, &value);
+            glUniform1i(target, value);
+        }
+    }
+}
+
+// program with the vertex shader of program and the trivial depthFragment, PassProgram() swaps it in
+GLuint CreateDepthProgram(GLuint program, const char* vertex)
+{
+    GLuint depthProgram;
+    CreateProgram(depthProgram, vertex, "shaders/depthFragment.shader");
+    depthPrograms[program] = depthProgram;
+    return depthProgram;
 }
 
-void CreateProgram(GLuint& programID, const char* vertex, const char* fragment)
+void CreateProgram(GLuint& programID, const char* vertex, const char* fragment, const vector<const char*>& fragmentPreludes)
 {
     char* vertexSrc;
     char* fragmentSrc;
     
     LoadFile(vertex, vertexSrc);
     LoadFile(fragment, fragmentSrc);
+
+    //the preludes go right after the #version line of the fragment shader, in order
+    if (!fragmentPreludes.empty() && fragmentSrc)
+    {
+        string preludes;
+        for (const char* fragmentPrelude : fragmentPreludes)
+        {
+            char* preludeSrc;
+            LoadFile(fragmentPrelude, preludeSrc);
+            preludes += string(preludeSrc ? preludeSrc : "") + "\n";
+            delete[] preludeSrc;
+        }
+        string source(fragmentSrc);
+        source.insert(source.find('\n') + 1, preludes);
+        delete[] fragmentSrc;
+        fragmentSrc = new char[source.size() + 1];
+        memcpy(fragmentSrc, source.c_str(), source.size() + 1);
+    }
     
     GLuint vertexShaderID, fragmentShaderID;
     //GLuint programID;
@@ -685,6 +2787,86 @@ GLuint loadTexture(const char* path, int comp)
     return textureID;
 }
 
+// loads every image into one layer of a GL_TEXTURE_2D_ARRAY, layers have to share a size so each image is resized to size x size
+GLuint loadTextureArray(const char** paths, int count, int size)
+{
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size, size, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+    //decoding and resizing is done on jobs, one image each, the uploads stay here
+    vector<unsigned char*> decoded(count), resized(count);
+    JobSystem::Get().ParallelFor(count, 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++)
+        {
+            int width, height, numChannels;
+            decoded[i] = stbi_load(paths[i], &width, &height, &numChannels, 4);
+            resized[i] = nullptr;
+            if (decoded[i] && (width != size || height != size))
+                resized[i] = ResizeImage(decoded[i], width, height, 4, size, size);
+        }
+    });
+
+    for (int i = 0; i < count; i++)
+    {
+        if (decoded[i])
+        {
+            unsigned char* data = resized[i] ? resized[i] : decoded[i];
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        }
+        else
+        {
+            std::cout << "Error loading texture: " << paths[i] << std::endl;
+        }
+
+        delete[] resized[i];
+        stbi_image_free(decoded[i]);
+    }
+
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return textureID;
+}
+
+// bilinear resample, caller owns the returned buffer
+unsigned char* ResizeImage(const unsigned char* src, int width, int height, int comp, int newWidth, int newHeight)
+{
+    unsigned char* dst = new unsigned char[newWidth * newHeight * comp];
+
+    for (int y = 0; y < newHeight; y++)
+    {
+        float sy = glm::clamp((y + 0.5f) * height / (float)newHeight - 0.5f, 0.0f, height - 1.0f);
+        int y0 = (int)sy;
+        int y1 = glm::min(y0 + 1, height - 1);
+        float ty = sy - y0;
+
+        for (int x = 0; x < newWidth; x++)
+        {
+            float sx = glm::clamp((x + 0.5f) * width / (float)newWidth - 0.5f, 0.0f, width - 1.0f);
+            int x0 = (int)sx;
+            int x1 = glm::min(x0 + 1, width - 1);
+            float tx = sx - x0;
+
+            for (int c = 0; c < comp; c++)
+            {
+                float top = src[(y0 * width + x0) * comp + c] * (1 - tx) + src[(y0 * width + x1) * comp + c] * tx;
+                float bottom = src[(y1 * width + x0) * comp + c] * (1 - tx) + src[(y1 * width + x1) * comp + c] * tx;
+                dst[(y * newWidth + x) * comp + c] = (unsigned char)(top * (1 - ty) + bottom * ty + 0.5f);
+            }
+        }
+    }
+
+    return dst;
+}
+
 void RenderBox(glm::mat4 &view, glm::mat4 &projection, int triangleIndexCount, glm::vec3 pos, glm::vec3 rot, glm::vec3 scale)
 {
    /* glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
@@ -700,14 +2882,15 @@ void RenderBox(glm::mat4 &view, glm::mat4 &projection, int triangleIndexCount, g
     world = world * glm::toMat4(glm::quat(rot));
     world = glm::scale(world, scale);
 
-    glUseProgram(simpleProgram);
+    GLuint program = PassProgram(simpleProgram);
+    glUseProgram(program);
 
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "world"), 1, GL_FALSE, glm::value_ptr(world));
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(simpleProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(glGetUniformLocation(program, "world"), 1, GL_FALSE, glm::value_ptr(world));
+    glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
-    glUniform3fv(glGetUniformLocation(simpleProgram, "lightDirection"), 1, glm::value_ptr(lightDirection));
-    glUniform3fv(glGetUniformLocation(simpleProgram, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+    glUniform3fv(glGetUniformLocation(program, "lightDirection"), 1, glm::value_ptr(lightDirection));
+    glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, boxTex);
@@ -760,7 +2943,7 @@ void Mouse_Callback(GLFWwindow* window, double xpos, double ypos)
 
     glm::vec3 camForward = camQuat * glm::vec3(0, 0, 1);
     glm::vec3 camUp = camQuat * glm::vec3(0, 1, 0);
-    view = glm::lookAt(cameraPosition, cameraPosition + camForward, camUp);
+    camView = glm::lookAt(camPosition, camPosition + camForward, camUp);
 }
 void Key_Callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
@@ -768,10 +2951,738 @@ void Key_Callback(GLFWwindow* window, int key, int scancode, int action, int mod
     {
         //store key is pressed
         keys[key] = true;
+
+        //toggles
+        if (key == GLFW_KEY_T)
+        {
+            terrainOptions.splat = !terrainOptions.splat;
+            std::cout << "Terrain material: " << (terrainOptions.splat ? "splat map" : "height lerp") << std::endl;
+        }
+        if (key == GLFW_KEY_B)
+        {
+            runTerrainBenchmark = true;
+        }
+        if (key == GLFW_KEY_H)
+        {
+            runHeightFieldBenchmark = true;
+        }
+        if (key == GLFW_KEY_J)
+        {
+            runJobBenchmark = true;
+        }
+        if (key == GLFW_KEY_K)
+        {
+            runTransformBenchmark = true;
+        }
+        if (key == GLFW_KEY_L)
+        {
+            useCpuSkinning = !useCpuSkinning;
+            std::cout << (useCpuSkinning ? "CPU skinning" : "GPU skinning") << std::endl;
+        }
+        if (key == GLFW_KEY_N)
+        {
+            runSkinningBenchmark = true;
+        }
+        if (key == GLFW_KEY_O)
+        {
+            runVertexBenchmark = true;
+        }
+        if (key == GLFW_KEY_U)
+        {
+            depthPrepassMode = (DepthPrepassMode)((depthPrepassMode + 1) % 3);
+            const char* modes[] = { "off", "per object from measured overdraw", "every object" };
+            std::cout << "Depth pre-pass: " << modes[depthPrepassMode] << std::endl;
+        }
+        if (key == GLFW_KEY_R)
+        {
+            deferredShading = !deferredShading;
+            std::cout << "Renderer: " << (deferredShading ? "deferred" : "forward") << std::endl;
+        }
+        if (key == GLFW_KEY_Q)
+        {
+            //shift toggles the report instead
+            if (mods & GLFW_MOD_SHIFT)
+            {
+                occlusionReport = !occlusionReport;
+                std::cout << "Occlusion report: " << (occlusionReport ? "on" : "off") << std::endl;
+            }
+            else
+            {
+                occlusionMode = (OcclusionMode)((occlusionMode + 1) % 3);
+                const char* modes[] = { "off", "Hi-Z of the frames before", "CPU raster of the occluders" };
+                std::cout << "Occlusion culling: " << modes[occlusionMode] << std::endl;
+            }
+        }
+        if (key == GLFW_KEY_Y)
+        {
+            //shift toggles the auto exposure instead
+            if (mods & GLFW_MOD_SHIFT)
+            {
+                autoExposure = !autoExposure;
+                std::cout << "Auto exposure: " << (autoExposure ? "on" : "off") << std::endl;
+            }
+            else
+            {
+                bloom = !bloom;
+                std::cout << "Bloom: " << (bloom ? "on" : "off") << std::endl;
+            }
+        }
+        if (key == GLFW_KEY_Z)
+        {
+            //shift goes to the next frame budget instead
+            if (mods & GLFW_MOD_SHIFT)
+            {
+                frameBudget = (frameBudget + 1) % (int)(sizeof(FRAME_BUDGETS_MS) / sizeof(FRAME_BUDGETS_MS[0]));
+                std::cout << "Frame budget: " << FRAME_BUDGETS_MS[frameBudget] << " ms" << std::endl;
+            }
+            else
+            {
+                dynamicResolutionEnabled = !dynamicResolutionEnabled;
+                std::cout << "Dynamic resolution: " << (dynamicResolutionEnabled ? "on" : "off") << std::endl;
+            }
+        }
+        if (key == GLFW_KEY_M)
+        {
+            shadowReport = !shadowReport;
+            std::cout << "Shadow report: " << (shadowReport ? "on" : "off") << std::endl;
+        }
+        if (key == GLFW_KEY_X)
+        {
+            clusterView = !clusterView;
+            std::cout << "Lights per cluster view: " << (clusterView ? "on" : "off") << std::endl;
+        }
+        if (key == GLFW_KEY_V)
+        {
+            overdrawView = !overdrawView;
+            overdrawMonitor.SetReport(overdrawView);
+            std::cout << "Overdraw view: " << (overdrawView ? "on" : "off") << std::endl;
+        }
+        if (key == GLFW_KEY_P)
+        {
+            terrainOptions.grid = !terrainOptions.grid;
+            std::cout << "Terrain mesh: " << (terrainOptions.grid ? "instanced grid patch" : "full resolution") << std::endl;
+        }
+        if (key == GLFW_KEY_E)
+        {
+            //raise the ground in front of the camera, hold shift to lower it
+            glm::vec3 target = camPosition + camQuat * glm::vec3(0, 0, 1) * 100.0f;
+            EditTerrain(target, 60.0f, (mods & GLFW_MOD_SHIFT) ? -10.0f : 10.0f);
+        }
+        if (key == GLFW_KEY_G && terrainStreamer)
+        {
+            terrainOptions.streamed = !terrainOptions.streamed;
+            std::cout << "Terrain: " << (terrainOptions.streamed ? "streamed tiles" : "single heightmap") << std::endl;
+        }
+        if (key == GLFW_KEY_I)
+        {
+            terrainOptions.strips = !terrainOptions.strips;
+            std::cout << "Terrain indices: " << (terrainOptions.strips ? "16 bit strips" : "32 bit list") << std::endl;
+        }
+        if (key == GLFW_KEY_C)
+        {
+            terrainOptions.clipmap = !terrainOptions.clipmap;
+            std::cout << "Terrain: " << (terrainOptions.clipmap ? "geometry clipmap" : "single heightmap") << std::endl;
+        }
     }
     else if(action == GLFW_RELEASE)
     {
         //store key is released
         keys[key] = false;
     }
-}
\ No newline at end of file
+}
+
+// renders the terrain from a fixed set of camera views with both materials and prints the GPU time of the terrain pass
+void RunTerrainBenchmark(GLFWwindow* window)
+{
+    const int warmupFrames = 10;
+    const int measuredFrames = 100;
+
+    glm::vec3 views[][2] = {
+        // position                         // look at
+        { glm::vec3(100, 125, 100),         glm::vec3(1262, 0, 1262) },
+        { glm::vec3(1262, 600, 1262),       glm::vec3(1263, 0, 1262) },
+        { glm::vec3(1262, 150, -200),       glm::vec3(1262, 100, 1262) },
+        { glm::vec3(2400, 250, 2400),       glm::vec3(0, 0, 0) },
+    };
+    int viewCount = sizeof(views) / sizeof(views[0]);
+
+    glm::vec3 savedPosition = cameraPosition;
+    glm::mat4 savedView = view;
+    bool savedMaterial = useSplatTerrain;
+    bool savedStrips = useStripTerrain;
+
+    std::cout << "Terrain benchmark (GPU ms per frame, terrain pass only)" << std::endl;
+    for (int v = 0; v < viewCount; v++)
+    {
+        cameraPosition = views[v][0];
+        view = glm::lookAt(views[v][0], views[v][1], glm::vec3(0, 1, 0));
+
+        //height lerp, splat map, splat map drawn with strips
+        double result[3];
+        for (int mode = 0; mode < 3; mode++)
+        {
+            useSplatTerrain = mode >= 1;
+            useStripTerrain = mode == 2;
+
+            for (int frame = 0; frame < warmupFrames + measuredFrames; frame++)
+            {
+                if (frame == warmupFrames)
+                    terrainTimer.Reset();
+
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                RenderSkyBox();
+                terrainTimer.Begin();
+                RenderTerrain();
+                terrainTimer.End();
+
+                glfwSwapBuffers(window);
+                terrainTimer.Collect();
+            }
+            terrainTimer.Finish();
+
+            result[mode] = terrainTimer.AverageMs();
+        }
+
+        std::cout << "view " << v << ": height lerp " << result[0] << " ms, splat map " << result[1] << " ms, splat map + strips " << result[2] << " ms" << std::endl;
+    }
+    std::cout << "indices: list " << terrainStrips.listIndexBytes / 1024 << " KB, strips " << terrainStrips.stripIndexBytes / 1024 << " KB; "
+        << "vertex shader runs: list " << terrainStrips.listInvocations << ", strips " << terrainStrips.stripInvocations << std::endl;
+
+    cameraPosition = savedPosition;
+    view = savedView;
+    useSplatTerrain = savedMaterial;
+    useStripTerrain = savedStrips;
+    terrainTimer.Reset();
+}
+
+// times batched height, normal and ray queries against the terrain height field
+void RunHeightFieldBenchmark()
+{
+    const int queryCount = 4000000;
+    const int rayCount = 200000;
+
+    float sizeX = (terrainHeightField.width - 1) * terrainHeightField.xzScale;
+    float sizeZ = (terrainHeightField.height - 1) * terrainHeightField.xzScale;
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::vector<glm::vec2> positions(queryCount);
+    for (int i = 0; i < queryCount; i++)
+        positions[i] = glm::vec2(unit(random) * sizeX, unit(random) * sizeZ);
+
+    //half straight down (ground clamping), half at a shallow angle (picking, line of sight)
+    std::vector<glm::vec3> origins(rayCount), directions(rayCount);
+    for (int i = 0; i < rayCount; i++)
+    {
+        origins[i] = glm::vec3(unit(random) * sizeX, 300.0f, unit(random) * sizeZ);
+        if (i % 2 == 0)
+            directions[i] = glm::vec3(0, -1, 0);
+        else
+            directions[i] = glm::vec3(unit(random) - 0.5f, -0.1f, unit(random) - 0.5f);
+    }
+
+    std::vector<float> heights(queryCount);
+    std::vector<glm::vec3> normals(queryCount);
+    std::vector<HeightFieldHit> hits(rayCount);
+    bool* hitResults = new bool[rayCount];
+
+    auto start = std::chrono::high_resolution_clock::now();
+    terrainHeightField.GetHeights(positions.data(), heights.data(), queryCount);
+    auto heightsDone = std::chrono::high_resolution_clock::now();
+    terrainHeightField.GetNormals(positions.data(), normals.data(), queryCount);
+    auto normalsDone = std::chrono::high_resolution_clock::now();
+    int hitCount = terrainHeightField.Raycasts(origins.data(), directions.data(), 10000.0f, hits.data(), hitResults, rayCount);
+    auto raysDone = std::chrono::high_resolution_clock::now();
+
+    double heightSeconds = std::chrono::duration<double>(heightsDone - start).count();
+    double normalSeconds = std::chrono::duration<double>(normalsDone - heightsDone).count();
+    double raySeconds = std::chrono::duration<double>(raysDone - normalsDone).count();
+
+    std::cout << "Height field benchmark (" << terrainHeightField.width << "x" << terrainHeightField.height << ")" << std::endl;
+    std::cout << "heights: " << queryCount / heightSeconds / 1000000.0 << " M queries/s" << std::endl;
+    std::cout << "normals: " << queryCount / normalSeconds / 1000000.0 << " M queries/s" << std::endl;
+    std::cout << "rays:    " << rayCount / raySeconds / 1000000.0 << " M queries/s (" << hitCount << " hits)" << std::endl;
+
+    delete[] hitResults;
+}
+
+// runs the same per frame and loading work on 1..N threads of the job system and prints how it scales
+void RunJobBenchmark()
+{
+    const int instanceCount = 200000;
+    const int repeats = 5;
+
+    //a field of boxes around the camera, about half of them in view
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    TransformArray transforms;
+    for (int i = 0; i < instanceCount; i++)
+    {
+        glm::vec3 position = camPosition + glm::vec3(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f) * 4000.0f;
+        glm::vec3 rotation = glm::vec3(unit(random), unit(random), unit(random)) * 6.2831853f;
+        transforms.Add(position, glm::quat(rotation), glm::vec3(10));
+    }
+    std::vector<glm::mat4> worlds(instanceCount);
+    std::vector<char> visible(instanceCount);
+    Frustum frustum = ExtractFrustum(camProjection * camView);
+
+    const char* texturePaths[] = { "textures/dirt.jpg", "textures/sand.jpg", "textures/grass.png", "textures/rock.jpg", "textures/snow.jpg" };
+    const int textureCount = 5;
+
+    JobSystem& jobs = JobSystem::Get();
+    std::cout << "Job benchmark: " << instanceCount << " transforms + culls, " << textureCount << " texture decodes" << std::endl;
+
+    double baseCull = 0, baseDecode = 0;
+    for (int threads = 1; threads <= jobs.ThreadCount(); threads++)
+    {
+        jobs.SetActiveThreads(threads);
+
+        //best of a few runs, the first one also warms up the threads
+        double cullMs = 1e9, decodeMs = 1e9;
+        int visibleCount = 0;
+        for (int r = 0; r < repeats; r++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            jobs.ParallelFor(instanceCount, 1024, [&](int begin, int end) {
+                transforms.ComposeWorld(&worlds[begin], begin, end);
+                for (int i = begin; i < end; i++)
+                {
+                    glm::vec3 boundsMin, boundsMax;
+                    TransformBounds(worlds[i], glm::vec3(-1), glm::vec3(1), boundsMin, boundsMax);
+                    visible[i] = IsBoxVisible(frustum, boundsMin, boundsMax);
+                }
+            });
+            cullMs = glm::min(cullMs, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+            visibleCount = (int)std::count(visible.begin(), visible.end(), 1);
+        }
+        for (int r = 0; r < 2; r++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            jobs.ParallelFor(textureCount, 1, [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                {
+                    DecodedImage image = DecodeTexture(texturePaths[i]);
+                    stbi_image_free(image.data);
+                }
+            });
+            decodeMs = glm::min(decodeMs, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+
+        if (threads == 1)
+        {
+            baseCull = cullMs;
+            baseDecode = decodeMs;
+        }
+        std::cout << threads << " threads: transforms + culling " << cullMs << " ms (x" << baseCull / cullMs << ", " << visibleCount << " visible), "
+            << "decoding " << decodeMs << " ms (x" << baseDecode / decodeMs << ")" << std::endl;
+    }
+
+    jobs.SetActiveThreads(jobs.ThreadCount());
+}
+
+// world matrices for 10k to 1M objects: glm's translate * rotate * scale, the SoA arrays one at a time and 4 (8 with AVX) at a time
+void RunTransformBenchmark()
+{
+    const int counts[] = { 10000, 100000, 1000000 };
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+#ifdef __AVX__
+    std::cout << "Transform benchmark (ns per world matrix, AVX)" << std::endl;
+#else
+    std::cout << "Transform benchmark (ns per world matrix, SSE)" << std::endl;
+#endif
+    for (int count : counts)
+    {
+        std::vector<glm::vec3> positions(count), rotations(count), scales(count);
+        TransformArray transforms;
+        for (int i = 0; i < count; i++)
+        {
+            positions[i] = glm::vec3(unit(random), unit(random), unit(random)) * 1000.0f;
+            rotations[i] = glm::vec3(unit(random), unit(random), unit(random)) * 3.1415926f;
+            scales[i] = glm::vec3(unit(random), unit(random), unit(random)) + 2.0f;
+            transforms.Add(positions[i], glm::quat(rotations[i]), scales[i]);
+        }
+        std::vector<glm::mat4> worlds(count);
+
+        //best of a few runs
+        double best[3] = { 1e9, 1e9, 1e9 };
+        for (int r = 0; r < 5; r++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < count; i++)
+                worlds[i] = ComposeWorld(positions[i], rotations[i], scales[i]);
+            auto glmDone = std::chrono::high_resolution_clock::now();
+            transforms.ComposeWorldScalar(worlds.data(), 0, count);
+            auto scalarDone = std::chrono::high_resolution_clock::now();
+            transforms.ComposeWorld(worlds.data(), 0, count);
+            auto simdDone = std::chrono::high_resolution_clock::now();
+
+            best[0] = glm::min(best[0], std::chrono::duration<double, std::nano>(glmDone - start).count() / count);
+            best[1] = glm::min(best[1], std::chrono::duration<double, std::nano>(scalarDone - glmDone).count() / count);
+            best[2] = glm::min(best[2], std::chrono::duration<double, std::nano>(simdDone - scalarDone).count() / count);
+        }
+
+        std::cout << count << " transforms: glm " << best[0] << " ns, SoA scalar " << best[1] << " ns, SoA SIMD " << best[2] << " ns (x" << best[0] / best[2] << ")" << std::endl;
+    }
+}
+
+// skins a synthetic 64 bone mesh one vertex at a time and 8 at a time, then spread over the job system like
+// SkinModelInstances does, and samples a clip for a crowd from the full keys with a binary search and from the
+// quantized keys with cursors
+void RunSkinningBenchmark()
+{
+    const int vertexCount = 1 << 17, boneCount = 64, chunkSize = 4096;
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    vector<Vertex> vertices(vertexCount);
+    for (Vertex& vertex : vertices)
+    {
+        vertex.Position = glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f;
+        vertex.Normal = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) - 0.5f);
+        vertex.TexCoords = glm::vec2(unit(random), unit(random));
+        //up to 4 influences that add up to 1
+        int influences = 1 + (int)(unit(random) * 3.99f);
+        float total = 0.0f;
+        for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+        {
+            vertex.m_BoneIDs[j] = j < influences ? (int)(unit(random) * (boneCount - 1)) : -1;
+            vertex.m_Weights[j] = j < influences ? unit(random) + 0.1f : 0.0f;
+            total += vertex.m_Weights[j];
+        }
+        for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            vertex.m_Weights[j] /= total;
+    }
+    SkinningSource source(vertices);
+
+    vector<glm::mat4> palette(boneCount);
+    for (glm::mat4& bone : palette)
+        bone = ComposeWorld(glm::vec3(unit(random), unit(random), unit(random)), glm::vec3(unit(random), unit(random), unit(random)) * 6.28f, glm::vec3(1));
+
+    vector<SkinnedVertex> reference(vertexCount), skinned(vertexCount);
+    auto timeSkinning = [&](const function<void()>& skin) {
+        double best = 1e9;
+        for (int r = 0; r < 5; r++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            skin();
+            best = glm::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+        return vertexCount / best;
+    };
+
+    std::cout << "Skinning benchmark (" << vertexCount << " vertices, " << boneCount << " bones)" << std::endl;
+    double scalar = timeSkinning([&] { SkinVerticesScalar(source, palette.data(), reference.data(), 0, vertexCount); });
+    std::cout << "scalar: " << scalar << " vertices/ms" << std::endl;
+#ifdef CPU_AVX2
+    if (CpuSupportsAVX2())
+    {
+        double avx2 = timeSkinning([&] { SkinVerticesAVX2(source, palette.data(), skinned.data(), 0, vertexCount); });
+        float maxError = 0.0f;
+        for (int i = 0; i < vertexCount; i++)
+            maxError = glm::max(maxError, glm::length(skinned[i].Position - reference[i].Position));
+        std::cout << "AVX2: " << avx2 << " vertices/ms (x" << avx2 / scalar << ", max error " << maxError << ")" << std::endl;
+    }
+#endif
+
+    JobSystem& jobs = JobSystem::Get();
+    double parallel = timeSkinning([&] {
+        jobs.ParallelFor((vertexCount + chunkSize - 1) / chunkSize, 1, [&](int begin, int end) {
+            for (int chunk = begin; chunk < end; chunk++)
+                SkinVertices(source, palette.data(), &skinned[chunk * chunkSize], chunk * chunkSize, glm::min((chunk + 1) * chunkSize, vertexCount));
+        });
+    });
+    std::cout << jobs.ThreadCount() << " threads: " << parallel << " vertices/ms, " << parallel / jobs.ThreadCount() << " vertices/ms per core" << std::endl;
+
+    //a crowd playing one clip at different phases, 60 frames at 60 Hz
+    const int instanceCount = 256, channelCount = 64, keyCount = 300, frames = 60;
+    AnimationClip clip;
+    clip.duration = (float)(keyCount - 1);
+    clip.ticksPerSecond = 30.0f;
+    for (int c = 0; c < channelCount; c++)
+    {
+        AnimationChannel channel;
+        channel.node = c;
+        for (int k = 0; k < keyCount; k++)
+        {
+            channel.positionTimes.push_back((float)k);
+            channel.rotationTimes.push_back((float)k);
+            channel.positions.push_back(glm::vec3(unit(random), unit(random), unit(random)));
+            channel.rotations.push_back(glm::normalize(glm::quat(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f)));
+        }
+        clip.channels.push_back(channel);
+    }
+    CompressedClip compressed(clip);
+
+    vector<NodePose> poses(channelCount, NodePose{ glm::vec3(0), glm::quat(1, 0, 0, 0), glm::vec3(1) });
+    vector<ClipCursor> cursors(instanceCount);
+    auto timeSampling = [&](bool quantized) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (int i = 0; i < instanceCount; i++)
+            {
+                float time = i * 0.37f + frame / 60.0f;
+                if (quantized)
+                    SampleClip(compressed, time, cursors[i], poses);
+                else
+                    SampleClip(clip, time, poses);
+            }
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count() / ((double)frames * instanceCount * channelCount);
+    };
+    double full = timeSampling(false);
+    double cursor = timeSampling(true);
+    size_t fullSize = 0;
+    for (const AnimationChannel& channel : clip.channels)
+        fullSize += (channel.positionTimes.size() + channel.rotationTimes.size()) * sizeof(float) + channel.positions.size() * sizeof(glm::vec3) + channel.rotations.size() * sizeof(glm::quat);
+    std::cout << "sampling " << instanceCount << " instances: binary search " << full << " ns, quantized with cursors " << cursor << " ns per channel, "
+              << fullSize / 1024 << " KB -> " << compressed.SizeInBytes() / 1024 << " KB" << std::endl;
+}
+
+// vertex throughput of the model shader on IronMan with the rasterizer off, so only the vertex work is timed: the
+// normal matrix from the object block against the inverse transpose the shader used to do for every vertex
+void RunVertexBenchmark()
+{
+    const int drawsPerFrame = 50;
+    const int warmupFrames = 10;
+    const int measuredFrames = 100;
+
+    GLuint inverseProgram;
+    CreateProgram(inverseProgram, "shaders/modelInverseNormalVertex.shader", "shaders/modelUntexturedFragment.shader");
+    glUniformBlockBinding(inverseProgram, glGetUniformBlockIndex(inverseProgram, "FrameData"), FRAME_UNIFORM_BINDING);
+    glUniformBlockBinding(inverseProgram, glGetUniformBlockIndex(inverseProgram, "ObjectData"), OBJECT_UNIFORM_BINDING);
+
+    //one frame and one object block, IronMan at the scale it is placed with
+    FrameUniformData frameData = { view, projection, glm::vec4(cameraPosition, 0.0f), glm::vec4(lightDirection, 0.0f) };
+    ObjectUniformData objectData = MakeObjectData(glm::scale(glm::mat4(1.0f), glm::vec3(7)), glm::vec4(1, 0, 0, 1));
+    GLuint uniforms;
+    glGenBuffers(1, &uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, uniforms);
+    glBufferData(GL_UNIFORM_BUFFER, 2 * UNIFORM_BLOCK_ALIGNMENT, nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frameData), &frameData);
+    glBufferSubData(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_ALIGNMENT, sizeof(objectData), &objectData);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, uniforms, 0, sizeof(frameData));
+    glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_UNIFORM_BINDING, uniforms, UNIFORM_BLOCK_ALIGNMENT, sizeof(objectData));
+
+    size_t vertexCount = 0, indexCount = 0;
+    for (const Mesh& mesh : ironMan->meshes)
+    {
+        vertexCount += mesh.vertices.size();
+        indexCount += mesh.indices.size();
+    }
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    GLuint programs[] = { inverseProgram, untexturedModelProgram };
+    double result[2];
+    for (int p = 0; p < 2; p++)
+    {
+        glUseProgram(programs[p]);
+        for (int frame = 0; frame < warmupFrames + measuredFrames; frame++)
+        {
+            if (frame == warmupFrames)
+                terrainTimer.Reset();
+
+            terrainTimer.Begin();
+            for (int d = 0; d < drawsPerFrame; d++)
+            {
+                for (const Mesh& mesh : ironMan->meshes)
+                {
+                    glBindVertexArray(mesh.VAO);
+                    glDrawElements(GL_TRIANGLES, (GLsizei)mesh.indices.size(), GL_UNSIGNED_INT, 0);
+                }
+            }
+            terrainTimer.End();
+            terrainTimer.Collect();
+        }
+        terrainTimer.Finish();
+        result[p] = terrainTimer.AverageMs();
+    }
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(0);
+
+    //the post transform cache shades somewhere between every vertex once and every index once
+    std::cout << "Vertex benchmark (IronMan x" << drawsPerFrame << ", " << vertexCount << " vertices, " << indexCount << " indices per draw)" << std::endl;
+    for (int p = 0; p < 2; p++)
+    {
+        std::cout << (p == 0 ? "inverse per vertex: " : "normal matrix:      ") << result[p] << " ms, "
+                  << vertexCount * drawsPerFrame / result[p] / 1000.0 << " M vertices/s" << std::endl;
+    }
+    std::cout << "saving: " << (1.0 - result[1] / result[0]) * 100.0 << "%" << std::endl;
+
+    glDeleteBuffers(1, &uniforms);
+    glDeleteProgram(inverseProgram);
+    terrainTimer.Reset();
+}
+
+//no window or GL: draws terrain LODs and the cottage into the occlusion rasterizer from a few fixed cameras and tests
+//a grid of boxes standing on the terrain. Every case is drawn once over the job system with AVX2 and once serial and
+//scalar, both have to agree bit for bit. The output only depends on the inputs, so runs can be compared
+int RunOcclusionTest(const char* heightmap, const char* cottage)
+{
+    int width, height, components;
+    unsigned char* data = stbi_load(heightmap, &width, &height, &components, 4);
+    if (!data)
+    {
+        std::cout << "Couldn't read " << heightmap << std::endl;
+        return -1;
+    }
+    HeightField field(data, width, height, 4, 250.0f, 5.0f);
+    stbi_image_free(data);
+
+    //the cottage where the scene puts it, its node transforms baked in
+    OccluderMesh house;
+    glm::mat4 houseWorld = ComposeWorld(glm::vec3(1500, field.GetHeight(1500, 1300), 1300), glm::vec3(0), glm::vec3(5));
+    Assimp::Importer importer;
+    const aiScene* scene = importer.ReadFile(cottage, aiProcess_Triangulate | aiProcess_PreTransformVertices);
+    if (scene && scene->mRootNode)
+    {
+        for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+        {
+            const aiMesh* mesh = scene->mMeshes[m];
+            unsigned int base = (unsigned int)house.vertices.size();
+            for (unsigned int v = 0; v < mesh->mNumVertices; v++)
+                house.vertices.push_back(glm::vec3(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z));
+            for (unsigned int f = 0; f < mesh->mNumFaces; f++)
+                if (mesh->mFaces[f].mNumIndices == 3)
+                    for (int i = 0; i < 3; i++)
+                        house.indices.push_back(base + mesh->mFaces[f].mIndices[i]);
+        }
+    }
+    else
+        std::cout << "Couldn't read " << cottage << ", terrain only" << std::endl;
+
+    //10 x 20 x 10 boxes on a grid over the whole terrain
+    const int grid = 64;
+    float extent = (field.width - 1) * field.xzScale;
+    vector<glm::vec3> boundsMin, boundsMax;
+    for (int z = 0; z < grid; z++)
+    {
+        for (int x = 0; x < grid; x++)
+        {
+            float wx = (x + 0.5f) * extent / grid, wz = (z + 0.5f) * extent / grid;
+            float ground = field.GetHeight(wx, wz);
+            boundsMin.push_back(glm::vec3(wx - 5, ground - 1, wz - 5));
+            boundsMax.push_back(glm::vec3(wx + 5, ground + 20, wz + 5));
+        }
+    }
+    int boxCount = (int)boundsMin.size();
+
+    struct Camera { const char* name; glm::vec3 position, target; };
+    glm::vec3 cottagePosition = glm::vec3(houseWorld[3]);
+    const Camera cameras[] = {
+        { "at the cottage", cottagePosition + glm::vec3(-60, 15, -40), cottagePosition },
+        { "over the terrain", glm::vec3(100, 600, 100), glm::vec3(extent * 0.5f, 0, extent * 0.5f) },
+        { "on the ground", glm::vec3(extent * 0.9f, field.GetHeight(extent * 0.9f, extent * 0.1f) + 5, extent * 0.1f), cottagePosition },
+        { "in the middle", glm::vec3(extent * 0.5f, field.GetHeight(extent * 0.5f, extent * 0.5f) + 10, extent * 0.5f), glm::vec3(0, 0, extent) },
+    };
+    const int steps[] = { 4, 8, 16 };
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), WIDTH / (float)HEIGHT, 0.05f, 10000.0f);
+
+    std::cout << "Occlusion test: " << OcclusionRasterizer::BUFFER_WIDTH << "x" << OcclusionRasterizer::BUFFER_HEIGHT << " depth, "
+              << boxCount << " boxes, cottage " << house.TriangleCount() << " triangles" << std::endl;
+    bool agree = true;
+    OcclusionRasterizer rasterizer, reference;
+    vector<char> occluded(boxCount), referenceOccluded(boxCount);
+    for (const Camera& camera : cameras)
+    {
+        glm::mat4 viewProjection = projection * glm::lookAt(camera.position, camera.target, glm::vec3(0, 1, 0));
+        for (int step : steps)
+        {
+            OccluderMesh terrain = TerrainOccluder(field, step);
+            for (OcclusionRasterizer* r : { &rasterizer, &reference })
+            {
+                r->Begin(viewProjection);
+                r->AddOccluder(terrain, glm::mat4(1.0f));
+                if (!house.indices.empty())
+                    r->AddOccluder(house, houseWorld);
+            }
+            rasterizer.Render(true, true);
+            reference.Render(false, false);
+            rasterizer.TestBoxes(boundsMin.data(), boundsMax.data(), boxCount, occluded.data(), true);
+            reference.TestBoxes(boundsMin.data(), boundsMax.data(), boxCount, referenceOccluded.data(), false);
+
+            bool same = rasterizer.Checksum() == reference.Checksum() && occluded == referenceOccluded;
+            agree = agree && same;
+            std::cout << camera.name << ", terrain step " << step << ": " << rasterizer.rasterizedTriangles << " of " << rasterizer.submittedTriangles
+                      << " triangles drawn, " << std::count(occluded.begin(), occluded.end(), 1) << " boxes occluded, depth "
+                      << std::hex << rasterizer.Checksum() << std::dec << (same ? "" : " MISMATCH with serial scalar") << std::endl;
+        }
+    }
+    std::cout << (agree ? "Threaded AVX2 and serial scalar agree" : "Threaded AVX2 and serial scalar differ") << std::endl;
+    return agree ? 0 : 1;
+}
+
+// compiles frame graphs without a GL context and checks what they come to: whole frames for the settings that change
+// their passes, where at half resolution the deferred frame's tone mapped image has to take the texture of the dead
+// G-buffer albedo, and a half resolution separable blur, whose third target has to take the texture of the first
+int RunFrameGraphTest()
+{
+    bool passed = true;
+    auto report = [&](const char* name, const FrameGraphStats& stats, bool expected) {
+        passed = passed && expected;
+        std::cout << name << ": " << stats.passes - stats.culledPasses << " of " << stats.passes << " passes, " << stats.transients << " transient targets in "
+                  << stats.textures << " textures, peak " << stats.peakBytes / 1024 << " KB, " << stats.allocatedBytes / 1024 << " KB allocated, "
+                  << stats.unaliasedBytes / 1024 << " KB without aliasing" << (expected ? "" : " UNEXPECTED") << std::endl;
+    };
+
+    //forward frames have the scene and its depth, deferred ones the five G-buffer targets and the scene; the post chain
+    //adds its bloom levels and the histogram, the Hi-Z its reductions
+    struct FrameCase { const char* name; bool deferred, overdrawView, captureDepth, bloom, autoExposure; float scale; int culled, transients, textures; };
+    const int levels = PostProcess::BLOOM_LEVELS, measured = PostProcess::HISTOGRAM_LEVEL, reductions = HiZBuffer::REDUCTIONS;
+    const FrameCase cases[] = {
+        { "forward frame", false, false, false, true, true, 1.0f, 0, levels + 3, levels + 3 },
+        { "forward frame, bloom off", false, false, false, false, true, 1.0f, levels - measured, measured + 3, measured + 3 },
+        { "forward frame, auto exposure off", false, false, false, true, false, 1.0f, 0, levels + 2, levels + 2 },
+        { "forward frame, both off", false, false, false, false, false, 1.0f, levels, 2, 2 },
+        { "forward frame at half resolution", false, false, false, true, true, 0.5f, 0, levels + 4, levels + 4 },
+        { "forward frame with Hi-Z", false, false, true, true, true, 1.0f, 0, levels + 3 + reductions, levels + 3 + reductions },
+        { "overdraw view", false, true, false, true, true, 1.0f, 0, 2, 2 },
+        { "deferred frame", true, false, false, true, true, 1.0f, 0, levels + 7, levels + 7 },
+        { "deferred frame at half resolution", true, false, false, true, true, 0.5f, 0, levels + 8, levels + 7 },
+        { "deferred frame with Hi-Z", true, false, true, true, true, 1.0f, 0, levels + 7 + reductions, levels + 7 + reductions },
+    };
+    postProcess.width = WIDTH;
+    postProcess.height = HEIGHT;
+    for (const FrameCase& c : cases)
+    {
+        RenderPacket packet = {};
+        packet.overdrawView = c.overdrawView;
+        packet.captureDepth = c.captureDepth;
+        packet.bloom = c.bloom;
+        packet.autoExposure = c.autoExposure;
+        postProcess.SetRenderScale(c.scale);
+        FrameGraph graph;
+        BuildFrameGraph(graph, packet, c.deferred, [] {});
+        const FrameGraphStats& stats = graph.Stats();
+        report(c.name, stats, stats.culledPasses == c.culled && stats.transients == c.transients && stats.textures == c.textures);
+    }
+
+    //scene -> half -> horizontal -> vertical -> screen, plus a debug view nobody reads
+    FrameGraph graph;
+    int scene = graph.Import(1, 1, WIDTH, HEIGHT, GL_RGBA16F), screen = graph.Import(0, 0, WIDTH, HEIGHT, GL_RGBA8);
+    int half = graph.Create(WIDTH / 2, HEIGHT / 2, GL_RGBA16F);
+    int horizontal = graph.Create(WIDTH / 2, HEIGHT / 2, GL_RGBA16F);
+    int vertical = graph.Create(WIDTH / 2, HEIGHT / 2, GL_RGBA16F);
+    int debugView = graph.Create(WIDTH, HEIGHT, GL_RGBA8);
+    graph.Read(graph.AddPass(half, FrameGraph::LOAD_NONE, [] {}), scene);
+    graph.Read(graph.AddPass(horizontal, FrameGraph::LOAD_NONE, [] {}), half);
+    graph.Read(graph.AddPass(vertical, FrameGraph::LOAD_NONE, [] {}), horizontal);
+    graph.Read(graph.AddPass(debugView, FrameGraph::LOAD_CLEAR, [] {}), vertical);
+    int composite = graph.AddPass(screen, FrameGraph::LOAD_NONE, [] {});
+    graph.Read(composite, scene);
+    graph.Read(composite, vertical);
+    graph.Compile();
+    const FrameGraphStats& stats = graph.Stats();
+    size_t target = (size_t)(WIDTH / 2) * (HEIGHT / 2) * RenderTargetTexelBytes(GL_RGBA16F);
+    report("separable blur", stats, stats.culledPasses == 1 && stats.transients == 3 && stats.textures == 2 && stats.peakBytes == 2 * target &&
+                                    stats.allocatedBytes == 2 * target && stats.unaliasedBytes == 3 * target);
+
+    std::cout << (passed ? "Frame graphs as expected" : "Frame graphs not as expected") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,383 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "culling.h"
+#include "transforms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+using namespace std;
+
+// most bones a skinned draw can use, the size of the Bones block in skinnedModelVertex.shader
+const int MAX_BONES = 128;
+
+// node transform split into its parts, so two poses can be blended
+struct NodePose {
+    glm::vec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+// a node of the model that vertices are weighted to. offset takes a vertex from mesh space into the bone's space
+// (aiBone::mOffsetMatrix), the bounds are those of its vertices in mesh space, for culling the animated model.
+// A bone without vertices has boundsMin > boundsMax
+struct Bone {
+    string name;
+    int node;
+    glm::mat4 offset;
+    glm::vec3 boundsMin, boundsMax;
+};
+
+// keyframes of one node, times are in ticks and sorted
+struct AnimationChannel {
+    int node;
+    vector<float> positionTimes, rotationTimes, scaleTimes;
+    vector<glm::vec3> positions;
+    vector<glm::quat> rotations;
+    vector<glm::vec3> scales;
+};
+
+struct AnimationClip {
+    string name;
+    float duration;
+    float ticksPerSecond;
+    vector<AnimationChannel> channels;
+};
+
+// what an instance plays. When blendClip is set the pose is blendWeight of the way from clip to blendClip
+struct AnimationState {
+    int clip = -1;
+    float time = 0.0f;
+    int blendClip = -1;
+    float blendTime = 0.0f;
+    float blendWeight = 0.0f;
+};
+
+// the key before time and how far along to the next one. One key (or none past the last) holds its value
+inline int FindKey(const vector<float>& times, float time, float& t)
+{
+    int next = (int)(upper_bound(times.begin(), times.end(), time) - times.begin());
+    if (next == 0 || next == (int)times.size())
+    {
+        t = 0.0f;
+        return next == 0 ? 0 : next - 1;
+    }
+    float span = times[next] - times[next - 1];
+    t = span > 0.0f ? (time - times[next - 1]) / span : 0.0f;
+    return next - 1;
+}
+
+// overwrites the poses of the nodes the clip animates at time seconds, the clip loops
+inline void SampleClip(const AnimationClip& clip, float seconds, vector<NodePose>& poses)
+{
+    float ticks = seconds * clip.ticksPerSecond;
+    if (clip.duration > 0.0f)
+        ticks = fmod(ticks, clip.duration);
+
+    for (const AnimationChannel& channel : clip.channels)
+    {
+        NodePose& pose = poses[channel.node];
+        float t;
+        if (!channel.positions.empty())
+        {
+            int key = FindKey(channel.positionTimes, ticks, t);
+            pose.position = t > 0.0f ? glm::mix(channel.positions[key], channel.positions[key + 1], t) : channel.positions[key];
+        }
+        if (!channel.rotations.empty())
+        {
+            int key = FindKey(channel.rotationTimes, ticks, t);
+            pose.rotation = t > 0.0f ? glm::slerp(channel.rotations[key], channel.rotations[key + 1], t) : channel.rotations[key];
+        }
+        if (!channel.scales.empty())
+        {
+            int key = FindKey(channel.scaleTimes, ticks, t);
+            pose.scale = t > 0.0f ? glm::mix(channel.scales[key], channel.scales[key + 1], t) : channel.scales[key];
+        }
+    }
+}
+
+// rotation key in 6 bytes: the largest component is dropped, it follows from the other three because the quaternion has
+// unit length (q and -q are the same rotation, so it can be made positive). The other three lie in [-1/sqrt2, 1/sqrt2]
+// and get 15 bits each, the index of the dropped one goes into the top bits of the first two
+struct PackedQuat {
+    unsigned short c[3];
+};
+
+inline PackedQuat PackQuat(glm::quat q)
+{
+    float v[4] = { q.x, q.y, q.z, q.w };
+    int largest = 0;
+    for (int i = 1; i < 4; i++)
+        if (fabs(v[i]) > fabs(v[largest]))
+            largest = i;
+    float sign = v[largest] < 0.0f ? -1.0f : 1.0f;
+
+    PackedQuat packed;
+    for (int i = 0, j = 0; i < 4; i++)
+    {
+        if (i == largest)
+            continue;
+        float unit = glm::clamp(v[i] * sign * 0.70710678f + 0.5f, 0.0f, 1.0f);
+        packed.c[j++] = (unsigned short)(unit * 32767.0f + 0.5f);
+    }
+    packed.c[0] |= (largest & 1) << 15;
+    packed.c[1] |= (largest >> 1) << 15;
+    return packed;
+}
+
+inline glm::quat UnpackQuat(PackedQuat packed)
+{
+    int largest = (packed.c[0] >> 15) | ((packed.c[1] >> 15) << 1);
+    float v[4];
+    float sum = 0.0f;
+    for (int i = 0, j = 0; i < 4; i++)
+    {
+        if (i == largest)
+            continue;
+        v[i] = ((packed.c[j++] & 0x7FFF) / 32767.0f - 0.5f) * 1.41421356f;
+        sum += v[i] * v[i];
+    }
+    v[largest] = sqrt(glm::max(1.0f - sum, 0.0f));
+    return glm::quat(v[3], v[0], v[1], v[2]);
+}
+
+// position or scale key in 6 bytes, 16 bits per component inside the box of its track
+struct PackedVec3 {
+    unsigned short c[3];
+};
+
+// AnimationClip with its keys quantized, about a third of the size
+struct CompressedChannel {
+    int node;
+    vector<float> positionTimes, rotationTimes, scaleTimes;
+    vector<PackedVec3> positions, scales;
+    vector<PackedQuat> rotations;
+    // box the position and scale keys are quantized in
+    glm::vec3 positionMin, positionExtent, scaleMin, scaleExtent;
+};
+
+// quantizes keys into the box spanned by all of them
+inline void PackTrack(const vector<glm::vec3>& keys, vector<PackedVec3>& packed, glm::vec3& boxMin, glm::vec3& boxExtent)
+{
+    glm::vec3 boxMax = keys.empty() ? glm::vec3(0.0f) : keys[0];
+    boxMin = boxMax;
+    for (const glm::vec3& key : keys)
+    {
+        boxMin = glm::min(boxMin, key);
+        boxMax = glm::max(boxMax, key);
+    }
+    boxExtent = boxMax - boxMin;
+
+    packed.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            float unit = boxExtent[c] > 0.0f ? (keys[i][c] - boxMin[c]) / boxExtent[c] : 0.0f;
+            packed[i].c[c] = (unsigned short)(unit * 65535.0f + 0.5f);
+        }
+    }
+}
+
+inline glm::vec3 UnpackVec3(PackedVec3 packed, glm::vec3 boxMin, glm::vec3 boxExtent)
+{
+    return boxMin + glm::vec3(packed.c[0], packed.c[1], packed.c[2]) * (boxExtent / 65535.0f);
+}
+
+struct CompressedClip {
+    float duration;
+    float ticksPerSecond;
+    vector<CompressedChannel> channels;
+
+    CompressedClip() : duration(0.0f), ticksPerSecond(25.0f) {}
+
+    explicit CompressedClip(const AnimationClip& clip) : duration(clip.duration), ticksPerSecond(clip.ticksPerSecond)
+    {
+        for (const AnimationChannel& source : clip.channels)
+        {
+            CompressedChannel channel;
+            channel.node = source.node;
+            channel.positionTimes = source.positionTimes;
+            channel.rotationTimes = source.rotationTimes;
+            channel.scaleTimes = source.scaleTimes;
+            PackTrack(source.positions, channel.positions, channel.positionMin, channel.positionExtent);
+            PackTrack(source.scales, channel.scales, channel.scaleMin, channel.scaleExtent);
+            for (const glm::quat& rotation : source.rotations)
+                channel.rotations.push_back(PackQuat(rotation));
+            channels.push_back(channel);
+        }
+    }
+
+    size_t SizeInBytes() const
+    {
+        size_t size = 0;
+        for (const CompressedChannel& channel : channels)
+        {
+            size += sizeof(channel) + (channel.positionTimes.size() + channel.rotationTimes.size() + channel.scaleTimes.size()) * sizeof(float);
+            size += (channel.positions.size() + channel.scales.size()) * sizeof(PackedVec3) + channel.rotations.size() * sizeof(PackedQuat);
+        }
+        return size;
+    }
+};
+
+// the key every track of a clip was at when it was sampled last. Playback mostly moves forward by a fraction of a key,
+// so sampling steps the keys forward from there instead of searching for them; it only starts over from the first
+// key when the time went back (the clip looped) or the clip changed
+struct ClipCursor {
+    const CompressedClip* clip = nullptr;
+    float ticks = 0.0f;
+    // position, rotation and scale key of every channel
+    vector<int> keys;
+};
+
+// moves key forward to the last key at or before ticks, t is how far along to the next one
+inline int AdvanceKey(const vector<float>& times, float ticks, int& key, float& t)
+{
+    int last = (int)times.size() - 1;
+    while (key < last && times[key + 1] <= ticks)
+        key++;
+    t = 0.0f;
+    if (key < last && ticks > times[key])
+        t = (ticks - times[key]) / (times[key + 1] - times[key]);
+    return key;
+}
+
+// same as SampleClip() on the compressed keys
+inline void SampleClip(const CompressedClip& clip, float seconds, ClipCursor& cursor, vector<NodePose>& poses)
+{
+    float ticks = seconds * clip.ticksPerSecond;
+    if (clip.duration > 0.0f)
+        ticks = fmod(ticks, clip.duration);
+    if (cursor.clip != &clip || ticks < cursor.ticks)
+    {
+        cursor.clip = &clip;
+        cursor.keys.assign(clip.channels.size() * 3, 0);
+    }
+    cursor.ticks = ticks;
+
+    int* keys = cursor.keys.data();
+    for (const CompressedChannel& channel : clip.channels)
+    {
+        NodePose& pose = poses[channel.node];
+        float t;
+        if (!channel.positions.empty())
+        {
+            int key = AdvanceKey(channel.positionTimes, ticks, keys[0], t);
+            glm::vec3 position = UnpackVec3(channel.positions[key], channel.positionMin, channel.positionExtent);
+            pose.position = t > 0.0f ? glm::mix(position, UnpackVec3(channel.positions[key + 1], channel.positionMin, channel.positionExtent), t) : position;
+        }
+        if (!channel.rotations.empty())
+        {
+            // normalized lerp, the keys are close enough together that it's indistinguishable from slerp
+            int key = AdvanceKey(channel.rotationTimes, ticks, keys[1], t);
+            glm::quat rotation = UnpackQuat(channel.rotations[key]);
+            if (t > 0.0f)
+            {
+                glm::quat next = UnpackQuat(channel.rotations[key + 1]);
+                if (glm::dot(rotation, next) < 0.0f)
+                    next = -next;
+                rotation = glm::normalize(rotation * (1.0f - t) + next * t);
+            }
+            pose.rotation = rotation;
+        }
+        if (!channel.scales.empty())
+        {
+            int key = AdvanceKey(channel.scaleTimes, ticks, keys[2], t);
+            glm::vec3 scale = UnpackVec3(channel.scales[key], channel.scaleMin, channel.scaleExtent);
+            pose.scale = t > 0.0f ? glm::mix(scale, UnpackVec3(channel.scales[key + 1], channel.scaleMin, channel.scaleExtent), t) : scale;
+        }
+        keys += 3;
+    }
+}
+
+// memory the evaluation works in, kept per thread so evaluating a frame doesn't allocate
+struct AnimationScratch {
+    vector<NodePose> poses, blendPoses;
+    TransformArray locals;
+    vector<glm::mat4> localMatrices;
+};
+
+// the skeleton of a model: its node hierarchy (parents before children), rest pose, bones and clips
+struct Skeleton {
+    vector<int> nodeParents;
+    vector<NodePose> restPoses;
+    vector<Bone> bones;
+    vector<AnimationClip> clips;
+    // the same clips quantized, what playback samples
+    vector<CompressedClip> compressedClips;
+
+    void CompressClips()
+    {
+        compressedClips.clear();
+        for (const AnimationClip& clip : clips)
+            compressedClips.push_back(CompressedClip(clip));
+    }
+
+    // poses the nodes for state and fills nodes with their transforms relative to the model, bones with the matrices
+    // that take a skinned vertex from the mesh to the model. boundsMin/Max are around every bone's vertices.
+    // with cursors (one for the clip, one for the blend clip) the compressed clips are sampled, otherwise the full ones
+    void Evaluate(const AnimationState& state, ClipCursor* cursors, AnimationScratch& scratch, vector<glm::mat4>& nodes, vector<glm::mat4>& palette,
+                  glm::vec3& boundsMin, glm::vec3& boundsMax) const
+    {
+        int nodeCount = (int)nodeParents.size();
+        scratch.poses = restPoses;
+        if (state.clip >= 0)
+        {
+            if (cursors)
+                SampleClip(compressedClips[state.clip], state.time, cursors[0], scratch.poses);
+            else
+                SampleClip(clips[state.clip], state.time, scratch.poses);
+        }
+        if (state.blendClip >= 0 && state.blendWeight > 0.0f)
+        {
+            scratch.blendPoses = restPoses;
+            if (cursors)
+                SampleClip(compressedClips[state.blendClip], state.blendTime, cursors[1], scratch.blendPoses);
+            else
+                SampleClip(clips[state.blendClip], state.blendTime, scratch.blendPoses);
+            for (int i = 0; i < nodeCount; i++)
+            {
+                NodePose& pose = scratch.poses[i];
+                const NodePose& blend = scratch.blendPoses[i];
+                pose.position = glm::mix(pose.position, blend.position, state.blendWeight);
+                pose.rotation = glm::slerp(pose.rotation, blend.rotation, state.blendWeight);
+                pose.scale = glm::mix(pose.scale, blend.scale, state.blendWeight);
+            }
+        }
+
+        // all local matrices in one SIMD pass, then down the hierarchy
+        scratch.locals.Clear();
+        for (const NodePose& pose : scratch.poses)
+            scratch.locals.Add(pose.position, pose.rotation, pose.scale);
+        scratch.localMatrices.resize(nodeCount);
+        scratch.locals.ComposeWorld(scratch.localMatrices.data(), 0, nodeCount);
+
+        nodes.resize(nodeCount);
+        for (int i = 0; i < nodeCount; i++)
+            nodes[i] = nodeParents[i] >= 0 ? nodes[nodeParents[i]] * scratch.localMatrices[i] : scratch.localMatrices[i];
+
+        palette.resize(bones.size());
+        bool empty = true;
+        for (size_t b = 0; b < bones.size(); b++)
+        {
+            const Bone& bone = bones[b];
+            palette[b] = bone.node >= 0 ? nodes[bone.node] * bone.offset : bone.offset;
+            if (bone.boundsMin.x > bone.boundsMax.x)
+                continue;
+
+            glm::vec3 boneMin, boneMax;
+            TransformBounds(palette[b], bone.boundsMin, bone.boundsMax, boneMin, boneMax);
+            boundsMin = empty ? boneMin : glm::min(boundsMin, boneMin);
+            boundsMax = empty ? boneMax : glm::max(boundsMax, boneMax);
+            empty = false;
+        }
+        if (empty)
+            boundsMin = boundsMax = glm::vec3(0.0f);
+    }
+};
+#endif
@@ -0,0 +1,280 @@
+#ifndef CLIPMAP_H
+#define CLIPMAP_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "terrain.h"
+
+#include <vector>
+#include <iostream>
+using namespace std;
+
+// Geometry clipmap terrain: nested square rings of gridSize x gridSize quads centered on the camera, every ring has
+// double the spacing of the one inside it, so the triangle count is the same no matter how large the world is.
+//
+// Every level keeps its heights in one layer of a (gridSize + 1)^2 texture array that is addressed toroidally
+// (texel = world grid coordinate mod size). When the camera moves only the rows and columns that scrolled into a level
+// are uploaded, the rest of the texture stays where it is.
+//
+// Level l is snapped to a grid of twice its own spacing, which leaves the level inside it either centered or one coarse
+// quad off in each axis, so there are 4 variants of the ring with the hole in a different spot. Vertices near the outer
+// edge of a level morph toward the coarser level to close the T-junctions between the two.
+class TerrainClipmap
+{
+public:
+    // quads per side of one level, has to be a multiple of 8
+    int gridSize;
+    int levels;
+    // spacing of the finest level, same as the height field samples
+    float spacing;
+
+    // texels uploaded by the last Update()
+    int uploadedTexels;
+    int trianglesPerFrame;
+
+    GLuint heightTexture;
+
+    TerrainClipmap(const HeightField* heightField, int gridSize = 64, int levels = 8)
+        : gridSize(gridSize), levels(levels), spacing(heightField->xzScale), uploadedTexels(0), trianglesPerFrame(0),
+        heightTexture(0), heightField(heightField)
+    {
+        origins.resize(levels);
+        valid.resize(levels, false);
+        setupTexture();
+        setupMesh();
+    }
+
+    ~TerrainClipmap()
+    {
+        glDeleteTextures(1, &heightTexture);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+    }
+
+    // the heights changed, every level gets refilled on the next Update()
+    void Invalidate()
+    {
+        for (int l = 0; l < levels; l++)
+            valid[l] = false;
+    }
+
+    // same size and spacing as the old one, every level gets refilled from it
+    void SetHeightField(const HeightField* heights)
+    {
+        heightField = heights;
+        Invalidate();
+    }
+
+    // recenters the levels around the camera and uploads what scrolled in
+    void Update(glm::vec3 cameraPosition)
+    {
+        uploadedTexels = 0;
+        int size = textureSize();
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        for (int l = 0; l < levels; l++)
+        {
+            glm::ivec2 origin = levelOrigin(l, cameraPosition);
+            glm::ivec2 old = origins[l];
+            origins[l] = origin;
+
+            if (!valid[l] || glm::abs(origin.x - old.x) >= size || glm::abs(origin.y - old.y) >= size)
+            {
+                fillLevel(l);
+                valid[l] = true;
+                continue;
+            }
+
+            // columns that scrolled in, over the full new height of the level
+            int fromX = origin.x > old.x ? old.x + gridSize + 1 : origin.x;
+            int toX = origin.x > old.x ? origin.x + gridSize : old.x - 1;
+            for (int x = fromX; x <= toX && origin.x != old.x; x++)
+                fillColumn(l, x);
+
+            int fromZ = origin.y > old.y ? old.y + gridSize + 1 : origin.y;
+            int toZ = origin.y > old.y ? origin.y + gridSize : old.y - 1;
+            for (int z = fromZ; z <= toZ && origin.y != old.y; z++)
+                fillRow(l, z);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // draws every level, the program has to be bound with its view/projection set
+    void Draw(GLuint program)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+
+        GLint levelLocation = glGetUniformLocation(program, "level");
+        GLint originLocation = glGetUniformLocation(program, "origin");
+        GLint spacingLocation = glGetUniformLocation(program, "spacing");
+        glUniform1i(glGetUniformLocation(program, "gridSize"), gridSize);
+
+        glBindVertexArray(VAO);
+        trianglesPerFrame = 0;
+        for (int l = 0; l < levels; l++)
+        {
+            // the finest level is a full grid, every other one leaves a hole where the level inside it sits
+            int range = 0;
+            if (l > 0)
+            {
+                glm::ivec2 offset = origins[l - 1] / 2 - origins[l] - glm::ivec2(gridSize / 4);
+                range = 1 + offset.x + offset.y * 2;
+            }
+
+            glUniform1i(levelLocation, l);
+            glUniform2i(originLocation, origins[l].x, origins[l].y);
+            glUniform1f(spacingLocation, spacing * (1 << l));
+            glDrawElements(GL_TRIANGLES, rangeCounts[range], GL_UNSIGNED_SHORT, (void*)(rangeOffsets[range] * sizeof(unsigned short)));
+            trianglesPerFrame += rangeCounts[range] / 3;
+        }
+        glBindVertexArray(0);
+    }
+
+private:
+    const HeightField* heightField;
+
+    // world grid coordinate (in level units) of the first sample of every level
+    vector<glm::ivec2> origins;
+    vector<bool> valid;
+
+    GLuint VAO, VBO, EBO;
+    // index ranges: full grid, then the ring with its hole offset by (0,0), (1,0), (0,1), (1,1)
+    int rangeOffsets[5], rangeCounts[5];
+
+    int textureSize() const { return gridSize + 1; }
+
+    glm::ivec2 levelOrigin(int level, glm::vec3 cameraPosition) const
+    {
+        float levelSpacing = spacing * (1 << level);
+        glm::ivec2 center = glm::ivec2(glm::floor(glm::vec2(cameraPosition.x, cameraPosition.z) / (2.0f * levelSpacing))) * 2;
+        return center - glm::ivec2(gridSize / 2);
+    }
+
+    float sample(int level, int x, int z) const
+    {
+        return heightField->GetSample(x * (1 << level), z * (1 << level));
+    }
+
+    // the texel that holds world grid coordinate g
+    int wrap(int g) const
+    {
+        int size = textureSize();
+        return ((g % size) + size) % size;
+    }
+
+    // the world grid coordinate inside [origin, origin + gridSize] that lands on texel t
+    int unwrap(int t, int origin) const
+    {
+        return origin + wrap(t - origin);
+    }
+
+    void fillLevel(int level)
+    {
+        int size = textureSize();
+        vector<float> texels(size * size);
+        for (int tz = 0; tz < size; tz++)
+        {
+            int z = unwrap(tz, origins[level].y);
+            for (int tx = 0; tx < size; tx++)
+                texels[tz * size + tx] = sample(level, unwrap(tx, origins[level].x), z);
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, level, size, size, 1, GL_RED, GL_FLOAT, texels.data());
+        uploadedTexels += size * size;
+    }
+
+    void fillColumn(int level, int x)
+    {
+        int size = textureSize();
+        vector<float> texels(size);
+        for (int tz = 0; tz < size; tz++)
+            texels[tz] = sample(level, x, unwrap(tz, origins[level].y));
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, wrap(x), 0, level, 1, size, 1, GL_RED, GL_FLOAT, texels.data());
+        uploadedTexels += size;
+    }
+
+    void fillRow(int level, int z)
+    {
+        int size = textureSize();
+        vector<float> texels(size);
+        for (int tx = 0; tx < size; tx++)
+            texels[tx] = sample(level, unwrap(tx, origins[level].x), z);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, wrap(z), level, size, 1, 1, GL_RED, GL_FLOAT, texels.data());
+        uploadedTexels += size;
+    }
+
+    void setupTexture()
+    {
+        glGenTextures(1, &heightTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightTexture);
+        // only read with texelFetch
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, textureSize(), textureSize(), levels, 0, GL_RED, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void setupMesh()
+    {
+        int side = gridSize + 1;
+        vector<unsigned short> vertices;
+        for (int i = 0; i < side * side; i++)
+        {
+            vertices.push_back(i % side);
+            vertices.push_back(i / side);
+        }
+
+        vector<unsigned short> indices;
+        for (int range = 0; range < 5; range++)
+        {
+            rangeOffsets[range] = (int)indices.size();
+            int holeX = gridSize / 4 + ((range - 1) & 1);
+            int holeZ = gridSize / 4 + (((range - 1) >> 1) & 1);
+
+            for (int z = 0; z < gridSize; z++)
+            {
+                for (int x = 0; x < gridSize; x++)
+                {
+                    bool inHole = x >= holeX && x < holeX + gridSize / 2 && z >= holeZ && z < holeZ + gridSize / 2;
+                    if (range > 0 && inHole)
+                        continue;
+
+                    int vertex = z * side + x;
+                    indices.push_back(vertex);
+                    indices.push_back(vertex + side);
+                    indices.push_back(vertex + side + 1);
+
+                    indices.push_back(vertex);
+                    indices.push_back(vertex + side + 1);
+                    indices.push_back(vertex + 1);
+                }
+            }
+            rangeCounts[range] = (int)indices.size() - rangeOffsets[range];
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        glBindVertexArray(VAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(unsigned short), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+
+        // grid corner, converted to float by the vertex fetch
+        glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(unsigned short) * 2, 0);
+        glEnableVertexAttribArray(0);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        std::cout << "Clipmap generated! " << levels << " levels, " << (vertices.size() + indices.size()) * sizeof(unsigned short) << " bytes of geometry" << std::endl;
+    }
+};
+#endif
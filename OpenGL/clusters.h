@@ -0,0 +1,393 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "deferred.h"
+#include "jobs.h"
+
+#include <emmintrin.h>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+// per frame parameters of the clusters, the ClusterData block of clusteredLights.shader (std140)
+struct ClusterUniformData {
+    glm::mat4 view;
+    // pixels per tile in x and y, depth where slice 1 starts, slices per unit of log depth
+    glm::vec4 scale;
+    // tiles in x and y, slices, 1 for the lights per cluster view
+    glm::ivec4 grid;
+};
+
+// what the fragment shaders read: for every cluster where its lights start in indices and how many there are
+struct ClusterLists {
+    ClusterUniformData parameters;
+    vector<glm::uvec2> ranges;
+    vector<unsigned short> indices;
+
+    // light references over all clusters, clusters with at least one light, the most lights in one cluster and the
+    // references that didn't fit into MAX_LIGHTS_PER_CLUSTER
+    int references, occupied, maxCount, overflow;
+};
+
+// bins point lights into view space clusters on the CPU, so the forward shaders only loop over the lights that can
+// reach the cluster of their pixel. The screen is cut into TILES_X * TILES_Y tiles, the depth into SLICES slices: slice 0
+// ends at nearDepth, the others are spaced logarithmically out to farDepth and the last one goes on forever.
+//
+// Per light the slices and tiles its bounding box projects to are worked out first (the view transform 4 lights at a
+// time), then the sphere is tested against the view space box of every cluster in that range, 4 tiles of a row at a
+// time. Slices are spread over the job system, a job only ever writes the clusters of its own slices
+class LightClusters
+{
+public:
+    static const int TILES_X = 16;
+    static const int TILES_Y = 9;
+    static const int SLICES = 24;
+    static const int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+    static const int MAX_LIGHTS_PER_CLUSTER = 128;
+
+    float nearDepth, farDepth;
+
+    LightClusters(float nearDepth = 5.0f, float farDepth = 3000.0f) : nearDepth(nearDepth), farDepth(farDepth), projection(0.0f)
+    {
+        sliceScale = (SLICES - 1) / logf(farDepth / nearDepth);
+        counts.resize(CLUSTER_COUNT);
+        slots.resize((size_t)CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER);
+    }
+
+    void Build(const glm::mat4& view, const glm::mat4& projection, int width, int height, const vector<PointLight>& lights, ClusterLists& out, bool simd = true)
+    {
+        if (projection != this->projection)
+            setupBounds(projection);
+
+        transformLights(view, lights);
+
+        JobSystem::Get().ParallelFor(SLICES, 1, [&](int begin, int end) {
+            for (int slice = begin; slice < end; slice++)
+                binSlice(slice, simd);
+        });
+
+        out.parameters.view = view;
+        out.parameters.scale = glm::vec4((float)width / TILES_X, (float)height / TILES_Y, nearDepth, sliceScale);
+        out.parameters.grid.x = TILES_X;
+        out.parameters.grid.y = TILES_Y;
+        out.parameters.grid.z = SLICES;
+        compact(out);
+    }
+
+    // slice a view space depth (distance in front of the camera) falls into, the same as ClusterIndex() in the shader
+    int Slice(float depth) const
+    {
+        if (depth < nearDepth)
+            return 0;
+        return std::min(1 + (int)(logf(depth / nearDepth) * sliceScale), SLICES - 1);
+    }
+
+private:
+    float sliceScale;
+    glm::mat4 projection;
+
+    // view space bounds of every cluster, index (slice * TILES_Y + y) * TILES_X + x, one array per component so the
+    // 4 tiles of a row starting at any x load with one unaligned load. Padded by 3 for the last group of a row
+    vector<float> minX, maxX, minY, maxY, minZ, maxZ;
+
+    // view space spheres of this frame's lights and the cluster ranges their bounding boxes cover
+    struct LightBounds {
+        float x, y, z, radius;
+        int tileX0, tileX1, tileY0, tileY1, slice0, slice1;
+    };
+    vector<LightBounds> bounds;
+    vector<float> lightX, lightY, lightZ;
+
+    vector<unsigned short> counts;
+    vector<unsigned short> slots;
+
+    void setupBounds(const glm::mat4& projection)
+    {
+        this->projection = projection;
+        for (vector<float>* component : { &minX, &maxX, &minY, &maxY, &minZ, &maxZ })
+            component->assign(CLUSTER_COUNT + 3, 0.0f);
+
+        // a symmetric perspective: view x = ndc x * depth / projection[0][0]
+        for (int slice = 0; slice < SLICES; slice++)
+        {
+            float depth0 = slice == 0 ? 0.0f : nearDepth * expf((slice - 1) / sliceScale);
+            float depth1 = slice == SLICES - 1 ? 1e6f : nearDepth * expf(slice / sliceScale);
+            for (int y = 0; y < TILES_Y; y++)
+            {
+                for (int x = 0; x < TILES_X; x++)
+                {
+                    float ndcX0 = -1.0f + 2.0f * x / TILES_X, ndcX1 = -1.0f + 2.0f * (x + 1) / TILES_X;
+                    float ndcY0 = -1.0f + 2.0f * y / TILES_Y, ndcY1 = -1.0f + 2.0f * (y + 1) / TILES_Y;
+                    int cluster = (slice * TILES_Y + y) * TILES_X + x;
+                    minX[cluster] = std::min(ndcX0 * depth0, ndcX0 * depth1) / projection[0][0];
+                    maxX[cluster] = std::max(ndcX1 * depth0, ndcX1 * depth1) / projection[0][0];
+                    minY[cluster] = std::min(ndcY0 * depth0, ndcY0 * depth1) / projection[1][1];
+                    maxY[cluster] = std::max(ndcY1 * depth0, ndcY1 * depth1) / projection[1][1];
+                    minZ[cluster] = -depth1;
+                    maxZ[cluster] = -depth0;
+                }
+            }
+        }
+    }
+
+    // view space centers 4 lights at a time, then the tiles and slices their boxes cover
+    void transformLights(const glm::mat4& view, const vector<PointLight>& lights)
+    {
+        int count = (int)lights.size();
+        int padded = (count + 3) / 4 * 4;
+        lightX.assign(padded, 0.0f);
+        lightY.assign(padded, 0.0f);
+        lightZ.assign(padded, 0.0f);
+        for (int i = 0; i < count; i++)
+        {
+            lightX[i] = lights[i].sphere.x;
+            lightY[i] = lights[i].sphere.y;
+            lightZ[i] = lights[i].sphere.z;
+        }
+
+        for (int i = 0; i < padded; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(&lightX[i]), y = _mm_loadu_ps(&lightY[i]), z = _mm_loadu_ps(&lightZ[i]);
+            __m128 row[3];
+            for (int r = 0; r < 3; r++)
+            {
+                row[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[0][r]), x), _mm_mul_ps(_mm_set1_ps(view[1][r]), y)),
+                                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[2][r]), z), _mm_set1_ps(view[3][r])));
+            }
+            _mm_storeu_ps(&lightX[i], row[0]);
+            _mm_storeu_ps(&lightY[i], row[1]);
+            _mm_storeu_ps(&lightZ[i], row[2]);
+        }
+
+        bounds.resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            LightBounds& light = bounds[i];
+            light.x = lightX[i];
+            light.y = lightY[i];
+            light.z = lightZ[i];
+            light.radius = lights[i].sphere.w;
+
+            float depth = -light.z;
+            if (depth + light.radius <= 0.0f)
+            {
+                // behind the camera, an empty range
+                light.slice0 = 1;
+                light.slice1 = 0;
+                continue;
+            }
+            light.slice0 = Slice(std::max(depth - light.radius, 0.0f));
+            light.slice1 = Slice(depth + light.radius);
+
+            light.tileX0 = light.tileY0 = 0;
+            light.tileX1 = TILES_X - 1;
+            light.tileY1 = TILES_Y - 1;
+            // spheres that reach the camera plane cover the whole screen, the others the projection of their box
+            float nearest = depth - light.radius;
+            if (nearest <= 1e-3f)
+                continue;
+            float ndcMinX = 1e30f, ndcMaxX = -1e30f, ndcMinY = 1e30f, ndcMaxY = -1e30f;
+            for (float d : { nearest, depth + light.radius })
+            {
+                for (float x : { light.x - light.radius, light.x + light.radius })
+                {
+                    float ndc = x * projection[0][0] / d;
+                    ndcMinX = std::min(ndcMinX, ndc);
+                    ndcMaxX = std::max(ndcMaxX, ndc);
+                }
+                for (float y : { light.y - light.radius, light.y + light.radius })
+                {
+                    float ndc = y * projection[1][1] / d;
+                    ndcMinY = std::min(ndcMinY, ndc);
+                    ndcMaxY = std::max(ndcMaxY, ndc);
+                }
+            }
+            light.tileX0 = std::max((int)floorf((ndcMinX * 0.5f + 0.5f) * TILES_X), 0);
+            light.tileX1 = std::min((int)floorf((ndcMaxX * 0.5f + 0.5f) * TILES_X), TILES_X - 1);
+            light.tileY0 = std::max((int)floorf((ndcMinY * 0.5f + 0.5f) * TILES_Y), 0);
+            light.tileY1 = std::min((int)floorf((ndcMaxY * 0.5f + 0.5f) * TILES_Y), TILES_Y - 1);
+        }
+    }
+
+    void addLight(int cluster, int light)
+    {
+        unsigned short& count = counts[cluster];
+        if (count < MAX_LIGHTS_PER_CLUSTER)
+            slots[(size_t)cluster * MAX_LIGHTS_PER_CLUSTER + count] = (unsigned short)light;
+        // counted past the end, compact() reports the ones that didn't fit
+        if (count < 0xFFFF)
+            count++;
+    }
+
+    void binSlice(int slice, bool simd)
+    {
+        int first = slice * TILES_X * TILES_Y;
+        std::fill(counts.begin() + first, counts.begin() + first + TILES_X * TILES_Y, (unsigned short)0);
+
+        for (int i = 0; i < (int)bounds.size(); i++)
+        {
+            const LightBounds& light = bounds[i];
+            if (slice < light.slice0 || slice > light.slice1)
+                continue;
+
+            for (int y = light.tileY0; y <= light.tileY1; y++)
+            {
+                int row = first + y * TILES_X;
+                if (simd)
+                    binRowSSE(row, light, i);
+                else
+                    binRowScalar(row, light, i);
+            }
+        }
+    }
+
+    // sphere against the boxes of tiles tileX0 .. tileX1 of a row, squared distance from the center to the box
+    void binRowScalar(int row, const LightBounds& light, int index)
+    {
+        float radius2 = light.radius * light.radius;
+        for (int x = light.tileX0; x <= light.tileX1; x++)
+        {
+            int cluster = row + x;
+            float dx = std::max(std::max(minX[cluster] - light.x, light.x - maxX[cluster]), 0.0f);
+            float dy = std::max(std::max(minY[cluster] - light.y, light.y - maxY[cluster]), 0.0f);
+            float dz = std::max(std::max(minZ[cluster] - light.z, light.z - maxZ[cluster]), 0.0f);
+            if (dx * dx + dy * dy + dz * dz <= radius2)
+                addLight(cluster, index);
+        }
+    }
+
+    void binRowSSE(int row, const LightBounds& light, int index)
+    {
+        __m128 x = _mm_set1_ps(light.x), y = _mm_set1_ps(light.y), z = _mm_set1_ps(light.z);
+        __m128 radius2 = _mm_set1_ps(light.radius * light.radius), zero = _mm_setzero_ps();
+        for (int tile = light.tileX0; tile <= light.tileX1; tile += 4)
+        {
+            int cluster = row + tile;
+            __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[cluster]), x), _mm_sub_ps(x, _mm_loadu_ps(&maxX[cluster]))), zero);
+            __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[cluster]), y), _mm_sub_ps(y, _mm_loadu_ps(&maxY[cluster]))), zero);
+            __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[cluster]), z), _mm_sub_ps(z, _mm_loadu_ps(&maxZ[cluster]))), zero);
+            __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            int mask = _mm_movemask_ps(_mm_cmple_ps(distance2, radius2));
+            // lanes past the end of the range belong to the next tiles or row
+            mask &= (1 << std::min(light.tileX1 - tile + 1, 4)) - 1;
+            while (mask)
+            {
+                int lane = 0;
+                while (!(mask & (1 << lane)))
+                    lane++;
+                addLight(cluster + lane, index);
+                mask &= mask - 1;
+            }
+        }
+    }
+
+    void compact(ClusterLists& out)
+    {
+        out.ranges.resize(CLUSTER_COUNT);
+        out.indices.clear();
+        out.references = out.occupied = out.maxCount = out.overflow = 0;
+        for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++)
+        {
+            int count = counts[cluster];
+            int stored = std::min(count, MAX_LIGHTS_PER_CLUSTER);
+            out.ranges[cluster] = glm::uvec2((unsigned int)out.indices.size(), (unsigned int)stored);
+            const unsigned short* lights = &slots[(size_t)cluster * MAX_LIGHTS_PER_CLUSTER];
+            out.indices.insert(out.indices.end(), lights, lights + stored);
+
+            out.references += stored;
+            out.occupied += count > 0;
+            out.maxCount = std::max(out.maxCount, count);
+            out.overflow += count - stored;
+        }
+    }
+};
+
+// the GL side of ClusterLists: a uniform block and three texture buffers, the lights (two RGBA32F texels each, the
+// layout of PointLight), the ranges (RG32UI per cluster) and the light indices (R16UI)
+class ClusterBuffers
+{
+public:
+    static const int RANGE_UNIT = 8;
+    static const int INDEX_UNIT = 9;
+    static const int LIGHT_UNIT = 10;
+
+    ClusterBuffers() : uniformBuffer(0) {}
+
+    ~ClusterBuffers()
+    {
+        glDeleteBuffers(1, &uniformBuffer);
+        glDeleteBuffers(3, buffers);
+        glDeleteTextures(3, textures);
+    }
+
+    // needs a current GL context
+    void Create()
+    {
+        glGenBuffers(1, &uniformBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterUniformData), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        GLenum formats[] = { GL_RG32UI, GL_R16UI, GL_RGBA32F };
+        for (int i = 0; i < 3; i++)
+        {
+            // a texture buffer needs storage before it can be attached
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // uploads the frame's lists and binds everything where the shaders look for it
+    // viewportScale is the part of the size the clusters were built for that is drawn to, the tiles shrink with it
+    void Upload(const ClusterLists& clusters, const vector<PointLight>& lights, bool debugView, GLuint uniformBinding, glm::vec2 viewportScale = glm::vec2(1.0f))
+    {
+        ClusterUniformData parameters = clusters.parameters;
+        parameters.grid.w = debugView ? 1 : 0;
+        parameters.scale.x *= viewportScale.x;
+        parameters.scale.y *= viewportScale.y;
+        glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(parameters), &parameters);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, uniformBinding, uniformBuffer);
+
+        upload(0, clusters.ranges.data(), clusters.ranges.size() * sizeof(glm::uvec2));
+        upload(1, clusters.indices.data(), clusters.indices.size() * sizeof(unsigned short));
+        upload(2, lights.data(), lights.size() * sizeof(PointLight));
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        int units[] = { RANGE_UNIT, INDEX_UNIT, LIGHT_UNIT };
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    GLuint uniformBuffer;
+    GLuint buffers[3];
+    GLuint textures[3];
+
+    // orphans last frame's contents, the buffer never shrinks to nothing so the texture stays valid
+    void upload(int i, const void* data, size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t)16), nullptr, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    }
+};
+#endif
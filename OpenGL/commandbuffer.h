@@ -0,0 +1,304 @@
+#ifndef COMMANDBUFFER_H
+#define COMMANDBUFFER_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstring>
+using namespace std;
+
+enum CommandType : unsigned short {
+    COMMAND_BIND_PROGRAM,
+    COMMAND_BIND_VERTEX_ARRAY,
+    COMMAND_BIND_TEXTURE,
+    COMMAND_ENABLE,
+    COMMAND_DISABLE,
+    COMMAND_UNIFORM_INT,
+    COMMAND_UNIFORM_VEC3,
+    COMMAND_UNIFORM_VEC4,
+    COMMAND_UNIFORM_MAT4,
+    COMMAND_DRAW_ELEMENTS,
+    COMMAND_BIND_UNIFORM_BLOCK,
+    COMMAND_DRAW_ELEMENTS_BASE_VERTEX,
+    COMMAND_DEPTH_FUNC,
+    COMMAND_DEPTH_MASK,
+    COMMAND_BEGIN_QUERY,
+    COMMAND_END_QUERY,
+    COMMAND_BLEND_FUNC,
+};
+
+// uniform blocks recorded into a buffer start on multiples of this, which covers GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+// on every implementation we run on
+const unsigned int UNIFORM_BLOCK_ALIGNMENT = 256;
+
+// every command is a header followed by one of the structs below, all of them plain 4 byte words
+struct CommandHeader {
+    CommandType type;
+    // in words, header included
+    unsigned short size;
+};
+struct BindCommand { unsigned int object; };
+struct BindTextureCommand { unsigned int unit, target, texture; };
+struct StateCommand { unsigned int capability; };
+struct UniformIntCommand { int location; int value; };
+struct UniformVec3Command { int location; float value[3]; };
+struct UniformVec4Command { int location; float value[4]; };
+struct UniformMat4Command { int location; float value[16]; };
+struct DrawElementsCommand { unsigned int mode, count, indexType, offset; };
+// offset into the buffer's uniform data
+struct BindUniformBlockCommand { unsigned int binding, offset, size; };
+// baseVertex counts from the start of the frame's streamed vertices
+struct DrawElementsBaseVertexCommand { unsigned int mode, count, indexType, offset; int baseVertex; };
+// slot indexes the query names handed to ExecuteCommands()
+struct QueryCommand { unsigned int target, slot; };
+struct BlendFuncCommand { unsigned int source, destination; };
+
+// linear stream of draw commands. Recording doesn't touch GL, so any thread can fill a buffer, only ExecuteCommands()
+// needs the context. Reset() keeps the memory, once a buffer has seen its largest frame recording doesn't allocate.
+// uniform blocks are copied into a separate block of memory that the GL thread uploads in one go before the replay
+class CommandBuffer
+{
+public:
+    void Reset() { words.clear(); uniformData.clear(); commandCount = 0; }
+    bool Empty() const { return words.empty(); }
+    int CommandCount() const { return commandCount; }
+    size_t SizeInBytes() const { return words.size() * sizeof(unsigned int); }
+
+    void BindProgram(unsigned int program) { push(COMMAND_BIND_PROGRAM, BindCommand{ program }); }
+    void BindVertexArray(unsigned int vertexArray) { push(COMMAND_BIND_VERTEX_ARRAY, BindCommand{ vertexArray }); }
+    void BindTexture(unsigned int unit, unsigned int target, unsigned int texture) { push(COMMAND_BIND_TEXTURE, BindTextureCommand{ unit, target, texture }); }
+    void Enable(unsigned int capability) { push(COMMAND_ENABLE, StateCommand{ capability }); }
+    void Disable(unsigned int capability) { push(COMMAND_DISABLE, StateCommand{ capability }); }
+    void DepthFunc(unsigned int function) { push(COMMAND_DEPTH_FUNC, StateCommand{ function }); }
+    void DepthMask(bool write) { push(COMMAND_DEPTH_MASK, StateCommand{ write ? 1u : 0u }); }
+    void BlendFunc(unsigned int source, unsigned int destination) { push(COMMAND_BLEND_FUNC, BlendFuncCommand{ source, destination }); }
+    void BeginQuery(unsigned int target, unsigned int slot) { push(COMMAND_BEGIN_QUERY, QueryCommand{ target, slot }); }
+    void EndQuery(unsigned int target) { push(COMMAND_END_QUERY, QueryCommand{ target, 0 }); }
+
+    // uniforms with a location of -1 are dropped right here, like GL would ignore them
+    void Uniform(int location, int value)
+    {
+        if (location >= 0)
+            push(COMMAND_UNIFORM_INT, UniformIntCommand{ location, value });
+    }
+    void Uniform(int location, const glm::vec3& value)
+    {
+        if (location < 0)
+            return;
+        UniformVec3Command command = {};
+        command.location = location;
+        memcpy(command.value, glm::value_ptr(value), sizeof(command.value));
+        push(COMMAND_UNIFORM_VEC3, command);
+    }
+    void Uniform(int location, const glm::vec4& value)
+    {
+        if (location < 0)
+            return;
+        UniformVec4Command command = {};
+        command.location = location;
+        memcpy(command.value, glm::value_ptr(value), sizeof(command.value));
+        push(COMMAND_UNIFORM_VEC4, command);
+    }
+    void Uniform(int location, const glm::mat4& value)
+    {
+        if (location < 0)
+            return;
+        UniformMat4Command command = {};
+        command.location = location;
+        memcpy(command.value, glm::value_ptr(value), sizeof(command.value));
+        push(COMMAND_UNIFORM_MAT4, command);
+    }
+
+    void DrawElements(unsigned int mode, unsigned int count, unsigned int indexType, unsigned int offset)
+    {
+        push(COMMAND_DRAW_ELEMENTS, DrawElementsCommand{ mode, count, indexType, offset });
+    }
+    void DrawElementsBaseVertex(unsigned int mode, unsigned int count, unsigned int indexType, unsigned int offset, int baseVertex)
+    {
+        push(COMMAND_DRAW_ELEMENTS_BASE_VERTEX, DrawElementsBaseVertexCommand{ mode, count, indexType, offset, baseVertex });
+    }
+
+    // copies value into the uniform data, the replay binds it to the block binding point
+    template <typename T>
+    void UniformBlock(unsigned int binding, const T& value)
+    {
+        UniformBlock(binding, &value, sizeof(T), sizeof(T));
+    }
+
+    // for blocks ending in an array that is only partly used: size bytes are copied, blockSize are bound
+    void UniformBlock(unsigned int binding, const void* data, unsigned int size, unsigned int blockSize)
+    {
+        unsigned int offset = (unsigned int)uniformData.size();
+        uniformData.resize(offset + (blockSize + UNIFORM_BLOCK_ALIGNMENT - 1) / UNIFORM_BLOCK_ALIGNMENT * UNIFORM_BLOCK_ALIGNMENT);
+        memcpy(&uniformData[offset], data, size);
+        push(COMMAND_BIND_UNIFORM_BLOCK, BindUniformBlockCommand{ binding, offset, blockSize });
+    }
+
+    const unsigned int* Data() const { return words.data(); }
+    size_t SizeInWords() const { return words.size(); }
+    // a multiple of UNIFORM_BLOCK_ALIGNMENT
+    const unsigned char* UniformData() const { return uniformData.data(); }
+    size_t UniformDataSize() const { return uniformData.size(); }
+
+private:
+    vector<unsigned int> words;
+    vector<unsigned char> uniformData;
+    int commandCount = 0;
+
+    template <typename T>
+    void push(CommandType type, const T& command)
+    {
+        static_assert(sizeof(T) % sizeof(unsigned int) == 0, "commands are made of whole words");
+        const size_t commandWords = sizeof(T) / sizeof(unsigned int);
+
+        size_t at = words.size();
+        words.resize(at + 1 + commandWords);
+        CommandHeader header = { type, (unsigned short)(1 + commandWords) };
+        memcpy(&words[at], &header, sizeof(header));
+        memcpy(&words[at + 1], &command, sizeof(T));
+        commandCount++;
+    }
+};
+
+// replays a buffer on the thread that owns the GL context. The buffer's uniform data has to be uploaded to
+// uniformBuffer at uniformBase, which has to be aligned to UNIFORM_BLOCK_ALIGNMENT. vertexBase is added to the base
+// vertex of every DrawElementsBaseVertex(), it is where the frame's streamed vertices start. queries are the query
+// objects BeginQuery() slots refer to
+inline void ExecuteCommands(const CommandBuffer& commands, GLuint uniformBuffer = 0, GLintptr uniformBase = 0, GLint vertexBase = 0, const GLuint* queries = nullptr)
+{
+    const unsigned int* word = commands.Data();
+    const unsigned int* end = word + commands.SizeInWords();
+    while (word < end)
+    {
+        CommandHeader header;
+        memcpy(&header, word, sizeof(header));
+        const void* command = word + 1;
+
+        switch (header.type)
+        {
+        case COMMAND_BIND_PROGRAM:
+            glUseProgram(((const BindCommand*)command)->object);
+            break;
+        case COMMAND_BIND_VERTEX_ARRAY:
+            glBindVertexArray(((const BindCommand*)command)->object);
+            break;
+        case COMMAND_BIND_TEXTURE:
+        {
+            const BindTextureCommand* bind = (const BindTextureCommand*)command;
+            glActiveTexture(GL_TEXTURE0 + bind->unit);
+            glBindTexture(bind->target, bind->texture);
+            break;
+        }
+        case COMMAND_ENABLE:
+            glEnable(((const StateCommand*)command)->capability);
+            break;
+        case COMMAND_DISABLE:
+            glDisable(((const StateCommand*)command)->capability);
+            break;
+        case COMMAND_UNIFORM_INT:
+        {
+            const UniformIntCommand* uniform = (const UniformIntCommand*)command;
+            glUniform1i(uniform->location, uniform->value);
+            break;
+        }
+        case COMMAND_UNIFORM_VEC3:
+        {
+            const UniformVec3Command* uniform = (const UniformVec3Command*)command;
+            glUniform3fv(uniform->location, 1, uniform->value);
+            break;
+        }
+        case COMMAND_UNIFORM_VEC4:
+        {
+            const UniformVec4Command* uniform = (const UniformVec4Command*)command;
+            glUniform4fv(uniform->location, 1, uniform->value);
+            break;
+        }
+        case COMMAND_UNIFORM_MAT4:
+        {
+            const UniformMat4Command* uniform = (const UniformMat4Command*)command;
+            glUniformMatrix4fv(uniform->location, 1, GL_FALSE, uniform->value);
+            break;
+        }
+        case COMMAND_DRAW_ELEMENTS:
+        {
+            const DrawElementsCommand* draw = (const DrawElementsCommand*)command;
+            glDrawElements(draw->mode, draw->count, draw->indexType, (void*)(size_t)draw->offset);
+            break;
+        }
+        case COMMAND_BIND_UNIFORM_BLOCK:
+        {
+            const BindUniformBlockCommand* bind = (const BindUniformBlockCommand*)command;
+            glBindBufferRange(GL_UNIFORM_BUFFER, bind->binding, uniformBuffer, uniformBase + bind->offset, bind->size);
+            break;
+        }
+        case COMMAND_DRAW_ELEMENTS_BASE_VERTEX:
+        {
+            const DrawElementsBaseVertexCommand* draw = (const DrawElementsBaseVertexCommand*)command;
+            glDrawElementsBaseVertex(draw->mode, draw->count, draw->indexType, (void*)(size_t)draw->offset, vertexBase + draw->baseVertex);
+            break;
+        }
+        case COMMAND_DEPTH_FUNC:
+            glDepthFunc(((const StateCommand*)command)->capability);
+            break;
+        case COMMAND_DEPTH_MASK:
+            glDepthMask(((const StateCommand*)command)->capability ? GL_TRUE : GL_FALSE);
+            break;
+        case COMMAND_BLEND_FUNC:
+        {
+            const BlendFuncCommand* blend = (const BlendFuncCommand*)command;
+            glBlendFunc(blend->source, blend->destination);
+            break;
+        }
+        case COMMAND_BEGIN_QUERY:
+        {
+            const QueryCommand* query = (const QueryCommand*)command;
+            glBeginQuery(query->target, queries[query->slot]);
+            break;
+        }
+        case COMMAND_END_QUERY:
+            glEndQuery(((const QueryCommand*)command)->target);
+            break;
+        }
+        word += header.size;
+    }
+}
+
+// the active uniforms of a program, looked up once on the GL thread so threads that record commands don't need GL
+class ProgramUniforms
+{
+public:
+    GLuint id;
+
+    ProgramUniforms() : id(0) {}
+
+    explicit ProgramUniforms(GLuint program) : id(program)
+    {
+        GLint count = 0;
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            char name[256];
+            GLsizei length;
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(program, i, sizeof(name), &length, &size, &type, name);
+            locations[name] = glGetUniformLocation(program, name);
+        }
+    }
+
+    // -1 when the program doesn't use the uniform, same as glGetUniformLocation
+    int Location(const string& name) const
+    {
+        auto it = locations.find(name);
+        return it == locations.end() ? -1 : it->second;
+    }
+
+private:
+    map<string, int> locations;
+};
+#endif
@@ -0,0 +1,34 @@
+#ifndef CPU_H
+#define CPU_H
+
+// the AVX2 kernels also use FMA, which every AVX2 CPU has. They are compiled when the build targets both, MSVC
+// compiles the intrinsics without /arch:AVX2 so there they are picked at runtime
+#if (defined(__AVX2__) && defined(__FMA__)) || defined(_MSC_VER)
+#define CPU_AVX2
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+inline bool CpuSupportsAVX2()
+{
+#if defined(__AVX2__) && defined(__FMA__)
+    return true;
+#elif defined(_MSC_VER)
+    int registers[4];
+    __cpuid(registers, 0);
+    if (registers[0] < 7)
+        return false;
+    // the OS has to save the ymm registers too
+    __cpuid(registers, 1);
+    bool fma = (registers[2] & (1 << 12)) != 0, osxsave = (registers[2] & (1 << 27)) != 0, avx = (registers[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(registers, 7, 0);
+    return (registers[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+// the 6 planes of a view frustum, xyz point inwards so a point is inside when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+// planes straight from the rows of projection * view (Gribb & Hartmann), in world space
+inline Frustum ExtractFrustum(const glm::mat4& viewProjection)
+{
+    glm::mat4 m = glm::transpose(viewProjection);
+    Frustum frustum;
+    frustum.planes[0] = m[3] + m[0]; // left
+    frustum.planes[1] = m[3] - m[0]; // right
+    frustum.planes[2] = m[3] + m[1]; // bottom
+    frustum.planes[3] = m[3] - m[1]; // top
+    frustum.planes[4] = m[3] + m[2]; // near
+    frustum.planes[5] = m[3] - m[2]; // far
+    for (int i = 0; i < 6; i++)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    return frustum;
+}
+
+// conservative: only false when the box is completely outside one of the planes
+inline bool IsBoxVisible(const Frustum& frustum, glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        const glm::vec4& plane = frustum.planes[i];
+        // the corner furthest along the plane normal
+        glm::vec3 corner(plane.x >= 0 ? boundsMax.x : boundsMin.x,
+                         plane.y >= 0 ? boundsMax.y : boundsMin.y,
+                         plane.z >= 0 ? boundsMax.z : boundsMin.z);
+        if (glm::dot(glm::vec3(plane), corner) + plane.w < 0)
+            return false;
+    }
+    return true;
+}
+
+inline bool IsSphereVisible(const Frustum& frustum, glm::vec3 center, float radius)
+{
+    for (int i = 0; i < 6; i++)
+        if (glm::dot(glm::vec3(frustum.planes[i]), center) + frustum.planes[i].w < -radius)
+            return false;
+    return true;
+}
+
+// axis aligned box around a transformed box (Arvo), without transforming all 8 corners
+inline void TransformBounds(const glm::mat4& world, glm::vec3 boundsMin, glm::vec3 boundsMax, glm::vec3& outMin, glm::vec3& outMax)
+{
+    outMin = outMax = glm::vec3(world[3]);
+    for (int column = 0; column < 3; column++)
+    {
+        glm::vec3 axis(world[column]);
+        glm::vec3 a = axis * boundsMin[column];
+        glm::vec3 b = axis * boundsMax[column];
+        outMin += glm::min(a, b);
+        outMax += glm::max(a, b);
+    }
+}
+#endif
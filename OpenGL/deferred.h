@@ -0,0 +1,186 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "framegraph.h"
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+using namespace std;
+
+// point light as the light volumes and the shaders read it
+struct PointLight {
+    // xyz position, w radius where the light reaches 0
+    glm::vec4 sphere;
+    // rgb color times intensity, w unused
+    glm::vec4 color;
+};
+
+// render targets of the deferred path, transient targets of the frame's FrameGraph. The geometry pass writes the surface
+// attributes, the lighting passes add up the light of every pixel in the light target. The lighting passes sample the
+// depth, so it isn't attached to the light target (that would be a feedback loop). Once the lights are added the
+// albedo, normal and material are dead, and their textures go back to the pool for the targets after them. Texture
+// units the lighting shaders read them from:
+//   0 albedo   RGBA8  rgb albedo, a specular intensity
+//   1 normal   RG16   octahedral world space normal in 0..1
+//   2 material RG8    roughness, ambient occlusion
+//   3 depth    DEPTH24
+//   4 light    RGBA16F
+class GBuffer
+{
+public:
+    enum Unit { ALBEDO_UNIT = 0, NORMAL_UNIT, MATERIAL_UNIT, DEPTH_UNIT, LIGHT_UNIT };
+
+    // resources of the graph the last Declare() was for
+    int albedo, normal, material, depth, light;
+
+    GBuffer() : albedo(-1), normal(-1), material(-1), depth(-1), light(-1), emptyVAO(0) {}
+
+    ~GBuffer()
+    {
+        if (emptyVAO)
+            glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    // needs a current GL context
+    void Create()
+    {
+        // core profile draws need a vertex array even when the vertex shader makes up its vertices
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    // the targets of a frame drawn at width x height, before its passes are added
+    void Declare(FrameGraph& graph, int width, int height)
+    {
+        albedo = graph.Create(width, height, GL_RGBA8);
+        normal = graph.Create(width, height, GL_RG16);
+        material = graph.Create(width, height, GL_RG8);
+        depth = graph.Create(width, height, GL_DEPTH_COMPONENT24);
+        light = graph.Create(width, height, GL_RGBA16F);
+    }
+
+    // the geometry pass draws into these together
+    vector<int> Surface() const { return { albedo, normal, material }; }
+
+    // pass reads the surface and the depth on their Unit
+    void ReadSurface(FrameGraph& graph, int pass) const
+    {
+        graph.Read(pass, albedo, ALBEDO_UNIT);
+        graph.Read(pass, normal, NORMAL_UNIT);
+        graph.Read(pass, material, MATERIAL_UNIT);
+        graph.Read(pass, depth, DEPTH_UNIT);
+    }
+
+    // one triangle over the whole target, made up in the vertex shader from gl_VertexID
+    void DrawFullscreen() const
+    {
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+    }
+
+private:
+    GLuint emptyVAO;
+};
+
+// draws every point light as a sphere around the space it reaches, instanced, so the lighting shader only runs on the
+// pixels the light can touch. The sphere is a little larger than the radius so its flat faces still cover all of it.
+// Drawn with the front faces culled, so the camera can be inside a volume
+class LightVolumes
+{
+public:
+    static const int RINGS = 8;
+    static const int SEGMENTS = 12;
+
+    LightVolumes() : VAO(0), VBO(0), EBO(0), instanceVBO(0), indexCount(0), capacity(0) {}
+
+    ~LightVolumes()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        GLuint buffers[] = { VBO, EBO, instanceVBO };
+        glDeleteBuffers(3, buffers);
+    }
+
+    // needs a current GL context
+    void Create()
+    {
+        // the faces of a UV sphere are cos(pi / segments) and cos(pi / (2 * rings)) closer in than its vertices
+        float scale = 1.0f / (cosf(3.14159265f / SEGMENTS) * cosf(3.14159265f / (2 * RINGS)));
+        vector<glm::vec3> vertices;
+        for (int r = 0; r <= RINGS; r++)
+        {
+            float theta = 3.14159265f * r / RINGS;
+            for (int s = 0; s < SEGMENTS; s++)
+            {
+                float phi = 2.0f * 3.14159265f * s / SEGMENTS;
+                vertices.push_back(glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * scale);
+            }
+        }
+        vector<unsigned short> indices;
+        for (int r = 0; r < RINGS; r++)
+        {
+            for (int s = 0; s < SEGMENTS; s++)
+            {
+                unsigned short a = (unsigned short)(r * SEGMENTS + s), b = (unsigned short)(r * SEGMENTS + (s + 1) % SEGMENTS);
+                unsigned short c = (unsigned short)(a + SEGMENTS), d = (unsigned short)(b + SEGMENTS);
+                // counter clockwise seen from outside
+                indices.insert(indices.end(), { a, b, c, b, d, c });
+            }
+        }
+        indexCount = (GLsizei)indices.size();
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &instanceVBO);
+
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), indices.data(), GL_STATIC_DRAW);
+
+        // one PointLight per instance
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(PointLight), (void*)offsetof(PointLight, sphere));
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(PointLight), (void*)offsetof(PointLight, color));
+        glVertexAttribDivisor(2, 1);
+
+        glBindVertexArray(0);
+    }
+
+    // the program has to be bound
+    void Draw(const vector<PointLight>& lights)
+    {
+        if (lights.empty())
+            return;
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        GLsizeiptr size = lights.size() * sizeof(PointLight);
+        // orphan the last frame's lights instead of waiting for the GPU to be done with them
+        if ((size_t)size > capacity)
+            capacity = size;
+        glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size, lights.data());
+
+        glBindVertexArray(VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, 0, (GLsizei)lights.size());
+        glBindVertexArray(0);
+    }
+
+private:
+    GLuint VAO, VBO, EBO, instanceVBO;
+    GLsizei indexCount;
+    size_t capacity;
+};
+#endif
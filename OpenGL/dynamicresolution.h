@@ -0,0 +1,85 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// picks the share of the full resolution the scene is drawn at from how long the GPU took for the frames before, in
+// steps of STEP between MIN_SCALE and 1. The measured times are smoothed, and the scale only goes:
+//  - down once the smoothed time stayed over OVER_BUDGET of the budget for OVER_FRAMES frames, straight to the step
+//    whose pixel count is expected to land in the middle of the dead band
+//  - up one step once it stayed under UNDER_BUDGET for UNDER_FRAMES frames, which is much longer, so a short quiet
+//    stretch doesn't bring back a resolution that was too slow
+// and after a change nothing happens for COOLDOWN_FRAMES frames, the timer queries are a few frames behind. Between
+// the two thresholds the scale stays where it is, so it doesn't oscillate
+class DynamicResolution
+{
+public:
+    static constexpr float MIN_SCALE = 0.5f, STEP = 0.05f;
+    static constexpr double OVER_BUDGET = 0.95, UNDER_BUDGET = 0.75;
+    static const int OVER_FRAMES = 4, UNDER_FRAMES = 45, COOLDOWN_FRAMES = 20;
+
+    bool enabled;
+    double budgetMs;
+
+    DynamicResolution(double budgetMs = 1000.0 / 60.0) : enabled(true), budgetMs(budgetMs), steps(0), smoothedMs(0.0), overFrames(0), underFrames(0), cooldown(0) {}
+
+    float Scale() const { return 1.0f - steps * STEP; }
+    double SmoothedMs() const { return smoothedMs; }
+
+    // with every GPU frame time that comes back, true when the scale changed
+    bool Update(double gpuMs)
+    {
+        smoothedMs = smoothedMs == 0.0 ? gpuMs : smoothedMs + (gpuMs - smoothedMs) * 0.1;
+        if (!enabled)
+            return setSteps(0);
+        if (cooldown > 0)
+        {
+            cooldown--;
+            return false;
+        }
+
+        if (smoothedMs > budgetMs * OVER_BUDGET)
+        {
+            underFrames = 0;
+            if (++overFrames < OVER_FRAMES)
+                return false;
+            // the GPU time goes with the pixel count, the square of the scale
+            float target = Scale() * (float)sqrt(budgetMs * (OVER_BUDGET + UNDER_BUDGET) * 0.5 / smoothedMs);
+            return setSteps(std::max((int)ceilf((1.0f - target) / STEP - 1e-3f), steps + 1));
+        }
+        overFrames = 0;
+        if (smoothedMs < budgetMs * UNDER_BUDGET)
+        {
+            if (++underFrames < UNDER_FRAMES)
+                return false;
+            return setSteps(steps - 1);
+        }
+        underFrames = 0;
+        return false;
+    }
+
+private:
+    int steps;
+    double smoothedMs;
+    int overFrames, underFrames, cooldown;
+
+    bool setSteps(int newSteps)
+    {
+        newSteps = glm::clamp(newSteps, 0, (int)lroundf((1.0f - MIN_SCALE) / STEP));
+        if (newSteps == steps)
+            return false;
+
+        // what the frames are expected to take now, so the smoothing doesn't have to catch up from the old time
+        float oldScale = Scale();
+        steps = newSteps;
+        smoothedMs *= (Scale() * Scale()) / (oldScale * oldScale);
+        overFrames = underFrames = 0;
+        cooldown = COOLDOWN_FRAMES;
+        return true;
+    }
+};
+#endif
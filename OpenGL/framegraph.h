@@ -0,0 +1,352 @@
+#ifndef FRAMEGRAPH_H
+#define FRAMEGRAPH_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "rendertargets.h"
+
+#include <vector>
+#include <functional>
+#include <cstddef>
+#include <algorithm>
+using namespace std;
+
+// what Compile() found for the passes of a frame. The memory is only that of the targets the graph's passes use, what
+// lives on across frames outside the graph (the shadow maps) isn't in it
+struct FrameGraphStats {
+    int passes, culledPasses;
+    // transient targets the passes that aren't culled use, and the pool textures they take with aliasing
+    int transients, textures;
+    // most transient target memory alive at once, what the textures take (only the same size and format alias, so it
+    // can be more), and what they would take each in a texture of its own
+    size_t peakBytes, allocatedBytes, unaliasedBytes;
+    // of the imported textures the passes use
+    size_t importedBytes;
+
+    bool operator==(const FrameGraphStats& other) const
+    {
+        return passes == other.passes && culledPasses == other.culledPasses && transients == other.transients && textures == other.textures &&
+               peakBytes == other.peakBytes && allocatedBytes == other.allocatedBytes && unaliasedBytes == other.unaliasedBytes &&
+               importedBytes == other.importedBytes;
+    }
+    bool operator!=(const FrameGraphStats& other) const { return !(*this == other); }
+};
+
+// the passes of a frame with the targets each draws into and the textures it reads, built again every frame. A pass
+// draws into one target, or into several color targets and a depth target at once (the G-buffer).
+// Compile() then works out:
+//  - which passes are culled: those none of whose targets anybody after them reads. Imported targets live on outside
+//    the graph (the screen, what the next frame reads), so passes drawing into them always stay, and so do the passes
+//    marked with Keep(), which hand their target to something outside the graph (a read back)
+//  - the lifetimes of the transient targets, from the first pass that isn't culled using one to the last. Execute() takes
+//    a target from the pool at its first pass and gives it back after its last, so targets whose lifetimes don't
+//    overlap share a texture when they have the same size and format
+// Execute() only binds a target or sets the viewport when the pass before left something else, only clears when the
+// pass asked for it, and binds the reads to their units only when they don't hold them already. So a pass may bind
+// textures of its own, but not on the units the graph binds reads to, and must leave the framebuffer bound
+class FrameGraph
+{
+public:
+    // what a pass does with what its targets held: doesn't care (it draws every texel), clears them (colors to 0, depth
+    // to 1, the depth mask has to be on), or draws onto them
+    enum Load { LOAD_NONE, LOAD_CLEAR, LOAD_KEEP };
+
+    FrameGraph() : stats() {}
+
+    // before the passes of a frame are added
+    void Reset()
+    {
+        resources.clear();
+        passes.clear();
+        stats = FrameGraphStats();
+    }
+
+    // a target that only lives during the frame, the texture comes from the pool
+    int Create(int width, int height, GLenum format)
+    {
+        Resource resource = {};
+        resource.target = { 0, 0, width, height, format };
+        resources.push_back(resource);
+        return (int)resources.size() - 1;
+    }
+
+    // a texture owned outside the graph, framebuffer draws into it. 0 and 0 for the default framebuffer
+    int Import(GLuint texture, GLuint framebuffer, int width, int height, GLenum format)
+    {
+        Resource resource = {};
+        resource.target = { texture, framebuffer, width, height, format };
+        resource.imported = true;
+        resources.push_back(resource);
+        return (int)resources.size() - 1;
+    }
+
+    // execute draws with the target bound and the reads on their units, unit 0 active
+    int AddPass(int target, Load load, function<void()> execute)
+    {
+        bool depth = IsDepthFormat(resources[target].target.format);
+        return AddPass(depth ? vector<int>() : vector<int>(1, target), depth ? target : -1, load, std::move(execute));
+    }
+
+    // draws into colors (draw buffers 0, 1, ..) and depth (-1 for none) together, they have to be the same size
+    int AddPass(const vector<int>& colors, int depth, Load load, function<void()> execute)
+    {
+        Pass pass;
+        pass.targets = colors;
+        pass.colorCount = (int)colors.size();
+        if (depth >= 0)
+            pass.targets.push_back(depth);
+        pass.load = load;
+        pass.execute = std::move(execute);
+        pass.viewportWidth = resources[pass.targets[0]].target.width;
+        pass.viewportHeight = resources[pass.targets[0]].target.height;
+        pass.culled = false;
+        pass.kept = false;
+        passes.push_back(std::move(pass));
+        return (int)passes.size() - 1;
+    }
+
+    // the pass only draws into the lower left width x height of its targets
+    void Viewport(int pass, int width, int height)
+    {
+        passes[pass].viewportWidth = width;
+        passes[pass].viewportHeight = height;
+    }
+
+    // the pass is never culled, something outside the graph takes what it drew
+    void Keep(int pass) { passes[pass].kept = true; }
+
+    // unit -1 takes the one after the pass's last read
+    void Read(int pass, int resource, int unit = -1)
+    {
+        vector<Input>& reads = passes[pass].reads;
+        Input input = { resource, unit >= 0 ? unit : (reads.empty() ? 0 : reads.back().unit + 1) };
+        reads.push_back(input);
+    }
+
+    void Compile()
+    {
+        // backwards: a target is live while a pass after reads what is in it
+        vector<char> live(resources.size(), 0);
+        for (int i = (int)passes.size() - 1; i >= 0; i--)
+        {
+            Pass& pass = passes[i];
+            pass.culled = !pass.kept;
+            for (int target : pass.targets)
+                if (resources[target].imported || live[target])
+                    pass.culled = false;
+            // the pass hides what the targets held before from the passes after, unless it draws onto them
+            for (int target : pass.targets)
+                if (pass.load != LOAD_KEEP)
+                    live[target] = 0;
+            if (pass.culled)
+                continue;
+            for (int target : pass.targets)
+                if (pass.load == LOAD_KEEP)
+                    live[target] = 1;
+            for (const Input& input : pass.reads)
+                live[input.resource] = 1;
+        }
+
+        for (Resource& resource : resources)
+            resource.first = resource.last = -1;
+        stats = FrameGraphStats();
+        stats.passes = (int)passes.size();
+        for (int i = 0; i < (int)passes.size(); i++)
+        {
+            if (passes[i].culled)
+            {
+                stats.culledPasses++;
+                continue;
+            }
+            for (int target : passes[i].targets)
+                use(target, i);
+            for (const Input& input : passes[i].reads)
+                use(input.resource, i);
+        }
+
+        // the same walk Execute() does through the pool, to count what the aliasing saves
+        struct Slot {
+            int width, height;
+            GLenum format;
+            bool free;
+        };
+        vector<Slot> slots;
+        vector<int> slotOf(resources.size(), -1);
+        for (int i = 0; i < (int)passes.size(); i++)
+        {
+            size_t alive = 0;
+            for (int r = 0; r < (int)resources.size(); r++)
+            {
+                const Resource& resource = resources[r];
+                if (resource.imported || resource.first < 0 || resource.first > i || resource.last < i)
+                    continue;
+                alive += bytes(resource);
+                if (resource.first != i)
+                    continue;
+                for (int s = 0; s < (int)slots.size() && slotOf[r] < 0; s++)
+                    if (slots[s].free && slots[s].width == resource.target.width && slots[s].height == resource.target.height && slots[s].format == resource.target.format)
+                        slotOf[r] = s;
+                if (slotOf[r] < 0)
+                {
+                    Slot slot = { resource.target.width, resource.target.height, resource.target.format, false };
+                    slots.push_back(slot);
+                    slotOf[r] = (int)slots.size() - 1;
+                    stats.allocatedBytes += bytes(resource);
+                }
+                slots[slotOf[r]].free = false;
+            }
+            stats.peakBytes = std::max(stats.peakBytes, alive);
+            for (int r = 0; r < (int)resources.size(); r++)
+                if (!resources[r].imported && resources[r].last == i)
+                    slots[slotOf[r]].free = true;
+        }
+        stats.textures = (int)slots.size();
+        for (const Resource& resource : resources)
+        {
+            if (resource.first < 0)
+                continue;
+            if (resource.imported)
+                stats.importedBytes += resource.target.texture ? bytes(resource) : 0;
+            else
+            {
+                stats.transients++;
+                stats.unaliasedBytes += bytes(resource);
+            }
+        }
+    }
+
+    // after Compile(), needs the GL context. Leaves the last pass's target bound and the units it used empty
+    void Execute(RenderTargetPool& pool)
+    {
+        bool bound = false;
+        GLuint framebuffer = 0;
+        int viewportWidth = 0, viewportHeight = 0;
+        vector<GLuint> units;
+        int activeUnit = -1;
+        vector<GLuint> colors;
+
+        for (int i = 0; i < (int)passes.size(); i++)
+        {
+            const Pass& pass = passes[i];
+            if (pass.culled)
+                continue;
+            for (Resource& resource : resources)
+                if (!resource.imported && resource.first == i)
+                    resource.target = pool.Acquire(resource.target.width, resource.target.height, resource.target.format);
+
+            // one target draws with its own framebuffer, several with the pool's for the combination
+            GLuint passFramebuffer = resources[pass.targets[0]].target.framebuffer;
+            GLenum depthFormat = pass.colorCount < (int)pass.targets.size() ? resources[pass.targets.back()].target.format : GL_NONE;
+            if (pass.targets.size() > 1)
+            {
+                colors.clear();
+                for (int c = 0; c < pass.colorCount; c++)
+                    colors.push_back(resources[pass.targets[c]].target.texture);
+                passFramebuffer = pool.Framebuffer(colors, depthFormat != GL_NONE ? resources[pass.targets.back()].target.texture : 0, depthFormat);
+            }
+            if (!bound || passFramebuffer != framebuffer)
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, passFramebuffer);
+                framebuffer = passFramebuffer;
+                bound = true;
+            }
+            if (pass.viewportWidth != viewportWidth || pass.viewportHeight != viewportHeight)
+            {
+                glViewport(0, 0, pass.viewportWidth, pass.viewportHeight);
+                viewportWidth = pass.viewportWidth;
+                viewportHeight = pass.viewportHeight;
+            }
+            if (pass.load == LOAD_CLEAR)
+            {
+                glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+                glClear((pass.colorCount > 0 ? GL_COLOR_BUFFER_BIT : 0) | (depthFormat != GL_NONE ? GL_DEPTH_BUFFER_BIT : 0) |
+                        (depthFormat == GL_DEPTH24_STENCIL8 ? GL_STENCIL_BUFFER_BIT : 0));
+            }
+
+            // a target may still be on a unit from a pass that read it, sampling it while drawing into it is a feedback loop
+            for (int target : pass.targets)
+                for (int unit = 0; unit < (int)units.size(); unit++)
+                    if (resources[target].target.texture && units[unit] == resources[target].target.texture)
+                        bindUnit(units, activeUnit, unit, 0);
+            for (const Input& input : pass.reads)
+                bindUnit(units, activeUnit, input.unit, resources[input.resource].target.texture);
+            if (activeUnit != 0)
+            {
+                glActiveTexture(GL_TEXTURE0);
+                activeUnit = 0;
+            }
+
+            pass.execute();
+
+            for (Resource& resource : resources)
+                if (!resource.imported && resource.last == i)
+                    pool.Release(resource.target);
+        }
+
+        for (int unit = 0; unit < (int)units.size(); unit++)
+            bindUnit(units, activeUnit, unit, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    const FrameGraphStats& Stats() const { return stats; }
+
+    // what a resource is drawn with, for the passes that need more than the graph binds (a blit). Transient targets only
+    // have their texture while Execute() runs the passes from their first to their last
+    const RenderTarget& Target(int resource) const { return resources[resource].target; }
+
+private:
+    struct Resource {
+        RenderTarget target;
+        bool imported;
+        // first and last pass that isn't culled using it, -1 when none is
+        int first, last;
+    };
+
+    struct Input {
+        int resource, unit;
+    };
+
+    struct Pass {
+        // the colors, then the depth when there is one
+        vector<int> targets;
+        int colorCount;
+        Load load;
+        vector<Input> reads;
+        function<void()> execute;
+        int viewportWidth, viewportHeight;
+        bool culled, kept;
+    };
+
+    vector<Resource> resources;
+    vector<Pass> passes;
+    FrameGraphStats stats;
+
+    void use(int resource, int pass)
+    {
+        Resource& r = resources[resource];
+        if (r.first < 0)
+            r.first = pass;
+        r.last = pass;
+    }
+
+    static size_t bytes(const Resource& resource)
+    {
+        return (size_t)resource.target.width * resource.target.height * RenderTargetTexelBytes(resource.target.format);
+    }
+
+    static void bindUnit(vector<GLuint>& units, int& activeUnit, int unit, GLuint texture)
+    {
+        if (unit >= (int)units.size())
+            units.resize(unit + 1, 0);
+        if (units[unit] == texture)
+            return;
+        if (activeUnit != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        units[unit] = texture;
+    }
+};
+#endif
@@ -0,0 +1,74 @@
+#ifndef FRAMEPIPELINE_H
+#define FRAMEPIPELINE_H
+
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+// hands frames from one producer thread to one consumer thread through two packets, so the producer fills frame n + 1
+// while the consumer still reads frame n. The producer never gets more than one frame ahead: it waits in BeginWrite()
+// until the consumer is done with the packet it wants to reuse.
+template <typename Packet>
+class FramePipeline
+{
+public:
+    FramePipeline() : written(0), read(0), closed(false) {}
+
+    // the packet to fill next, waits while the consumer still reads it
+    Packet& BeginWrite()
+    {
+        unique_lock<mutex> lock(stateMutex);
+        changed.wait(lock, [&] { return closed || written - read < 2; });
+        return packets[written % 2];
+    }
+
+    // hands the packet from BeginWrite() to the consumer
+    void EndWrite()
+    {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            written++;
+        }
+        changed.notify_all();
+    }
+
+    // oldest packet that wasn't read yet, waits for one. Null once the pipeline is closed
+    const Packet* BeginRead()
+    {
+        unique_lock<mutex> lock(stateMutex);
+        changed.wait(lock, [&] { return closed || read < written; });
+        if (closed)
+            return nullptr;
+        return &packets[read % 2];
+    }
+
+    // the packet from BeginRead() can be reused by the producer
+    void EndRead()
+    {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            read++;
+        }
+        changed.notify_all();
+    }
+
+    // wakes both sides, the consumer gets null from then on
+    void Close()
+    {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            closed = true;
+        }
+        changed.notify_all();
+    }
+
+private:
+    Packet packets[2];
+    // packets handed over and packets given back, both only grow
+    unsigned long long written, read;
+    bool closed;
+
+    mutex stateMutex;
+    condition_variable changed;
+};
+#endif
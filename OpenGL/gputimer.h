@@ -0,0 +1,169 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+// measures how long the GPU spends on the commands issued between Begin() and End().
+// GL_TIME_ELAPSED queries are kept in a small ring, results are only read back once the driver
+// reports them available so timing a pass never stalls the pipeline.
+// note: only one GL_TIME_ELAPSED query can be active at a time, so timers can't be nested.
+class GpuTimer
+{
+public:
+    static const int QUERY_COUNT = 4;
+
+    // last finished measurement and the running average since the last Reset()
+    double lastMs;
+    double totalMs;
+    unsigned int samples;
+
+    GpuTimer() : lastMs(0.0), totalMs(0.0), samples(0), head(0), inFlight(0)
+    {
+        for (int i = 0; i < QUERY_COUNT; i++)
+            queries[i] = 0;
+    }
+
+    // needs a current GL context
+    void Init()
+    {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    void Begin()
+    {
+        // every query is still waiting on the GPU, wait for the oldest one to free up a slot
+        if (inFlight == QUERY_COUNT)
+            Collect(true);
+
+        glBeginQuery(GL_TIME_ELAPSED, queries[head]);
+    }
+
+    void End()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        head = (head + 1) % QUERY_COUNT;
+        inFlight++;
+    }
+
+    // reads back every finished query, call once a frame
+    void Collect(bool wait = false)
+    {
+        while (inFlight > 0)
+        {
+            GLuint query = queries[(head - inFlight + QUERY_COUNT) % QUERY_COUNT];
+            if (!wait)
+            {
+                GLint available = 0;
+                glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    break;
+            }
+            // only block on the first query, the ones after it may still be running
+            wait = false;
+
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+            lastMs = ns / 1000000.0;
+            totalMs += lastMs;
+            samples++;
+            inFlight--;
+        }
+    }
+
+    // waits until every query issued so far has been read back
+    void Finish()
+    {
+        while (inFlight > 0)
+            Collect(true);
+    }
+
+    double AverageMs() const
+    {
+        return samples > 0 ? totalMs / samples : 0.0;
+    }
+
+    void Reset()
+    {
+        // drop whatever is still in flight so it doesn't end up in the new average
+        Finish();
+        lastMs = 0.0;
+        totalMs = 0.0;
+        samples = 0;
+    }
+
+private:
+    GLuint queries[QUERY_COUNT];
+    int head;
+    int inFlight;
+};
+
+// like GpuTimer, but from a timestamp at Begin() to one at End(). Timestamps aren't GL_TIME_ELAPSED queries, so the
+// span can cover passes that have GpuTimers of their own, a whole frame for example
+class GpuSpanTimer
+{
+public:
+    static const int QUERY_COUNT = 4;
+
+    // last finished measurement and how many there have been
+    double lastMs;
+    unsigned int samples;
+
+    GpuSpanTimer() : lastMs(0.0), samples(0), head(0), inFlight(0)
+    {
+        for (int i = 0; i < QUERY_COUNT; i++)
+            queries[i][0] = queries[i][1] = 0;
+    }
+
+    // needs a current GL context
+    void Init()
+    {
+        glGenQueries(QUERY_COUNT * 2, &queries[0][0]);
+    }
+
+    void Begin()
+    {
+        // every pair is still waiting on the GPU, the oldest has to be read to free it
+        if (inFlight == QUERY_COUNT)
+            Collect(true);
+
+        glQueryCounter(queries[head][0], GL_TIMESTAMP);
+    }
+
+    void End()
+    {
+        glQueryCounter(queries[head][1], GL_TIMESTAMP);
+        head = (head + 1) % QUERY_COUNT;
+        inFlight++;
+    }
+
+    // reads back every finished span, call once a frame
+    void Collect(bool wait = false)
+    {
+        while (inFlight > 0)
+        {
+            GLuint* pair = queries[(head - inFlight + QUERY_COUNT) % QUERY_COUNT];
+            if (!wait)
+            {
+                // the end is written after the begin
+                GLint available = 0;
+                glGetQueryObjectiv(pair[1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    break;
+            }
+            wait = false;
+
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(pair[0], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(pair[1], GL_QUERY_RESULT, &end);
+            lastMs = (end - begin) / 1000000.0;
+            samples++;
+            inFlight--;
+        }
+    }
+
+private:
+    GLuint queries[QUERY_COUNT][2];
+    int head;
+    int inFlight;
+};
+#endif
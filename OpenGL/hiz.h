@@ -0,0 +1,275 @@
+#ifndef HIZ_H
+#define HIZ_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "framegraph.h"
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// farthest depth pyramid of a frame on the CPU. Level 0 is what the GPU reduced the depth buffer to, every level after
+// it half the size (rounded up) with each texel the farthest of the 2x2 under it. Depths are window depths (0 near,
+// 1 far) of the camera viewProjection was taken from. The frame may have been drawn into only the lower left
+// viewportScale of its depth buffer, the rest of it cleared to 1
+struct HiZPyramid {
+    vector<vector<float>> levels;
+    vector<int> widths, heights;
+    glm::mat4 viewProjection;
+    glm::vec2 viewportScale = glm::vec2(1.0f);
+    // of the frame it was read back from, 0 while there is none yet
+    unsigned int frame = 0;
+
+    // conservative: only true when every point of the box is behind what the pyramid's frame drew where it lands
+    bool IsBoxOccluded(glm::vec3 boundsMin, glm::vec3 boundsMax) const
+    {
+        if (levels.empty())
+            return false;
+
+        // screen rectangle and nearest depth of the 8 corners
+        float minX = 1.0f, minY = 1.0f, maxX = -1.0f, maxY = -1.0f, nearest = 1.0f;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 clip = viewProjection * glm::vec4(i & 1 ? boundsMax.x : boundsMin.x, i & 2 ? boundsMax.y : boundsMin.y, i & 4 ? boundsMax.z : boundsMin.z, 1.0f);
+            // reaches behind the camera, no rectangle to test
+            if (clip.w <= 1e-4f)
+                return false;
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            minX = std::min(minX, ndc.x);
+            maxX = std::max(maxX, ndc.x);
+            minY = std::min(minY, ndc.y);
+            maxY = std::max(maxY, ndc.y);
+            nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+        }
+        if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+            return false;
+
+        int x0 = texel(minX, viewportScale.x, widths[0]), x1 = texel(maxX, viewportScale.x, widths[0]);
+        int y0 = texel(minY, viewportScale.y, heights[0]), y1 = texel(maxY, viewportScale.y, heights[0]);
+        // the first level where the rectangle covers at most 2x2 texels
+        int level = 0;
+        while (level + 1 < (int)levels.size() && std::max(x1 - x0, y1 - y0) >= 2)
+        {
+            x0 >>= 1; x1 >>= 1; y0 >>= 1; y1 >>= 1;
+            level++;
+        }
+
+        const vector<float>& depths = levels[level];
+        int width = widths[level];
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                if (nearest <= depths[y * width + x])
+                    return false;
+        return true;
+    }
+
+    // builds levels 1.. from level 0
+    void BuildLevels()
+    {
+        levels.resize(1);
+        widths.resize(1);
+        heights.resize(1);
+        while (widths.back() > 1 || heights.back() > 1)
+        {
+            int sourceWidth = widths.back(), sourceHeight = heights.back();
+            int width = (sourceWidth + 1) / 2, height = (sourceHeight + 1) / 2;
+            vector<float> level(width * height);
+            const vector<float>& source = levels.back();
+            for (int y = 0; y < height; y++)
+            {
+                int y0 = y * 2, y1 = std::min(y * 2 + 1, sourceHeight - 1);
+                for (int x = 0; x < width; x++)
+                {
+                    int x0 = x * 2, x1 = std::min(x * 2 + 1, sourceWidth - 1);
+                    level[y * width + x] = std::max(std::max(source[y0 * sourceWidth + x0], source[y0 * sourceWidth + x1]),
+                                                    std::max(source[y1 * sourceWidth + x0], source[y1 * sourceWidth + x1]));
+                }
+            }
+            levels.push_back(std::move(level));
+            widths.push_back(width);
+            heights.push_back(height);
+        }
+    }
+
+private:
+    static int texel(float ndc, float scale, int size)
+    {
+        return glm::clamp((int)((ndc * 0.5f + 0.5f) * scale * size), 0, size - 1);
+    }
+};
+
+// the render thread's half of the occlusion culling. After a frame is drawn its depth buffer is reduced on the GPU to
+// a farthest depth image REDUCTIONS halvings smaller, which is read back through a ring of pixel buffers. A read back
+// is only mapped once its fence has passed, so nothing waits on the GPU; the pyramid the main thread culls with is
+// two or three frames old. The main thread takes it with Latest(), tests against it with the matrices it was drawn with.
+// The levels of the reduction are transient targets of the frame's FrameGraph, each only lives until the next one is
+// drawn from it, and the last one until it is copied into the read back
+class HiZBuffer
+{
+public:
+    static const int REDUCTIONS = 4;
+    static const int READBACKS = 3;
+
+    HiZBuffer() : program(0), emptyVAO(0), frame(0), head(0)
+    {
+        for (int i = 0; i < READBACKS; i++)
+        {
+            readbacks[i].buffer = 0;
+            readbacks[i].fence = 0;
+        }
+    }
+
+    ~HiZBuffer()
+    {
+        // Create() never ran, the headless frame graph test adds the passes without a GL context
+        if (!emptyVAO)
+            return;
+        glDeleteVertexArrays(1, &emptyVAO);
+        for (Readback& readback : readbacks)
+        {
+            glDeleteBuffers(1, &readback.buffer);
+            if (readback.fence)
+                glDeleteSync(readback.fence);
+        }
+    }
+
+    // needs a current GL context. reduceProgram is fullscreenVertex with hizReduceFragment, width x height the size of
+    // the depth buffers that are captured
+    void Create(int width, int height, GLuint reduceProgram)
+    {
+        program = reduceProgram;
+        glm::ivec2 size = LevelSize(width, height, REDUCTIONS - 1);
+        for (Readback& readback : readbacks)
+        {
+            glGenBuffers(1, &readback.buffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, size.x * size.y * sizeof(float), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    // level i of the reduction of a width x height depth buffer
+    static glm::ivec2 LevelSize(int width, int height, int level)
+    {
+        glm::ivec2 size(width, height);
+        for (int i = 0; i <= level; i++)
+            size = (size + 1) / 2;
+        return size;
+    }
+
+    // the reduction of depth, a width x height resource of graph, after the passes that draw it. viewportScale is the
+    // part of it the frame was drawn into, viewProjection the camera it was drawn with. Returns the last pass
+    int AddPasses(FrameGraph& graph, int depth, int width, int height, const glm::mat4& viewProjection, glm::vec2 viewportScale = glm::vec2(1.0f))
+    {
+        int source = depth, pass = -1;
+        for (int i = 0; i < REDUCTIONS; i++)
+        {
+            glm::ivec2 size = LevelSize(width, height, i);
+            int level = graph.Create(size.x, size.y, GL_R32F);
+            bool last = i == REDUCTIONS - 1;
+            pass = graph.AddPass(level, FrameGraph::LOAD_NONE, [=]() {
+                glDisable(GL_DEPTH_TEST);
+                glDisable(GL_CULL_FACE);
+                glUseProgram(program);
+                glBindVertexArray(emptyVAO);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+                glBindVertexArray(0);
+                if (last)
+                    readBack(size, viewProjection, viewportScale);
+            });
+            graph.Read(pass, source, 0);
+            source = level;
+        }
+        // nothing in the graph reads the last level
+        graph.Keep(pass);
+        return pass;
+    }
+
+    // once a frame, maps the newest read back whose fence has passed. Never waits
+    void Collect()
+    {
+        for (int i = 0; i < READBACKS; i++)
+        {
+            // oldest first
+            Readback& readback = readbacks[(head + i) % READBACKS];
+            if (!readback.fence || glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                continue;
+            glDeleteSync(readback.fence);
+            readback.fence = 0;
+
+            glm::ivec2 size = readback.size;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            const float* depths = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size.x * size.y * sizeof(float), GL_MAP_READ_BIT);
+            if (depths)
+            {
+                HiZPyramid pyramid;
+                pyramid.levels.push_back(vector<float>(depths, depths + size.x * size.y));
+                pyramid.widths.push_back(size.x);
+                pyramid.heights.push_back(size.y);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                pyramid.BuildLevels();
+                pyramid.viewProjection = readback.viewProjection;
+                pyramid.viewportScale = readback.viewportScale;
+                pyramid.frame = readback.frame;
+
+                lock_guard<mutex> lock(latestMutex);
+                if (pyramid.frame > latest.frame)
+                    latest = std::move(pyramid);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+    }
+
+    // main thread: copies the newest pyramid into out when it is newer than what out has
+    void Latest(HiZPyramid& out) const
+    {
+        lock_guard<mutex> lock(latestMutex);
+        if (latest.frame > out.frame)
+            out = latest;
+    }
+
+private:
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;
+        glm::ivec2 size;
+        glm::mat4 viewProjection;
+        glm::vec2 viewportScale;
+        unsigned int frame;
+    };
+
+    GLuint program, emptyVAO;
+    Readback readbacks[READBACKS];
+    unsigned int frame;
+    int head;
+
+    HiZPyramid latest;
+    mutable mutex latestMutex;
+
+    // the last level is bound, into the pixel buffer, the copy happens whenever the GPU gets there
+    void readBack(glm::ivec2 size, const glm::mat4& viewProjection, glm::vec2 viewportScale)
+    {
+        Readback& readback = readbacks[head];
+        // the main thread hasn't been quick enough, drop the oldest
+        if (readback.fence)
+            glDeleteSync(readback.fence);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glReadPixels(0, 0, size.x, size.y, GL_RED, GL_FLOAT, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback.size = size;
+        readback.viewProjection = viewProjection;
+        readback.viewportScale = viewportScale;
+        readback.frame = ++frame;
+        head = (head + 1) % READBACKS;
+    }
+};
+#endif
@@ -0,0 +1,291 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+using namespace std;
+
+class JobCounter;
+
+struct Job {
+    function<void()> task;
+    // lowered once the task ran, can be null
+    JobCounter* counter;
+};
+
+// number of jobs that still have to finish. JobSystem::Wait() returns once it is back at zero and jobs can be held
+// back until a counter reaches zero, which is how dependencies between groups of jobs are expressed.
+// a counter can be reused once it is done, it has to outlive the jobs that use it, so Wait() on it before it goes away.
+class JobCounter
+{
+public:
+    JobCounter() : value(0) {}
+
+    bool IsDone() const { return value.load() == 0; }
+
+private:
+    friend class JobSystem;
+
+    atomic<int> value;
+    // jobs waiting for this counter to reach zero
+    mutex continuationMutex;
+    vector<Job> continuations;
+};
+
+// work stealing job system. Every thread has its own deque, it pushes and pops its own jobs at the back (newest first,
+// so the data it just touched is still in cache) and when that runs dry steals the oldest job from the front of
+// another thread's deque. The thread that created the system is thread 0 and only runs jobs while it waits.
+// threads that aren't part of the system can queue jobs too, those go round robin over the deques.
+class JobSystem
+{
+public:
+    // shared system with one thread per core, counting the main thread
+    static JobSystem& Get()
+    {
+        static JobSystem system(std::max((int)thread::hardware_concurrency(), 1));
+        return system;
+    }
+
+    explicit JobSystem(int threadCount) : queuedJobs(0), nextQueue(0), quit(false)
+    {
+        threadCount = std::max(threadCount, 1);
+        activeThreads = threadCount;
+        for (int i = 0; i < threadCount; i++)
+            queues.push_back(unique_ptr<Queue>(new Queue()));
+
+        threadIndex() = 0;
+        for (int i = 1; i < threadCount; i++)
+            workers.push_back(thread(&JobSystem::workerLoop, this, i));
+    }
+
+    ~JobSystem()
+    {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers)
+            worker.join();
+    }
+
+    int ThreadCount() const { return (int)queues.size(); }
+
+    // only the first count threads pick up jobs, used to measure how work scales over cores
+    void SetActiveThreads(int count)
+    {
+        {
+            lock_guard<mutex> lock(sleepMutex);
+            activeThreads = std::max(1, std::min(count, ThreadCount()));
+        }
+        wake.notify_all();
+    }
+
+    int ActiveThreads() const { return activeThreads.load(); }
+
+    // queues task. counter is raised right away and lowered once the task ran.
+    // with a dependency the task is held back until that counter reaches zero
+    void Run(function<void()> task, JobCounter* counter = nullptr, JobCounter* dependency = nullptr)
+    {
+        if (counter)
+            counter->value++;
+
+        Job job = { std::move(task), counter };
+        if (dependency)
+        {
+            lock_guard<mutex> lock(dependency->continuationMutex);
+            if (dependency->value.load() > 0)
+            {
+                dependency->continuations.push_back(std::move(job));
+                return;
+            }
+        }
+        push(std::move(job));
+    }
+
+    // runs jobs on the calling thread until counter reaches zero
+    void Wait(JobCounter& counter)
+    {
+        int index = threadIndex();
+        while (counter.value.load() > 0)
+        {
+            Job job;
+            if (index >= 0 ? pop(index, job) : steal(-1, job))
+                execute(job);
+            else
+                this_thread::yield();
+        }
+
+        // the last job still holds the lock while it hands off the continuations, after this the counter can go
+        lock_guard<mutex> lock(counter.continuationMutex);
+    }
+
+    // calls body(begin, end) for chunks of at most grain items until [0, count) is covered and waits for all of them
+    void ParallelFor(int count, int grain, const function<void(int, int)>& body)
+    {
+        if (count <= 0)
+            return;
+
+        grain = std::max(grain, 1);
+        if (count <= grain || activeThreads == 1)
+        {
+            for (int begin = 0; begin < count; begin += grain)
+                body(begin, std::min(begin + grain, count));
+            return;
+        }
+
+        JobCounter counter;
+        for (int begin = 0; begin < count; begin += grain)
+        {
+            int end = std::min(begin + grain, count);
+            Run([&body, begin, end] { body(begin, end); }, &counter);
+        }
+        Wait(counter);
+    }
+
+private:
+    struct Queue {
+        mutex lock;
+        deque<Job> jobs;
+    };
+    vector<unique_ptr<Queue>> queues;
+    vector<thread> workers;
+
+    atomic<int> activeThreads;
+    // jobs sitting in any of the deques, sleeping workers only wake up for these
+    atomic<int> queuedJobs;
+    atomic<unsigned int> nextQueue;
+
+    mutex sleepMutex;
+    condition_variable wake;
+    bool quit;
+
+    // -1 on threads that don't belong to the system
+    static int& threadIndex()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    void push(Job job)
+    {
+        int index = threadIndex();
+        if (index < 0)
+            index = nextQueue++ % queues.size();
+
+        {
+            lock_guard<mutex> lock(queues[index]->lock);
+            queues[index]->jobs.push_back(std::move(job));
+        }
+        queuedJobs++;
+
+        // taking the lock makes sure a worker that is about to sleep sees the new job first
+        {
+            lock_guard<mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // newest job of our own deque, otherwise one stolen from someone else
+    bool pop(int index, Job& job)
+    {
+        {
+            Queue& own = *queues[index];
+            lock_guard<mutex> lock(own.lock);
+            if (!own.jobs.empty())
+            {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                queuedJobs--;
+                return true;
+            }
+        }
+        return steal(index, job);
+    }
+
+    bool steal(int index, Job& job)
+    {
+        static thread_local unsigned int seed = 0x9E3779B9u ^ (unsigned int)hash<thread::id>()(this_thread::get_id());
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        int count = (int)queues.size();
+        int start = seed % count;
+        for (int i = 0; i < count; i++)
+        {
+            int victim = (start + i) % count;
+            if (victim == index)
+                continue;
+
+            Queue& queue = *queues[victim];
+            lock_guard<mutex> lock(queue.lock);
+            if (!queue.jobs.empty())
+            {
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+                queuedJobs--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(Job& job)
+    {
+        job.task();
+
+        JobCounter* counter = job.counter;
+        if (!counter)
+            return;
+
+        // lowered under the lock so a Run() with this counter as dependency either sees it at zero or gets handed off,
+        // and Wait() can't return while the counter is still being touched
+        vector<Job> ready;
+        {
+            lock_guard<mutex> lock(counter->continuationMutex);
+            if (--counter->value == 0)
+                ready.swap(counter->continuations);
+        }
+        // everything that waited on this counter can go now
+        for (Job& next : ready)
+            push(std::move(next));
+    }
+
+    void workerLoop(int index)
+    {
+        threadIndex() = index;
+        int idleSpins = 0;
+        while (true)
+        {
+            Job job;
+            if (index < activeThreads && pop(index, job))
+            {
+                execute(job);
+                idleSpins = 0;
+                continue;
+            }
+
+            // spin a little before sleeping, jobs tend to come in bursts
+            if (++idleSpins < 64)
+            {
+                this_thread::yield();
+                continue;
+            }
+
+            unique_lock<mutex> lock(sleepMutex);
+            wake.wait(lock, [&] { return quit || (index < activeThreads && queuedJobs.load() > 0); });
+            if (quit)
+                return;
+            idleSpins = 0;
+        }
+    }
+};
+#endif
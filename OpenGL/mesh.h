@@ -6,6 +6,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "commandbuffer.h"
+
 #include <string>
 #include <vector>
 using namespace std;
@@ -29,6 +31,13 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// vertex written by the CPU skinning into a streamed buffer, the part of Vertex the model shaders read
+struct SkinnedVertex {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
 struct Texture {
     unsigned int id;
     string type;
@@ -42,6 +51,14 @@ public:
     vector<unsigned int> indices;
     vector<Texture>      textures;
     unsigned int VAO;
+    // positions, normals and texture coordinates from the CPU skinning stream, 0 until SetupStream()
+    unsigned int streamVAO;
+    // local space bounds, for culling
+    glm::vec3 boundsMin, boundsMax;
+    // sampler uniform of every texture, texture i goes to unit i
+    vector<string> samplerNames;
+    // some vertex has a bone weight, it is drawn with the skinned program
+    bool skinned;
 
     // constructor
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
@@ -49,15 +66,18 @@ public:
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        streamVAO = 0;
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
-    }
+        boundsMin = boundsMax = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position;
+        skinned = false;
+        for (const Vertex& vertex : vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.Position);
+            boundsMax = glm::max(boundsMax, vertex.Position);
+            skinned = skinned || vertex.m_Weights[0] > 0.0f;
+        }
 
-    // render the mesh
-    void Draw(unsigned int program)
-    {
-        // bind appropriate textures
+        // retrieve texture number (the N in diffuse_textureN)
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr = 1;
@@ -66,8 +86,6 @@ public:
         unsigned int ambientOcclusionNr = 1;
         for (unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
             if (name == "texture_diffuse")
@@ -82,9 +100,22 @@ public:
                 number = std::to_string(roughnessNr++); // transfer unsigned int to string
             else if (name == "texture_ao")
                 number = std::to_string(ambientOcclusionNr++); // transfer unsigned int to string
+            samplerNames.push_back(name + number);
+        }
+
+        // now that we have all the required data, set the vertex buffers and its attribute pointers.
+        setupMesh();
+    }
 
+    // render the mesh
+    void Draw(unsigned int program)
+    {
+        // bind appropriate textures
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(program, (name + number).c_str()), i);
+            glUniform1i(glGetUniformLocation(program, samplerNames[i].c_str()), i);
             // and finally bind the texture
             glBindTexture(GL_TEXTURE_2D, textures[i].id);
         }
@@ -98,10 +129,63 @@ public:
         glActiveTexture(GL_TEXTURE0);
     }
 
+    // same as Draw(), recorded into commands instead of sent to GL
+    void Record(CommandBuffer& commands, const ProgramUniforms& program) const
+    {
+        recordTextures(commands, program);
+        RecordGeometry(commands);
+    }
+
+    // draws vertices that were skinned on the CPU, they start at baseVertex in the stream buffer
+    void RecordStreamed(CommandBuffer& commands, const ProgramUniforms& program, int baseVertex) const
+    {
+        recordTextures(commands, program);
+        RecordGeometry(commands, baseVertex);
+    }
+
+    // only the draw, for programs that don't sample the textures (depth only). baseVertex >= 0 draws the streamed vertices
+    void RecordGeometry(CommandBuffer& commands, int baseVertex = -1) const
+    {
+        if (baseVertex >= 0)
+        {
+            commands.BindVertexArray(streamVAO);
+            commands.DrawElementsBaseVertex(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0, baseVertex);
+            return;
+        }
+        commands.BindVertexArray(VAO);
+        commands.DrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+    }
+
+    // second vertex array that reads SkinnedVertex from streamBuffer and the indices of the mesh
+    void SetupStream(unsigned int streamBuffer)
+    {
+        glGenVertexArrays(1, &streamVAO);
+        glBindVertexArray(streamVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (void*)offsetof(SkinnedVertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(SkinnedVertex), (void*)offsetof(SkinnedVertex, TexCoords));
+        glBindVertexArray(0);
+    }
+
 private:
     // render data 
     unsigned int VBO, EBO;
 
+    void recordTextures(CommandBuffer& commands, const ProgramUniforms& program) const
+    {
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            commands.Uniform(program.Location(samplerNames[i]), (int)i);
+            commands.BindTexture(i, GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
@@ -11,6 +11,9 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "jobs.h"
+#include "animation.h"
+#include "skinning.h"
 
 #include <string>
 #include <fstream>
@@ -18,16 +21,38 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cfloat>
 using namespace std;
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
 
+// pixels decoded by stb_image, data is null when the file couldn't be read
+struct DecodedImage {
+    unsigned char* data;
+    int width, height, components;
+};
+// safe to call from any thread
+DecodedImage DecodeTexture(const string& filename);
+// needs the GL context, frees the pixels
+unsigned int UploadTexture(DecodedImage& image, const char* path);
+
 class Model
 {
 public:
     // model data 
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
+    // node hierarchy of the file, parents come before their children (the root has -1)
+    vector<int>       nodeParents;
+    // aiNode::mTransformation, relative to the parent node
+    vector<glm::mat4> nodeTransforms;
+    // the node every mesh hangs from
+    vector<int>       meshNodes;
+    vector<string>    nodeNames;
+    // bones, rest pose and animation clips, bones is empty when no mesh is skinned
+    Skeleton          skeleton;
+    // bind pose of every skinned mesh for the CPU skinning, empty for the others
+    vector<SkinningSource> skinningSources;
     string directory;
     bool gammaCorrection;
 
@@ -45,12 +70,24 @@ public:
     }
 
 private:
+    // vertex data of one mesh, filled in on a job
+    struct MeshData {
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        // skeleton bone of every aiBone of the mesh, and the bounds of the vertices each of them moves
+        vector<int> bones;
+        vector<glm::vec3> boneBoundsMin, boneBoundsMax;
+        SkinningSource skinning;
+    };
+    // indices in textures_loaded that still have to be read from disk
+    vector<int> pendingTextures;
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
     void loadModel(string const& path)
     {
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_LimitBoneWeights);
         // check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
@@ -61,34 +98,174 @@ private:
         directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        vector<aiMesh*> sceneMeshes;
+        processNode(scene->mRootNode, scene, sceneMeshes, -1);
+        skeleton.nodeParents = nodeParents;
+
+        // bones are shared between meshes, so they get their index here before the meshes are split over jobs
+        vector<MeshData> meshData(sceneMeshes.size());
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+            processBones(sceneMeshes[i], meshData[i]);
+        processAnimations(scene);
+        skeleton.CompressClips();
+
+        // copying the vertex data out of assimp doesn't need GL, so every mesh is its own job
+        JobSystem::Get().ParallelFor((int)sceneMeshes.size(), 1, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                processMesh(sceneMeshes[i], meshData[i]);
+                if (!meshData[i].bones.empty())
+                    meshData[i].skinning = SkinningSource(meshData[i].vertices);
+            }
+        });
+
+        for (const MeshData& data : meshData)
+        {
+            for (size_t b = 0; b < data.bones.size(); b++)
+            {
+                Bone& bone = skeleton.bones[data.bones[b]];
+                bone.boundsMin = glm::min(bone.boundsMin, data.boneBoundsMin[b]);
+                bone.boundsMax = glm::max(bone.boundsMax, data.boneBoundsMax[b]);
+            }
+        }
+
+        // materials are resolved here, the textures they need are read from disk all at once
+        vector<vector<int>> meshTextures(sceneMeshes.size());
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+            meshTextures[i] = processMaterial(scene->mMaterials[sceneMeshes[i]->mMaterialIndex]);
+        loadPendingTextures();
+
+        for (size_t i = 0; i < sceneMeshes.size(); i++)
+        {
+            vector<Texture> textures;
+            for (int texture : meshTextures[i])
+                textures.push_back(textures_loaded[texture]);
+            meshes.push_back(Mesh(meshData[i].vertices, meshData[i].indices, textures));
+            skinningSources.push_back(std::move(meshData[i].skinning));
+        }
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode* node, const aiScene* scene)
+    // processes a node in a recursive fashion. Collects each individual mesh located at the node and repeats this process on its children nodes (if any).
+    void processNode(aiNode* node, const aiScene* scene, vector<aiMesh*>& sceneMeshes, int parent)
     {
-        // process each mesh located at the current node
+        int index = (int)nodeParents.size();
+        nodeParents.push_back(parent);
+        nodeTransforms.push_back(toGlm(node->mTransformation));
+        nodeNames.push_back(node->mName.C_Str());
+
+        // the same transform in parts, animations replace and blend these
+        aiVector3D scaling, position;
+        aiQuaternion rotation;
+        node->mTransformation.Decompose(scaling, rotation, position);
+        skeleton.restPoses.push_back({ glm::vec3(position.x, position.y, position.z), glm::quat(rotation.w, rotation.x, rotation.y, rotation.z), glm::vec3(scaling.x, scaling.y, scaling.z) });
+
+        // collect each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+            meshNodes.push_back(index);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, sceneMeshes, index);
         }
 
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // assimp matrices are row major
+    static glm::mat4 toGlm(const aiMatrix4x4& m)
+    {
+        return glm::mat4(m.a1, m.b1, m.c1, m.d1,
+                         m.a2, m.b2, m.c2, m.d2,
+                         m.a3, m.b3, m.c3, m.d3,
+                         m.a4, m.b4, m.c4, m.d4);
+    }
+
+    int findNode(const string& name) const
+    {
+        for (size_t i = 0; i < nodeNames.size(); i++)
+            if (nodeNames[i] == name)
+                return (int)i;
+        return -1;
+    }
+
+    // adds the bones of the mesh to the skeleton, bones with the same name are the same bone
+    void processBones(aiMesh* mesh, MeshData& data)
+    {
+        for (unsigned int i = 0; i < mesh->mNumBones; i++)
+        {
+            const aiBone* bone = mesh->mBones[i];
+            string name = bone->mName.C_Str();
+
+            int index = 0;
+            while (index < (int)skeleton.bones.size() && skeleton.bones[index].name != name)
+                index++;
+            if (index == (int)skeleton.bones.size())
+            {
+                if (index == MAX_BONES)
+                    cout << "ERROR::MODEL::BONES more than " << MAX_BONES << " bones, the skinned draws will be wrong" << endl;
+                skeleton.bones.push_back({ name, findNode(name), toGlm(bone->mOffsetMatrix), glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) });
+            }
+            data.bones.push_back(index);
+        }
+        data.boneBoundsMin.assign(data.bones.size(), glm::vec3(FLT_MAX));
+        data.boneBoundsMax.assign(data.bones.size(), glm::vec3(-FLT_MAX));
+    }
+
+    // keyframes of every animation, channels of nodes that don't exist are dropped
+    void processAnimations(const aiScene* scene)
+    {
+        for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+        {
+            const aiAnimation* animation = scene->mAnimations[i];
+            AnimationClip clip;
+            clip.name = animation->mName.C_Str();
+            clip.duration = (float)animation->mDuration;
+            clip.ticksPerSecond = animation->mTicksPerSecond > 0.0 ? (float)animation->mTicksPerSecond : 25.0f;
+
+            for (unsigned int c = 0; c < animation->mNumChannels; c++)
+            {
+                const aiNodeAnim* nodeAnimation = animation->mChannels[c];
+                AnimationChannel channel;
+                channel.node = findNode(nodeAnimation->mNodeName.C_Str());
+                if (channel.node < 0)
+                    continue;
+
+                for (unsigned int k = 0; k < nodeAnimation->mNumPositionKeys; k++)
+                {
+                    const aiVectorKey& key = nodeAnimation->mPositionKeys[k];
+                    channel.positionTimes.push_back((float)key.mTime);
+                    channel.positions.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+                }
+                for (unsigned int k = 0; k < nodeAnimation->mNumRotationKeys; k++)
+                {
+                    const aiQuatKey& key = nodeAnimation->mRotationKeys[k];
+                    channel.rotationTimes.push_back((float)key.mTime);
+                    channel.rotations.push_back(glm::quat(key.mValue.w, key.mValue.x, key.mValue.y, key.mValue.z));
+                }
+                for (unsigned int k = 0; k < nodeAnimation->mNumScalingKeys; k++)
+                {
+                    const aiVectorKey& key = nodeAnimation->mScalingKeys[k];
+                    channel.scaleTimes.push_back((float)key.mTime);
+                    channel.scales.push_back(glm::vec3(key.mValue.x, key.mValue.y, key.mValue.z));
+                }
+                clip.channels.push_back(channel);
+            }
+            skeleton.clips.push_back(clip);
+        }
+    }
+
+    // runs on a job, only reads the assimp mesh
+    void processMesh(aiMesh* mesh, MeshData& data)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3);
 
         // walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -130,9 +307,36 @@ private:
             }
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+            // bones, filled in below
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                vertex.m_BoneIDs[j] = -1;
+                vertex.m_Weights[j] = 0.0f;
+            }
 
             vertices.push_back(vertex);
         }
+        // aiProcess_LimitBoneWeights leaves at most 4 (AI_LMW_MAX_WEIGHTS) weights per vertex
+        for (unsigned int i = 0; i < mesh->mNumBones; i++)
+        {
+            const aiBone* bone = mesh->mBones[i];
+            for (unsigned int w = 0; w < bone->mNumWeights; w++)
+            {
+                const aiVertexWeight& weight = bone->mWeights[w];
+                Vertex& vertex = vertices[weight.mVertexId];
+                for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+                {
+                    if (vertex.m_BoneIDs[j] < 0)
+                    {
+                        vertex.m_BoneIDs[j] = data.bones[i];
+                        vertex.m_Weights[j] = weight.mWeight;
+                        break;
+                    }
+                }
+                data.boneBoundsMin[i] = glm::min(data.boneBoundsMin[i], vertex.Position);
+                data.boneBoundsMax[i] = glm::max(data.boneBoundsMax[i], vertex.Position);
+            }
+        }
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
@@ -141,8 +345,12 @@ private:
             for (unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
         }
-        // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+    }
+
+    // the textures of a material as indices in textures_loaded
+    vector<int> processMaterial(aiMaterial* material)
+    {
+        vector<int> textures;
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
         // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
         // Same applies to other texture as the following list summarizes:
@@ -151,33 +359,32 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+        vector<int> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
         textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+        vector<int> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
         textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+        std::vector<int> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
         textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height");
+        std::vector<int> heightMaps = loadMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         // 5. roughness maps
-        std::vector<Texture> roughMaps = loadMaterialTextures(material, aiTextureType_SHININESS, "texture_roughness");
+        std::vector<int> roughMaps = loadMaterialTextures(material, aiTextureType_SHININESS, "texture_roughness");
         textures.insert(textures.end(), roughMaps.begin(), roughMaps.end());
         // 6. ao maps
-        std::vector<Texture> aoMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ao");
+        std::vector<int> aoMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ao");
         textures.insert(textures.end(), aoMaps.begin(), aoMaps.end());
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return textures;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    // checks all material textures of a given type and queues the textures that aren't loaded yet.
+    // the required textures are returned as indices in textures_loaded.
+    vector<int> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
     {
-        vector<Texture> textures;
+        vector<int> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
@@ -188,23 +395,54 @@ private:
             {
                 if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
                 {
-                    textures.push_back(textures_loaded[j]);
+                    textures.push_back(j);
                     skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
                     break;
                 }
             }
             if (!skip)
-            {   // if texture hasn't been loaded already, load it
+            {   // if texture hasn't been loaded already, queue it, the id is filled in by loadPendingTextures
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
+                texture.id = 0;
                 texture.type = typeName;
                 texture.path = str.C_Str();
-                textures.push_back(texture);
+                textures.push_back((int)textures_loaded.size());
+                pendingTextures.push_back((int)textures_loaded.size());
                 textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
             }
         }
         return textures;
     }
+
+    // decodes the queued textures on jobs and uploads them here as they finish, in order.
+    // only a few decodes run ahead of the uploads so there aren't dozens of decoded images in memory at once
+    void loadPendingTextures()
+    {
+        JobSystem& jobs = JobSystem::Get();
+        int count = (int)pendingTextures.size();
+        int ahead = jobs.ThreadCount() + 1;
+
+        vector<DecodedImage> images(count);
+        unique_ptr<JobCounter[]> decoded(new JobCounter[count]);
+        auto queueDecode = [&](int i) {
+            string filename = directory + '/' + textures_loaded[pendingTextures[i]].path;
+            DecodedImage* image = &images[i];
+            jobs.Run([image, filename] { *image = DecodeTexture(filename); }, &decoded[i]);
+        };
+
+        for (int i = 0; i < count && i < ahead; i++)
+            queueDecode(i);
+        for (int i = 0; i < count; i++)
+        {
+            jobs.Wait(decoded[i]);
+            if (i + ahead < count)
+                queueDecode(i + ahead);
+
+            Texture& texture = textures_loaded[pendingTextures[i]];
+            texture.id = UploadTexture(images[i], texture.path.c_str());
+        }
+        pendingTextures.clear();
+    }
 };
 
 
@@ -213,11 +451,24 @@ unsigned int TextureFromFile(const char* path, const string& directory, bool gam
     string filename = string(path);
     filename = directory + '/' + filename;
 
+    DecodedImage image = DecodeTexture(filename);
+    return UploadTexture(image, path);
+}
+
+DecodedImage DecodeTexture(const string& filename)
+{
+    DecodedImage image;
+    image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0);
+    return image;
+}
+
+unsigned int UploadTexture(DecodedImage& image, const char* path)
+{
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    int width = image.width, height = image.height, nrComponents = image.components;
+    unsigned char* data = image.data;
     if (data)
     {
         GLenum format;
@@ -0,0 +1,514 @@
+#ifndef OCCLUSIONRASTER_H
+#define OCCLUSIONRASTER_H
+
+#include <glm/glm.hpp>
+
+#include "terrain.h"
+#include "jobs.h"
+#include "cpu.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// triangles an occluder is drawn with into an OcclusionRasterizer, positions in the occluder's own space
+struct OccluderMesh {
+    vector<glm::vec3> vertices;
+    vector<unsigned int> indices;
+
+    int TriangleCount() const { return (int)indices.size() / 3; }
+};
+
+// the terrain with every step'th sample in x and z, a lower LOD of it. Every vertex is the lowest sample within step
+// of it, so the coarse surface stays under the real one and never hides what is in a valley
+inline OccluderMesh TerrainOccluder(const HeightField& field, int step)
+{
+    OccluderMesh mesh;
+    int columns = (field.width - 1 + step - 1) / step + 1, rows = (field.height - 1 + step - 1) / step + 1;
+    mesh.vertices.reserve(columns * rows);
+    for (int row = 0; row < rows; row++)
+    {
+        int z = std::min(row * step, field.height - 1);
+        for (int column = 0; column < columns; column++)
+        {
+            int x = std::min(column * step, field.width - 1);
+            float lowest = FLT_MAX;
+            for (int sz = std::max(z - step, 0); sz <= std::min(z + step, field.height - 1); sz++)
+                for (int sx = std::max(x - step, 0); sx <= std::min(x + step, field.width - 1); sx++)
+                    lowest = std::min(lowest, field.heights[sz * field.width + sx]);
+            mesh.vertices.push_back(glm::vec3(x * field.xzScale, lowest, z * field.xzScale));
+        }
+    }
+
+    mesh.indices.reserve((columns - 1) * (rows - 1) * 6);
+    for (int row = 0; row + 1 < rows; row++)
+    {
+        for (int column = 0; column + 1 < columns; column++)
+        {
+            unsigned int i = row * columns + column;
+            unsigned int quad[6] = { i, i + columns, i + 1, i + 1, i + columns, i + columns + 1 };
+            mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+        }
+    }
+    return mesh;
+}
+
+// a small depth buffer drawn on the CPU from coarse occluders, for visibility answers without a GPU.
+//
+// Render() first transforms the vertices, then sets up and bins the triangles in batches of BIN_BATCH: clipped to the
+// near plane and a guard band, snapped to 1/16 pixel and added to the bin of every tile their bounds touch. Every tile
+// is then rasterized by one job, going through the bins in batch order. Coverage is 3 integer edge functions at pixel
+// centers, 8 pixels side by side with AVX2; each pixel keeps the nearest depth. The depth written is the farthest the
+// triangle gets within the pixel, so boxes that only just peek out over an occluder are still seen.
+//
+// The edge functions are exact and every pixel's depth is the minimum of the same float expression over the triangles
+// covering it, so the buffer is the same bit for bit with or without threads and with or without AVX2.
+// Triangles are drawn from both sides, the occluders don't have to be closed
+class OcclusionRasterizer
+{
+public:
+    static const int BUFFER_WIDTH = 256, BUFFER_HEIGHT = 128;
+    static const int TILE_WIDTH = 32, TILE_HEIGHT = 16;
+    static const int TILES_X = BUFFER_WIDTH / TILE_WIDTH, TILES_Y = BUFFER_HEIGHT / TILE_HEIGHT;
+    static const int TILE_COUNT = TILES_X * TILES_Y;
+    // triangles set up by one binning job, fixed so the bins don't depend on the thread count
+    static const int BIN_BATCH = 1024;
+
+    // of the last Render(): triangles of the occluders and what was left to rasterize after clipping
+    int submittedTriangles, rasterizedTriangles;
+
+    OcclusionRasterizer() : submittedTriangles(0), rasterizedTriangles(0), viewProjection(1.0f), renderedViewProjection(1.0f),
+                            depth(BUFFER_WIDTH * BUFFER_HEIGHT, 1.0f), tileMaxDepth(TILE_COUNT, 1.0f) {}
+
+    // starts the occluders of a camera, viewProjection goes to GL clip space
+    void Begin(const glm::mat4& viewProjection)
+    {
+        this->viewProjection = viewProjection;
+        occluders.clear();
+    }
+
+    // mesh is read in Render(), it has to live until then
+    void AddOccluder(const OccluderMesh& mesh, const glm::mat4& world)
+    {
+        occluders.push_back({ &mesh, viewProjection * world, 0, 0 });
+    }
+
+    // parallel spreads the work over the job system, simd uses the AVX2 rows when the CPU has them
+    void Render(bool parallel = true, bool simd = true)
+    {
+        renderedViewProjection = viewProjection;
+        int vertexCount = 0, triangleCount = 0;
+        for (Occluder& occluder : occluders)
+        {
+            occluder.firstVertex = vertexCount;
+            occluder.firstTriangle = triangleCount;
+            vertexCount += (int)occluder.mesh->vertices.size();
+            triangleCount += occluder.mesh->TriangleCount();
+        }
+        submittedTriangles = triangleCount;
+
+        JobSystem& jobs = JobSystem::Get();
+        auto parallelFor = [&](int count, int grain, const function<void(int, int)>& body) {
+            if (parallel)
+                jobs.ParallelFor(count, grain, body);
+            else if (count > 0)
+                body(0, count);
+        };
+
+        clip.resize(vertexCount);
+        parallelFor((int)occluders.size(), 1, [&](int begin, int end) {
+            for (int o = begin; o < end; o++)
+            {
+                const Occluder& occluder = occluders[o];
+                const vector<glm::vec3>& vertices = occluder.mesh->vertices;
+                for (size_t v = 0; v < vertices.size(); v++)
+                    clip[occluder.firstVertex + v] = occluder.clipFromMesh * glm::vec4(vertices[v], 1.0f);
+            }
+        });
+
+        int batchCount = (triangleCount + BIN_BATCH - 1) / BIN_BATCH;
+        if ((int)batches.size() < batchCount)
+            batches.resize(batchCount);
+        parallelFor(batchCount, 1, [&](int begin, int end) {
+            for (int b = begin; b < end; b++)
+                bin(b, std::min((b + 1) * BIN_BATCH, triangleCount));
+        });
+        rasterizedTriangles = 0;
+        for (int b = 0; b < batchCount; b++)
+            rasterizedTriangles += (int)batches[b].triangles.size();
+
+#ifdef CPU_AVX2
+        static const bool avx2 = CpuSupportsAVX2();
+        bool useAvx2 = simd && avx2;
+#else
+        bool useAvx2 = false;
+#endif
+        parallelFor(TILE_COUNT, 1, [&](int begin, int end) {
+            for (int tile = begin; tile < end; tile++)
+                rasterizeTile(tile, batchCount, useAvx2);
+        });
+    }
+
+    // conservative: only true when every pixel the box covers has an occluder in front of all of it
+    bool IsBoxOccluded(glm::vec3 boundsMin, glm::vec3 boundsMax) const
+    {
+        // pixel rectangle and nearest depth of the 8 corners
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = 1.0f;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 corner = renderedViewProjection * glm::vec4(i & 1 ? boundsMax.x : boundsMin.x, i & 2 ? boundsMax.y : boundsMin.y, i & 4 ? boundsMax.z : boundsMin.z, 1.0f);
+            // reaches behind the camera, no rectangle to test
+            if (corner.w <= 1e-4f)
+                return false;
+            float x = (corner.x / corner.w * 0.5f + 0.5f) * BUFFER_WIDTH, y = (corner.y / corner.w * 0.5f + 0.5f) * BUFFER_HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearest = std::min(nearest, corner.z / corner.w * 0.5f + 0.5f);
+        }
+        if (maxX < 0.0f || minX >= BUFFER_WIDTH || maxY < 0.0f || minY >= BUFFER_HEIGHT)
+            return false;
+
+        int x0 = (int)floorf(std::max(minX, 0.0f)), x1 = (int)floorf(std::min(maxX, BUFFER_WIDTH - 1.0f));
+        int y0 = (int)floorf(std::max(minY, 0.0f)), y1 = (int)floorf(std::min(maxY, BUFFER_HEIGHT - 1.0f));
+        for (int tileY = y0 / TILE_HEIGHT; tileY <= y1 / TILE_HEIGHT; tileY++)
+        {
+            for (int tileX = x0 / TILE_WIDTH; tileX <= x1 / TILE_WIDTH; tileX++)
+            {
+                // the whole tile is in front of the box
+                if (nearest > tileMaxDepth[tileY * TILES_X + tileX])
+                    continue;
+
+                int tx0 = std::max(x0, tileX * TILE_WIDTH), tx1 = std::min(x1, tileX * TILE_WIDTH + TILE_WIDTH - 1);
+                int ty0 = std::max(y0, tileY * TILE_HEIGHT), ty1 = std::min(y1, tileY * TILE_HEIGHT + TILE_HEIGHT - 1);
+                for (int y = ty0; y <= ty1; y++)
+                    for (int x = tx0; x <= tx1; x++)
+                        if (nearest <= depth[y * BUFFER_WIDTH + x])
+                            return false;
+            }
+        }
+        return true;
+    }
+
+    // occluded[i] is set for box i, over the job system
+    void TestBoxes(const glm::vec3* boundsMin, const glm::vec3* boundsMax, int count, char* occluded, bool parallel = true) const
+    {
+        auto test = [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+                occluded[i] = IsBoxOccluded(boundsMin[i], boundsMax[i]);
+        };
+        if (parallel)
+            JobSystem::Get().ParallelFor(count, 256, test);
+        else
+            test(0, count);
+    }
+
+    // window depths, 0 near and 1 where nothing was drawn, row 0 at the bottom
+    const vector<float>& Depth() const { return depth; }
+
+    // FNV-1a of the depth bits, for comparing runs
+    uint32_t Checksum() const
+    {
+        uint32_t hash = 2166136261u;
+        for (float value : depth)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            for (int i = 0; i < 4; i++)
+            {
+                hash ^= (bits >> (i * 8)) & 0xff;
+                hash *= 16777619u;
+            }
+        }
+        return hash;
+    }
+
+private:
+    // edges and bounds in 1/SUBPIXEL pixels
+    static const int SUBPIXEL = 16;
+    // significant bits of the depth slopes, 24 of a float less the 8 of a pixel coordinate
+    static const int SLOPE_BITS = 16;
+
+    struct Occluder {
+        const OccluderMesh* mesh;
+        glm::mat4 clipFromMesh;
+        int firstVertex, firstTriangle;
+    };
+
+    // a triangle ready to rasterize. Edge i is a * x + b * y + c at the center of pixel (x, y), >= 0 inside; the depth
+    // of pixel (x, y) is min(depthBase + depthX * x + depthY * y, depthMax), added up in that order
+    struct ScreenTriangle {
+        int a[3], b[3], c[3];
+        float depthBase, depthX, depthY, depthMax;
+        int minX, minY, maxX, maxY;
+    };
+
+    struct Batch {
+        vector<ScreenTriangle> triangles;
+        // triangles of the batch touching every tile
+        vector<int> bins[TILE_COUNT];
+    };
+
+    glm::mat4 viewProjection, renderedViewProjection;
+    vector<Occluder> occluders;
+    vector<glm::vec4> clip;
+    vector<Batch> batches;
+    vector<float> depth;
+    // the farthest depth of every tile
+    vector<float> tileMaxDepth;
+
+    // sets up the triangles from batch * BIN_BATCH to end
+    void bin(int batchIndex, int end)
+    {
+        Batch& batch = batches[batchIndex];
+        batch.triangles.clear();
+        for (vector<int>& tileBin : batch.bins)
+            tileBin.clear();
+
+        int triangle = batchIndex * BIN_BATCH;
+        // the occluder the first triangle is in
+        int o = (int)(std::upper_bound(occluders.begin(), occluders.end(), triangle, [](int t, const Occluder& occluder) { return t < occluder.firstTriangle; }) - occluders.begin()) - 1;
+        for (; triangle < end; triangle++)
+        {
+            while (triangle >= occluders[o].firstTriangle + occluders[o].mesh->TriangleCount())
+                o++;
+            const Occluder& occluder = occluders[o];
+            const unsigned int* indices = &occluder.mesh->indices[(triangle - occluder.firstTriangle) * 3];
+            glm::vec4 polygon[9] = { clip[occluder.firstVertex + indices[0]], clip[occluder.firstVertex + indices[1]], clip[occluder.firstVertex + indices[2]] };
+
+            int count = clipPolygon(polygon);
+            if (count < 3)
+                continue;
+            glm::vec3 screen[9];
+            for (int i = 0; i < count; i++)
+            {
+                glm::vec4& p = polygon[i];
+                screen[i] = glm::vec3((p.x / p.w * 0.5f + 0.5f) * BUFFER_WIDTH, (p.y / p.w * 0.5f + 0.5f) * BUFFER_HEIGHT, p.z / p.w * 0.5f + 0.5f);
+            }
+            for (int i = 1; i + 1 < count; i++)
+                setup(screen[0], screen[i], screen[i + 1], batch);
+        }
+    }
+
+    // Sutherland-Hodgman against the near plane and the guard band, in clip space. polygon has room for the 3 + 5
+    // vertices it can grow to. The guard band reaches twice the screen out from its center, which keeps the edge
+    // functions well inside 32 bits
+    static int clipPolygon(glm::vec4 (&polygon)[9])
+    {
+        // dot(plane, p) >= 0 inside: near, then -x, +x, -y, +y of the guard band
+        static const glm::vec4 planes[5] = {
+            glm::vec4(0, 0, 1, 1),
+            glm::vec4(1, 0, 0, 2), glm::vec4(-1, 0, 0, 2),
+            glm::vec4(0, 1, 0, 2), glm::vec4(0, -1, 0, 2),
+        };
+        // all on the outside of one of the screen edges or the near plane
+        static const glm::vec4 screenPlanes[5] = {
+            glm::vec4(0, 0, 1, 1), glm::vec4(1, 0, 0, 1), glm::vec4(-1, 0, 0, 1), glm::vec4(0, 1, 0, 1), glm::vec4(0, -1, 0, 1),
+        };
+        bool inside = true;
+        for (int p = 0; p < 5; p++)
+        {
+            float d0 = glm::dot(screenPlanes[p], polygon[0]), d1 = glm::dot(screenPlanes[p], polygon[1]), d2 = glm::dot(screenPlanes[p], polygon[2]);
+            if (d0 < 0.0f && d1 < 0.0f && d2 < 0.0f)
+                return 0;
+            inside = inside && glm::dot(planes[p], polygon[0]) >= 0.0f && glm::dot(planes[p], polygon[1]) >= 0.0f && glm::dot(planes[p], polygon[2]) >= 0.0f;
+        }
+        if (inside)
+            return 3;
+
+        int count = 3;
+        glm::vec4 clipped[9];
+        for (int p = 0; p < 5 && count >= 3; p++)
+        {
+            int out = 0;
+            for (int i = 0; i < count; i++)
+            {
+                const glm::vec4& from = polygon[i];
+                const glm::vec4& to = polygon[(i + 1) % count];
+                float dFrom = glm::dot(planes[p], from), dTo = glm::dot(planes[p], to);
+                if (dFrom >= 0.0f)
+                    clipped[out++] = from;
+                if ((dFrom >= 0.0f) != (dTo >= 0.0f))
+                    clipped[out++] = from + (to - from) * (dFrom / (dFrom - dTo));
+            }
+            count = out;
+            std::copy(clipped, clipped + count, polygon);
+        }
+        return count;
+    }
+
+    static int snap(float pixels) { return (int)floorf(pixels * SUBPIXEL + 0.5f); }
+
+    void setup(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, Batch& batch)
+    {
+        int x[3] = { snap(v0.x), snap(v1.x), snap(v2.x) }, y[3] = { snap(v0.y), snap(v1.y), snap(v2.y) };
+        int64_t area = (int64_t)(x[1] - x[0]) * (y[2] - y[0]) - (int64_t)(y[1] - y[0]) * (x[2] - x[0]);
+        if (area == 0)
+            return;
+        // drawn from both sides, the other winding is turned around
+        if (area < 0)
+        {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(v1, v2);
+        }
+
+        // pixels whose centers (x + 0.5) are in the bounds, clamped to the buffer
+        int minFixedX = std::min(x[0], std::min(x[1], x[2])), maxFixedX = std::max(x[0], std::max(x[1], x[2]));
+        int minFixedY = std::min(y[0], std::min(y[1], y[2])), maxFixedY = std::max(y[0], std::max(y[1], y[2]));
+        ScreenTriangle t;
+        t.minX = std::max(ceilDiv(minFixedX - SUBPIXEL / 2, SUBPIXEL), 0);
+        t.maxX = std::min(floorDiv(maxFixedX - SUBPIXEL / 2, SUBPIXEL), BUFFER_WIDTH - 1);
+        t.minY = std::max(ceilDiv(minFixedY - SUBPIXEL / 2, SUBPIXEL), 0);
+        t.maxY = std::min(floorDiv(maxFixedY - SUBPIXEL / 2, SUBPIXEL), BUFFER_HEIGHT - 1);
+        if (t.minX > t.maxX || t.minY > t.maxY)
+            return;
+
+        // edge i goes from vertex i to vertex i + 1, moved to the center of pixel (0, 0) and scaled to whole pixels
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3;
+            int a = y[i] - y[j], b = x[j] - x[i];
+            int64_t c = (int64_t)x[i] * y[j] - (int64_t)y[i] * x[j] + (int64_t)(a + b) * (SUBPIXEL / 2);
+            t.a[i] = a * SUBPIXEL;
+            t.b[i] = b * SUBPIXEL;
+            t.c[i] = (int)c;
+        }
+
+        // depth plane through the snapped vertices, pushed back to the farthest it gets within a pixel
+        float x0 = x[0] / (float)SUBPIXEL, y0 = y[0] / (float)SUBPIXEL;
+        float dx1 = x[1] / (float)SUBPIXEL - x0, dy1 = y[1] / (float)SUBPIXEL - y0;
+        float dx2 = x[2] / (float)SUBPIXEL - x0, dy2 = y[2] / (float)SUBPIXEL - y0;
+        float dz1 = v1.z - v0.z, dz2 = v2.z - v0.z;
+        float inverseArea = 1.0f / (dx1 * dy2 - dy1 * dx2);
+        float depthX = (dz1 * dy2 - dz2 * dy1) * inverseArea, depthY = (dz2 * dx1 - dz1 * dx2) * inverseArea;
+        // the slopes keep SLOPE_BITS significant bits, so times a pixel coordinate (8 bits at most) they are exact. Then a
+        // compiler fusing the multiply and add into an FMA rounds the same as one that doesn't, and the scalar and the
+        // AVX2 rows stay identical whatever the build contracts. The plane moves back by what the rounding could take off
+        t.depthX = roundSlope(depthX);
+        t.depthY = roundSlope(depthY);
+        float slopeError = fabsf(t.depthX - depthX) * (BUFFER_WIDTH + fabsf(x0)) + fabsf(t.depthY - depthY) * (BUFFER_HEIGHT + fabsf(y0));
+        t.depthBase = v0.z + t.depthX * (0.5f - x0) + t.depthY * (0.5f - y0) + 0.5f * (fabsf(t.depthX) + fabsf(t.depthY)) + slopeError;
+        t.depthMax = std::min(std::max(v0.z, std::max(v1.z, v2.z)), 1.0f);
+
+        int index = (int)batch.triangles.size();
+        batch.triangles.push_back(t);
+        for (int tileY = t.minY / TILE_HEIGHT; tileY <= t.maxY / TILE_HEIGHT; tileY++)
+            for (int tileX = t.minX / TILE_WIDTH; tileX <= t.maxX / TILE_WIDTH; tileX++)
+                batch.bins[tileY * TILES_X + tileX].push_back(index);
+    }
+
+    static float roundSlope(float slope)
+    {
+        // too small to matter, and a product that isn't a normal float wouldn't be exact
+        if (!(fabsf(slope) >= 1e-30f))
+            return 0.0f;
+        int exponent;
+        float mantissa = frexpf(slope, &exponent);
+        return ldexpf(roundf(ldexpf(mantissa, SLOPE_BITS)), exponent - SLOPE_BITS);
+    }
+
+    static int floorDiv(int value, int divisor) { return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor); }
+    static int ceilDiv(int value, int divisor) { return -floorDiv(-value, divisor); }
+
+    void rasterizeTile(int tile, int batchCount, bool avx2)
+    {
+        int tileX = (tile % TILES_X) * TILE_WIDTH, tileY = (tile / TILES_X) * TILE_HEIGHT;
+        for (int y = tileY; y < tileY + TILE_HEIGHT; y++)
+            std::fill(&depth[y * BUFFER_WIDTH + tileX], &depth[y * BUFFER_WIDTH + tileX] + TILE_WIDTH, 1.0f);
+
+        for (int b = 0; b < batchCount; b++)
+        {
+            const Batch& batch = batches[b];
+            for (int index : batch.bins[tile])
+            {
+                const ScreenTriangle& t = batch.triangles[index];
+                // whole blocks of 8 pixels, tiles start on a multiple of 8
+                int x0 = std::max(t.minX, tileX) & ~7, x1 = std::min(t.maxX, tileX + TILE_WIDTH - 1);
+                int y0 = std::max(t.minY, tileY), y1 = std::min(t.maxY, tileY + TILE_HEIGHT - 1);
+#ifdef CPU_AVX2
+                if (avx2)
+                {
+                    rasterizeAVX2(t, x0, x1, y0, y1);
+                    continue;
+                }
+#endif
+                rasterizeScalar(t, x0, x1, y0, y1);
+            }
+        }
+
+        float farthest = 0.0f;
+        for (int y = tileY; y < tileY + TILE_HEIGHT; y++)
+            for (int x = tileX; x < tileX + TILE_WIDTH; x++)
+                farthest = std::max(farthest, depth[y * BUFFER_WIDTH + x]);
+        tileMaxDepth[tile] = farthest;
+    }
+
+    // the reference for the AVX2 rows, the same operations one lane at a time
+    void rasterizeScalar(const ScreenTriangle& t, int x0, int x1, int y0, int y1)
+    {
+        for (int y = y0; y <= y1; y++)
+        {
+            float* row = &depth[y * BUFFER_WIDTH];
+            for (int x = x0; x <= x1; x++)
+            {
+                int e0 = t.a[0] * x + t.b[0] * y + t.c[0];
+                int e1 = t.a[1] * x + t.b[1] * y + t.c[1];
+                int e2 = t.a[2] * x + t.b[2] * y + t.c[2];
+                if ((e0 | e1 | e2) < 0)
+                    continue;
+                float z = std::min(t.depthBase + t.depthX * (float)x + t.depthY * (float)y, t.depthMax);
+                row[x] = std::min(z, row[x]);
+            }
+        }
+    }
+
+#ifdef CPU_AVX2
+    // 8 pixels of a row at a time. The edge functions step with integer adds, a pixel is in when none of the three
+    // has its sign bit set
+    void rasterizeAVX2(const ScreenTriangle& t, int x0, int x1, int y0, int y1)
+    {
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i a[3], blockStep[3];
+        for (int i = 0; i < 3; i++)
+        {
+            a[i] = _mm256_set1_epi32(t.a[i]);
+            blockStep[i] = _mm256_set1_epi32(t.a[i] * 8);
+        }
+        const __m256 depthX = _mm256_set1_ps(t.depthX), depthY = _mm256_set1_ps(t.depthY);
+        const __m256 depthBase = _mm256_set1_ps(t.depthBase), depthMax = _mm256_set1_ps(t.depthMax);
+        const __m256 eight = _mm256_set1_ps(8.0f);
+        const __m256 firstX = _mm256_add_ps(_mm256_set1_ps((float)x0), _mm256_cvtepi32_ps(lanes));
+
+        for (int y = y0; y <= y1; y++)
+        {
+            float* row = &depth[y * BUFFER_WIDTH];
+            __m256i edge[3];
+            for (int i = 0; i < 3; i++)
+                edge[i] = _mm256_add_epi32(_mm256_set1_epi32(t.a[i] * x0 + t.b[i] * y + t.c[i]), _mm256_mullo_epi32(lanes, a[i]));
+            __m256 rowY = _mm256_mul_ps(depthY, _mm256_set1_ps((float)y));
+            __m256 xs = firstX;
+            for (int x = x0; x <= x1; x += 8)
+            {
+                __m256i outside = _mm256_or_si256(_mm256_or_si256(edge[0], edge[1]), edge[2]);
+                int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff;
+                if (mask)
+                {
+                    __m256 z = _mm256_min_ps(_mm256_add_ps(_mm256_add_ps(depthBase, _mm256_mul_ps(depthX, xs)), rowY), depthMax);
+                    __m256 old = _mm256_loadu_ps(row + x);
+                    __m256 nearer = _mm256_min_ps(z, old);
+                    _mm256_storeu_ps(row + x, _mm256_blendv_ps(nearer, old, _mm256_castsi256_ps(outside)));
+                }
+                for (int i = 0; i < 3; i++)
+                    edge[i] = _mm256_add_epi32(edge[i], blockStep[i]);
+                xs = _mm256_add_ps(xs, eight);
+            }
+        }
+    }
+#endif
+};
+#endif
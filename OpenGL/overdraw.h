@@ -0,0 +1,144 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+// the two GL_SAMPLES_PASSED queries of an object in a measured frame
+enum OverdrawPass {
+    // depth pre-pass with GL_LESS: the fragments its color pass would shade without a pre-pass
+    OVERDRAW_DEPTH = 0,
+    // color pass with GL_LEQUAL against the finished depth buffer: the fragments that are actually visible
+    OVERDRAW_COLOR = 1,
+};
+
+// decides which opaque objects are worth a depth pre-pass. Every MEASURE_INTERVAL frames the main thread asks for a
+// measured frame, which pre-passes every object with sample queries around both of its passes. Once the render thread
+// has read them back, an object keeps its pre-pass when the fragments it no longer shades make up for drawing it twice.
+// The main thread asks for frames and reads decisions, the render thread issues and collects the queries
+class OverdrawMonitor
+{
+public:
+    static const int MEASURE_INTERVAL = 60;
+    // a shaded fragment costs about this many depth only fragments, a vertex about this many
+    static const int SHADED_FRAGMENT_COST = 8;
+    static const int VERTEX_COST = 2;
+
+    OverdrawMonitor() : framesSinceMeasurement(MEASURE_INTERVAL), measuring(false), issued(false), report(false) {}
+
+    // needs a current GL context, objects are numbered 0 .. count - 1
+    void Init(int count)
+    {
+        objects.resize(count);
+        queries.resize(count * 2);
+        glGenQueries((GLsizei)queries.size(), queries.data());
+    }
+
+    // what the report calls it and how many vertices drawing it again costs
+    void SetObject(int object, const string& name, size_t vertexCount)
+    {
+        objects[object].name = name;
+        objects[object].vertexCount = vertexCount;
+    }
+
+    // main thread, once a frame. True when this frame measures: every object is pre-passed and queried
+    bool BeginFrame()
+    {
+        lock_guard<mutex> lock(stateMutex);
+        if (measuring || ++framesSinceMeasurement < MEASURE_INTERVAL)
+            return false;
+        framesSinceMeasurement = 0;
+        measuring = true;
+        issued = false;
+        return true;
+    }
+
+    bool UsePrepass(int object) const
+    {
+        lock_guard<mutex> lock(stateMutex);
+        return objects[object].prepass;
+    }
+
+    // prints every object when a measurement comes in
+    void SetReport(bool enabled)
+    {
+        lock_guard<mutex> lock(stateMutex);
+        report = enabled;
+    }
+
+    // render thread
+    const GLuint* Queries() const { return queries.data(); }
+    static unsigned int Slot(int object, OverdrawPass pass) { return object * 2 + pass; }
+    GLuint Query(int object, OverdrawPass pass) const { return queries[Slot(object, pass)]; }
+
+    // the measured frame was submitted
+    void Issued()
+    {
+        lock_guard<mutex> lock(stateMutex);
+        issued = true;
+    }
+
+    // once a frame, reads the measurement back when the GPU is done with it. Never waits
+    void Collect()
+    {
+        lock_guard<mutex> lock(stateMutex);
+        if (!measuring || !issued)
+            return;
+
+        for (GLuint query : queries)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+        }
+
+        for (size_t i = 0; i < objects.size(); i++)
+        {
+            Object& object = objects[i];
+            GLuint depthSamples = 0, colorSamples = 0;
+            glGetQueryObjectuiv(queries[Slot((int)i, OVERDRAW_DEPTH)], GL_QUERY_RESULT, &depthSamples);
+            glGetQueryObjectuiv(queries[Slot((int)i, OVERDRAW_COLOR)], GL_QUERY_RESULT, &colorSamples);
+
+            object.shadedSamples = depthSamples;
+            object.visibleSamples = colorSamples;
+            double saved = (double)depthSamples - colorSamples;
+            double cost = (double)object.vertexCount * VERTEX_COST + depthSamples;
+            object.prepass = saved * SHADED_FRAGMENT_COST > cost;
+        }
+        measuring = false;
+
+        if (report)
+        {
+            std::cout << "Overdraw (fragments shaded without a pre-pass / visible):";
+            for (const Object& object : objects)
+            {
+                std::cout << " " << object.name << " " << (object.visibleSamples > 0 ? (double)object.shadedSamples / object.visibleSamples : 0.0)
+                          << "x" << (object.prepass ? " (pre-pass)" : "") << ",";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+private:
+    struct Object {
+        string name;
+        size_t vertexCount = 0;
+        bool prepass = false;
+        GLuint shadedSamples = 0, visibleSamples = 0;
+    };
+
+    vector<Object> objects;
+    vector<GLuint> queries;
+    int framesSinceMeasurement;
+    // a measured frame was handed out and not read back yet, issued once the render thread submitted it
+    bool measuring, issued;
+    bool report;
+    mutable mutex stateMutex;
+};
+#endif
@@ -0,0 +1,298 @@
+#ifndef POSTPROCESS_H
+#define POSTPROCESS_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+
+#include "rendertargets.h"
+#include "framegraph.h"
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// the programs of the post chain, all but the histogram one are fullscreenVertex with their fragment shader
+struct PostPrograms {
+    GLuint downsample, upsample, histogram, exposure, tonemap, upscale;
+};
+
+// the scene is drawn into an RGBA16F target instead of the default framebuffer, so light above 1 survives until the
+// post chain takes it to the screen:
+//  - bloom: the scene is halved BLOOM_LEVELS times with a 13 tap filter, then every level gets the tent filtered one
+//    below it added on the way back up, so the top level holds the blur of all of them
+//  - auto exposure: a histogram of the luminance of HISTOGRAM_LEVEL, drawn as one point per texel counted by additive
+//    blending, gives the average luminance between two percentiles. A 1x1 target follows it over time like an eye
+//  - tone mapping of scene and bloom by the adapted exposure into the default framebuffer
+// The scene can be drawn at less than the full size, into the lower left renderWidth x renderHeight of its target.
+// The chain then only reads that part, tone maps at that size and upscales to the screen with a sharpening filter.
+// The chain's passes go into the frame's FrameGraph after the ones drawing the scene, the scene, the bloom levels, the
+// histogram and the tone mapped image are transient targets of it. Only the adapted luminance outlives a frame
+class PostProcess
+{
+public:
+    static const int BLOOM_LEVELS = 6;
+    // the level the luminance is measured on, a sixteenth of the scene in each direction
+    static const int HISTOGRAM_LEVEL = 4;
+    static const int HISTOGRAM_BINS = 64;
+    // log2 luminance the histogram covers
+    static constexpr float MIN_LOG_LUMINANCE = -8.0f, MAX_LOG_LUMINANCE = 4.0f;
+
+    bool bloom, autoExposure;
+    // how much of the bloom is mixed into the scene
+    float bloomStrength;
+    // what the average luminance is exposed to, and how far the exposure may go
+    float exposureKey, minExposure, maxExposure;
+    // how quickly the exposure follows, per second
+    float adaptationRate;
+    // of the upscaling at half resolution, it goes down to 0 towards the full one
+    float sharpness;
+
+    int width, height;
+    // the part of the scene target that is drawn into, set with SetRenderScale()
+    int renderWidth, renderHeight;
+
+    PostProcess() : bloom(true), autoExposure(true), bloomStrength(0.05f), exposureKey(0.5f), minExposure(0.25f), maxExposure(4.0f),
+                    adaptationRate(1.5f), sharpness(0.6f), width(0), height(0), renderWidth(0),
+                    renderHeight(0), emptyVAO(0), current(0), lastTime(-1.0f)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            adaptedTextures[i] = 0;
+            adaptedFBOs[i] = 0;
+        }
+    }
+
+    ~PostProcess()
+    {
+        // Create() never ran, the headless frame graph test builds the chain without a GL context
+        if (!emptyVAO)
+            return;
+        glDeleteTextures(2, adaptedTextures);
+        glDeleteFramebuffers(2, adaptedFBOs);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    // needs a current GL context
+    void Create(int width, int height, const PostPrograms& programs)
+    {
+        this->width = width;
+        this->height = height;
+        renderWidth = width;
+        renderHeight = height;
+        this->programs = programs;
+
+        // the adapted luminance of the last frame is read while this frame's is drawn, so there are two. They start at
+        // the key, an exposure of 1
+        for (int i = 0; i < 2; i++)
+        {
+            adaptedTextures[i] = createTexture(1, 1, GL_R32F, GL_RED, GL_FLOAT, GL_NEAREST, &exposureKey);
+            glGenFramebuffers(1, &adaptedFBOs[i]);
+            glBindFramebuffer(GL_FRAMEBUFFER, adaptedFBOs[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, adaptedTextures[i], 0);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenVertexArrays(1, &emptyVAO);
+
+        glUseProgram(programs.histogram);
+        glUniform1f(glGetUniformLocation(programs.histogram, "minLogLuminance"), MIN_LOG_LUMINANCE);
+        glUniform1f(glGetUniformLocation(programs.histogram, "logLuminanceRange"), MAX_LOG_LUMINANCE - MIN_LOG_LUMINANCE);
+        glUniform1i(glGetUniformLocation(programs.histogram, "bins"), HISTOGRAM_BINS);
+        glUseProgram(programs.exposure);
+        glUniform1f(glGetUniformLocation(programs.exposure, "minLogLuminance"), MIN_LOG_LUMINANCE);
+        glUniform1f(glGetUniformLocation(programs.exposure, "logLuminanceRange"), MAX_LOG_LUMINANCE - MIN_LOG_LUMINANCE);
+        glUniform1f(glGetUniformLocation(programs.exposure, "lowPercentile"), 0.3f);
+        glUniform1f(glGetUniformLocation(programs.exposure, "highPercentile"), 0.95f);
+        glUniform1i(glGetUniformLocation(programs.exposure, "histogram"), 0);
+        glUniform1i(glGetUniformLocation(programs.exposure, "previous"), 1);
+        glUseProgram(programs.tonemap);
+        glUniform1i(glGetUniformLocation(programs.tonemap, "scene"), 0);
+        glUniform1i(glGetUniformLocation(programs.tonemap, "bloom"), 1);
+        glUniform1i(glGetUniformLocation(programs.tonemap, "exposure"), 2);
+        glUseProgram(0);
+    }
+
+    // the share of the full size the scene is drawn at from now on, in both directions
+    void SetRenderScale(float scale)
+    {
+        renderWidth = glm::clamp((int)lroundf(width * scale), 1, width);
+        renderHeight = glm::clamp((int)lroundf(height * scale), 1, height);
+    }
+
+    bool Scaled() const { return renderWidth != width || renderHeight != height; }
+    glm::vec2 RenderScale() const { return glm::vec2((float)renderWidth / width, (float)renderHeight / height); }
+
+    // the scene's targets in graph, before the passes drawing them are added. The depth is sampled by the Hi-Z reduction,
+    // so a texture rather than a renderbuffer
+    int CreateScene(FrameGraph& graph) const { return graph.Create(width, height, GL_RGBA16F); }
+    int CreateSceneDepth(FrameGraph& graph) const { return graph.Create(width, height, GL_DEPTH24_STENCIL8); }
+
+    // the chain's passes from scene into screen, added to graph. Makes no GL calls, the passes do when they run. time is
+    // the frame's, in seconds, for the adaptation. With bloom off the upsampling and the levels below the histogram one
+    // are culled. Below full resolution the tone mapped image has the full size like the scene, so it can take the
+    // texture of a full size RGBA8 target that died before it (the G-buffer albedo)
+    void Build(FrameGraph& graph, int scene, int screen, float time)
+    {
+        float deltaTime = lastTime < 0.0f ? 0.0f : glm::clamp(time - lastTime, 0.0f, 0.25f);
+        lastTime = time;
+        glm::vec2 sceneScale = RenderScale();
+
+        // down, the first level weights away single bright pixels
+        int levels[BLOOM_LEVELS];
+        glm::ivec2 levelSizes[BLOOM_LEVELS];
+        int source = scene;
+        glm::ivec2 sourceSize(width, height);
+        for (int i = 0; i < BLOOM_LEVELS; i++)
+        {
+            // the levels are sized from the part of the scene that is drawn
+            glm::ivec2 imageSize = i == 0 ? glm::ivec2(renderWidth, renderHeight) : sourceSize;
+            levelSizes[i] = glm::max(imageSize / 2, glm::ivec2(1));
+            levels[i] = graph.Create(levelSizes[i].x, levelSizes[i].y, GL_RGBA16F);
+            glm::vec2 texelSize = 1.0f / glm::vec2(sourceSize);
+            glm::vec2 sourceScale = i == 0 ? sceneScale : glm::vec2(1.0f);
+            int pass = graph.AddPass(levels[i], FrameGraph::LOAD_NONE, [=]() {
+                beginFullscreen();
+                glUseProgram(programs.downsample);
+                glUniform2fv(glGetUniformLocation(programs.downsample, "texelSize"), 1, &texelSize[0]);
+                glUniform1i(glGetUniformLocation(programs.downsample, "firstLevel"), i == 0);
+                glUniform2fv(glGetUniformLocation(programs.downsample, "sourceScale"), 1, &sourceScale[0]);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            });
+            graph.Read(pass, source);
+            source = levels[i];
+            sourceSize = levelSizes[i];
+        }
+
+        int adapted = -1;
+        if (autoExposure)
+        {
+            glm::ivec2 measured = levelSizes[HISTOGRAM_LEVEL - 1];
+            int histogram = graph.Create(HISTOGRAM_BINS, 1, GL_R32F);
+            int pass = graph.AddPass(histogram, FrameGraph::LOAD_CLEAR, [=]() {
+                beginFullscreen();
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE);
+                glUseProgram(programs.histogram);
+                glDrawArrays(GL_POINTS, 0, measured.x * measured.y);
+                glDisable(GL_BLEND);
+            });
+            graph.Read(pass, levels[HISTOGRAM_LEVEL - 1]);
+
+            int next = 1 - current;
+            int previous = graph.Import(adaptedTextures[current], adaptedFBOs[current], 1, 1, GL_R32F);
+            adapted = graph.Import(adaptedTextures[next], adaptedFBOs[next], 1, 1, GL_R32F);
+            float adaptation = 1.0f - expf(-deltaTime * adaptationRate);
+            pass = graph.AddPass(adapted, FrameGraph::LOAD_NONE, [=]() {
+                beginFullscreen();
+                glUseProgram(programs.exposure);
+                glUniform1f(glGetUniformLocation(programs.exposure, "adaptation"), adaptation);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            });
+            graph.Read(pass, histogram, 0);
+            graph.Read(pass, previous, 1);
+            current = next;
+        }
+
+        // up, each level gets the one below it added
+        if (bloom)
+        {
+            for (int i = BLOOM_LEVELS - 1; i > 0; i--)
+            {
+                glm::vec2 texelSize = 1.0f / glm::vec2(levelSizes[i]);
+                int pass = graph.AddPass(levels[i - 1], FrameGraph::LOAD_KEEP, [=]() {
+                    beginFullscreen();
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_ONE, GL_ONE);
+                    glUseProgram(programs.upsample);
+                    glUniform2fv(glGetUniformLocation(programs.upsample, "texelSize"), 1, &texelSize[0]);
+                    glDrawArrays(GL_TRIANGLES, 0, 3);
+                    glDisable(GL_BLEND);
+                });
+                graph.Read(pass, levels[i]);
+            }
+        }
+
+        // below full resolution the tone mapped image is upscaled afterwards, sharpening works on the final colors
+        int toneMapped = Scaled() ? graph.Create(width, height, GL_RGBA8) : screen;
+        float strength = bloom ? bloomStrength : 0.0f, key = autoExposure ? exposureKey : 0.0f;
+        int pass = graph.AddPass(toneMapped, FrameGraph::LOAD_NONE, [=]() {
+            beginFullscreen();
+            glUseProgram(programs.tonemap);
+            glUniform1f(glGetUniformLocation(programs.tonemap, "bloomStrength"), strength);
+            glUniform1f(glGetUniformLocation(programs.tonemap, "bloomScale"), 1.0f / BLOOM_LEVELS);
+            glUniform1f(glGetUniformLocation(programs.tonemap, "exposureKey"), key);
+            glUniform2f(glGetUniformLocation(programs.tonemap, "exposureRange"), minExposure, maxExposure);
+            glUniform2fv(glGetUniformLocation(programs.tonemap, "sceneScale"), 1, &sceneScale[0]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        });
+        graph.Read(pass, scene, 0);
+        if (bloom)
+            graph.Read(pass, levels[0], 1);
+        if (autoExposure)
+            graph.Read(pass, adapted, 2);
+        if (Scaled())
+            graph.Viewport(pass, renderWidth, renderHeight);
+
+        if (Scaled())
+        {
+            glm::vec2 texelSize = 1.0f / glm::vec2(width, height);
+            float missing = 1.0f - (float)renderWidth / width;
+            float amount = sharpness * glm::clamp(missing * 2.0f, 0.0f, 1.0f);
+            pass = graph.AddPass(screen, FrameGraph::LOAD_NONE, [=]() {
+                beginFullscreen();
+                glUseProgram(programs.upscale);
+                glUniform2fv(glGetUniformLocation(programs.upscale, "texelSize"), 1, &texelSize[0]);
+                glUniform2fv(glGetUniformLocation(programs.upscale, "sourceScale"), 1, &sceneScale[0]);
+                glUniform1f(glGetUniformLocation(programs.upscale, "sharpness"), amount);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            });
+            graph.Read(pass, toneMapped);
+        }
+    }
+
+    // instead of the chain, the scene as it is into screen, for views whose colors mean something (the overdraw view)
+    void BuildCopy(FrameGraph& graph, int scene, int screen) const
+    {
+        int w = width, h = height, sourceWidth = renderWidth, sourceHeight = renderHeight;
+        const FrameGraph* frameGraph = &graph;
+        int pass = graph.AddPass(screen, FrameGraph::LOAD_NONE, [=]() {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, frameGraph->Target(scene).framebuffer);
+            glBlitFramebuffer(0, 0, sourceWidth, sourceHeight, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, frameGraph->Target(screen).framebuffer);
+        });
+        // blitted rather than sampled, the read only keeps the scene alive
+        graph.Read(pass, scene);
+    }
+
+private:
+    PostPrograms programs;
+    GLuint emptyVAO;
+    GLuint adaptedTextures[2], adaptedFBOs[2];
+    // which of the two holds the newest adapted luminance
+    int current;
+    float lastTime;
+
+    // what every pass of the chain starts with, the passes before may have been drawing geometry
+    void beginFullscreen() const
+    {
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_CULL_FACE);
+        glBindVertexArray(emptyVAO);
+    }
+
+    static GLuint createTexture(int width, int height, GLint internalFormat, GLenum format, GLenum type, GLint filter, const void* data)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, data);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+};
+#endif
@@ -0,0 +1,226 @@
+#ifndef RENDERTARGETS_H
+#define RENDERTARGETS_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+using namespace std;
+
+// a texture with a framebuffer that draws into it. Color formats get linear filtering, the post passes sample them
+// between texels
+struct RenderTarget {
+    GLuint texture, framebuffer;
+    int width, height;
+    GLenum format;
+};
+
+inline size_t RenderTargetTexelBytes(GLenum format)
+{
+    switch (format)
+    {
+    case GL_RGBA32F: return 16;
+    case GL_RGBA16F: return 8;
+    case GL_R11F_G11F_B10F: return 4;
+    case GL_RGBA8: return 4;
+    case GL_R32F: return 4;
+    case GL_RG16F: return 4;
+    case GL_RG16: return 4;
+    case GL_DEPTH24_STENCIL8: return 4;
+    case GL_DEPTH_COMPONENT24: return 4;
+    case GL_R16F: return 2;
+    case GL_RG8: return 2;
+    case GL_R8: return 1;
+    default: return 4;
+    }
+}
+
+inline bool IsDepthFormat(GLenum format)
+{
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH_COMPONENT24;
+}
+
+// targets that only live for part of a frame. Acquire() hands out a free target of the same size and format when there
+// is one and only creates a new one otherwise, Release() gives it back for the passes after. A target nobody
+// acquired for MAX_IDLE_FRAMES frames is deleted, so sizes that aren't used any more go away.
+// Every target draws with its own framebuffer, Framebuffer() makes the ones that draw into several at once
+class RenderTargetPool
+{
+public:
+    static const int MAX_IDLE_FRAMES = 120;
+
+    RenderTargetPool() : frame(0), created(0) {}
+
+    ~RenderTargetPool()
+    {
+        for (Entry& entry : entries)
+            destroy(entry.target);
+        for (const Combined& combined : combinedFramebuffers)
+            glDeleteFramebuffers(1, &combined.framebuffer);
+    }
+
+    // needs the GL context
+    RenderTarget Acquire(int width, int height, GLenum format)
+    {
+        for (Entry& entry : entries)
+        {
+            if (!entry.inUse && entry.target.width == width && entry.target.height == height && entry.target.format == format)
+            {
+                entry.inUse = true;
+                entry.lastUsed = frame;
+                return entry.target;
+            }
+        }
+
+        Entry entry;
+        entry.target = create(width, height, format);
+        entry.inUse = true;
+        entry.lastUsed = frame;
+        entries.push_back(entry);
+        created++;
+        return entry.target;
+    }
+
+    void Release(const RenderTarget& target)
+    {
+        for (Entry& entry : entries)
+            if (entry.target.texture == target.texture)
+                entry.inUse = false;
+    }
+
+    // a framebuffer drawing into colors (draw buffers 0, 1, ..) and depth (0 for none, of depthFormat) together. Made
+    // the first time the combination comes up and kept until one of its textures is deleted, with steady frames the
+    // pool hands out the same textures and this is a lookup
+    GLuint Framebuffer(const vector<GLuint>& colors, GLuint depth, GLenum depthFormat)
+    {
+        for (const Combined& combined : combinedFramebuffers)
+            if (combined.colors == colors && combined.depth == depth)
+                return combined.framebuffer;
+
+        Combined combined = { colors, depth, 0 };
+        glGenFramebuffers(1, &combined.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, combined.framebuffer);
+        vector<GLenum> drawBuffers;
+        for (size_t i = 0; i < colors.size(); i++)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i, GL_TEXTURE_2D, colors[i], 0);
+            drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + (GLenum)i);
+        }
+        if (depth)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, depthFormat == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        if (drawBuffers.empty())
+            glDrawBuffer(GL_NONE);
+        else
+            glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Render target framebuffer of " << colors.size() << " colors" << (depth ? " and depth" : "") << " incomplete" << std::endl;
+        combinedFramebuffers.push_back(combined);
+        return combined.framebuffer;
+    }
+
+    // once a frame, after the last Release()
+    void EndFrame()
+    {
+        for (size_t i = 0; i < entries.size();)
+        {
+            if (!entries[i].inUse && frame - entries[i].lastUsed > MAX_IDLE_FRAMES)
+            {
+                // a new texture may get the name again, the framebuffers drawing into it go first
+                forget(entries[i].target.texture);
+                destroy(entries[i].target);
+                entries.erase(entries.begin() + i);
+            }
+            else
+                i++;
+        }
+        frame++;
+    }
+
+    int Count() const { return (int)entries.size(); }
+    // textures ever created, stays put once every size a frame needs is in the pool
+    int Created() const { return created; }
+
+    size_t Bytes() const
+    {
+        size_t bytes = 0;
+        for (const Entry& entry : entries)
+            bytes += (size_t)entry.target.width * entry.target.height * RenderTargetTexelBytes(entry.target.format);
+        return bytes;
+    }
+
+private:
+    struct Entry {
+        RenderTarget target;
+        bool inUse;
+        int lastUsed;
+    };
+
+    struct Combined {
+        vector<GLuint> colors;
+        GLuint depth;
+        GLuint framebuffer;
+    };
+
+    vector<Entry> entries;
+    vector<Combined> combinedFramebuffers;
+    int frame;
+    int created;
+
+    static RenderTarget create(int width, int height, GLenum format)
+    {
+        RenderTarget target = { 0, 0, width, height, format };
+        bool depth = IsDepthFormat(format);
+        bool twoChannels = format == GL_RG16F || format == GL_RG16 || format == GL_RG8;
+        GLenum pixelFormat = depth ? (format == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT)
+                                   : (format == GL_R32F || format == GL_R16F || format == GL_R8 ? GL_RED : (twoChannels ? GL_RG : GL_RGBA));
+        GLenum type = format == GL_DEPTH24_STENCIL8 ? GL_UNSIGNED_INT_24_8 : (depth ? GL_UNSIGNED_INT :
+                      (format == GL_RGBA8 || format == GL_R8 || format == GL_RG8 ? GL_UNSIGNED_BYTE : (format == GL_RG16 ? GL_UNSIGNED_SHORT : GL_FLOAT)));
+
+        glGenTextures(1, &target.texture);
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, pixelFormat, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &target.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        if (depth)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, format == GL_DEPTH24_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, target.texture, 0);
+            glDrawBuffer(GL_NONE);
+        }
+        else
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Render target " << width << "x" << height << " framebuffer incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return target;
+    }
+
+    void forget(GLuint texture)
+    {
+        for (size_t i = 0; i < combinedFramebuffers.size();)
+        {
+            const Combined& combined = combinedFramebuffers[i];
+            if (combined.depth == texture || find(combined.colors.begin(), combined.colors.end(), texture) != combined.colors.end())
+            {
+                glDeleteFramebuffers(1, &combined.framebuffer);
+                combinedFramebuffers.erase(combinedFramebuffers.begin() + i);
+            }
+            else
+                i++;
+        }
+    }
+
+    static void destroy(RenderTarget& target)
+    {
+        glDeleteFramebuffers(1, &target.framebuffer);
+        glDeleteTextures(1, &target.texture);
+    }
+};
+#endif
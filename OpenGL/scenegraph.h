@@ -0,0 +1,79 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+using namespace std;
+
+// transform hierarchy kept in flat arrays where a parent always comes before its children, so Update() is one linear
+// pass: by the time a node is reached its parent's world matrix is already up to date.
+// Only nodes whose local transform changed, and everything below them, get their world matrix recomputed
+class SceneGraph
+{
+public:
+    // -1 for root nodes
+    vector<int> parents;
+    vector<glm::mat4> locals;
+    vector<glm::mat4> worlds;
+
+    // world matrices recomputed by the last Update()
+    int updatedNodes;
+
+    SceneGraph() : updatedNodes(0) {}
+
+    int NodeCount() const { return (int)parents.size(); }
+
+    // parent has to exist already, which is what keeps the array ordered
+    int AddNode(int parent, const glm::mat4& local)
+    {
+        int node = NodeCount();
+        parents.push_back(parent);
+        locals.push_back(local);
+        worlds.push_back(local);
+        dirty.push_back(1);
+        changed.push_back(0);
+        return node;
+    }
+
+    // copies a hierarchy that is ordered the same way (parents[i] < i, -1 for its root) below parent.
+    // returns the index of its first node, node i of the subtree ends up at first + i
+    int AddSubtree(int parent, const vector<int>& subtreeParents, const vector<glm::mat4>& subtreeLocals)
+    {
+        int first = NodeCount();
+        for (size_t i = 0; i < subtreeParents.size(); i++)
+            AddNode(subtreeParents[i] < 0 ? parent : first + subtreeParents[i], subtreeLocals[i]);
+        return first;
+    }
+
+    void SetLocal(int node, const glm::mat4& local)
+    {
+        locals[node] = local;
+        dirty[node] = 1;
+    }
+
+    const glm::mat4& World(int node) const { return worlds[node]; }
+
+    void Update()
+    {
+        updatedNodes = 0;
+        for (int i = 0; i < NodeCount(); i++)
+        {
+            int parent = parents[i];
+            changed[i] = dirty[i] || (parent >= 0 && changed[parent]);
+            if (!changed[i])
+                continue;
+
+            worlds[i] = parent >= 0 ? worlds[parent] * locals[i] : locals[i];
+            dirty[i] = 0;
+            updatedNodes++;
+        }
+    }
+
+private:
+    // local transform set since the last Update()
+    vector<char> dirty;
+    // world matrix recomputed in this Update(), tells the children to follow
+    vector<char> changed;
+};
+#endif
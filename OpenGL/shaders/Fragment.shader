@@ -1,5 +1,7 @@
 #version 330 core
+#ifndef GBUFFER
 out vec4 FragColor;
+#endif
 
 in vec3 color;
 in vec2 uv;
@@ -32,7 +34,19 @@ void main()
     normal = normalize(normal * 2.0f - 1.0f);
     normal = tbn * normal;
 
-    float lightValue = max(dot(lightDirection, normal), 0.0);
+    //the cell shading is forward only, deferred lights the box like everything else
+#ifdef GBUFFER
+    WriteGBuffer(color * texture(mainTex, uv).rgb, normal, 1.0, 256.0, 1.0);
+#else
+
+    //the sun shines along lightDirection like for every other shader, and is blocked by the shadow maps
+    float lightValue = max(dot(-lightDirection, normal), 0.0);
+#ifdef SHADOWS
+    float shadow = SunShadow(FragPos.xyz, normal);
+#else
+    float shadow = 1.0;
+#endif
+    lightValue *= shadow;
 
     //Specular data
     vec3 viewDirection = normalize(FragPos.rgb - cameraPosition);
@@ -42,10 +56,15 @@ void main()
 
     vec3 cellShading = texture(gradientTex,  vec2(0.0f, -min(lightValue + .1f, 1.0))).rgb;
 
-    float specular = pow(max(-dot( reflectedLightDirection, viewDirection), 0.0), 256);
+    float specular = pow(max(-dot( reflectedLightDirection, viewDirection), 0.0), 256) * shadow;
 
     vec4 result = vec4(color, 1.0f) * texture( mainTex, uv);
-    result.rgb = result.rgb * cellShading;
+#ifdef CLUSTERED_LIGHTS
+    vec3 pointLight = ClusteredLights(FragPos.xyz, normal, viewDirection, result.rgb, 1.0, 256.0);
+#else
+    vec3 pointLight = vec3(0.0);
+#endif
+    result.rgb = result.rgb * cellShading + pointLight;
 
     //Fog
     float distance = length(FragPos.xyz - cameraPosition);
@@ -57,4 +76,5 @@ void main()
     vec3 fogColor = lerp(bottomColor, topColor, max(viewDirection.y, 0.0));
 
     FragColor =  lerp(result + specular, vec4(fogColor, 1), fog);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D source;
+//of source
+uniform vec2 texelSize;
+//the first downsample of the scene weights its 5 boxes by their brightness, so single very bright pixels don't flicker
+uniform int firstLevel;
+//the part of source that holds the image, the scene is only drawn into a corner of its target below full resolution
+uniform vec2 sourceScale;
+
+vec3 Tap(vec2 offset)
+{
+    vec2 limit = sourceScale - texelSize * 0.5;
+    return texture(source, min(uv * sourceScale + texelSize * offset, limit)).rgb;
+}
+
+float KarisWeight(vec3 color)
+{
+    return 1.0 / (1.0 + dot(color, vec3(0.2126, 0.7152, 0.0722)));
+}
+
+//13 bilinear taps over a 4x4 texel neighbourhood of source: the center box at half the weight and the 4 overlapping
+//corner boxes at an eighth each (Jimenez, "Next Generation Post Processing in Call of Duty: Advanced Warfare")
+void main()
+{
+    vec3 a = Tap(vec2(-2.0, 2.0));
+    vec3 b = Tap(vec2(0.0, 2.0));
+    vec3 c = Tap(vec2(2.0, 2.0));
+    vec3 d = Tap(vec2(-2.0, 0.0));
+    vec3 e = Tap(vec2(0.0));
+    vec3 f = Tap(vec2(2.0, 0.0));
+    vec3 g = Tap(vec2(-2.0, -2.0));
+    vec3 h = Tap(vec2(0.0, -2.0));
+    vec3 i = Tap(vec2(2.0, -2.0));
+    vec3 j = Tap(vec2(-1.0, 1.0));
+    vec3 k = Tap(vec2(1.0, 1.0));
+    vec3 l = Tap(vec2(-1.0, -1.0));
+    vec3 m = Tap(vec2(1.0, -1.0));
+
+    vec3 boxes[5] = vec3[5]((j + k + l + m) * 0.25, (a + b + d + e) * 0.25, (b + c + e + f) * 0.25, (d + e + g + h) * 0.25, (e + f + h + i) * 0.25);
+    float weights[5] = float[5](0.5, 0.125, 0.125, 0.125, 0.125);
+    if (firstLevel != 0)
+        for (int box = 0; box < 5; box++)
+            weights[box] *= KarisWeight(boxes[box]);
+
+    vec3 result = vec3(0.0);
+    float total = 0.0;
+    for (int box = 0; box < 5; box++)
+    {
+        result += boxes[box] * weights[box];
+        total += weights[box];
+    }
+    FragColor = vec4(result / total, 1.0);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D source;
+//of source, the smaller level
+uniform vec2 texelSize;
+
+//3x3 tent over the level below, added onto the level drawn to, so every level ends up with the blur of all the ones
+//below it
+void main()
+{
+    vec3 result = texture(source, uv).rgb * 4.0;
+    result += (texture(source, uv + texelSize * vec2(0.0, 1.0)).rgb + texture(source, uv + texelSize * vec2(0.0, -1.0)).rgb +
+               texture(source, uv + texelSize * vec2(1.0, 0.0)).rgb + texture(source, uv + texelSize * vec2(-1.0, 0.0)).rgb) * 2.0;
+    result += texture(source, uv + texelSize * vec2(1.0, 1.0)).rgb + texture(source, uv + texelSize * vec2(-1.0, 1.0)).rgb +
+              texture(source, uv + texelSize * vec2(1.0, -1.0)).rgb + texture(source, uv + texelSize * vec2(-1.0, -1.0)).rgb;
+    FragColor = vec4(result / 16.0, 1.0);
+}
@@ -0,0 +1,54 @@
+#version 330 core
+//corner of the level grid, 0..gridSize
+layout(location = 0) in vec2 aGrid;
+
+out vec2 uv;
+out vec3 normal;
+out vec3 worldPosition;
+
+//one layer per level, addressed toroidally by world grid coordinate
+uniform sampler2DArray clipmap;
+
+uniform mat4 view, projection;
+
+uniform int gridSize;
+uniform int level;
+//world grid coordinate of corner 0 and the distance between two corners of this level
+uniform ivec2 origin;
+uniform float spacing;
+
+float heightAt(ivec2 corner)
+{
+    int size = gridSize + 1;
+    ivec2 texel = ((origin + corner) % size + size) % size;
+    return texelFetch(clipmap, ivec3(texel, level), 0).r;
+}
+
+void main()
+{
+    ivec2 corner = ivec2(aGrid);
+    float height = heightAt(corner);
+
+    //the outer band morphs into the next coarser level, on the very edge the odd corners sit exactly on its triangles.
+    //origin is even so the even corners of this level are the corners of the coarser one
+    int edge = min(min(corner.x, corner.y), min(gridSize - corner.x, gridSize - corner.y));
+    float morph = clamp(1.0 - float(edge) / float(gridSize / 8), 0.0, 1.0);
+    ivec2 odd = corner & 1;
+    ivec2 c0 = corner - odd;
+    ivec2 c1 = corner + odd;
+    float coarse = (heightAt(c0) + heightAt(ivec2(c1.x, c0.y)) + heightAt(ivec2(c0.x, c1.y)) + heightAt(c1)) * 0.25;
+    height = mix(height, coarse, morph);
+
+    //central differences, one sided on the border where the neighbours belong to the other side of the ring buffer
+    ivec2 n0 = max(corner - 1, 0);
+    ivec2 n1 = min(corner + 1, gridSize);
+    float dx = (heightAt(ivec2(n1.x, corner.y)) - heightAt(ivec2(n0.x, corner.y))) / (float(n1.x - n0.x) * spacing);
+    float dz = (heightAt(ivec2(corner.x, n1.y)) - heightAt(ivec2(corner.x, n0.y))) / (float(n1.y - n0.y) * spacing);
+    normal = normalize(vec3(-dx, 1.0, -dz));
+
+    vec2 xz = vec2(origin + corner) * spacing;
+    worldPosition = vec3(xz.x, height, xz.y);
+    uv = xz;
+
+    gl_Position = projection * view * vec4(worldPosition, 1.0);
+}
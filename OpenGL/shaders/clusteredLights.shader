@@ -0,0 +1,63 @@
+//put after the #version line of a forward fragment shader by CreateProgram(), the shader then adds the point lights
+//binned by LightClusters with ClusteredLights(), which only loops over the lights of the cluster the fragment is in
+#define CLUSTERED_LIGHTS
+
+//per frame, filled in by the render thread (CLUSTER_UNIFORM_BINDING)
+layout(std140) uniform ClusterData {
+    mat4 clusterView;
+    //pixels per tile in x and y, depth where slice 1 starts, slices per unit of log depth
+    vec4 clusterScale;
+    //tiles in x and y, slices, 1 for the lights per cluster view
+    ivec4 clusterGrid;
+};
+
+//offset into clusterIndices and light count of every cluster
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
+//two texels a light: xyz position and radius, rgb color
+uniform samplerBuffer pointLights;
+
+//the same slices as LightClusters::Slice()
+int ClusterIndex(vec3 position)
+{
+    float depth = -(clusterView * vec4(position, 1.0)).z;
+    int slice = depth < clusterScale.z ? 0 : min(1 + int(log(depth / clusterScale.z) * clusterScale.w), clusterGrid.z - 1);
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterScale.xy), clusterGrid.xy - 1);
+    return (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+}
+
+//blue for one light per cluster through green and yellow to red for 32 or more
+vec3 ClusterHeat(uint count)
+{
+    if (count == 0u)
+        return vec3(0.0);
+    float t = clamp(float(count) / 32.0, 0.0, 1.0);
+    return clamp(vec3(t * 2.0 - 0.5, 1.5 - abs(t * 2.0 - 1.0) * 2.0, 1.0 - t * 2.0), 0.0, 1.0);
+}
+
+//light of the point lights reaching position, the same falloff and shading as the deferred light volumes
+vec3 ClusteredLights(vec3 position, vec3 normal, vec3 viewDirection, vec3 albedo, float specular, float shininess)
+{
+    uvec2 range = texelFetch(clusterRanges, ClusterIndex(position)).xy;
+    if (clusterGrid.w != 0)
+        return ClusterHeat(range.y);
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+        vec4 sphere = texelFetch(pointLights, light * 2);
+        vec3 toLight = sphere.xyz - position;
+        float distance = length(toLight);
+        if (distance >= sphere.w)
+            continue;
+
+        vec3 lightDirection = toLight / distance;
+        float attenuation = 1.0 - distance / sphere.w;
+        attenuation *= attenuation;
+        float lambert = max(dot(normal, lightDirection), 0.0);
+        float spec = pow(max(dot(-viewDirection, reflect(-lightDirection, normal)), 0.0), shininess) * specular;
+        result += texelFetch(pointLights, light * 2 + 1).rgb * attenuation * (albedo * lambert + vec3(spec));
+    }
+    return result;
+}
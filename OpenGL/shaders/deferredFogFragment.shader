@@ -0,0 +1,42 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D gDepth;
+uniform sampler2D lightTex;
+
+uniform mat4 inverseViewProjection;
+uniform vec3 cameraPosition;
+
+vec3 lerp(vec3 a, vec3 b, float t) {
+    return a + (b - a) * t;
+}
+
+//the same distance fog the forward shaders add, over the lit image on its way to the screen. The sky isn't fogged
+void main()
+{
+    //uv is across the viewport, which may only be part of the targets
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec3 color = texelFetch(lightTex, texel, 0).rgb;
+    float depth = texelFetch(gDepth, texel, 0).r;
+    if (depth == 1.0)
+    {
+        FragColor = vec4(color, 1.0);
+        return;
+    }
+
+    vec4 position = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    position /= position.w;
+
+    vec3 viewDirection = normalize(position.xyz - cameraPosition);
+    float distance = length(position.xyz - cameraPosition);
+    float fog = pow(clamp((distance - 250) / 1000, 0, 1), 2);
+
+    vec3 topColor = vec3(68.0f / 255.0f, 118.0f / 255.0f, 189.0f / 255.0f);
+    vec3 bottomColor = vec3(188.0f / 255.0f, 214.0f / 255.0f, 231.0f / 255.0f);
+
+    vec3 fogColor = lerp(bottomColor, topColor, max(viewDirection.y, 0.0));
+
+    FragColor = vec4(lerp(color, fogColor, fog), 1.0);
+}
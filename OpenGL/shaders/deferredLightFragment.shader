@@ -0,0 +1,55 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+uniform vec3 lightDirection;
+uniform vec3 cameraPosition;
+
+vec3 UnpackNormal(vec2 p)
+{
+    p = p * 2.0 - 1.0;
+    vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+//the sun for every pixel the geometry pass wrote, the sky drawn before stays where the depth was cleared to 1
+void main()
+{
+    //uv is across the viewport, which may only be part of the targets
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, texel, 0).r;
+    if (depth == 1.0)
+        discard;
+
+    vec4 position = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    position /= position.w;
+
+    vec4 albedo = texelFetch(gAlbedo, texel, 0);
+    vec3 normal = UnpackNormal(texelFetch(gNormal, texel, 0).rg);
+    vec2 material = texelFetch(gMaterial, texel, 0).rg;
+
+    float light = max(dot(-lightDirection, normal), 0.0);
+#ifdef SHADOWS
+    float shadow = SunShadow(position.xyz, normal);
+#else
+    float shadow = 1.0;
+#endif
+    light *= shadow;
+
+    vec3 viewDirection = normalize(position.xyz - cameraPosition);
+    vec3 refl = reflect(lightDirection, normal);
+    float shininess = exp2((1.0 - material.r) * 8.0);
+    float spec = pow(max(dot(-viewDirection, refl), 0.0), shininess) * albedo.a * shadow;
+
+    FragColor = vec4(albedo.rgb * max(light, 0.2) * material.g + vec3(spec), 1.0);
+}
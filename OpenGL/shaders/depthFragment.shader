@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+
+//depth pre-pass: nothing to compute, color writes are masked off.
+//the overdraw view draws with it too, additively, so every shaded layer adds this much
+void main()
+{
+    FragColor = vec4(0.12, 0.06, 0.02, 1.0);
+}
@@ -0,0 +1,39 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D histogram;
+//the adapted luminance of the frame before, 1x1
+uniform sampler2D previous;
+uniform float minLogLuminance;
+uniform float logLuminanceRange;
+//how far to move towards this frame's luminance, from the frame time
+uniform float adaptation;
+//the darkest and the brightest part of the pixels that are left out of the average
+uniform float lowPercentile;
+uniform float highPercentile;
+
+//average luminance of the pixels between the two percentiles of the histogram, the eye adapts to it over time.
+//Drawn into a 1x1 target
+void main()
+{
+    int bins = textureSize(histogram, 0).x;
+    float total = 0.0;
+    for (int i = 0; i < bins; i++)
+        total += texelFetch(histogram, ivec2(i, 0), 0).r;
+
+    float low = total * lowPercentile, high = total * highPercentile;
+    float seen = 0.0, sum = 0.0, weight = 0.0;
+    for (int i = 0; i < bins; i++)
+    {
+        float count = texelFetch(histogram, ivec2(i, 0), 0).r;
+        float counted = max(min(seen + count, high) - max(seen, low), 0.0);
+        seen += count;
+        float logLuminance = i == 0 ? minLogLuminance : minLogLuminance + (float(i) - 0.5) / float(bins - 1) * logLuminanceRange;
+        sum += counted * logLuminance;
+        weight += counted;
+    }
+
+    float previousLuminance = texelFetch(previous, ivec2(0, 0), 0).r;
+    float luminance = weight > 0.0 ? exp2(sum / weight) : previousLuminance;
+    FragColor = vec4(previousLuminance + (luminance - previousLuminance) * adaptation);
+}
@@ -0,0 +1,9 @@
+#version 330 core
+out vec2 uv;
+
+//one triangle that covers the screen, drawn without a vertex buffer: gl_VertexID 0, 1, 2 -> (0, 0), (2, 0), (0, 2)
+void main()
+{
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
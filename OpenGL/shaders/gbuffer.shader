@@ -0,0 +1,23 @@
+//put after the #version line of a fragment shader by CreateProgram() to make its G-buffer variant,
+//the shader then writes its surface with WriteGBuffer() and leaves the lighting and fog to the deferred passes
+#define GBUFFER
+
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec2 gNormal;
+layout(location = 2) out vec2 gMaterial;
+
+//octahedral encoding: the normal projected onto the octahedron |x| + |y| + |z| = 1, the lower half folded over
+vec2 PackNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 p = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return p * 0.5 + 0.5;
+}
+
+//shininess is the specular exponent of the forward shaders (1 - 256), stored as a roughness in 0..1
+void WriteGBuffer(vec3 albedo, vec3 normal, float specular, float shininess, float ambientOcclusion)
+{
+    gAlbedo = vec4(albedo, specular);
+    gNormal = PackNormal(normalize(normal));
+    gMaterial = vec2(1.0 - log2(shininess) / 8.0, ambientOcclusion);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+out float MaxDepth;
+
+uniform sampler2D source;
+
+//one level of the Hi-Z reduction: every texel is the farthest of the 2x2 source texels under it. The target is half
+//the source rounded up, so the last texel of an odd row or column only covers one source texel
+void main()
+{
+    ivec2 last = textureSize(source, 0) - 1;
+    ivec2 texel = ivec2(gl_FragCoord.xy) * 2;
+    float a = texelFetch(source, min(texel, last), 0).r;
+    float b = texelFetch(source, min(texel + ivec2(1, 0), last), 0).r;
+    float c = texelFetch(source, min(texel + ivec2(0, 1), last), 0).r;
+    float d = texelFetch(source, min(texel + ivec2(1, 1), last), 0).r;
+    MaxDepth = max(max(a, b), max(c, d));
+}
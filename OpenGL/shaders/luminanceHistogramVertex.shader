@@ -0,0 +1,21 @@
+#version 330 core
+
+uniform sampler2D source;
+//log2 luminance at the start of bin 1 and the range bins 1.. cover, bin 0 is for what is darker
+uniform float minLogLuminance;
+uniform float logLuminanceRange;
+uniform int bins;
+
+//one point per texel of source, drawn without a vertex buffer. It lands on the texel of its luminance bin in a
+//bins x 1 target, where additive blending counts it
+void main()
+{
+    int width = textureSize(source, 0).x;
+    vec3 color = texelFetch(source, ivec2(gl_VertexID % width, gl_VertexID / width), 0).rgb;
+    float luminance = dot(color, vec3(0.2126, 0.7152, 0.0722));
+
+    float bin = 0.0;
+    if (luminance > exp2(minLogLuminance))
+        bin = 1.0 + floor(clamp((log2(luminance) - minLogLuminance) / logLuminanceRange, 0.0, 0.999) * float(bins - 1));
+    gl_Position = vec4((bin + 0.5) / float(bins) * 2.0 - 1.0, 0.0, 0.0, 1.0);
+}
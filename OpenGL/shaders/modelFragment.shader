@@ -1,5 +1,7 @@
 #version 330 core
+#ifndef GBUFFER
 out vec4 FragColor;
+#endif
 
 in vec2 TexCoords;
 in vec3 Normals;
@@ -11,8 +13,13 @@ uniform sampler2D texture_normal1;
 uniform sampler2D texture_roughness1;
 uniform sampler2D texture_ao1;
 
-uniform vec3 cameraPosition;
-uniform vec3 lightDirection;
+//per frame, filled in by the render thread (FRAME_UNIFORM_BINDING)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
 
 vec4 lerp(vec4 a, vec4 b, float t) {
     return a + (b - a) * t;
@@ -31,7 +38,17 @@ void main()
     vec4 diffuse = texture(texture_diffuse1, TexCoords);
     vec4 specTex = texture(texture_specular1, TexCoords);
 
+#ifdef GBUFFER
+    WriteGBuffer(diffuse.rgb, Normals, specTex.r, lerp(1, 128, texture(texture_roughness1, TexCoords).r), texture(texture_ao1, TexCoords).r);
+#else
+
     float light = max(dot(-lightDirection, Normals), 0.0);
+#ifdef SHADOWS
+    float shadow = SunShadow(FragPos.xyz, Normals);
+#else
+    float shadow = 1.0;
+#endif
+    light *= shadow;
 
     vec3 viewDirection = normalize(FragPos.rgb - cameraPosition);
     vec3 refl = reflect(lightDirection, Normals);
@@ -40,7 +57,11 @@ void main()
     
     float roughness = texture(texture_roughness1, TexCoords).r;
     float spec = pow(max(dot(-viewDirection, refl), 0.0), lerp(1, 128, roughness));
-    vec3 specular = spec * specTex.rgb;
+    vec3 specular = spec * specTex.rgb * shadow;
+
+#ifdef CLUSTERED_LIGHTS
+    specular += ClusteredLights(FragPos.xyz, Normals, viewDirection, diffuse.rgb, specTex.r, lerp(1, 128, roughness));
+#endif
     
     float distance = length(FragPos.xyz - cameraPosition);
     float fog = pow(clamp((distance - 250) / 1000, 0, 1), 2);
@@ -53,4 +74,5 @@ void main()
     vec4 result = lerp(diffuse * max(light * ambientOcclusion, 0.2 * ambientOcclusion) + vec4(specular, 0), vec4(fogColor, 1.0), fog);
 
     FragColor = result;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,33 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+out vec3 Normals;
+out vec4 FragPos;
+
+//per frame, filled in by the render thread (FRAME_UNIFORM_BINDING)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
+
+//per object, recorded with the draw (OBJECT_UNIFORM_BINDING)
+layout(std140) uniform ObjectData {
+    mat4 world;
+    mat3 normalMatrix;
+    vec4 defaultColor;
+};
+
+void main()
+{
+    TexCoords = aTexCoords;
+    FragPos = world * vec4(aPos, 1.0);
+    gl_Position = projection * view * FragPos;
+
+    // the baseline RunVertexBenchmark compares against, modelVertex.shader gets normalMatrix from the CPU
+    Normals = normalize( mat3(inverse(transpose(world)))* aNormal );
+}
\ No newline at end of file
@@ -1,13 +1,26 @@
 #version 330 core
+#ifndef GBUFFER
 out vec4 FragColor;
+#endif
 
 in vec2 TexCoords;
 in vec3 Normals;
 in vec4 FragPos;
 
-uniform vec4 defaultColor = vec4(0, 0, 0, 1);
-uniform vec3 cameraPosition;
-uniform vec3 lightDirection;
+//per frame, filled in by the render thread (FRAME_UNIFORM_BINDING)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
+
+//per object, recorded with the draw (OBJECT_UNIFORM_BINDING)
+layout(std140) uniform ObjectData {
+    mat4 world;
+    mat3 normalMatrix;
+    vec4 defaultColor;
+};
 
 vec4 lerp(vec4 a, vec4 b, float t) {
     return a + (b - a) * t;
@@ -26,14 +39,28 @@ void main()
   
     vec4 diffuse = defaultColor;
 
+#ifdef GBUFFER
+    WriteGBuffer(diffuse.rgb, Normals, 1.0, 256.0, 1.0);
+#else
+
     float light = max(dot(-lightDirection, Normals), 0.0);
+#ifdef SHADOWS
+    float shadow = SunShadow(FragPos.xyz, Normals);
+#else
+    float shadow = 1.0;
+#endif
+    light *= shadow;
 
     vec3 viewDirection = normalize(FragPos.rgb - cameraPosition);
     vec3 refl = reflect(lightDirection, Normals);
     
     float spec = pow(max(-dot( refl, viewDirection), 0.0), 256);
 
-    vec3 specular = spec * vec3(1, 1, 1);
+    vec3 specular = spec * vec3(1, 1, 1) * shadow;
+
+#ifdef CLUSTERED_LIGHTS
+    specular += ClusteredLights(FragPos.xyz, Normals, viewDirection, diffuse.rgb, 1.0, 256.0);
+#endif
     
     float distance = length(FragPos.xyz - cameraPosition);
     float fog = pow(clamp((distance - 250) / 1000, 0, 1), 2);
@@ -46,4 +73,5 @@ void main()
     vec4 result = lerp(diffuse * max(light, 0.2) + vec4(specular, 0), vec4(fogColor, 1.0), fog);
 
     FragColor = result;
+#endif
 }
\ No newline at end of file
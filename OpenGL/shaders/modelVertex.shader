@@ -7,9 +7,20 @@ out vec2 TexCoords;
 out vec3 Normals;
 out vec4 FragPos;
 
-uniform mat4 world;
-uniform mat4 view;
-uniform mat4 projection;
+//per frame, filled in by the render thread (FRAME_UNIFORM_BINDING)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
+
+//per object, recorded with the draw (OBJECT_UNIFORM_BINDING)
+layout(std140) uniform ObjectData {
+    mat4 world;
+    mat3 normalMatrix;
+    vec4 defaultColor;
+};
 
 void main()
 {
@@ -17,6 +28,5 @@ void main()
     FragPos = world * vec4(aPos, 1.0);
     gl_Position = projection * view * FragPos;
 
-    // not the most efficient, but it works
-    Normals = normalize( mat3(inverse(transpose(world)))* aNormal );
+    Normals = normalize(normalMatrix * aNormal);
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+#version 330 core
+out vec4 FragColor;
+
+flat in vec4 sphere;
+flat in vec3 color;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+uniform sampler2D gMaterial;
+uniform sampler2D gDepth;
+
+uniform mat4 inverseViewProjection;
+uniform vec3 cameraPosition;
+//of the viewport, which may only be part of the targets
+uniform vec2 screenSize;
+
+vec3 UnpackNormal(vec2 p)
+{
+    p = p * 2.0 - 1.0;
+    vec3 n = vec3(p, 1.0 - abs(p.x) - abs(p.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+//one light on the pixels its volume covers, added to what the other lights left
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec2 uv = gl_FragCoord.xy / screenSize;
+    float depth = texelFetch(gDepth, texel, 0).r;
+
+    vec4 position = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    position /= position.w;
+
+    vec3 toLight = sphere.xyz - position.xyz;
+    float distance = length(toLight);
+    if (distance >= sphere.w)
+        discard;
+
+    vec4 albedo = texelFetch(gAlbedo, texel, 0);
+    vec3 normal = UnpackNormal(texelFetch(gNormal, texel, 0).rg);
+    vec2 material = texelFetch(gMaterial, texel, 0).rg;
+
+    vec3 lightDirection = toLight / distance;
+    float attenuation = 1.0 - distance / sphere.w;
+    attenuation *= attenuation;
+    float light = max(dot(normal, lightDirection), 0.0);
+
+    vec3 viewDirection = normalize(position.xyz - cameraPosition);
+    vec3 refl = reflect(-lightDirection, normal);
+    float shininess = exp2((1.0 - material.r) * 8.0);
+    float spec = pow(max(dot(-viewDirection, refl), 0.0), shininess) * albedo.a;
+
+    FragColor = vec4(color * attenuation * (albedo.rgb * light * material.g + vec3(spec)), 0.0);
+}
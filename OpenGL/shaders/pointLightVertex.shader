@@ -0,0 +1,17 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+//one PointLight per instance
+layout(location = 1) in vec4 lightSphere;
+layout(location = 2) in vec4 lightColor;
+
+flat out vec4 sphere;
+flat out vec3 color;
+
+uniform mat4 view, projection;
+
+void main()
+{
+    sphere = lightSphere;
+    color = lightColor.rgb;
+    gl_Position = projection * view * vec4(lightSphere.xyz + aPos * lightSphere.w, 1.0);
+}
@@ -0,0 +1,39 @@
+//put after the #version line of a fragment shader by CreateProgram(), SunShadow() then says how much of the sun
+//reaches a point through the cascaded shadow maps of CascadedShadows
+#define SHADOWS
+
+//per frame, filled in by the render thread (SHADOW_UNIFORM_BINDING)
+layout(std140) uniform ShadowData {
+    //world space to shadow map texture space of every cascade
+    mat4 shadowMatrices[4];
+    //camera view, the view depth picks the cascade
+    mat4 shadowView;
+    //view depth where every cascade ends
+    vec4 shadowSplits;
+    //world size of a shadow map texel of every cascade
+    vec4 shadowTexelSizes;
+};
+
+uniform sampler2DArrayShadow shadowMap;
+
+//1 in full sun, 0 in shadow. The point is moved out along the normal by a texel or so, which keeps surfaces at
+//grazing angles from shadowing themselves, then 3x3 filtered compares soften the edge
+float SunShadow(vec3 position, vec3 normal)
+{
+    float depth = -(shadowView * vec4(position, 1.0)).z;
+    if (depth >= shadowSplits.w)
+        return 1.0;
+    int cascade = depth < shadowSplits.x ? 0 : (depth < shadowSplits.y ? 1 : (depth < shadowSplits.z ? 2 : 3));
+
+    vec4 coord = shadowMatrices[cascade] * vec4(position + normalize(normal) * shadowTexelSizes[cascade] * 1.5, 1.0);
+    //a cascade that wasn't updated this frame may not reach this far
+    if (any(lessThan(coord.xyz, vec3(0.0))) || any(greaterThan(coord.xyz, vec3(1.0))))
+        return 1.0;
+
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+            lit += texture(shadowMap, vec4(coord.xy + vec2(x, y) * texel, float(cascade), coord.z));
+    return lit / 9.0;
+}
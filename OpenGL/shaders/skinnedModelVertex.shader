@@ -0,0 +1,45 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 5) in ivec4 aBoneIDs;
+layout(location = 6) in vec4 aWeights;
+
+out vec2 TexCoords;
+out vec3 Normals;
+out vec4 FragPos;
+
+//per frame, filled in by the render thread (FRAME_UNIFORM_BINDING)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPosition;
+    vec3 lightDirection;
+};
+
+//per object, recorded with the draw (OBJECT_UNIFORM_BINDING)
+layout(std140) uniform ObjectData {
+    mat4 world;
+    mat3 normalMatrix;
+    vec4 defaultColor;
+};
+
+//per instance, mesh space to model space for every bone of the pose (BONE_UNIFORM_BINDING), MAX_BONES long
+layout(std140) uniform Bones {
+    mat4 bones[128];
+};
+
+void main()
+{
+    //unused influences have id -1 and weight 0
+    mat4 skin = bones[max(aBoneIDs.x, 0)] * aWeights.x
+              + bones[max(aBoneIDs.y, 0)] * aWeights.y
+              + bones[max(aBoneIDs.z, 0)] * aWeights.z
+              + bones[max(aBoneIDs.w, 0)] * aWeights.w;
+
+    TexCoords = aTexCoords;
+    FragPos = world * skin * vec4(aPos, 1.0);
+    gl_Position = projection * view * FragPos;
+
+    Normals = normalize(normalMatrix * mat3(skin) * aNormal);
+}
@@ -16,7 +16,8 @@ void main()
     vec3 topColor = vec3(68.0f / 255.0f, 118.0f / 255.0f, 189.0f / 255.0f);
     vec3 bottomColor = vec3(188.0f / 255.0f, 214.0f / 255.0f, 231.0f / 255.0f);
 
-    vec3 sunColor = vec3(1.0f, 200 / 255.0, 50 / 255.0);
+    //brighter than the screen can show, the post chain blooms it and rolls it off
+    vec3 sunColor = vec3(1.0f, 200 / 255.0, 50 / 255.0) * 4.0;
 
     vec3 viewDirection = normalize(worldPosition.rgb - cameraPosition);
 
@@ -1,5 +1,7 @@
 #version 330 core
+#ifndef GBUFFER
 out vec4 FragColor;
+#endif
 
 in vec2 uv;
 in vec3 worldPosition;
@@ -34,6 +36,9 @@ void main()
     //Lighting
     
     float lightValue = max( -dot(normal, lightDirection), 0.0f);
+#ifdef SHADOWS
+    lightValue *= SunShadow(worldPosition, normal);
+#endif
 
     //vec3 cellShading = texture(gradientTex,  vec2(0.0f, -min(lightValue + .1f, 1.0))).rgb;
 
@@ -70,6 +75,10 @@ void main()
 
     vec3 diffuse = lerp(lerp(lerp(lerp(dirtColor, sandColor, dirtToSand), grassColor, sandToGrass), rockColor, grassToRock), snowColor, rockToSnow);
 
+#ifdef GBUFFER
+    WriteGBuffer(diffuse, normal, 0.0, 1.0, 1.0);
+#else
+
     float fog = pow(clamp((distance - 250) / 1000, 0, 1), 2);
 
     vec3 topColor = vec3(68.0f / 255.0f, 118.0f / 255.0f, 189.0f / 255.0f);
@@ -77,8 +86,14 @@ void main()
     
     vec3 fogColor = lerp(bottomColor, topColor, max(viewDirection.y, 0.0));
 
-    vec4 result = vec4(lerp(diffuse * min(lightValue + 0.1, 1.0), fogColor, fog), 1); //+ specular;
+    vec3 pointLight = vec3(0.0);
+#ifdef CLUSTERED_LIGHTS
+    pointLight = ClusteredLights(worldPosition, normal, viewDirection, diffuse, 0.0, 1.0);
+#endif
+
+    vec4 result = vec4(lerp(diffuse * min(lightValue + 0.1, 1.0) + pointLight, fogColor, fog), 1); //+ specular;
 
     FragColor =  result;
     //FragColor = texture(gradientTex, vec2(0.0f, lightValue));
+#endif
 }
\ No newline at end of file
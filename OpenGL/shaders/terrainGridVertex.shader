@@ -0,0 +1,36 @@
+#version 330 core
+//corner of the patch quad grid, 0..patchSize
+layout(location = 0) in vec2 aGrid;
+
+out vec2 uv;
+out vec3 normal;
+out vec3 worldPosition;
+
+uniform sampler2D mainTex;
+
+uniform mat4 world, view, projection;
+
+//one instance per patch, patches are laid out row by row
+uniform int patchSize;
+uniform int patchesPerRow;
+uniform float hScale;
+uniform float xzScale;
+
+void main()
+{
+    ivec2 size = textureSize(mainTex, 0);
+    ivec2 patchIndex = ivec2(gl_InstanceID % patchesPerRow, gl_InstanceID / patchesPerRow);
+
+    //patches on the far edges hang over the heightmap, those vertices collapse onto the last texel
+    ivec2 texel = min(patchIndex * patchSize + ivec2(aGrid), size - 1);
+
+    //same height the CPU mesh bakes for this sample
+    float height = texelFetch(mainTex, texel, 0).r * hScale;
+    vec3 pos = vec3(texel.x * xzScale, height, texel.y * xzScale);
+
+    gl_Position = projection * view * world * vec4(pos, 1.0);
+    uv = vec2(texel) / vec2(size);
+    normal = vec3(0, 1, 0);
+
+    worldPosition = mat3(world) * pos;
+}
@@ -0,0 +1,96 @@
+#version 330 core
+#ifndef GBUFFER
+out vec4 FragColor;
+#endif
+
+in vec2 uv;
+in vec3 worldPosition;
+
+uniform sampler2D mainTex;
+uniform sampler2D normalTex;
+
+//layers: 0 dirt, 1 sand, 2 grass, 3 rock, 4 snow
+uniform sampler2DArray layers;
+//weights of layer 0-3, layer 4 gets whatever is left
+uniform sampler2D splatTex;
+
+uniform vec3 lightDirection;
+uniform vec3 cameraPosition;
+
+vec3 lerp( vec3 a, vec3 b, float t)
+{
+    return a + (b - a) * t;
+}
+
+//textureGrad, because the fetches happen inside branches where implicit derivatives are undefined
+vec3 sampleLayer(float layer, vec2 uvClose, vec4 gradClose, vec2 uvFar, vec4 gradFar, float uvLerp)
+{
+    vec3 color = vec3(0.0);
+    if (uvLerp < 1.0)
+        color += textureGrad(layers, vec3(uvClose, layer), gradClose.xy, gradClose.zw).rgb * (1.0 - uvLerp);
+    if (uvLerp > 0.0)
+        color += textureGrad(layers, vec3(uvFar, layer), gradFar.xy, gradFar.zw).rgb * uvLerp;
+    return color;
+}
+
+void main()
+{
+    //Normal map
+    vec3 normal = texture(normalTex, uv).rgb;
+    normal = normalize(normal * 2.0 - 1.0);
+    normal.gb = normal.bg;
+    normal.r = -normal.r;
+    normal.b = -normal.b;
+
+    vec3 viewDirection = normalize(worldPosition.rgb - cameraPosition);
+
+    //Lighting
+    float lightValue = max( -dot(normal, lightDirection), 0.0f);
+#ifdef SHADOWS
+    lightValue *= SunShadow(worldPosition, normal);
+#endif
+
+    //Paint based on the splat map
+    vec4 splat = texture(splatTex, uv);
+    float weights[5] = float[5](splat.r, splat.g, splat.b, splat.a, max(1.0 - dot(splat, vec4(1.0)), 0.0));
+
+    float distance = length(worldPosition.xyz - cameraPosition);
+    float uvLerp = clamp((distance - 250) / 150, -1, 1) * 0.5f + 0.5f;
+
+    vec2 uvClose = uv * 100;
+    vec2 uvFar = uv * 10;
+    vec4 gradClose = vec4(dFdx(uvClose), dFdy(uvClose));
+    vec4 gradFar = vec4(dFdx(uvFar), dFdy(uvFar));
+
+    //only the layers that actually contribute are fetched, the splat map keeps at most 3 of them per texel
+    vec3 diffuse = vec3(0.0);
+    float totalWeight = 0.0;
+    for (int i = 0; i < 5; i++)
+    {
+        if (weights[i] > 0.01)
+        {
+            diffuse += sampleLayer(float(i), uvClose, gradClose, uvFar, gradFar, uvLerp) * weights[i];
+            totalWeight += weights[i];
+        }
+    }
+    diffuse /= max(totalWeight, 0.0001);
+
+#ifdef GBUFFER
+    WriteGBuffer(diffuse, normal, 0.0, 1.0, 1.0);
+#else
+
+    float fog = pow(clamp((distance - 250) / 1000, 0, 1), 2);
+
+    vec3 topColor = vec3(68.0f / 255.0f, 118.0f / 255.0f, 189.0f / 255.0f);
+    vec3 bottomColor = vec3(188.0f / 255.0f, 214.0f / 255.0f, 231.0f / 255.0f);
+
+    vec3 fogColor = lerp(bottomColor, topColor, max(viewDirection.y, 0.0));
+
+    vec3 pointLight = vec3(0.0);
+#ifdef CLUSTERED_LIGHTS
+    pointLight = ClusteredLights(worldPosition, normal, viewDirection, diffuse, 0.0, 1.0);
+#endif
+
+    FragColor = vec4(lerp(diffuse * min(lightValue + 0.1, 1.0) + pointLight, fogColor, fog), 1);
+#endif
+}
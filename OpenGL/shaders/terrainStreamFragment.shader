@@ -0,0 +1,101 @@
+#version 330 core
+#ifndef GBUFFER
+out vec4 FragColor;
+#endif
+
+in vec2 uv;
+in vec3 normal;
+in vec3 worldPosition;
+
+//layers: 0 dirt, 1 sand, 2 grass, 3 rock, 4 snow
+uniform sampler2DArray layers;
+
+uniform vec3 lightDirection;
+uniform vec3 cameraPosition;
+
+vec3 lerp( vec3 a, vec3 b, float t)
+{
+    return a + (b - a) * t;
+}
+
+vec3 sampleLayer(float layer, vec2 uvClose, vec4 gradClose, vec2 uvFar, vec4 gradFar, float uvLerp)
+{
+    vec3 color = vec3(0.0);
+    if (uvLerp < 1.0)
+        color += textureGrad(layers, vec3(uvClose, layer), gradClose.xy, gradClose.zw).rgb * (1.0 - uvLerp);
+    if (uvLerp > 0.0)
+        color += textureGrad(layers, vec3(uvFar, layer), gradFar.xy, gradFar.zw).rgb * uvLerp;
+    return color;
+}
+
+void main()
+{
+    //streamed tiles have no normal map, the vertex normals are built from the tile heights
+    vec3 n = normalize(normal);
+
+    vec3 viewDirection = normalize(worldPosition.rgb - cameraPosition);
+
+    //Lighting
+    float lightValue = max( -dot(n, lightDirection), 0.0f);
+#ifdef SHADOWS
+    lightValue *= SunShadow(worldPosition, n);
+#endif
+
+    //Paint based on height and slope, the world can be any size so layers tile in world space
+    float y = worldPosition.y;
+
+    float dirtToSand = clamp((y - 20) / 10, -1, 1) * .5 + .5;
+    float sandToGrass = clamp((y - 60) / 10, -1, 1) * .5 + .5;
+    float grassToRock = clamp((y - 120) / 10, -1, 1) * .5 + .5;
+    float rockToSnow = clamp((y - 160) / 10, -1, 1) * .5 + .5;
+    float slopeToRock = smoothstep(0.3, 0.5, 1.0 - n.y);
+
+    float weights[5];
+    weights[4] = rockToSnow;
+    weights[3] = grassToRock * (1 - rockToSnow);
+    weights[2] = sandToGrass * (1 - grassToRock) * (1 - rockToSnow);
+    weights[1] = dirtToSand * (1 - sandToGrass) * (1 - grassToRock) * (1 - rockToSnow);
+    weights[0] = (1 - dirtToSand) * (1 - sandToGrass) * (1 - grassToRock) * (1 - rockToSnow);
+    for (int i = 0; i < 5; i++)
+        weights[i] *= 1.0 - slopeToRock;
+    weights[3] += slopeToRock;
+
+    float distance = length(worldPosition.xyz - cameraPosition);
+    float uvLerp = clamp((distance - 250) / 150, -1, 1) * 0.5f + 0.5f;
+
+    vec2 uvClose = worldPosition.xz / 25.0;
+    vec2 uvFar = worldPosition.xz / 250.0;
+    vec4 gradClose = vec4(dFdx(uvClose), dFdy(uvClose));
+    vec4 gradFar = vec4(dFdx(uvFar), dFdy(uvFar));
+
+    vec3 diffuse = vec3(0.0);
+    float totalWeight = 0.0;
+    for (int i = 0; i < 5; i++)
+    {
+        if (weights[i] > 0.01)
+        {
+            diffuse += sampleLayer(float(i), uvClose, gradClose, uvFar, gradFar, uvLerp) * weights[i];
+            totalWeight += weights[i];
+        }
+    }
+    diffuse /= max(totalWeight, 0.0001);
+
+#ifdef GBUFFER
+    WriteGBuffer(diffuse, n, 0.0, 1.0, 1.0);
+#else
+
+    float fog = pow(clamp((distance - 250) / 1000, 0, 1), 2);
+
+    vec3 topColor = vec3(68.0f / 255.0f, 118.0f / 255.0f, 189.0f / 255.0f);
+    vec3 bottomColor = vec3(188.0f / 255.0f, 214.0f / 255.0f, 231.0f / 255.0f);
+
+    vec3 fogColor = lerp(bottomColor, topColor, max(viewDirection.y, 0.0));
+
+    vec3 pointLight = vec3(0.0);
+#ifdef CLUSTERED_LIGHTS
+    pointLight = ClusteredLights(worldPosition, n, viewDirection, diffuse, 0.0, 1.0);
+#endif
+
+    FragColor = vec4(lerp(diffuse * min(lightValue + 0.1, 1.0) + pointLight, fogColor, fog), 1);
+#endif
+}
@@ -0,0 +1,36 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+uniform sampler2D scene;
+uniform sampler2D bloom;
+//adapted average luminance, 1x1
+uniform sampler2D exposure;
+uniform float bloomStrength;
+//bloom holds the sum of every level
+uniform float bloomScale;
+//what the adapted average luminance is brought to, 0 for a fixed exposure of 1
+uniform float exposureKey;
+uniform vec2 exposureRange;
+//the part of scene that holds the image
+uniform vec2 sceneScale;
+
+//the colors were made for the screen, so they go through unchanged up to shoulderStart and only what is brighter is
+//rolled off towards 1 instead of clipping
+const float shoulderStart = 0.6;
+
+vec3 Shoulder(vec3 color)
+{
+    vec3 over = max(color - shoulderStart, 0.0);
+    vec3 rolled = shoulderStart + (1.0 - shoulderStart) * (1.0 - exp(-over / (1.0 - shoulderStart)));
+    return mix(color, rolled, step(shoulderStart, color));
+}
+
+void main()
+{
+    vec3 color = mix(texture(scene, min(uv * sceneScale, sceneScale - 0.5 / vec2(textureSize(scene, 0)))).rgb, texture(bloom, uv).rgb * bloomScale, bloomStrength);
+    if (exposureKey > 0.0)
+        color *= clamp(exposureKey / max(texelFetch(exposure, ivec2(0, 0), 0).r, 1e-4), exposureRange.x, exposureRange.y);
+    FragColor = vec4(Shoulder(color), 1.0);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 uv;
+
+//the tone mapped image at the resolution the scene was drawn at, filtered bilinearly onto the screen
+uniform sampler2D source;
+//of source
+uniform vec2 texelSize;
+//the part of source that holds the image, the lower left corner like the scene
+uniform vec2 sourceScale;
+//0 leaves the bilinear result
+uniform float sharpness;
+
+vec3 Tap(vec2 offset)
+{
+    return texture(source, clamp(uv * sourceScale + texelSize * offset, texelSize * 0.5, sourceScale - texelSize * 0.5)).rgb;
+}
+
+//an unsharp mask against the 4 neighbours, clamped to their range so edges don't get halos: bilinear upscaling blurs,
+//and the lower the resolution the more it has to give back
+void main()
+{
+    vec3 center = Tap(vec2(0.0));
+    vec3 n = Tap(vec2(0.0, 1.0));
+    vec3 s = Tap(vec2(0.0, -1.0));
+    vec3 e = Tap(vec2(1.0, 0.0));
+    vec3 w = Tap(vec2(-1.0, 0.0));
+
+    vec3 low = min(center, min(min(n, s), min(e, w)));
+    vec3 high = max(center, max(max(n, s), max(e, w)));
+    vec3 sharpened = center + (center - (n + s + e + w) * 0.25) * sharpness;
+    FragColor = vec4(clamp(sharpened, low, high), 1.0);
+}
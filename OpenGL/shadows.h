@@ -0,0 +1,234 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "culling.h"
+#include "gputimer.h"
+
+#include <cmath>
+#include <iostream>
+using namespace std;
+
+const int SHADOW_CASCADES = 4;
+
+// the ShadowData block of shadows.shader (std140)
+struct ShadowUniformData {
+    // world space to shadow map texture space (xy 0..1 and the depth to compare) of every cascade
+    glm::mat4 matrices[SHADOW_CASCADES];
+    // camera view, the view depth of a fragment picks its cascade
+    glm::mat4 view;
+    // view depth where every cascade ends
+    glm::vec4 splits;
+    // world size of a shadow map texel of every cascade, for the normal offset
+    glm::vec4 texelSizes;
+};
+
+// one cascade as the main thread fitted it
+struct ShadowCascade {
+    glm::mat4 view, projection;
+    // of the box the casters are drawn from, for culling them
+    Frustum frustum;
+    // drawn this frame, otherwise its shadow map and matrices stay the ones of the last update
+    bool updated;
+};
+
+struct ShadowCascades {
+    ShadowCascade cascades[SHADOW_CASCADES];
+    ShadowUniformData uniforms;
+};
+
+// fits SHADOW_CASCADES shadow maps of a directional light to slices of the camera frustum. The slices are spaced
+// between logarithmic and linear (the practical split scheme) out to shadowDistance. Each cascade is an orthographic
+// box around the bounding sphere of its slice, so its size never changes when the camera turns. Its center is snapped
+// to whole shadow map texels, so moving the camera doesn't make the shadow edges crawl. The box reaches
+// casterDistance further towards the light, so casters outside the slice still shadow it.
+//
+// The near cascades are fitted and drawn every frame, the far ones at UPDATE_INTERVALS, on different frames
+class CascadedShadows
+{
+public:
+    static const int SIZE = 2048;
+
+    float shadowDistance, casterDistance, splitLambda;
+
+    CascadedShadows(float shadowDistance = 2000.0f, float casterDistance = 2000.0f, float splitLambda = 0.8f)
+        : shadowDistance(shadowDistance), casterDistance(casterDistance), splitLambda(splitLambda), frame(0), lightDirection(0.0f) {}
+
+    // main thread, once a frame. projection is the camera's symmetric perspective projection. The cascades that
+    // aren't updated keep what they were fitted to last time
+    void Update(const glm::mat4& view, const glm::mat4& projection, glm::vec3 lightDirection, ShadowCascades& out)
+    {
+        static const int UPDATE_INTERVALS[SHADOW_CASCADES] = { 1, 1, 2, 4 };
+        static const int UPDATE_PHASES[SHADOW_CASCADES] = { 0, 0, 1, 0 };
+
+        glm::vec3 up = fabs(lightDirection.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+        glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+        glm::mat4 inverseView = glm::inverse(view);
+        // texture space from clip space
+        glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+
+        // the light moved, the old maps are no use any more
+        bool all = lightDirection != this->lightDirection;
+        this->lightDirection = lightDirection;
+
+        float nearDepth = 1.0f;
+        float depth0 = 0.0f;
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+        {
+            float t = (i + 1) / (float)SHADOW_CASCADES;
+            float depth1 = splitLambda * nearDepth * powf(shadowDistance / nearDepth, t) + (1.0f - splitLambda) * (nearDepth + (shadowDistance - nearDepth) * t);
+
+            ShadowCascade& cascade = state.cascades[i];
+            cascade.updated = all || frame % UPDATE_INTERVALS[i] == UPDATE_PHASES[i];
+            if (cascade.updated)
+            {
+                fit(depth0, depth1, projection, inverseView, lightRotation, cascade, state.uniforms.texelSizes[i]);
+                state.uniforms.matrices[i] = bias * cascade.projection * cascade.view;
+            }
+            state.uniforms.splits[i] = depth1;
+            depth0 = depth1;
+        }
+        state.uniforms.view = view;
+        out = state;
+        frame++;
+    }
+
+private:
+    int frame;
+    glm::vec3 lightDirection;
+    ShadowCascades state;
+
+    void fit(float depth0, float depth1, const glm::mat4& projection, const glm::mat4& inverseView, const glm::mat4& lightRotation, ShadowCascade& cascade, float& texelSize)
+    {
+        // bounding sphere of the slice: its center on the view axis, where it is equally far from the corners of
+        // both ends
+        float tanX = 1.0f / projection[0][0], tanY = 1.0f / projection[1][1];
+        float corner2 = tanX * tanX + tanY * tanY;
+        float centerDepth = glm::clamp(0.5f * (depth0 + depth1) * (1.0f + corner2), depth0, depth1);
+        float radius = sqrtf(std::max((depth1 - centerDepth) * (depth1 - centerDepth) + depth1 * depth1 * corner2,
+                                      (centerDepth - depth0) * (centerDepth - depth0) + depth0 * depth0 * corner2));
+        // a little larger and rounded, so float noise doesn't change the texel size
+        radius = ceilf(radius * 1.05f);
+
+        glm::vec3 center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+        glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+        texelSize = 2.0f * radius / SIZE;
+        lightCenter.x = floorf(lightCenter.x / texelSize) * texelSize;
+        lightCenter.y = floorf(lightCenter.y / texelSize) * texelSize;
+
+        // the light looks down -z of lightRotation
+        cascade.view = lightRotation;
+        cascade.projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+                                        -lightCenter.z - radius - casterDistance, -lightCenter.z + radius);
+        cascade.frustum = ExtractFrustum(cascade.projection * cascade.view);
+    }
+};
+
+// the depth maps of the cascades, one layer of a texture array each, sampled with hardware depth compares
+class ShadowMaps
+{
+public:
+    static const int UNIT = 11;
+
+    GLuint texture;
+    // how long the GPU took to draw each cascade the last time it was updated
+    GpuTimer timers[SHADOW_CASCADES];
+
+    // of the texture array
+    static size_t Bytes() { return (size_t)CascadedShadows::SIZE * CascadedShadows::SIZE * SHADOW_CASCADES * 4; }
+
+    ShadowMaps() : texture(0), uniformBuffer(0)
+    {
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+            framebuffers[i] = 0;
+    }
+
+    ~ShadowMaps()
+    {
+        glDeleteTextures(1, &texture);
+        glDeleteFramebuffers(SHADOW_CASCADES, framebuffers);
+        glDeleteBuffers(1, &uniformBuffer);
+    }
+
+    // needs a current GL context
+    void Create()
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, CascadedShadows::SIZE, CascadedShadows::SIZE, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        // linear filtering of the compare results, 4 texels for the price of one fetch
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        glGenFramebuffers(SHADOW_CASCADES, framebuffers);
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, i);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "Shadow cascade " << i << " framebuffer incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &uniformBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowUniformData), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        for (GpuTimer& timer : timers)
+            timer.Init();
+    }
+
+    // the depth of cascade i is drawn after this, offset a little so surfaces don't shadow themselves
+    void BeginCascade(int i)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+        glViewport(0, 0, CascadedShadows::SIZE, CascadedShadows::SIZE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1.5f, 4.0f);
+        timers[i].Begin();
+    }
+
+    void EndCascade(int i)
+    {
+        timers[i].End();
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // the frame's matrices and the maps where the shaders look for them
+    void Bind(const ShadowUniformData& uniforms, GLuint uniformBinding)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, uniformBinding, uniformBuffer);
+
+        glActiveTexture(GL_TEXTURE0 + UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void Collect()
+    {
+        for (GpuTimer& timer : timers)
+            timer.Collect();
+    }
+
+private:
+    GLuint framebuffers[SHADOW_CASCADES];
+    GLuint uniformBuffer;
+};
+#endif
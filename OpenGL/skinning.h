@@ -0,0 +1,180 @@
+#ifndef SKINNING_H
+#define SKINNING_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "cpu.h"
+
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+// the bind pose of a skinned mesh one array per component, so 8 vertices load into one register per component.
+// the arrays are padded to a multiple of 8 with vertices that have no weights
+class SkinningSource
+{
+public:
+    vector<float> positionX, positionY, positionZ;
+    vector<float> normalX, normalY, normalZ;
+    vector<float> texCoordU, texCoordV;
+    // bone of influence j of every vertex, -1 became 0 with a weight of 0
+    vector<int> bones[MAX_BONE_INFLUENCE];
+    vector<float> weights[MAX_BONE_INFLUENCE];
+
+    SkinningSource() : count(0), boneCount(0) {}
+
+    explicit SkinningSource(const vector<Vertex>& vertices) : count((int)vertices.size()), boneCount(0)
+    {
+        int padded = (count + 7) / 8 * 8;
+        for (vector<float>* component : { &positionX, &positionY, &positionZ, &normalX, &normalY, &normalZ, &texCoordU, &texCoordV })
+            component->assign(padded, 0.0f);
+        for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+        {
+            bones[j].assign(padded, 0);
+            weights[j].assign(padded, 0.0f);
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            const Vertex& vertex = vertices[i];
+            positionX[i] = vertex.Position.x; positionY[i] = vertex.Position.y; positionZ[i] = vertex.Position.z;
+            normalX[i] = vertex.Normal.x; normalY[i] = vertex.Normal.y; normalZ[i] = vertex.Normal.z;
+            texCoordU[i] = vertex.TexCoords.x; texCoordV[i] = vertex.TexCoords.y;
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                bones[j][i] = vertex.m_BoneIDs[j] >= 0 ? vertex.m_BoneIDs[j] : 0;
+                weights[j][i] = vertex.m_BoneIDs[j] >= 0 ? vertex.m_Weights[j] : 0.0f;
+                boneCount = std::max(boneCount, bones[j][i] + 1);
+            }
+        }
+    }
+
+    int Count() const { return count; }
+    bool Empty() const { return count == 0; }
+    // highest bone index used + 1, the palette has to be at least this long
+    int BoneCount() const { return boneCount; }
+
+private:
+    int count;
+    int boneCount;
+};
+
+// one vertex at a time, also the reference for the AVX2 kernel. Normals are left for the shader to normalize
+inline void SkinVerticesScalar(const SkinningSource& source, const glm::mat4* palette, SkinnedVertex* out, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        glm::mat4 skin = palette[source.bones[0][i]] * source.weights[0][i];
+        for (int j = 1; j < MAX_BONE_INFLUENCE; j++)
+            skin += palette[source.bones[j][i]] * source.weights[j][i];
+
+        SkinnedVertex& vertex = out[i - begin];
+        vertex.Position = glm::vec3(skin * glm::vec4(source.positionX[i], source.positionY[i], source.positionZ[i], 1.0f));
+        vertex.Normal = glm::mat3(skin) * glm::vec3(source.normalX[i], source.normalY[i], source.normalZ[i]);
+        vertex.TexCoords = glm::vec2(source.texCoordU[i], source.texCoordV[i]);
+    }
+}
+
+#ifdef CPU_AVX2
+// rows[r][k] = element k of register r, afterwards rows[k][r]
+inline void Transpose8(__m256 (&rows)[8])
+{
+    __m256 a0 = _mm256_unpacklo_ps(rows[0], rows[1]), a1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+    __m256 a2 = _mm256_unpacklo_ps(rows[2], rows[3]), a3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+    __m256 a4 = _mm256_unpacklo_ps(rows[4], rows[5]), a5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+    __m256 a6 = _mm256_unpacklo_ps(rows[6], rows[7]), a7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+    __m256 b0 = _mm256_shuffle_ps(a0, a2, _MM_SHUFFLE(1, 0, 1, 0)), b1 = _mm256_shuffle_ps(a0, a2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 b2 = _mm256_shuffle_ps(a1, a3, _MM_SHUFFLE(1, 0, 1, 0)), b3 = _mm256_shuffle_ps(a1, a3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 b4 = _mm256_shuffle_ps(a4, a6, _MM_SHUFFLE(1, 0, 1, 0)), b5 = _mm256_shuffle_ps(a4, a6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 b6 = _mm256_shuffle_ps(a5, a7, _MM_SHUFFLE(1, 0, 1, 0)), b7 = _mm256_shuffle_ps(a5, a7, _MM_SHUFFLE(3, 2, 3, 2));
+    rows[0] = _mm256_permute2f128_ps(b0, b4, 0x20);
+    rows[1] = _mm256_permute2f128_ps(b1, b5, 0x20);
+    rows[2] = _mm256_permute2f128_ps(b2, b6, 0x20);
+    rows[3] = _mm256_permute2f128_ps(b3, b7, 0x20);
+    rows[4] = _mm256_permute2f128_ps(b0, b4, 0x31);
+    rows[5] = _mm256_permute2f128_ps(b1, b5, 0x31);
+    rows[6] = _mm256_permute2f128_ps(b2, b6, 0x31);
+    rows[7] = _mm256_permute2f128_ps(b3, b7, 0x31);
+}
+
+// 8 vertices per iteration. The palette is first turned into the 3 rows of every bone's affine part (12 floats), so
+// blending the influences of a vertex is one 8 wide and one 4 wide FMA per bone. The blended matrices of the 8 vertices
+// are transposed into 12 registers of one element each, the 8 vertices are then transformed side by side with FMAs and
+// transposed back into 8 SkinnedVertex (8 floats each) on the way out.
+// Gathering each element of the 8 vertices' bones instead (12 gathers per influence) skips the first transposes but
+// ran at half the speed, the bone rows are contiguous so two loads per influence are cheaper
+inline void SkinVerticesAVX2(const SkinningSource& source, const glm::mat4* palette, SkinnedVertex* out, int begin, int end)
+{
+    static_assert(sizeof(SkinnedVertex) == 8 * sizeof(float), "SkinnedVertex is written as 8 floats");
+
+    static thread_local vector<float> boneRows;
+    boneRows.resize(source.BoneCount() * 12 + 4);
+    for (int b = 0; b < source.BoneCount(); b++)
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                boneRows[b * 12 + r * 4 + c] = palette[b][c][r];
+    const float* rows = boneRows.data();
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        // rows 0 and 1 of the blended matrix of every vertex, then row 2
+        __m256 upper[8], lower[8];
+        for (int k = 0; k < 8; k++)
+        {
+            __m256 rows01 = _mm256_setzero_ps();
+            __m128 row2 = _mm_setzero_ps();
+            for (int j = 0; j < MAX_BONE_INFLUENCE; j++)
+            {
+                // unused influences have weight 0, adding them is cheaper than a branch that mispredicts
+                float weight = source.weights[j][i + k];
+                const float* bone = rows + source.bones[j][i + k] * 12;
+                rows01 = _mm256_fmadd_ps(_mm256_set1_ps(weight), _mm256_loadu_ps(bone), rows01);
+                row2 = _mm_fmadd_ps(_mm_set1_ps(weight), _mm_loadu_ps(bone + 8), row2);
+            }
+            upper[k] = rows01;
+            lower[k] = _mm256_castps128_ps256(row2);
+        }
+        // skin[r * 4 + c] holds element (row r, column c) of the 8 vertices
+        Transpose8(upper);
+        Transpose8(lower);
+        const __m256* skin0 = upper;
+        const __m256* skin2 = lower;
+
+        __m256 px = _mm256_loadu_ps(&source.positionX[i]), py = _mm256_loadu_ps(&source.positionY[i]), pz = _mm256_loadu_ps(&source.positionZ[i]);
+        __m256 nx = _mm256_loadu_ps(&source.normalX[i]), ny = _mm256_loadu_ps(&source.normalY[i]), nz = _mm256_loadu_ps(&source.normalZ[i]);
+
+        __m256 vertex[8];
+        for (int r = 0; r < 3; r++)
+        {
+            const __m256* row = r < 2 ? skin0 + r * 4 : skin2;
+            vertex[r] = _mm256_fmadd_ps(row[0], px, _mm256_fmadd_ps(row[1], py, _mm256_fmadd_ps(row[2], pz, row[3])));
+            vertex[3 + r] = _mm256_fmadd_ps(row[0], nx, _mm256_fmadd_ps(row[1], ny, _mm256_mul_ps(row[2], nz)));
+        }
+        vertex[6] = _mm256_loadu_ps(&source.texCoordU[i]);
+        vertex[7] = _mm256_loadu_ps(&source.texCoordV[i]);
+
+        Transpose8(vertex);
+        float* destination = (float*)(out + (i - begin));
+        for (int k = 0; k < 8; k++)
+            _mm256_storeu_ps(destination + k * 8, vertex[k]);
+    }
+    SkinVerticesScalar(source, palette, out + (i - begin), i, end);
+}
+#endif
+
+// skins vertices [begin, end) of source with the bone matrices in palette into out[0 .. end - begin)
+inline void SkinVertices(const SkinningSource& source, const glm::mat4* palette, SkinnedVertex* out, int begin, int end)
+{
+#ifdef CPU_AVX2
+    static const bool avx2 = CpuSupportsAVX2();
+    if (avx2)
+    {
+        SkinVerticesAVX2(source, palette, out, begin, end);
+        return;
+    }
+#endif
+    SkinVerticesScalar(source, palette, out, begin, end);
+}
+#endif
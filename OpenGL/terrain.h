@@ -0,0 +1,313 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cfloat>
+using namespace std;
+
+struct HeightFieldHit {
+    // world space hit point
+    glm::vec3 Position;
+    // surface normal of the hit triangle
+    glm::vec3 Normal;
+    // distance along the (normalized) ray
+    float Distance;
+};
+
+// CPU copy of the terrain heights, answers height/normal/ray queries without touching the GPU.
+// sample (x, z) sits at world position (x * xzScale, height, z * xzScale), same layout GeneratePlane uses for the mesh.
+class HeightField
+{
+public:
+    int width, height;
+    float hScale, xzScale;
+    // world space heights, row major
+    vector<float> heights;
+
+    HeightField() : width(0), height(0), hScale(1.0f), xzScale(1.0f) {}
+
+    // data is the decoded heightmap, the first channel of every texel is the height
+    HeightField(const unsigned char* data, int width, int height, int comp, float hScale, float xzScale)
+        : width(width), height(height), hScale(hScale), xzScale(xzScale)
+    {
+        heights.resize(width * height);
+        for (int i = 0; i < width * height; i++)
+            heights[i] = (data[i * comp] / 255.0f) * hScale;
+
+        buildPyramid();
+    }
+
+    float GetSample(int x, int z) const
+    {
+        x = glm::clamp(x, 0, width - 1);
+        z = glm::clamp(z, 0, height - 1);
+        return heights[z * width + x];
+    }
+
+    // bilinear height at world position (x, z), clamped to the edges of the terrain
+    float GetHeight(float x, float z) const
+    {
+        int x0, z0;
+        float tx, tz;
+        cellAt(x, z, x0, z0, tx, tz);
+
+        const float* row0 = &heights[z0 * width + x0];
+        const float* row1 = row0 + width;
+        float top = row0[0] + (row0[1] - row0[0]) * tx;
+        float bottom = row1[0] + (row1[1] - row1[0]) * tx;
+        return top + (bottom - top) * tz;
+    }
+
+    // normal of the bilinear surface at world position (x, z)
+    glm::vec3 GetNormal(float x, float z) const
+    {
+        int x0, z0;
+        float tx, tz;
+        cellAt(x, z, x0, z0, tx, tz);
+
+        const float* row0 = &heights[z0 * width + x0];
+        const float* row1 = row0 + width;
+        float dx = ((row0[1] - row0[0]) * (1 - tz) + (row1[1] - row1[0]) * tz) / xzScale;
+        float dz = ((row1[0] - row0[0]) * (1 - tx) + (row1[1] - row0[1]) * tx) / xzScale;
+        return glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+    }
+
+    // first intersection of the ray with the terrain triangles within maxDistance, direction doesn't have to be normalized.
+    // walks the min/max pyramid front to back and only tests the triangles of cells whose bounds the ray passes through.
+    bool Raycast(glm::vec3 origin, glm::vec3 direction, float maxDistance, HeightFieldHit& hit) const
+    {
+        if (levels.empty())
+            return false;
+
+        direction = glm::normalize(direction);
+        glm::vec3 invDirection = 1.0f / direction;
+
+        // children are visited in ray order so the first triangle hit is the closest one
+        int flipX = direction.x < 0 ? 1 : 0;
+        int flipZ = direction.z < 0 ? 1 : 0;
+
+        Node stack[64 * 4];
+        int stackSize = 0;
+
+        // the top level is at most 2x2, push it far to near like any other node's children
+        int top = (int)levels.size() - 1;
+        pushChildren(stack, stackSize, top, 0, 0, flipX, flipZ);
+
+        while (stackSize > 0)
+        {
+            Node node = stack[--stackSize];
+            const Level& level = levels[node.level];
+            int index = node.z * level.width + node.x;
+
+            // bounds of the node in world space, a node covers (1 << level) cells per axis
+            int cells = 1 << node.level;
+            glm::vec3 boundsMin(node.x * cells * xzScale, level.minHeights[index], node.z * cells * xzScale);
+            glm::vec3 boundsMax((node.x + 1) * cells * xzScale, level.maxHeights[index], (node.z + 1) * cells * xzScale);
+
+            float tMin, tMax;
+            if (!intersectBounds(origin, invDirection, boundsMin, boundsMax, tMin, tMax) || tMin > maxDistance)
+                continue;
+
+            if (node.level == 0)
+            {
+                if (intersectCell(node.x, node.z, origin, direction, maxDistance, hit))
+                    return true;
+                continue;
+            }
+
+            pushChildren(stack, stackSize, node.level - 1, node.x * 2, node.z * 2, flipX, flipZ);
+        }
+        return false;
+    }
+
+    // batched versions, positions are world space (x, z)
+    void GetHeights(const glm::vec2* positions, float* results, int count) const
+    {
+        for (int i = 0; i < count; i++)
+            results[i] = GetHeight(positions[i].x, positions[i].y);
+    }
+
+    void GetNormals(const glm::vec2* positions, glm::vec3* results, int count) const
+    {
+        for (int i = 0; i < count; i++)
+            results[i] = GetNormal(positions[i].x, positions[i].y);
+    }
+
+    // returns the number of rays that hit, hits[i] is only valid when hitResults[i] is true
+    int Raycasts(const glm::vec3* origins, const glm::vec3* directions, float maxDistance, HeightFieldHit* hits, bool* hitResults, int count) const
+    {
+        int hitCount = 0;
+        for (int i = 0; i < count; i++)
+        {
+            hitResults[i] = Raycast(origins[i], directions[i], maxDistance, hits[i]);
+            if (hitResults[i]) hitCount++;
+        }
+        return hitCount;
+    }
+
+private:
+    // level 0 holds the height range of every cell (the quad between 4 samples), every next level halves the resolution
+    struct Level {
+        int width, height;
+        vector<float> minHeights, maxHeights;
+    };
+    vector<Level> levels;
+
+    struct Node { int level, x, z; };
+
+    // pushes the 2x2 block of nodes starting at (x, z) far to near, so the one closest to the ray origin is popped first
+    void pushChildren(Node* stack, int& stackSize, int level, int x, int z, int flipX, int flipZ) const
+    {
+        for (int i = 3; i >= 0; i--)
+        {
+            int cx = x + ((i & 1) ^ flipX);
+            int cz = z + (((i >> 1) & 1) ^ flipZ);
+            if (cx < levels[level].width && cz < levels[level].height)
+                stack[stackSize++] = { level, cx, cz };
+        }
+    }
+
+    void buildPyramid()
+    {
+        levels.clear();
+        if (width < 2 || height < 2)
+            return;
+
+        Level base;
+        base.width = width - 1;
+        base.height = height - 1;
+        base.minHeights.resize(base.width * base.height);
+        base.maxHeights.resize(base.width * base.height);
+        for (int z = 0; z < base.height; z++)
+        {
+            for (int x = 0; x < base.width; x++)
+            {
+                float h00 = heights[z * width + x], h10 = heights[z * width + x + 1];
+                float h01 = heights[(z + 1) * width + x], h11 = heights[(z + 1) * width + x + 1];
+                base.minHeights[z * base.width + x] = glm::min(glm::min(h00, h10), glm::min(h01, h11));
+                base.maxHeights[z * base.width + x] = glm::max(glm::max(h00, h10), glm::max(h01, h11));
+            }
+        }
+        levels.push_back(base);
+
+        while (levels.back().width > 2 || levels.back().height > 2)
+        {
+            const Level& prev = levels.back();
+            Level next;
+            next.width = (prev.width + 1) / 2;
+            next.height = (prev.height + 1) / 2;
+            next.minHeights.resize(next.width * next.height);
+            next.maxHeights.resize(next.width * next.height);
+            for (int z = 0; z < next.height; z++)
+            {
+                for (int x = 0; x < next.width; x++)
+                {
+                    float lo = FLT_MAX, hi = -FLT_MAX;
+                    for (int i = 0; i < 4; i++)
+                    {
+                        int px = x * 2 + (i & 1), pz = z * 2 + (i >> 1);
+                        if (px >= prev.width || pz >= prev.height) continue;
+                        lo = glm::min(lo, prev.minHeights[pz * prev.width + px]);
+                        hi = glm::max(hi, prev.maxHeights[pz * prev.width + px]);
+                    }
+                    next.minHeights[z * next.width + x] = lo;
+                    next.maxHeights[z * next.width + x] = hi;
+                }
+            }
+            levels.push_back(next);
+        }
+    }
+
+    // cell under world position (x, z) and the position inside it
+    void cellAt(float x, float z, int& x0, int& z0, float& tx, float& tz) const
+    {
+        float fx = glm::clamp(x / xzScale, 0.0f, (float)(width - 1));
+        float fz = glm::clamp(z / xzScale, 0.0f, (float)(height - 1));
+        x0 = glm::min((int)fx, width - 2);
+        z0 = glm::min((int)fz, height - 2);
+        tx = fx - x0;
+        tz = fz - z0;
+    }
+
+    static bool intersectBounds(glm::vec3 origin, glm::vec3 invDirection, glm::vec3 boundsMin, glm::vec3 boundsMax, float& tMin, float& tMax)
+    {
+        tMin = 0.0f;
+        tMax = FLT_MAX;
+        for (int i = 0; i < 3; i++)
+        {
+            // parallel to this slab, only inside or outside
+            if (glm::isinf(invDirection[i]))
+            {
+                if (origin[i] < boundsMin[i] || origin[i] > boundsMax[i])
+                    return false;
+                continue;
+            }
+            float t0 = (boundsMin[i] - origin[i]) * invDirection[i];
+            float t1 = (boundsMax[i] - origin[i]) * invDirection[i];
+            tMin = glm::max(tMin, glm::min(t0, t1));
+            tMax = glm::min(tMax, glm::max(t0, t1));
+        }
+        return tMin <= tMax;
+    }
+
+    // the two triangles of a cell, split the same way as the terrain index buffer
+    bool intersectCell(int x, int z, glm::vec3 origin, glm::vec3 direction, float maxDistance, HeightFieldHit& hit) const
+    {
+        glm::vec3 v00(x * xzScale, heights[z * width + x], z * xzScale);
+        glm::vec3 v10((x + 1) * xzScale, heights[z * width + x + 1], z * xzScale);
+        glm::vec3 v01(x * xzScale, heights[(z + 1) * width + x], (z + 1) * xzScale);
+        glm::vec3 v11((x + 1) * xzScale, heights[(z + 1) * width + x + 1], (z + 1) * xzScale);
+
+        float bestT = maxDistance;
+        bool found = false;
+        glm::vec3 normal;
+        float t;
+        if (intersectTriangle(origin, direction, v00, v01, v11, t) && t <= bestT)
+        {
+            bestT = t;
+            normal = glm::cross(v01 - v00, v11 - v00);
+            found = true;
+        }
+        if (intersectTriangle(origin, direction, v00, v11, v10, t) && t <= bestT)
+        {
+            bestT = t;
+            normal = glm::cross(v11 - v00, v10 - v00);
+            found = true;
+        }
+        if (!found)
+            return false;
+
+        hit.Distance = bestT;
+        hit.Position = origin + direction * bestT;
+        hit.Normal = glm::normalize(normal);
+        return true;
+    }
+
+    // Moller-Trumbore, double sided
+    static bool intersectTriangle(glm::vec3 origin, glm::vec3 direction, glm::vec3 a, glm::vec3 b, glm::vec3 c, float& t)
+    {
+        glm::vec3 edge1 = b - a;
+        glm::vec3 edge2 = c - a;
+        glm::vec3 p = glm::cross(direction, edge2);
+        float det = glm::dot(edge1, p);
+        if (glm::abs(det) < 1e-8f)
+            return false;
+
+        float invDet = 1.0f / det;
+        glm::vec3 s = origin - a;
+        float u = glm::dot(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(direction, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        t = glm::dot(edge2, q) * invDet;
+        return t >= 0.0f;
+    }
+};
+#endif
@@ -0,0 +1,581 @@
+#ifndef TERRAINSTREAM_H
+#define TERRAINSTREAM_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include <glm/glm.hpp>
+#include "stb_image.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cfloat>
+using namespace std;
+
+// Tiled terrain that doesn't have to fit in memory.
+//
+// Offline, SplitTerrain cuts a heightmap into tiles of tileSize x tileSize quads for every level of a mip pyramid,
+// level L samples every 2^L-th height so one tile covers (tileSize << L) source samples. Every tile is its own file,
+// next to a terrain.txt manifest.
+//
+// At runtime TerrainStreamer walks the pyramid as a quadtree around the camera, loads the tiles it wants on a worker
+// thread (file read + vertex build), uploads a few of them per frame and keeps the resident tiles in an LRU cache with a
+// memory budget. A tile is only refined once all of its children are resident, so there is always something to draw.
+
+#define TERRAIN_TILE_MAGIC 0x4C495454 // "TTIL"
+
+struct TerrainTileHeader {
+    uint32_t magic;
+    int32_t tileSize;
+    int32_t level;
+    int32_t x, z;
+};
+
+// cuts source into tiles, outDir has to exist. Returns false when the source can't be read.
+bool SplitTerrain(const char* source, const char* outDir, int tileSize, float hScale, float xzScale)
+{
+    int width, height, channels;
+    unsigned short* data = stbi_load_16(source, &width, &height, &channels, 1);
+    if (!data)
+    {
+        std::cout << "Error loading terrain source: " << source << std::endl;
+        return false;
+    }
+
+    // keep halving until one or two tiles cover the whole terrain
+    int levels = 1;
+    int size = glm::max(width, height) - 1;
+    while ((size + (tileSize << (levels - 1)) - 1) / (tileSize << (levels - 1)) > 2)
+        levels++;
+
+    vector<unsigned short> tile((tileSize + 1) * (tileSize + 1));
+    for (int level = 0; level < levels; level++)
+    {
+        int step = 1 << level;
+        int tilesX = ((width - 1) + (tileSize << level) - 1) / (tileSize << level);
+        int tilesZ = ((height - 1) + (tileSize << level) - 1) / (tileSize << level);
+
+        for (int tz = 0; tz < tilesZ; tz++)
+        {
+            for (int tx = 0; tx < tilesX; tx++)
+            {
+                // point sampled, so every vertex of a coarse tile sits exactly on the finer surface
+                for (int z = 0; z <= tileSize; z++)
+                {
+                    int sz = glm::min((tz * tileSize + z) * step, height - 1);
+                    for (int x = 0; x <= tileSize; x++)
+                    {
+                        int sx = glm::min((tx * tileSize + x) * step, width - 1);
+                        tile[z * (tileSize + 1) + x] = data[sz * width + sx];
+                    }
+                }
+
+                TerrainTileHeader header = { TERRAIN_TILE_MAGIC, tileSize, level, tx, tz };
+                string path = string(outDir) + "/L" + std::to_string(level) + "_" + std::to_string(tx) + "_" + std::to_string(tz) + ".tile";
+                std::ofstream file(path, std::ios::binary);
+                if (!file.is_open())
+                {
+                    std::cout << "Error writing terrain tile: " << path << std::endl;
+                    stbi_image_free(data);
+                    return false;
+                }
+                file.write((const char*)&header, sizeof(header));
+                file.write((const char*)tile.data(), tile.size() * sizeof(unsigned short));
+            }
+        }
+        std::cout << "Terrain level " << level << ": " << tilesX << "x" << tilesZ << " tiles" << std::endl;
+    }
+
+    std::ofstream manifest(string(outDir) + "/terrain.txt");
+    manifest << width << " " << height << " " << tileSize << " " << levels << " " << hScale << " " << xzScale << std::endl;
+
+    stbi_image_free(data);
+    return true;
+}
+
+class TerrainStreamer
+{
+public:
+    // manifest data
+    int width, height, tileSize, levels;
+    float hScale, xzScale;
+
+    // tuning
+    // a tile of level L is refined while the camera is closer than lodDistance * 2^L
+    float lodDistance;
+    // GPU bytes the resident tiles may use
+    size_t memoryBudget;
+    // tiles uploaded per frame, spreads the glBufferData calls so a burst of finished loads doesn't hitch
+    int maxUploadsPerFrame;
+
+    // stats of the last Update()
+    size_t residentBytes;
+    int residentTiles, drawnTiles, pendingTiles;
+
+    TerrainStreamer(string const& directory, float lodDistance = 400.0f, size_t memoryBudget = 64 * 1024 * 1024, int maxUploadsPerFrame = 2)
+        : width(0), height(0), tileSize(0), levels(0), hScale(1.0f), xzScale(1.0f),
+        lodDistance(lodDistance), memoryBudget(memoryBudget), maxUploadsPerFrame(maxUploadsPerFrame),
+        residentBytes(0), residentTiles(0), drawnTiles(0), pendingTiles(0),
+        directory(directory), frame(0), indexCount(0), EBO(0), stop(false)
+    {
+        std::ifstream manifest(directory + "/terrain.txt");
+        if (!manifest.is_open())
+        {
+            std::cout << "ERROR::TERRAIN:: no manifest in " << directory << std::endl;
+            return;
+        }
+        manifest >> width >> height >> tileSize >> levels >> hScale >> xzScale;
+
+        setupIndices();
+        worker = std::thread(&TerrainStreamer::workerLoop, this);
+    }
+
+    ~TerrainStreamer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        if (worker.joinable())
+            worker.join();
+
+        for (auto& pair : tiles)
+            releaseTile(pair.second);
+        if (EBO) glDeleteBuffers(1, &EBO);
+    }
+
+    bool IsValid() const { return levels > 0; }
+
+    // uploads finished loads, picks the tiles to draw around the camera, requests missing ones and evicts old ones
+    void Update(glm::vec3 cameraPosition)
+    {
+        if (!IsValid())
+            return;
+
+        frame++;
+        uploadCompleted();
+
+        visible.clear();
+        wanted.clear();
+
+        int top = levels - 1;
+        for (int z = 0; z < tilesZ(top); z++)
+            for (int x = 0; x < tilesX(top); x++)
+                selectTile(top, x, z, cameraPosition);
+
+        queueRequests();
+        evict();
+
+        residentTiles = (int)tiles.size();
+        drawnTiles = (int)visible.size();
+        pendingTiles = (int)pending.size();
+    }
+
+    // draws the tiles picked by the last Update(), the program has to be bound
+    void Draw()
+    {
+        for (size_t i = 0; i < visible.size(); i++)
+        {
+            glBindVertexArray(visible[i]->VAO);
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+        }
+        glBindVertexArray(0);
+    }
+
+private:
+    // vertex layout matches GeneratePlane: position, normal, uv
+    static const int STRIDE = 8;
+
+    struct Tile {
+        GLuint VAO, VBO;
+        size_t bytes;
+        unsigned int lastUsed;
+        float minHeight, maxHeight;
+    };
+
+    // built on the worker thread, uploaded on the GL thread
+    struct LoadedTile {
+        uint64_t key;
+        vector<float> vertices;
+        float minHeight, maxHeight;
+    };
+
+    string directory;
+    unsigned int frame;
+
+    unordered_map<uint64_t, Tile> tiles;
+    // tiles that are queued, loading or loaded but not uploaded yet
+    unordered_set<uint64_t> pending;
+    // tiles that failed to load, never requested again
+    unordered_set<uint64_t> failed;
+
+    vector<Tile*> visible;
+    // wanted tiles with their priority (distance to the camera)
+    vector<pair<float, uint64_t>> wanted;
+
+    GLsizei indexCount;
+    GLuint EBO;
+
+    // shared with the worker, guarded by mutex
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    deque<uint64_t> requests;
+    vector<LoadedTile> completed;
+    bool stop;
+
+    static uint64_t makeKey(int level, int x, int z)
+    {
+        return ((uint64_t)level << 48) | ((uint64_t)x << 24) | (uint64_t)z;
+    }
+
+    static void splitKey(uint64_t key, int& level, int& x, int& z)
+    {
+        level = (int)(key >> 48);
+        x = (int)((key >> 24) & 0xFFFFFF);
+        z = (int)(key & 0xFFFFFF);
+    }
+
+    int tilesX(int level) const { return ((width - 1) + (tileSize << level) - 1) / (tileSize << level); }
+    int tilesZ(int level) const { return ((height - 1) + (tileSize << level) - 1) / (tileSize << level); }
+
+    float tileDistance(int level, int x, int z, float minHeight, float maxHeight, glm::vec3 cameraPosition) const
+    {
+        float size = (float)(tileSize << level) * xzScale;
+        glm::vec3 boundsMin(x * size, minHeight, z * size);
+        glm::vec3 boundsMax((x + 1) * size, maxHeight, (z + 1) * size);
+        glm::vec3 closest = glm::clamp(cameraPosition, boundsMin, boundsMax);
+        return glm::length(cameraPosition - closest);
+    }
+
+    void selectTile(int level, int x, int z, glm::vec3 cameraPosition)
+    {
+        uint64_t key = makeKey(level, x, z);
+        auto it = tiles.find(key);
+        if (it == tiles.end())
+        {
+            // only the top level gets here without a resident tile, there is nothing coarser to fall back on
+            want(key, tileDistance(level, x, z, 0.0f, hScale, cameraPosition));
+            return;
+        }
+
+        Tile& tile = it->second;
+        tile.lastUsed = frame;
+
+        float distance = tileDistance(level, x, z, tile.minHeight, tile.maxHeight, cameraPosition);
+        if (level == 0 || distance >= lodDistance * (1 << level))
+        {
+            visible.push_back(&tile);
+            return;
+        }
+
+        // refine only when every child is there, otherwise keep drawing this tile and load the children
+        bool childrenResident = true;
+        for (int i = 0; i < 4; i++)
+        {
+            int cx = x * 2 + (i & 1), cz = z * 2 + (i >> 1);
+            if (cx >= tilesX(level - 1) || cz >= tilesZ(level - 1))
+                continue;
+            uint64_t childKey = makeKey(level - 1, cx, cz);
+            if (tiles.find(childKey) == tiles.end())
+            {
+                childrenResident = false;
+                want(childKey, tileDistance(level - 1, cx, cz, tile.minHeight, tile.maxHeight, cameraPosition));
+            }
+        }
+
+        if (!childrenResident)
+        {
+            visible.push_back(&tile);
+            return;
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            int cx = x * 2 + (i & 1), cz = z * 2 + (i >> 1);
+            if (cx < tilesX(level - 1) && cz < tilesZ(level - 1))
+                selectTile(level - 1, cx, cz, cameraPosition);
+        }
+    }
+
+    void want(uint64_t key, float priority)
+    {
+        if (failed.find(key) == failed.end())
+            wanted.push_back(make_pair(priority, key));
+    }
+
+    // replaces the request queue with this frame's wanted tiles, nearest first. Tiles that aren't wanted anymore and
+    // haven't been picked up by the worker yet are dropped.
+    void queueRequests()
+    {
+        std::sort(wanted.begin(), wanted.end());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < requests.size(); i++)
+            pending.erase(requests[i]);
+        requests.clear();
+
+        for (size_t i = 0; i < wanted.size(); i++)
+        {
+            uint64_t key = wanted[i].second;
+            // already loading or loaded
+            if (pending.find(key) != pending.end())
+                continue;
+            requests.push_back(key);
+            pending.insert(key);
+        }
+        if (!requests.empty())
+            condition.notify_one();
+    }
+
+    void uploadCompleted()
+    {
+        vector<LoadedTile> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int count = glm::min((int)completed.size(), maxUploadsPerFrame);
+            for (int i = 0; i < count; i++)
+                ready.push_back(std::move(completed[i]));
+            completed.erase(completed.begin(), completed.begin() + count);
+        }
+
+        for (size_t i = 0; i < ready.size(); i++)
+        {
+            LoadedTile& loaded = ready[i];
+            pending.erase(loaded.key);
+            if (loaded.vertices.empty())
+            {
+                failed.insert(loaded.key);
+                continue;
+            }
+
+            Tile tile;
+            tile.bytes = loaded.vertices.size() * sizeof(float);
+            tile.lastUsed = frame;
+            tile.minHeight = loaded.minHeight;
+            tile.maxHeight = loaded.maxHeight;
+
+            glGenVertexArrays(1, &tile.VAO);
+            glGenBuffers(1, &tile.VBO);
+
+            glBindVertexArray(tile.VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, tile.VBO);
+            glBufferData(GL_ARRAY_BUFFER, tile.bytes, loaded.vertices.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+            // position
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * STRIDE, 0);
+            glEnableVertexAttribArray(0);
+            // normal
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * STRIDE, (void*)(sizeof(float) * 3));
+            glEnableVertexAttribArray(1);
+            // uv
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(float) * STRIDE, (void*)(sizeof(float) * 6));
+            glEnableVertexAttribArray(2);
+
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            tiles[loaded.key] = tile;
+            residentBytes += tile.bytes;
+        }
+    }
+
+    // drops least recently used tiles until the cache fits the budget, tiles used this frame are never evicted
+    void evict()
+    {
+        if (residentBytes <= memoryBudget)
+            return;
+
+        vector<pair<unsigned int, uint64_t>> candidates;
+        for (auto& pair : tiles)
+            if (pair.second.lastUsed != frame)
+                candidates.push_back(make_pair(pair.second.lastUsed, pair.first));
+        std::sort(candidates.begin(), candidates.end());
+
+        for (size_t i = 0; i < candidates.size() && residentBytes > memoryBudget; i++)
+        {
+            Tile& tile = tiles[candidates[i].second];
+            residentBytes -= tile.bytes;
+            releaseTile(tile);
+            tiles.erase(candidates[i].second);
+        }
+    }
+
+    void releaseTile(Tile& tile)
+    {
+        glDeleteVertexArrays(1, &tile.VAO);
+        glDeleteBuffers(1, &tile.VBO);
+    }
+
+    // one grid of tileSize x tileSize quads plus a skirt along every edge that hides cracks between levels,
+    // shared by every tile
+    void setupIndices()
+    {
+        int side = tileSize + 1;
+        vector<unsigned int> indices;
+        indices.reserve(tileSize * tileSize * 6 + 4 * tileSize * 6);
+
+        for (int z = 0; z < tileSize; z++)
+        {
+            for (int x = 0; x < tileSize; x++)
+            {
+                int vertex = z * side + x;
+                indices.push_back(vertex);
+                indices.push_back(vertex + side);
+                indices.push_back(vertex + side + 1);
+
+                indices.push_back(vertex);
+                indices.push_back(vertex + side + 1);
+                indices.push_back(vertex + 1);
+            }
+        }
+
+        // skirt vertices follow the grid, edge by edge: z = 0, z = tileSize, x = 0, x = tileSize
+        int skirt = side * side;
+        for (int edge = 0; edge < 4; edge++)
+        {
+            for (int i = 0; i < tileSize; i++)
+            {
+                int a, b;
+                if (edge == 0) { a = i; b = i + 1; }
+                else if (edge == 1) { a = tileSize * side + i; b = a + 1; }
+                else if (edge == 2) { a = i * side; b = (i + 1) * side; }
+                else { a = i * side + tileSize; b = (i + 1) * side + tileSize; }
+
+                int sa = skirt + edge * side + i;
+                int sb = sa + 1;
+                // both windings, so the skirt shows from either side with back face culling on
+                indices.push_back(a); indices.push_back(sa); indices.push_back(b);
+                indices.push_back(b); indices.push_back(sa); indices.push_back(sb);
+                indices.push_back(a); indices.push_back(b); indices.push_back(sa);
+                indices.push_back(b); indices.push_back(sb); indices.push_back(sa);
+            }
+        }
+
+        indexCount = (GLsizei)indices.size();
+        glGenBuffers(1, &EBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            uint64_t key;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] { return stop || !requests.empty(); });
+                if (stop)
+                    return;
+                key = requests.front();
+                requests.pop_front();
+            }
+
+            LoadedTile loaded;
+            loaded.key = key;
+            loadTile(loaded);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(std::move(loaded));
+        }
+    }
+
+    // reads the tile file and builds its vertices, runs on the worker thread. Leaves vertices empty on failure.
+    void loadTile(LoadedTile& loaded) const
+    {
+        int level, tx, tz;
+        splitKey(loaded.key, level, tx, tz);
+
+        string path = directory + "/L" + std::to_string(level) + "_" + std::to_string(tx) + "_" + std::to_string(tz) + ".tile";
+        std::ifstream file(path, std::ios::binary);
+        TerrainTileHeader header;
+        if (!file.is_open() || !file.read((char*)&header, sizeof(header)) || header.magic != TERRAIN_TILE_MAGIC || header.tileSize != tileSize)
+        {
+            std::cout << "Error loading terrain tile: " << path << std::endl;
+            return;
+        }
+
+        int side = tileSize + 1;
+        vector<unsigned short> samples(side * side);
+        if (!file.read((char*)samples.data(), samples.size() * sizeof(unsigned short)))
+        {
+            std::cout << "Error loading terrain tile: " << path << std::endl;
+            return;
+        }
+
+        float spacing = (float)(1 << level) * xzScale;
+        float originX = tx * tileSize * spacing;
+        float originZ = tz * tileSize * spacing;
+        float worldWidth = (width - 1) * xzScale;
+        float worldHeight = (height - 1) * xzScale;
+        // deep enough to cover the error of a coarser neighbour
+        float skirtDepth = spacing * 2.0f;
+
+        loaded.minHeight = FLT_MAX;
+        loaded.maxHeight = -FLT_MAX;
+        loaded.vertices.resize((side * side + 4 * side) * STRIDE);
+
+        float* vertex = loaded.vertices.data();
+        for (int z = 0; z < side; z++)
+        {
+            for (int x = 0; x < side; x++)
+            {
+                float h = samples[z * side + x] / 65535.0f * hScale;
+                loaded.minHeight = glm::min(loaded.minHeight, h);
+                loaded.maxHeight = glm::max(loaded.maxHeight, h);
+
+                // central differences inside the tile, one sided on its edges
+                int x0 = glm::max(x - 1, 0), x1 = glm::min(x + 1, tileSize);
+                int z0 = glm::max(z - 1, 0), z1 = glm::min(z + 1, tileSize);
+                float dx = (samples[z * side + x1] - samples[z * side + x0]) / 65535.0f * hScale / ((x1 - x0) * spacing);
+                float dz = (samples[z1 * side + x] - samples[z0 * side + x]) / 65535.0f * hScale / ((z1 - z0) * spacing);
+                glm::vec3 normal = glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+
+                float worldX = originX + x * spacing;
+                float worldZ = originZ + z * spacing;
+
+                *vertex++ = worldX;
+                *vertex++ = h;
+                *vertex++ = worldZ;
+                *vertex++ = normal.x;
+                *vertex++ = normal.y;
+                *vertex++ = normal.z;
+                *vertex++ = worldX / worldWidth;
+                *vertex++ = worldZ / worldHeight;
+            }
+        }
+
+        // skirts copy the edge vertices, pushed down
+        for (int edge = 0; edge < 4; edge++)
+        {
+            for (int i = 0; i < side; i++)
+            {
+                int source;
+                if (edge == 0) source = i;
+                else if (edge == 1) source = tileSize * side + i;
+                else if (edge == 2) source = i * side;
+                else source = i * side + tileSize;
+
+                const float* edgeVertex = &loaded.vertices[source * STRIDE];
+                for (int c = 0; c < STRIDE; c++)
+                    vertex[c] = edgeVertex[c];
+                vertex[1] -= skirtDepth;
+                vertex += STRIDE;
+            }
+        }
+    }
+};
+#endif
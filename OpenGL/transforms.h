@@ -0,0 +1,178 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <emmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+#include <vector>
+#include <cmath>
+using namespace std;
+
+// matrix that takes normals into world space, the inverse transpose of the upper 3x3 of world. When the columns are
+// orthogonal and equally long (rotation times a uniform scale s) that is the matrix itself divided by s^2, no inverse
+inline glm::mat3 NormalMatrix(const glm::mat4& world)
+{
+    glm::mat3 m(world);
+    float xx = glm::dot(m[0], m[0]), yy = glm::dot(m[1], m[1]), zz = glm::dot(m[2], m[2]);
+    float tolerance = 1e-4f * xx;
+    if (fabs(xx - yy) <= tolerance && fabs(xx - zz) <= tolerance &&
+        fabs(glm::dot(m[0], m[1])) <= tolerance && fabs(glm::dot(m[0], m[2])) <= tolerance && fabs(glm::dot(m[1], m[2])) <= tolerance)
+        return m * (1.0f / xx);
+    return glm::inverseTranspose(m);
+}
+
+// position, rotation and scale of many objects stored as one array per component, so the same component of 4 (SSE) or
+// 8 (AVX builds) objects loads into one register. ComposeWorld() builds translate * rotate * scale straight from the
+// quaternion instead of multiplying three mat4s, and only transposes into glm::mat4 layout on the way out.
+class TransformArray
+{
+public:
+    vector<float> positionX, positionY, positionZ;
+    vector<float> rotationX, rotationY, rotationZ, rotationW;
+    vector<float> scaleX, scaleY, scaleZ;
+
+    int Count() const { return (int)positionX.size(); }
+
+    void Clear()
+    {
+        for (vector<float>* component : components())
+            component->clear();
+    }
+
+    int Add(glm::vec3 position, glm::quat rotation, glm::vec3 scale)
+    {
+        for (vector<float>* component : components())
+            component->push_back(0.0f);
+        Set(Count() - 1, position, rotation, scale);
+        return Count() - 1;
+    }
+
+    void Set(int i, glm::vec3 position, glm::quat rotation, glm::vec3 scale)
+    {
+        positionX[i] = position.x; positionY[i] = position.y; positionZ[i] = position.z;
+        rotationX[i] = rotation.x; rotationY[i] = rotation.y; rotationZ[i] = rotation.z; rotationW[i] = rotation.w;
+        scaleX[i] = scale.x; scaleY[i] = scale.y; scaleZ[i] = scale.z;
+    }
+
+    // world matrices of objects [begin, end) into out[0 .. end - begin)
+    void ComposeWorld(glm::mat4* out, int begin, int end) const
+    {
+        int i = begin;
+#ifdef __AVX__
+        for (; i + 8 <= end; i += 8)
+            composeAVX(out + (i - begin), i);
+#endif
+        for (; i + 4 <= end; i += 4)
+            composeSSE(out + (i - begin), i);
+        for (; i < end; i++)
+            out[i - begin] = composeScalar(i);
+    }
+
+    // the same one object at a time, for reference
+    void ComposeWorldScalar(glm::mat4* out, int begin, int end) const
+    {
+        for (int i = begin; i < end; i++)
+            out[i - begin] = composeScalar(i);
+    }
+
+private:
+    vector<vector<float>*> components()
+    {
+        return { &positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ };
+    }
+
+    // columns of the rotation (same as glm::mat3_cast) times the scale of that axis, then the position
+    glm::mat4 composeScalar(int i) const
+    {
+        float x = rotationX[i], y = rotationY[i], z = rotationZ[i], w = rotationW[i];
+        float xx = x * x, yy = y * y, zz = z * z;
+        float xy = x * y, xz = x * z, yz = y * z;
+        float wx = w * x, wy = w * y, wz = w * z;
+
+        glm::mat4 m;
+        m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * scaleX[i];
+        m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * scaleY[i];
+        m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * scaleZ[i];
+        m[3] = glm::vec4(positionX[i], positionY[i], positionZ[i], 1.0f);
+        return m;
+    }
+
+    // 16 registers that each hold one matrix element of 4 objects, transposed into 4 matrices
+    static void store4(glm::mat4* out, const __m128 (&element)[4][4])
+    {
+        for (int column = 0; column < 4; column++)
+        {
+            __m128 r0 = element[column][0], r1 = element[column][1], r2 = element[column][2], r3 = element[column][3];
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(&out[0][column][0], r0);
+            _mm_storeu_ps(&out[1][column][0], r1);
+            _mm_storeu_ps(&out[2][column][0], r2);
+            _mm_storeu_ps(&out[3][column][0], r3);
+        }
+    }
+
+    void composeSSE(glm::mat4* out, int i) const
+    {
+        __m128 x = _mm_loadu_ps(&rotationX[i]), y = _mm_loadu_ps(&rotationY[i]);
+        __m128 z = _mm_loadu_ps(&rotationZ[i]), w = _mm_loadu_ps(&rotationW[i]);
+        __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+
+        __m128 x2 = _mm_mul_ps(x, two), y2 = _mm_mul_ps(y, two), z2 = _mm_mul_ps(z, two);
+        __m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+        __m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+        __m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+        __m128 sx = _mm_loadu_ps(&scaleX[i]), sy = _mm_loadu_ps(&scaleY[i]), sz = _mm_loadu_ps(&scaleZ[i]);
+
+        __m128 element[4][4] = {
+            { _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx), _mm_mul_ps(_mm_add_ps(xy, wz), sx), _mm_mul_ps(_mm_sub_ps(xz, wy), sx), zero },
+            { _mm_mul_ps(_mm_sub_ps(xy, wz), sy), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy), _mm_mul_ps(_mm_add_ps(yz, wx), sy), zero },
+            { _mm_mul_ps(_mm_add_ps(xz, wy), sz), _mm_mul_ps(_mm_sub_ps(yz, wx), sz), _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz), zero },
+            { _mm_loadu_ps(&positionX[i]), _mm_loadu_ps(&positionY[i]), _mm_loadu_ps(&positionZ[i]), one },
+        };
+        store4(out, element);
+    }
+
+#ifdef __AVX__
+    void composeAVX(glm::mat4* out, int i) const
+    {
+        __m256 x = _mm256_loadu_ps(&rotationX[i]), y = _mm256_loadu_ps(&rotationY[i]);
+        __m256 z = _mm256_loadu_ps(&rotationZ[i]), w = _mm256_loadu_ps(&rotationW[i]);
+        __m256 one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f), zero = _mm256_setzero_ps();
+
+        __m256 x2 = _mm256_mul_ps(x, two), y2 = _mm256_mul_ps(y, two), z2 = _mm256_mul_ps(z, two);
+        __m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+        __m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+        __m256 wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+
+        __m256 sx = _mm256_loadu_ps(&scaleX[i]), sy = _mm256_loadu_ps(&scaleY[i]), sz = _mm256_loadu_ps(&scaleZ[i]);
+
+        __m256 element[4][4] = {
+            { _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx), _mm256_mul_ps(_mm256_add_ps(xy, wz), sx), _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx), zero },
+            { _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy), _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy), _mm256_mul_ps(_mm256_add_ps(yz, wx), sy), zero },
+            { _mm256_mul_ps(_mm256_add_ps(xz, wy), sz), _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz), _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz), zero },
+            { _mm256_loadu_ps(&positionX[i]), _mm256_loadu_ps(&positionY[i]), _mm256_loadu_ps(&positionZ[i]), one },
+        };
+
+        // the low and high 4 objects go through the same transpose as the SSE path
+        __m128 low[4][4], high[4][4];
+        for (int column = 0; column < 4; column++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                low[column][row] = _mm256_castps256_ps128(element[column][row]);
+                high[column][row] = _mm256_extractf128_ps(element[column][row], 1);
+            }
+        }
+        store4(out, low);
+        store4(out + 4, high);
+    }
+#endif
+};
+#endif
@@ -0,0 +1,111 @@
+#ifndef UNIFORMRING_H
+#define UNIFORMRING_H
+
+#include <glad/glad.h> // holds all OpenGL type declarations
+
+#include "commandbuffer.h"
+
+#include <iostream>
+using namespace std;
+
+// streams the uniforms of a frame through one GL_UNIFORM_BUFFER that is split into a region per frame in flight
+// (or any other per frame data, the CPU skinned vertices go through a GL_ARRAY_BUFFER ring).
+// A region is mapped unsynchronized, so the driver never has to wait for the GPU to be done with the buffer; instead the
+// fence placed after the last draw of a frame tells us when its region can be written again. With three regions that
+// fence has normally long passed by the time we come back around.
+class UniformRing
+{
+public:
+    static const int REGIONS = 3;
+
+    // frames that had to wait for the GPU before they could write their region
+    int stalls;
+
+    explicit UniformRing(GLenum target = GL_UNIFORM_BUFFER) : stalls(0), target(target), buffer(0), regionSize(0), region(0)
+    {
+        for (int i = 0; i < REGIONS; i++)
+            fences[i] = 0;
+    }
+
+    ~UniformRing()
+    {
+        for (int i = 0; i < REGIONS; i++)
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        glDeleteBuffers(1, &buffer);
+    }
+
+    GLuint Buffer() const { return buffer; }
+
+    // the buffer exists from here on, for vertex arrays that have to point at it before the first Map()
+    void Create()
+    {
+        if (buffer)
+            return;
+        if (target == GL_UNIFORM_BUFFER)
+        {
+            GLint alignment = 0;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            if (alignment <= 0 || UNIFORM_BLOCK_ALIGNMENT % alignment != 0)
+                std::cout << "ERROR::UNIFORM_RING::ALIGNMENT " << alignment << " doesn't divide " << UNIFORM_BLOCK_ALIGNMENT << std::endl;
+        }
+        glGenBuffers(1, &buffer);
+    }
+
+    // maps size bytes of the next region and returns them, offset is where they start in Buffer().
+    // offset is a multiple of UNIFORM_BLOCK_ALIGNMENT. The buffer grows when a frame doesn't fit anymore
+    unsigned char* Map(GLsizeiptr size, GLintptr& offset)
+    {
+        Create();
+        glBindBuffer(target, buffer);
+        region = (region + 1) % REGIONS;
+
+        if (size > regionSize)
+        {
+            // new storage, the GPU can keep reading the old one so no fence has to be waited on
+            regionSize = (size + size / 2 + UNIFORM_BLOCK_ALIGNMENT - 1) / UNIFORM_BLOCK_ALIGNMENT * UNIFORM_BLOCK_ALIGNMENT;
+            glBufferData(target, regionSize * REGIONS, nullptr, GL_STREAM_DRAW);
+            for (int i = 0; i < REGIONS; i++)
+            {
+                if (fences[i])
+                    glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+        }
+        else if (fences[region])
+        {
+            if (glClientWaitSync(fences[region], 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                stalls++;
+                glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            }
+            glDeleteSync(fences[region]);
+            fences[region] = 0;
+        }
+
+        offset = region * regionSize;
+        return (unsigned char*)glMapBufferRange(target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+
+    void Unmap()
+    {
+        glBindBuffer(target, buffer);
+        if (!glUnmapBuffer(target))
+            std::cout << "ERROR::BUFFER::MAPPING_LOST data of this frame is undefined" << std::endl;
+        glBindBuffer(target, 0);
+    }
+
+    // after the last draw that reads the current region
+    void Fence()
+    {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    GLenum target;
+    GLuint buffer;
+    GLsizeiptr regionSize;
+    int region;
+    GLsync fences[REGIONS];
+};
+#endif